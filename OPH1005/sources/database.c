@@ -13,6 +13,62 @@
 //
 // 23/12/2005:	Added a reset of the database error code in the function IsFileOpen
 //
+// 17/10/2026:	Added an optional record block cache with LRU eviction and write-back (SetDatabaseCache)
+//
+// 17/10/2026:	HeapSort() and QuickSort() sort the whole file in memory when it fits in coreleft()
+//
+// 17/10/2026:	Added ExternalSort() for databases that do not fit in memory
+//
+// 17/10/2026:	Added InsertRecordSorted() to keep a sorted database sorted without sorting it again
+//
+// 17/10/2026:	Added DeleteRecords() and DeleteRecordSet(), DeleteRecord() moves the following records in blocks
+//
+// 17/10/2026:	Added delete markers (SetDeleteMarker) with CompactDatabase() and CompactWhenNeeded()
+//
+// 17/10/2026:	The index file is now a B+tree with pages of DB_INDEX_PAGESZ bytes, added ScanIndexRange()
+//
+// 17/10/2026:	Added a hash index file with linear probing for exact key lookups (CreateHashIndex)
+//
+// 17/10/2026:	Added an in memory fence index for BinarySearch and InsertRecordSorted (SetFenceIndex)
+//
+// 17/10/2026:	Added a Bloom filter saved next to the database to skip searches for unknown keys (SetBloomFilter)
+//
+// 17/10/2026:	Added KeySearch() with interpolation search for numeric keys and GetSearchProbes()
+//
+// 17/10/2026:	Added BinarySearchMany() to find many keys in one pass through the database
+//
+// 17/10/2026:	Added RadixSort() for fixed width keys, in memory or with distribution passes on file
+//
+// 17/10/2026:	Added TagSort() and SortDatabase() which picks the sort method that fits in memory
+//
+// 17/10/2026:	SortDatabase() finds the longest sorted run and merges the other records into it
+//
+// 17/10/2026:	Added a header file with the sort state and a change counter (SetDatabaseHeader)
+//
+// 17/10/2026:	Added a delta log, records are appended and merged into the sorted records later (SetDeltaLog)
+//
+// 17/10/2026:	Added secondary indexes kept up to date by WriteRecord() and RangeQuery() (SetSecondaryIndex)
+//
+// 17/10/2026:	Added SearchSecondaryIndex() to find all records with a key in a secondary index
+//
+// 17/10/2026:	Added UpsertRecord() to overwrite or insert a record with one search
+//
+// 17/10/2026:	Added aggregates kept up to date by WriteRecord(), counts and last values per key (SetAggregate)
+//
+// 17/10/2026:	SortDatabase() uses RadixSort() for short keys on file, the radix buckets only use memory while sorting
+//
+// 17/10/2026:	Secondary index entries hold the header key, sorts and merges no longer make the index file again
+//
+// 17/10/2026:	SetAggregate() limits the keys of an aggregate, the table only grows when memory is left for the OS
+//
+// 17/10/2026:	The aggregate table is kept in a file with a record cache, DeleteRecords() takes off the removed records
+//
+// 17/10/2026:	Added a write counter in the record kept by WriteRecord(), e.g. the scans of a device (SetWriteCounter)
+//
+// 17/10/2026:	Added partitioned databases, records split over files per value bucket with a catalog (OpenPartitions)
+//
+// 17/10/2026:	Added dictionary files that give keys a 16 bit code, found with a hash index file (OpenDictionary)
+//
 
 
 #include <stdio.h>
@@ -33,11 +89,192 @@
 
 #include "database.h"
 
+//
+// Memory that must stay available for the OS (NetO) when the database is loaded in memory
+//
+#define DB_MEM_RESERVE		5000L
+
+//
+// Size of the buffer used for moving blocks of records in the file
+//
+#define DB_MOVE_BUFSZ		4096
+
+//
+// External sort settings
+//
+#define DB_MERGE_WAYS		8	// Maximum amount of runs merged in one pass
+
 //
 // lErrorCode holds the last error that occured in the database
 //
 static long lErrorCode;
 
+//
+// One block of consecutive records held in the record cache
+//
+typedef struct
+{
+	long	lFirstRecord;		// record number of the first record in the block, -1L when unused
+	short	sCount;				// amount of valid records in the block
+	short	bDirty;				// block was changed and must be written back
+	unsigned long ulUsed;		// last used stamp, the lowest stamp is evicted first
+	char*	pData;				// the records of this block
+}SDBBlock;
+
+//
+// The record cache attached to SDBFile
+//
+struct SDBCache
+{
+	short	sBlocks;			// amount of blocks in the cache
+	short	sRecsPerBlock;		// amount of records in one block
+	unsigned long ulClock;		// increased on every block access
+	SDBBlock* pBlocks;			// block administration
+	char*	pData;				// memory for all blocks
+};
+
+//
+// The fence index attached to SDBFile, the keys of every lStep-th record of a sorted database
+//
+struct SDBFence
+{
+	short	sOffset;			// position of the key in the record
+	short	sKeySz;				// size of the key
+	long	lStep;				// amount of records between two fences when built
+	long	lCount;				// amount of fences, -1L when the fences must be built again
+	long	lMax;				// amount of fences that fit in the memory
+	long*	pRecNo;				// record number of each fence, from low to high
+	char*	pKeys;				// key of each fence
+};
+
+//
+// The Bloom filter attached to SDBFile, kept in memory and saved in a file next to the database
+//
+struct SDBBloom
+{
+	short	sOffset;			// position of the key in the record
+	short	sKeySz;				// size of the key
+	long	lBits;				// amount of bits in the filter
+	int		bDirty;				// changed since it was saved
+	int		bStale;				// records were deleted, the filter is made again on the next search
+	unsigned char* pBits;		// the filter
+};
+
+//
+// The sort state header attached to SDBFile, saved in a file next to the database
+//
+struct SDBHeader
+{
+	short	sOffset;			// position of the sort key in the record
+	short	sKeySz;				// size of the sort key
+	long	lSorted;			// the records before this record number are sorted on the key
+	long	lGeneration;		// increased on every change of the database
+	int		bChanged;			// changed since it was saved
+	int		bDirtyOnDisk;		// the header file is marked as not up to date
+	char*	pRecord;			// record buffer for the order checks
+};
+
+//
+// The delta log attached to SDBFile, the keys of the records added after the last sort
+//
+struct SDBDelta
+{
+	short	sOffset;			// position of the key in the record
+	short	sKeySz;				// size of the key
+	long	lMax;				// size of the table, the delta is merged when it is full
+	long	lBase;				// record number of the first record after the sorted records
+	long	lCount;				// amount of keys in the table, -1L when it must be read again
+	long	lGeneration;		// header generation when the table was up to date
+	char*	pKeys;				// the keys
+	char*	pRecord;			// record buffer
+};
+
+//
+// A secondary index attached to SDBFile, a B+tree index file on another field then the sort key
+//
+struct SDBSecondary
+{
+	short	sOffset;			// position of the key in the record
+	short	sKeySz;				// size of the key
+	short	sPrimaryOfs;		// position of the header key that follows the key in an entry
+	short	sPrimarySz;			// size of the header key
+	char*	pKey;				// key and header key of the entry to add
+	char*	pOld;				// key and header key of the entry of the overwritten record
+	int		bOld;				// pOld holds the entry of the record that is overwritten
+	int		bHold;				// a sort moves the records, WriteRecord() adds no entries
+	int		bMoved;				// records moved since the index file was made, their entries hold an old record number
+	long	lGeneration;		// header generation when the index file was up to date, -1L when it must be made again
+	char	szFileName[ DB_MAX_FNAME ];	// name of the index file
+	SDBFile	dbIndex;			// the open index file
+	struct SDBSecondary *pNext;	// the next secondary index of the database
+};
+
+//
+// An aggregate attached to SDBFile, per key of a field the records, writes and last value of another field
+//
+struct SDBAggregate
+{
+	short	sOffset;			// position of the key in the record
+	short	sKeySz;				// size of the key
+	short	sValueOffset;		// position of the value, 4 bytes with the most significant byte first
+	long	lBucketSize;		// the last values are counted per bucket of this size
+	long	lGeneration;		// header generation when the table was up to date, -1L when it must be made again
+	long	lSlots;				// size of the hash table in the table file, a power of 2
+	long	lMaxSlots;			// largest size of the hash table, 0L without limit
+	long	lKeys;				// amount of used slots
+	long	lLiveKeys;			// amount of keys with records
+	long	lBucket;			// highest bucket of a last value, -1L when there is none
+	long	lBucketKeys;		// amount of keys with records and their last value in lBucket
+	long	lInsert;			// record number of an inserted record, it has no old record to remove
+	short	sHdrRecs;			// amount of records of the table file that hold its header
+	int		bHold;				// a sort moves the records with WriteRecord(), nothing changes
+	int		bOld;				// pRecord holds the record that is overwritten
+	int		bDirty;				// changed since it was saved
+	int		bDirtyOnDisk;		// the table file is marked as not up to date
+	int		bFull;				// the keys did not fit, the aggregate is stopped until SetAggregate()
+	char*	pRecord;			// record buffer for the overwritten record
+	char*	pEntry;				// two slot buffers
+	char*	pHeader;			// header buffer of sHdrRecs records
+	char	szFileName[ DB_MAX_FNAME ];	// name of the aggregate file
+	SDBFile	dbTable;			// the open table file, the slots follow the header records
+	struct SDBAggregate *pNext;	// the next aggregate of the database
+};
+
+//
+// The secondary indexes use the index file functions further on
+//
+static void SecondaryOverwrite( SDBFile *dbFile );
+static void SecondaryWrite( SDBFile *dbFile, long recno, char* record );
+static void SecondaryHold( SDBFile *dbFile, int bHold );
+static void SecondaryMoved( SDBFile *dbFile );
+static int SaveSecondary( SDBFile *dbFile );
+static void FreeSecondary( SDBFile *dbFile );
+
+//
+// The aggregates follow the changes of the database further on
+//
+static void AggregateOverwrite( SDBFile *dbFile );
+static void AggregateWrite( SDBFile *dbFile, char* record, int bAppend );
+static void AggregateInsert( SDBFile *dbFile, long recno );
+static void AggregateDelete( SDBFile *dbFile, long first, long count, long* recordnumbers );
+static void AggregateReorder( SDBFile *dbFile );
+static void AggregateHold( SDBFile *dbFile, int bHold );
+static int SaveAggregate( SDBFile *dbFile );
+static void FreeAggregate( SDBFile *dbFile );
+
+//
+// The write counter is kept by WriteRecord() further on
+//
+static char* CounterWrite( SDBFile *dbFile, char* record, int iFlag );
+static void CounterInsert( SDBFile *dbFile, long recno );
+static void CounterHold( SDBFile *dbFile, int bHold );
+static void FreeCounter( SDBFile *dbFile );
+
+//
+// The hash index of a dictionary file is closed by CloseDatabase()
+//
+static void FreeDictionary( SDBFile *dbFile );
+
 
 long GetDBErrorCode( void )
 {
@@ -50,773 +287,7592 @@ static int IsFileOpen( SDBFile *dbFile )
 	return (dbFile->bOpen == TRUE)?TRUE:FALSE;
 }
 
-int OpenDatabase( const char* filename, short recordsize, SDBFile *dbFile )
+static void SetFileName( SDBFile *dbFile, const char* filename )
 {
-	long lfilesz;
+	strncpy( dbFile->szFileName, filename, DB_MAX_FNAME - 1 );
+	dbFile->szFileName[ DB_MAX_FNAME - 1 ] = '\0';
+}
 
-	if( IsFileOpen( dbFile ))
-	{
-		lErrorCode = DB_ERROR_ALREADY_OPEN;
-		return FALSE;
-	}
+//
+// Make a file name from a database name with another extension e.g. data.csv -> data.tm1
+//
+static void MakeFileName( const char* filename, const char* ext, char* newname )
+{
+	char* dot;
 
-	if( (lfilesz = fsize( (char*)filename )) == -1L )
+	strncpy( newname, filename, DB_MAX_FNAME - 5 );
+	newname[ DB_MAX_FNAME - 5 ] = '\0';
+	if( (dot = strrchr( newname, '.' )) != NULL )
+		*dot = '\0';
+	strcat( newname, "." );
+	strcat( newname, ext );
+}
+
+//
+// Store or get a long as 4 bytes, most significant byte first, the same on every platform
+//
+static void PutLong( char* ptr, long value )
+{
+	ptr[ 0 ] = (char)(value >> 24);
+	ptr[ 1 ] = (char)(value >> 16);
+	ptr[ 2 ] = (char)(value >> 8);
+	ptr[ 3 ] = (char)value;
+}
+
+static long GetLong( char* ptr )
+{
+	return ((long)(signed char)ptr[ 0 ] << 24) | ((long)(unsigned char)ptr[ 1 ] << 16) |
+		   ((long)(unsigned char)ptr[ 2 ] << 8) | (long)(unsigned char)ptr[ 3 ];
+}
+
+//
+// FNV-1a hash of the key
+//
+static unsigned long HashKey( char* key, short keysize )
+{
+	unsigned long hash;
+
+	hash = 2166136261UL;
+	while( keysize-- > 0 )
 	{
-		lErrorCode = DB_ERROR_NOT_EXIST;
-		return FALSE;
+		hash ^= (unsigned char)*key++;
+		hash = (hash * 16777619UL) & 0xFFFFFFFFUL;
 	}
+	return hash;
+}
 
-	if( (dbFile->fd = open( (char*)filename, O_RDWR | O_BINARY, 0x777 )) == -1 )
+//
+// Read or write size bytes at position pos of an open file
+//
+static int ReadAt( int fd, long pos, char* buffer, int size )
+{
+	if( lseek( fd, pos, SEEK_SET ) == -1L )
 	{
-		lErrorCode = DB_ERROR_OPEN;
+		lErrorCode = DB_ERROR_RECORD_JMP;
 		return FALSE;
 	}
-	dbFile->bOpen = TRUE;
-	if( lfilesz % recordsize)
+	if( read( fd, buffer, size ) != size )
 	{
-		lErrorCode = DB_ERROR_RECORD_SIZE;
-		CloseDatabase( dbFile );
+		lErrorCode = DB_ERROR_READ_FILE;
 		return FALSE;
 	}
-	dbFile->sRecSz = recordsize;
-	dbFile->lCurrRecord = lfilesz?0:-1L;
-	dbFile->lTotalRecords = lfilesz / recordsize;
-
 	return TRUE;
 }
 
-
-int CreateDatabase( const char* filename, short recordsize, SDBFile *dbFile )
+static int WriteAt( int fd, long pos, char* buffer, int size )
 {
-	if( IsFileOpen( dbFile ))
+	if( lseek( fd, pos, SEEK_SET ) == -1L )
 	{
-		lErrorCode = DB_ERROR_ALREADY_OPEN;
+		lErrorCode = DB_ERROR_RECORD_JMP;
 		return FALSE;
 	}
-
-	if( (dbFile->fd = open( (char*)filename, O_RDWR | O_BINARY | O_CREAT | O_TRUNC, 0x0 )) == -1 )
+	if( write( fd, buffer, size ) != size )
 	{
-		lErrorCode = DB_ERROR_OPEN;
+		lErrorCode = DB_ERROR_WRITE_FILE;
 		return FALSE;
 	}
-	dbFile->bOpen = TRUE;
-	dbFile->sRecSz = recordsize;
-	dbFile->lCurrRecord = 0L;
-	dbFile->lTotalRecords = 0L;
-
 	return TRUE;
 }
 
+// ++++++++++++++++++++++++++++++++++++++
+// Record cache functions
+// ++++++++++++++++++++++++++++++++++++++
 
-void CloseDatabase( SDBFile *dbFile )
+//
+// Write one changed block back to the file
+//
+static int WriteBackBlock( SDBFile *dbFile, SDBBlock *pBlock )
 {
-	if( !IsFileOpen( dbFile ))
-		return;
-	//
-	// Close the open file handle
-	//
-	close( dbFile->fd );
-	dbFile->bOpen = FALSE;
-	dbFile->fd = -1;
-}
+	int size;
 
+	if( !pBlock->bDirty )
+		return TRUE;
 
-long GetCurrentRecord( SDBFile *dbFile )
-{
-	if( !IsFileOpen( dbFile ) )
+	size = pBlock->sCount * dbFile->sRecSz;
+	if( lseek( dbFile->fd, (long)(pBlock->lFirstRecord * dbFile->sRecSz), SEEK_SET ) == -1L )
 	{
-		lErrorCode = DB_ERROR_NOT_OPEN;
-		return -1L;
+		lErrorCode = DB_ERROR_RECORD_JMP;
+		return FALSE;
 	}
-	if( dbFile->lTotalRecords == 0L )
+	if( write( dbFile->fd, pBlock->pData, size ) != size )
 	{
-		lErrorCode = DB_ERROR_EMPTY;
-		return -1L;
+		lErrorCode = DB_ERROR_WRITE_FILE;
+		return FALSE;
 	}
-	return dbFile->lCurrRecord;
+	pBlock->bDirty = FALSE;
+	return TRUE;
 }
 
+//
+// Write all changed blocks back to the file.
+// Blocks are written in ascending order so appended records never leave a gap in the file
+//
+static int FlushCache( SDBFile *dbFile )
+{
+	struct SDBCache *pCache;
+	SDBBlock *pLowest;
+	int i;
 
-long GetTotalRecords( SDBFile *dbFile )
+	if( (pCache = dbFile->pCache) == NULL )
+		return TRUE;
+	for(;;)
+	{
+		pLowest = NULL;
+		for( i = 0; i < pCache->sBlocks; i++ )
+		{
+			if( pCache->pBlocks[ i ].bDirty &&
+				( pLowest == NULL || pCache->pBlocks[ i ].lFirstRecord < pLowest->lFirstRecord ))
+				pLowest = &pCache->pBlocks[ i ];
+		}
+		if( pLowest == NULL )
+			return TRUE;
+		if( !WriteBackBlock( dbFile, pLowest ))
+			return FALSE;
+	}
+}
+
+//
+// Forget all cached blocks, must be called after the file is changed without the cache
+//
+static void InvalidateCache( SDBFile *dbFile )
 {
-	if( !IsFileOpen( dbFile ) )
+	struct SDBCache *pCache;
+	int i;
+
+	if( (pCache = dbFile->pCache) == NULL )
+		return;
+	for( i = 0; i < pCache->sBlocks; i++ )
 	{
-		lErrorCode = DB_ERROR_NOT_OPEN;
-		return -1L;
+		pCache->pBlocks[ i ].lFirstRecord = -1L;
+		pCache->pBlocks[ i ].sCount = 0;
+		pCache->pBlocks[ i ].bDirty = FALSE;
+		pCache->pBlocks[ i ].ulUsed = 0L;
 	}
-	return dbFile->lTotalRecords;
+	pCache->ulClock = 0L;
 }
 
+static void FreeCache( SDBFile *dbFile )
+{
+	if( dbFile->pCache == NULL )
+		return;
+	free( dbFile->pCache->pData );
+	free( dbFile->pCache->pBlocks );
+	free( dbFile->pCache );
+	dbFile->pCache = NULL;
+}
 
-int GotoRecord( SDBFile *dbFile, long recordnumber )
+//
+// Return the cached block that holds recno, load it from file when it is not in the cache
+//
+static SDBBlock* CacheBlock( SDBFile *dbFile, long recno )
 {
-	long totalrecords;
-	if( ( totalrecords = GetTotalRecords( dbFile )) == -1L )
-		return FALSE;
+	struct SDBCache *pCache;
+	SDBBlock *pBlock;
+	SDBBlock *pVictim;
+	long first;
+	int i, n;
 
-	if( recordnumber < 0L || recordnumber >= totalrecords )
+	pCache = dbFile->pCache;
+	first = recno - (recno % pCache->sRecsPerBlock);
+	pCache->ulClock++;
+	pVictim = NULL;
+	for( i = 0; i < pCache->sBlocks; i++ )
 	{
-		lErrorCode = DB_ERROR_INVALID_REC_NO;
-		return FALSE;
+		pBlock = &pCache->pBlocks[ i ];
+		if( pBlock->lFirstRecord == first )
+		{
+			pBlock->ulUsed = pCache->ulClock;
+			return pBlock;
+		}
+		if( pVictim == NULL || pBlock->ulUsed < pVictim->ulUsed )
+			pVictim = pBlock;
 	}
 
-	dbFile->lCurrRecord = recordnumber;
-
-	return TRUE;
+	//
+	// Evict the least recently used block, unused blocks have stamp 0 so they go first
+	//
+	if( pVictim->bDirty && !FlushCache( dbFile ))
+		return NULL;
+	pVictim->lFirstRecord = -1L;
+	pVictim->sCount = 0;
+	//
+	// A block that starts past the last record has nothing on file yet
+	//
+	if( first < dbFile->lTotalRecords )
+	{
+		if( lseek( dbFile->fd, (long)(first * dbFile->sRecSz), SEEK_SET ) == -1L )
+		{
+			lErrorCode = DB_ERROR_RECORD_JMP;
+			return NULL;
+		}
+		if( (n = read( dbFile->fd, pVictim->pData, pCache->sRecsPerBlock * dbFile->sRecSz )) < 0 )
+		{
+			lErrorCode = DB_ERROR_READ_FILE;
+			return NULL;
+		}
+		pVictim->sCount = (short)(n / dbFile->sRecSz);
+	}
+	pVictim->lFirstRecord = first;
+	pVictim->bDirty = FALSE;
+	pVictim->ulUsed = pCache->ulClock;
+	return pVictim;
 }
 
-
-int ReadCurrentRecord( SDBFile *dbFile, char* record )
+static int CacheRead( SDBFile *dbFile, long recno, char* record )
 {
-	long curr;
-
-	if( (curr = GetCurrentRecord( dbFile )) == -1L )
-		return FALSE;
+	SDBBlock *pBlock;
+	int index;
 
-	if( lseek( dbFile->fd, (long)(curr * dbFile->sRecSz), SEEK_SET ) == -1L)
+	if( (pBlock = CacheBlock( dbFile, recno )) == NULL )
 	{
-		lErrorCode = DB_ERROR_RECORD_JMP;
+		record[0] = '\0';
 		return FALSE;
 	}
-
-	if( read( dbFile->fd, record, dbFile->sRecSz ) != dbFile->sRecSz )
+	index = (int)(recno - pBlock->lFirstRecord);
+	if( index >= pBlock->sCount )
 	{
 		lErrorCode = DB_ERROR_READ_FILE;
 		record[0] = '\0';
 		return FALSE;
 	}
-
+	memcpy( record, pBlock->pData + index * dbFile->sRecSz, dbFile->sRecSz );
 	return TRUE;
 }
 
-
-int ReadFirstRecord( SDBFile *dbFile, char* record )
+//
+// Overwrite a cached record, or add it when recno is the first record after the block
+//
+static int CacheWrite( SDBFile *dbFile, long recno, char* record )
 {
-	if( !GotoRecord( dbFile, 0L ))
+	SDBBlock *pBlock;
+	int index;
+
+	if( (pBlock = CacheBlock( dbFile, recno )) == NULL )
 		return FALSE;
-	if( !ReadCurrentRecord( dbFile, record ))
+	index = (int)(recno - pBlock->lFirstRecord);
+	if( index > pBlock->sCount )
+	{
+		lErrorCode = DB_ERROR_WRITE_FILE;
 		return FALSE;
+	}
+	memcpy( pBlock->pData + index * dbFile->sRecSz, record, dbFile->sRecSz );
+	if( index == pBlock->sCount )
+		pBlock->sCount++;
+	pBlock->bDirty = TRUE;
 	return TRUE;
 }
 
-
-int ReadLastRecord( SDBFile *dbFile, char* record )
+int SetDatabaseCache( SDBFile *dbFile, short blocks, short recordsperblock )
 {
-	long lastrecord;
-	if( (lastrecord = GetTotalRecords( dbFile )) == -1L )
+	struct SDBCache *pCache;
+	int i;
+
+	if( !IsFileOpen( dbFile ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return FALSE;
+	}
+	//
+	// Remove the old cache first
+	//
+	if( !FlushCache( dbFile ))
+		return FALSE;
+	FreeCache( dbFile );
+	if( blocks <= 0 || recordsperblock <= 0 )
+		return TRUE;
+
+	lErrorCode = DB_ERROR_MEM;
+	if( (pCache = (struct SDBCache*) malloc( sizeof( struct SDBCache ))) == NULL )
 		return FALSE;
-	if( !GotoRecord( dbFile, lastrecord - 1L ))
+	if( (pCache->pBlocks = (SDBBlock*) malloc( blocks * sizeof( SDBBlock ))) == NULL )
+	{
+		free( pCache );
 		return FALSE;
-	if( !ReadCurrentRecord( dbFile, record ))
+	}
+	if( (pCache->pData = (char*) malloc( (unsigned int)blocks * recordsperblock * dbFile->sRecSz )) == NULL )
+	{
+		free( pCache->pBlocks );
+		free( pCache );
 		return FALSE;
+	}
+	lErrorCode = DB_OK;
+	pCache->sBlocks = blocks;
+	pCache->sRecsPerBlock = recordsperblock;
+	for( i = 0; i < blocks; i++ )
+		pCache->pBlocks[ i ].pData = pCache->pData + i * recordsperblock * dbFile->sRecSz;
+	dbFile->pCache = pCache;
+	InvalidateCache( dbFile );
 	return TRUE;
 }
 
-
-int ReadPreviousRecord( SDBFile *dbFile, char* record )
+//
+// TRUE when the record holds the delete marker, see SetDeleteMarker()
+//
+static int IsDeleted( SDBFile *dbFile, char* record )
 {
-	long curr;
-	if( (curr = GetCurrentRecord( dbFile )) == -1L )
-		return FALSE;
-	if( !GotoRecord( dbFile, curr - 1L ))
-		return FALSE;
-	if( !ReadCurrentRecord( dbFile, record ))
-		return FALSE;
-	return TRUE;
+	return ( dbFile->bMarkDeleted && record[ dbFile->sDelOffset ] == DB_DELETED_MARK )? TRUE : FALSE;
 }
 
+//
+// The Bloom filter file is the database name with extension blm:
+//
+//		"BLM1", offset (2 bytes), keysize (2 bytes), bits (4 bytes), records (4 bytes), the filter
+//
+// records is the amount of records in the database when the filter was saved, a filter
+// that does not match the database is made again.
+//
+#define BLOOM_MAGIC			"BLM1"
+#define BLOOM_HDRSZ			16
+#define BLOOM_HASHES		4		// amount of bits set for each key
 
-int ReadNextRecord( SDBFile *dbFile, char* record )
+//
+// Set (bSet TRUE) or test the bits of key, returns TRUE when all bits of the key are set
+//
+static int BloomBits( struct SDBBloom *pBloom, char* key, int bSet )
 {
-	long curr;
-	if( (curr = GetCurrentRecord( dbFile )) == -1L )
-		return FALSE;
-	if( !GotoRecord( dbFile, curr + 1L ))
-		return FALSE;
-	if( !ReadCurrentRecord( dbFile, record ))
-		return FALSE;
+	unsigned long hash, step, bit;
+	int i;
+
+	hash = HashKey( key, pBloom->sKeySz );
+	step = ((hash >> 17) | (hash << 15)) | 1UL;
+	for( i = 0; i < BLOOM_HASHES; i++ )
+	{
+		bit = ((hash + i * step) & 0xFFFFFFFFUL) % (unsigned long)pBloom->lBits;
+		if( bSet )
+			pBloom->pBits[ bit >> 3 ] |= (unsigned char)(1 << (bit & 7));
+		else if( !(pBloom->pBits[ bit >> 3 ] & (1 << (bit & 7))))
+			return FALSE;
+	}
 	return TRUE;
 }
 
-
-int DeleteRecord( SDBFile *dbFile, long recordnumber )
+//
+// Make the filter from all records that are not deleted
+//
+static int BuildBloom( SDBFile *dbFile )
 {
-	char *record;
+	struct SDBBloom *pBloom;
+	char* record;
 	long recno;
-	long totalrecords;
-
-	if( ( totalrecords = GetTotalRecords( dbFile )) == -1L )
-		return FALSE;
-	if( !GotoRecord( dbFile, recordnumber ))
-		return FALSE;
 
-	if( (record = (char*)malloc( dbFile->sRecSz)) == NULL )
+	if( (record = (char*) malloc( dbFile->sRecSz )) == NULL )
 	{
 		lErrorCode = DB_ERROR_MEM;
 		return FALSE;
 	}
-
-	for( recno = recordnumber +1L; recno < totalrecords; recno++ )
+	pBloom = dbFile->pBloom;
+	memset( pBloom->pBits, 0, (size_t)(pBloom->lBits >> 3) );
+	for( recno = 0L; recno < dbFile->lTotalRecords; recno++ )
 	{
-		if( !GotoRecord( dbFile, recno ))
-			break;
-		if( !ReadCurrentRecord( dbFile, record ))
-			break;
-		if( !GotoRecord( dbFile, recno -1L ))
-			break;
-		if( !WriteRecord( dbFile, record, WRITE_OVER ))
+		if( !GotoRecord( dbFile, recno ) || !ReadCurrentRecord( dbFile, record ))
 			break;
+		if( !IsDeleted( dbFile, record ))
+			BloomBits( pBloom, record + pBloom->sOffset, TRUE );
 	}
 	free( record );
-	if( chsize( dbFile->fd, (long)((totalrecords -1L) * (dbFile->sRecSz ))) == -1)
-		lErrorCode = DB_ERROR_CHANGE_SIZE;
-	if( GetDBErrorCode() != DB_OK )
+	pBloom->bStale = FALSE;
+	pBloom->bDirty = TRUE;
+	if( recno < dbFile->lTotalRecords )
+	{
+		//
+		// Without a complete filter every key may be in the database
+		//
+		memset( pBloom->pBits, 0xFF, (size_t)(pBloom->lBits >> 3) );
 		return FALSE;
-	dbFile->lTotalRecords--;
+	}
 	return TRUE;
 }
 
-
-int WriteRecord( SDBFile *dbFile, char* record, int iFlag )
+//
+// Write the filter to its file when it was changed
+//
+static int SaveBloom( SDBFile *dbFile )
 {
-	long curr;
+	static char bloomname[ DB_MAX_FNAME ];
+	struct SDBBloom *pBloom;
+	char header[ BLOOM_HDRSZ ];
+	int fd, ok;
 
-	if( !IsFileOpen( dbFile ) )
+	if( (pBloom = dbFile->pBloom) == NULL || !pBloom->bDirty )
+		return TRUE;
+	memset( header, 0, sizeof( header ));
+	memcpy( header, BLOOM_MAGIC, 4 );
+	header[ 4 ] = (char)(pBloom->sOffset >> 8);
+	header[ 5 ] = (char)pBloom->sOffset;
+	header[ 6 ] = (char)(pBloom->sKeySz >> 8);
+	header[ 7 ] = (char)pBloom->sKeySz;
+	PutLong( header + 8, pBloom->lBits );
+	PutLong( header + 12, dbFile->lTotalRecords );
+	MakeFileName( dbFile->szFileName, "blm", bloomname );
+	if( (fd = open( bloomname, O_RDWR | O_BINARY | O_CREAT | O_TRUNC, 0x0 )) == -1 )
 	{
-		lErrorCode = DB_ERROR_NOT_OPEN;
+		lErrorCode = DB_ERROR_CREATE;
 		return FALSE;
 	}
+	ok = WriteAt( fd, 0L, header, BLOOM_HDRSZ ) && WriteAt( fd, (long)BLOOM_HDRSZ, (char*)pBloom->pBits, (int)(pBloom->lBits >> 3) );
+	close( fd );
+	if( ok )
+		pBloom->bDirty = FALSE;
+	return ok;
+}
 
-	if( iFlag == WRITE_OVER )
-	{
-		if( (curr = GetCurrentRecord( dbFile )) == -1L )
-			return FALSE;
-		//
-		// Jump to the position to overwrite the record
-		//
-		if( lseek( dbFile->fd, (long)(dbFile->sRecSz * curr), SEEK_SET ) == -1L)
-		{
-			lErrorCode = DB_ERROR_RECORD_JMP;
-			return FALSE;
-		}
-	}
-	else if( iFlag == WRITE_APPEND )
-	{
-		if( lseek( dbFile->fd, 0L, SEEK_END ) == -1L )
-		{
-			lErrorCode = DB_ERROR_RECORD_JMP;
-			return FALSE;
-		}
-	}
-	else
-	{
-		lErrorCode = DB_ERROR_INVALID_WFLAG;
-		return FALSE;
-	}
+//
+// Read the filter from its file, returns FALSE when there is no file that fits the database
+//
+static int LoadBloom( SDBFile *dbFile )
+{
+	static char bloomname[ DB_MAX_FNAME ];
+	struct SDBBloom *pBloom;
+	char header[ BLOOM_HDRSZ ];
+	int fd, ok;
 
-	if( write( dbFile->fd, record, dbFile->sRecSz ) != dbFile->sRecSz )
-	{
-		lErrorCode = DB_ERROR_WRITE_FILE;
+	pBloom = dbFile->pBloom;
+	MakeFileName( dbFile->szFileName, "blm", bloomname );
+	if( (fd = open( bloomname, O_RDWR | O_BINARY, 0x777 )) == -1 )
 		return FALSE;
-	}
-
-	if( iFlag == WRITE_APPEND )
-	{
-		dbFile->lTotalRecords++;
-		GotoRecord( dbFile, GetTotalRecords( dbFile ) -1L );
-	}
+	ok = ReadAt( fd, 0L, header, BLOOM_HDRSZ ) && memcmp( header, BLOOM_MAGIC, 4 ) == 0 &&
+		 (((unsigned char)header[ 4 ] << 8) | (unsigned char)header[ 5 ]) == pBloom->sOffset &&
+		 (((unsigned char)header[ 6 ] << 8) | (unsigned char)header[ 7 ]) == pBloom->sKeySz &&
+		 GetLong( header + 8 ) == pBloom->lBits && GetLong( header + 12 ) == dbFile->lTotalRecords &&
+		 ReadAt( fd, (long)BLOOM_HDRSZ, (char*)pBloom->pBits, (int)(pBloom->lBits >> 3) );
+	close( fd );
+	lErrorCode = DB_OK;
+	return ok;
+}
 
-	return TRUE;
+static void FreeBloom( SDBFile *dbFile )
+{
+	if( dbFile->pBloom == NULL )
+		return;
+	free( dbFile->pBloom->pBits );
+	free( dbFile->pBloom );
+	dbFile->pBloom = NULL;
 }
 
+//
+// Add the key of a written record to the filter
+//
+static void BloomWrite( SDBFile *dbFile, char* record )
+{
+	if( dbFile->pBloom == NULL )
+		return;
+	BloomBits( dbFile->pBloom, record + dbFile->pBloom->sOffset, TRUE );
+	dbFile->pBloom->bDirty = TRUE;
+}
 
-// ++++++++++++++++++++++++++++++++++++++
-// Sorting database functions
-// ++++++++++++++++++++++++++++++++++++++
+//
+// Records were removed, their keys are only removed from the filter when it is made again
+//
+static void BloomDelete( SDBFile *dbFile )
+{
+	if( dbFile->pBloom == NULL )
+		return;
+	dbFile->pBloom->bStale = TRUE;
+	dbFile->pBloom->bDirty = TRUE;
+}
 
 //
-// Insertion sort is a very fast sorting method for almost sorted databases
+// Returns FALSE only when searchkey is certainly not in the database
 //
-int InsertionSort( SDBFile *dbFile, short offset, short checksize )
+static int BloomMayContain( SDBFile *dbFile, char* searchkey, int checksize, int offset )
 {
-	long i, j;
-	long totalrecords;
-	char* temp1;
-	char* temp2;
+	struct SDBBloom *pBloom;
 
-	if( ( totalrecords = GetTotalRecords( dbFile )) == -1L )
-		return FALSE;
+	if( (pBloom = dbFile->pBloom) == NULL || pBloom->sOffset != offset || pBloom->sKeySz != checksize )
+		return TRUE;
+	if( pBloom->bStale && !BuildBloom( dbFile ))
+		return TRUE;
+	return BloomBits( pBloom, searchkey, FALSE );
+}
 
-	if( dbFile->sRecSz < (checksize+offset) )
+int SetBloomFilter( SDBFile *dbFile, short offset, short keysize, long size )
+{
+	struct SDBBloom *pBloom;
+
+	if( !IsFileOpen( dbFile ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return FALSE;
+	}
+	if( !SaveBloom( dbFile ))
+		return FALSE;
+	FreeBloom( dbFile );
+	if( size <= 0L )
+		return TRUE;
+	if( keysize <= 0 || dbFile->sRecSz < (keysize+offset) )
 	{
 		lErrorCode = DB_ERROR_SORTLENGTH;
 		return FALSE;
 	}
-
 	lErrorCode = DB_ERROR_MEM;
-	if( (temp1 = (char*) malloc( (unsigned int)dbFile->sRecSz)) == NULL )
-		goto Clean1;
-
-	if( (temp2 = (char*) malloc( (unsigned int)dbFile->sRecSz)) == NULL )
-		goto Clean2;
-	lErrorCode = DB_OK;
-	for( i = 1L; i < totalrecords; i++ )
+	if( size > 0x7FFFL )
+		return FALSE;
+	if( (pBloom = (struct SDBBloom*) malloc( sizeof( struct SDBBloom ))) == NULL )
+		return FALSE;
+	if( (pBloom->pBits = (unsigned char*) malloc( (unsigned int)size )) == NULL )
 	{
-		if( !GotoRecord( dbFile, i ))
-			goto CleanAll;
-		if( !ReadCurrentRecord( dbFile, temp1 ))
-			goto CleanAll;
-		j = i;
-		while( j > 0L )
-		{
-			if( !GotoRecord( dbFile, (j-1L) ))
-				goto CleanAll;
-			if( !ReadCurrentRecord( dbFile, temp2 ))
-				goto CleanAll;
-
-			if( memcmp( temp1+offset, temp2+offset, checksize) > 0 )
-				break;
-
-			if( !GotoRecord( dbFile, j ))
-				goto CleanAll;
-			if( !WriteRecord( dbFile, temp2, WRITE_OVER ))
-				goto CleanAll;
-			j--;
-		}
-		if( !GotoRecord( dbFile, j ))
-			goto CleanAll;
-		if( !WriteRecord( dbFile, temp1, WRITE_OVER ))
-			goto CleanAll;
+		free( pBloom );
+		return FALSE;
 	}
+	lErrorCode = DB_OK;
+	pBloom->sOffset = offset;
+	pBloom->sKeySz = keysize;
+	pBloom->lBits = size * 8L;
+	pBloom->bDirty = FALSE;
+	pBloom->bStale = FALSE;
+	dbFile->pBloom = pBloom;
+	if( LoadBloom( dbFile ))
+		return TRUE;
+	if( BuildBloom( dbFile ))
+		return SaveBloom( dbFile );
+	return FALSE;
+}
 
-CleanAll:
-	free( temp2 );
-Clean2:
-	free( temp1 );
-Clean1:
-	if( GetDBErrorCode() != DB_OK )
-		return FALSE;
-	return TRUE;
+int MayContainKey( SDBFile *dbFile, char* searchkey )
+{
+	if( !IsFileOpen( dbFile ) || dbFile->pBloom == NULL )
+		return TRUE;
+	return BloomMayContain( dbFile, searchkey, dbFile->pBloom->sKeySz, dbFile->pBloom->sOffset );
 }
 
+//
+// The header file is the database name with extension hdr:
+//
+//		"HDR1", record size (2 bytes), key offset (2 bytes), key size (2 bytes), dirty (2 bytes),
+//		records (4 bytes), sorted (4 bytes), generation (4 bytes), extension of the database (4 bytes)
+//
+// dirty is written at the first change after the header was saved, a header that is dirty
+// or does not match the database is not trusted. The extension tells which file the header
+// belongs to, an index or temporary file with the same name and another extension has no header.
+//
+#define HEADER_MAGIC		"HDR1"
+#define HEADER_SIZE			28
+
+//
+// The extension of filename in 4 bytes, padded with 0
+//
+static void HeaderExtension( const char* filename, char* ext )
+{
+	const char* dot;
+
+	memset( ext, 0, 4 );
+	if( (dot = strrchr( filename, '.' )) != NULL )
+		strncpy( ext, dot + 1, 3 );
+}
 
 //
-// Heap sort helper function
+// Read the header file of filename, FALSE when there is none or it belongs to another file
 //
-static int downheap( SDBFile *dbFile, long max_records, long k, short offset, short checksize, char* tmp1, char* tmp2, char* tmp3 )
+static int ReadHeaderFile( const char* filename, char* header )
 {
-	long j, N2;
+	static char headername[ DB_MAX_FNAME ];
+	char ext[ 4 ];
+	int fd, ok;
 
-	if( !GotoRecord( dbFile, (k-1L)))
-		return FALSE;
-	if( !ReadCurrentRecord( dbFile, tmp1 ))
+	MakeFileName( filename, "hdr", headername );
+	if( (fd = open( headername, O_RDWR | O_BINARY, 0x777 )) == -1 )
 		return FALSE;
+	HeaderExtension( filename, ext );
+	ok = ReadAt( fd, 0L, header, HEADER_SIZE ) && memcmp( header, HEADER_MAGIC, 4 ) == 0 &&
+		 memcmp( header + 24, ext, 4 ) == 0;
+	close( fd );
+	lErrorCode = DB_OK;
+	return ok;
+}
 
-	N2 = max_records >> 1;
-	while( k <= N2)
+static int WriteHeaderFile( SDBFile *dbFile, int bDirty )
+{
+	static char headername[ DB_MAX_FNAME ];
+	struct SDBHeader *pHeader;
+	char header[ HEADER_SIZE ];
+	int fd, ok;
+
+	pHeader = dbFile->pHeader;
+	memcpy( header, HEADER_MAGIC, 4 );
+	header[ 4 ] = (char)(dbFile->sRecSz >> 8);
+	header[ 5 ] = (char)dbFile->sRecSz;
+	header[ 6 ] = (char)(pHeader->sOffset >> 8);
+	header[ 7 ] = (char)pHeader->sOffset;
+	header[ 8 ] = (char)(pHeader->sKeySz >> 8);
+	header[ 9 ] = (char)pHeader->sKeySz;
+	header[ 10 ] = 0;
+	header[ 11 ] = (char)bDirty;
+	PutLong( header + 12, dbFile->lTotalRecords );
+	PutLong( header + 16, pHeader->lSorted );
+	PutLong( header + 20, pHeader->lGeneration );
+	HeaderExtension( dbFile->szFileName, header + 24 );
+	MakeFileName( dbFile->szFileName, "hdr", headername );
+	if( (fd = open( headername, O_RDWR | O_BINARY | O_CREAT | O_TRUNC, 0x0 )) == -1 )
 	{
-		j = k + k;
+		lErrorCode = DB_ERROR_CREATE;
+		return FALSE;
+	}
+	ok = WriteAt( fd, 0L, header, HEADER_SIZE );
+	close( fd );
+	//
+	// A half written header must not be trusted
+	//
+	if( !ok )
+		remove( headername );
+	return ok;
+}
 
-		if( !GotoRecord( dbFile, (j-1L)))
-			return FALSE;
-		if( !ReadCurrentRecord( dbFile, tmp2 ))
-			return FALSE;
+//
+// Read the header file, the sort state is only taken over when the header can be trusted
+//
+static void LoadHeader( SDBFile *dbFile )
+{
+	struct SDBHeader *pHeader;
+	char header[ HEADER_SIZE ];
 
-		if( j < max_records )
+	pHeader = dbFile->pHeader;
+	if( ReadHeaderFile( dbFile->szFileName, header ))
+	{
+		pHeader->lGeneration = GetLong( header + 20 );
+		if( (((unsigned char)header[ 4 ] << 8) | (unsigned char)header[ 5 ]) == dbFile->sRecSz &&
+			(((unsigned char)header[ 6 ] << 8) | (unsigned char)header[ 7 ]) == pHeader->sOffset &&
+			(((unsigned char)header[ 8 ] << 8) | (unsigned char)header[ 9 ]) == pHeader->sKeySz &&
+			header[ 10 ] == 0 && header[ 11 ] == 0 && GetLong( header + 12 ) == dbFile->lTotalRecords )
 		{
-			if( !GotoRecord( dbFile, j))
-				return FALSE;
-			if( !ReadCurrentRecord( dbFile, tmp3 ))
-				return FALSE;
-
-			if( memcmp( tmp2 + offset, tmp3 + offset, checksize ) < 0 )
-			{
-				memmove( tmp2, tmp3, dbFile->sRecSz );
-				j++;
-			}
+			pHeader->lSorted = GetLong( header + 16 );
+			pHeader->bChanged = FALSE;
 		}
-		if( !GotoRecord( dbFile, k-1L))
-			return FALSE;
-
-		if( memcmp( tmp1+offset, tmp2+offset, checksize ) >= 0 )
-			break;
-
-		if( !WriteRecord( dbFile, tmp2, WRITE_OVER ))
-			return FALSE;
-		k = j;
 	}
-	if( !GotoRecord( dbFile, k-1L))
-		return FALSE;
+}
 
-	if( !WriteRecord( dbFile, tmp1, WRITE_OVER ))
-			return FALSE;
+//
+// Returns FALSE when the header file of filename was written for another record size
+//
+static int CheckHeaderFile( const char* filename, short recordsize )
+{
+	char header[ HEADER_SIZE ];
 
-	return TRUE;
+	return !ReadHeaderFile( filename, header ) ||
+		   (((unsigned char)header[ 4 ] << 8) | (unsigned char)header[ 5 ]) == recordsize;
 }
 
 //
-// Heap sort works best on databases that have not been sorted at all
+// Write the header to its file when it was changed
 //
-int HeapSort( SDBFile *dbFile, short offset, short checksize )
+static int SaveHeader( SDBFile *dbFile )
 {
-	long totalrecords;
-	long k, N;
-	char* temp1;
-	char* temp2;
-	char* temp3;
-
-	if( ( totalrecords = GetTotalRecords( dbFile )) == -1L )
+	if( dbFile->pHeader == NULL || !dbFile->pHeader->bChanged )
+		return TRUE;
+	if( !WriteHeaderFile( dbFile, FALSE ))
 		return FALSE;
+	dbFile->pHeader->bChanged = FALSE;
+	dbFile->pHeader->bDirtyOnDisk = FALSE;
+	return TRUE;
+}
 
-	if( dbFile->sRecSz < (checksize+offset) )
-	{
-		lErrorCode = DB_ERROR_SORTLENGTH;
-		return FALSE;
-	}
+static void FreeHeader( SDBFile *dbFile )
+{
+	if( dbFile->pHeader == NULL )
+		return;
+	free( dbFile->pHeader->pRecord );
+	free( dbFile->pHeader );
+	dbFile->pHeader = NULL;
+}
+
+//
+// The database is changed, the first change after the header was saved marks the header file dirty
+//
+static void HeaderChanged( SDBFile *dbFile )
+{
+	struct SDBHeader *pHeader;
+	long errorcode;
+
+	pHeader = dbFile->pHeader;
+	pHeader->lGeneration++;
+	pHeader->bChanged = TRUE;
+	if( pHeader->bDirtyOnDisk )
+		return;
+	errorcode = lErrorCode;
+	if( WriteHeaderFile( dbFile, TRUE ))
+		pHeader->bDirtyOnDisk = TRUE;
+	lErrorCode = errorcode;
+}
+
+//
+// Read record recno without moving the current record
+//
+static int ReadRecordAt( SDBFile *dbFile, long recno, char* record )
+{
+	if( dbFile->pCache != NULL )
+		return CacheRead( dbFile, recno, record );
+	return ReadAt( dbFile->fd, recno * dbFile->sRecSz, record, dbFile->sRecSz );
+}
+
+//
+// TRUE when the key of record at recno is not lower then the key of the record before it
+// and, when recno + 1 is below limit, not higher then the key of the record after it
+//
+static int HeaderInOrder( SDBFile *dbFile, long recno, char* record, long limit )
+{
+	struct SDBHeader *pHeader;
+	long errorcode;
+	int ok;
+
+	pHeader = dbFile->pHeader;
+	errorcode = lErrorCode;
+	ok = TRUE;
+	if( recno > 0L )
+		ok = ReadRecordAt( dbFile, recno - 1L, pHeader->pRecord ) &&
+			 memcmp( pHeader->pRecord + pHeader->sOffset, record + pHeader->sOffset, pHeader->sKeySz ) <= 0;
+	if( ok && recno + 1L < limit )
+		ok = ReadRecordAt( dbFile, recno + 1L, pHeader->pRecord ) &&
+			 memcmp( pHeader->pRecord + pHeader->sOffset, record + pHeader->sOffset, pHeader->sKeySz ) >= 0;
+	lErrorCode = errorcode;
+	return ok;
+}
+
+//
+// Keep the sorted records up to date after record recno was written
+//
+static void HeaderWrite( SDBFile *dbFile, long recno, char* record )
+{
+	struct SDBHeader *pHeader;
+
+	if( (pHeader = dbFile->pHeader) == NULL )
+		return;
+	HeaderChanged( dbFile );
+	if( recno == pHeader->lSorted )
+	{
+		if( HeaderInOrder( dbFile, recno, record, 0L ))
+			pHeader->lSorted++;
+	}
+	else if( recno < pHeader->lSorted && !HeaderInOrder( dbFile, recno, record, pHeader->lSorted ))
+		pHeader->lSorted = recno;
+}
+
+//
+// The records from recno on moved one up to insert a record at recno
+//
+static void HeaderInsert( SDBFile *dbFile, long recno )
+{
+	if( dbFile->pHeader == NULL )
+		return;
+	HeaderChanged( dbFile );
+	if( recno < dbFile->pHeader->lSorted )
+		dbFile->pHeader->lSorted++;
+}
+
+//
+// count records from first on are removed
+//
+static void HeaderDelete( SDBFile *dbFile, long first, long count )
+{
+	struct SDBHeader *pHeader;
+
+	if( (pHeader = dbFile->pHeader) == NULL )
+		return;
+	HeaderChanged( dbFile );
+	if( first >= pHeader->lSorted )
+		return;
+	if( first + count >= pHeader->lSorted )
+		pHeader->lSorted = first;
+	else
+		pHeader->lSorted -= count;
+}
+
+//
+// Any record may be removed, a sorted database stays sorted (see HeaderTruncate)
+//
+static void HeaderCompact( SDBFile *dbFile )
+{
+	if( dbFile->pHeader == NULL )
+		return;
+	HeaderChanged( dbFile );
+	if( dbFile->pHeader->lSorted < dbFile->lTotalRecords )
+		dbFile->pHeader->lSorted = 0L;
+}
+
+static void HeaderTruncate( SDBFile *dbFile, long totalrecords )
+{
+	if( dbFile->pHeader != NULL && dbFile->pHeader->lSorted > totalrecords )
+		dbFile->pHeader->lSorted = totalrecords;
+}
+
+//
+// The records are reordered, nothing is known to be sorted until the sort is done
+//
+static void HeaderReorder( SDBFile *dbFile )
+{
+	if( dbFile->pHeader == NULL )
+		return;
+	HeaderChanged( dbFile );
+	dbFile->pHeader->lSorted = 0L;
+}
+
+//
+// The database is sorted on checksize characters from offset on
+//
+static void HeaderSetSorted( SDBFile *dbFile, short offset, short checksize )
+{
+	struct SDBHeader *pHeader;
+
+	if( (pHeader = dbFile->pHeader) == NULL || pHeader->sOffset != offset || checksize < pHeader->sKeySz )
+		return;
+	if( pHeader->lSorted != dbFile->lTotalRecords )
+	{
+		HeaderChanged( dbFile );
+		pHeader->lSorted = dbFile->lTotalRecords;
+	}
+}
+
+//
+// Amount of records from the start of the database that are sorted on checksize characters
+// from offset on. Without a header for that key the database is taken to be sorted.
+//
+static long HeaderSortedRecords( SDBFile *dbFile, int offset, int checksize )
+{
+	struct SDBHeader *pHeader;
+
+	if( (pHeader = dbFile->pHeader) == NULL || pHeader->sOffset != offset || checksize > pHeader->sKeySz )
+		return dbFile->lTotalRecords;
+	return pHeader->lSorted;
+}
+
+int SetDatabaseHeader( SDBFile *dbFile, short offset, short keysize )
+{
+	struct SDBHeader *pHeader;
+
+	if( !IsFileOpen( dbFile ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return FALSE;
+	}
+	if( !SaveHeader( dbFile ))
+		return FALSE;
+	FreeHeader( dbFile );
+	if( keysize <= 0 )
+		return TRUE;
+	if( dbFile->sRecSz < (keysize+offset) )
+	{
+		lErrorCode = DB_ERROR_SORTLENGTH;
+		return FALSE;
+	}
+	lErrorCode = DB_ERROR_MEM;
+	if( (pHeader = (struct SDBHeader*) malloc( sizeof( struct SDBHeader ))) == NULL )
+		return FALSE;
+	if( (pHeader->pRecord = (char*) malloc( dbFile->sRecSz )) == NULL )
+	{
+		free( pHeader );
+		return FALSE;
+	}
+	lErrorCode = DB_OK;
+	pHeader->sOffset = offset;
+	pHeader->sKeySz = keysize;
+	pHeader->lSorted = 0L;
+	pHeader->lGeneration = 0L;
+	pHeader->bChanged = TRUE;
+	pHeader->bDirtyOnDisk = FALSE;
+	dbFile->pHeader = pHeader;
+	LoadHeader( dbFile );
+	return SaveHeader( dbFile );
+}
+
+long GetSortedRecords( SDBFile *dbFile )
+{
+	if( !IsFileOpen( dbFile ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return -1L;
+	}
+	if( dbFile->pHeader == NULL )
+		return 0L;
+	return dbFile->pHeader->lSorted;
+}
+
+long GetDatabaseGeneration( SDBFile *dbFile )
+{
+	if( !IsFileOpen( dbFile ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return -1L;
+	}
+	if( dbFile->pHeader == NULL )
+		return 0L;
+	return dbFile->pHeader->lGeneration;
+}
+
+//
+// The delta log keeps the keys of the records after the sorted records in memory, entry i
+// is the key of record lBase + i. The table is read again when the header generation shows
+// the database was changed by something else then a written record.
+//
+static void FreeDelta( SDBFile *dbFile )
+{
+	if( dbFile->pDelta == NULL )
+		return;
+	free( dbFile->pDelta->pKeys );
+	free( dbFile->pDelta->pRecord );
+	free( dbFile->pDelta );
+	dbFile->pDelta = NULL;
+}
+
+//
+// Read the keys of the records after the sorted records,
+// returns FALSE when they do not fit in the table
+//
+static int BuildDelta( SDBFile *dbFile )
+{
+	struct SDBDelta *pDelta;
+	long recno, errorcode;
+
+	pDelta = dbFile->pDelta;
+	pDelta->lBase = dbFile->pHeader->lSorted;
+	pDelta->lGeneration = dbFile->pHeader->lGeneration;
+	pDelta->lCount = -1L;
+	if( dbFile->lTotalRecords - pDelta->lBase > pDelta->lMax )
+		return FALSE;
+	errorcode = lErrorCode;
+	for( recno = pDelta->lBase; recno < dbFile->lTotalRecords; recno++ )
+	{
+		if( !ReadRecordAt( dbFile, recno, pDelta->pRecord ))
+		{
+			lErrorCode = errorcode;
+			return FALSE;
+		}
+		memcpy( pDelta->pKeys + (recno - pDelta->lBase) * pDelta->sKeySz, pDelta->pRecord + pDelta->sOffset, pDelta->sKeySz );
+	}
+	pDelta->lCount = dbFile->lTotalRecords - pDelta->lBase;
+	return TRUE;
+}
+
+//
+// Returns TRUE when the table holds the keys of all records after the sorted records
+//
+static int DeltaUpToDate( SDBFile *dbFile )
+{
+	struct SDBDelta *pDelta;
+
+	if( (pDelta = dbFile->pDelta) == NULL || dbFile->pHeader == NULL )
+		return FALSE;
+	if( pDelta->lCount != -1L && pDelta->lGeneration == dbFile->pHeader->lGeneration &&
+		pDelta->lBase == dbFile->pHeader->lSorted && pDelta->lBase + pDelta->lCount == dbFile->lTotalRecords )
+		return TRUE;
+	return BuildDelta( dbFile );
+}
+
+//
+// Keep the table up to date after record recno was written, called after HeaderWrite
+//
+static void DeltaWrite( SDBFile *dbFile, long recno, char* record )
+{
+	struct SDBDelta *pDelta;
+	struct SDBHeader *pHeader;
+	long i;
+
+	if( (pDelta = dbFile->pDelta) == NULL || (pHeader = dbFile->pHeader) == NULL || pDelta->lCount == -1L )
+		return;
+	//
+	// Only this write may have changed the database since the table was up to date
+	//
+	if( pDelta->lGeneration + 1L != pHeader->lGeneration )
+	{
+		pDelta->lCount = -1L;
+		return;
+	}
+	pDelta->lGeneration = pHeader->lGeneration;
+	i = recno - pDelta->lBase;
+	if( pHeader->lSorted != pDelta->lBase )
+	{
+		//
+		// A record appended in order to a database without delta is sorted
+		//
+		if( pDelta->lCount == 0L && pHeader->lSorted == recno + 1L )
+			pDelta->lBase = pHeader->lSorted;
+		else
+			pDelta->lCount = -1L;
+	}
+	else if( i >= 0L && i < pDelta->lCount )
+		memcpy( pDelta->pKeys + i * pDelta->sKeySz, record + pDelta->sOffset, pDelta->sKeySz );
+	else if( i == pDelta->lCount && i < pDelta->lMax )
+	{
+		memcpy( pDelta->pKeys + i * pDelta->sKeySz, record + pDelta->sOffset, pDelta->sKeySz );
+		pDelta->lCount++;
+	}
+	else if( i >= 0L )
+		pDelta->lCount = -1L;
+}
+
+int SetDeltaLog( SDBFile *dbFile, short offset, short keysize, long maxrecords )
+{
+	struct SDBDelta *pDelta;
+
+	if( !IsFileOpen( dbFile ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return FALSE;
+	}
+	FreeDelta( dbFile );
+	if( maxrecords <= 0L )
+		return TRUE;
+	if( dbFile->pHeader == NULL || dbFile->pHeader->sOffset != offset || dbFile->pHeader->sKeySz != keysize )
+	{
+		lErrorCode = DB_ERROR_NO_HEADER;
+		return FALSE;
+	}
+	lErrorCode = DB_ERROR_MEM;
+	if( maxrecords * keysize > 0x7FFFL )
+		return FALSE;
+	if( (pDelta = (struct SDBDelta*) malloc( sizeof( struct SDBDelta ))) == NULL )
+		return FALSE;
+	if( (pDelta->pKeys = (char*) malloc( (unsigned int)(maxrecords * keysize) )) == NULL )
+	{
+		free( pDelta );
+		return FALSE;
+	}
+	if( (pDelta->pRecord = (char*) malloc( dbFile->sRecSz )) == NULL )
+	{
+		free( pDelta->pKeys );
+		free( pDelta );
+		return FALSE;
+	}
+	lErrorCode = DB_OK;
+	pDelta->sOffset = offset;
+	pDelta->sKeySz = keysize;
+	pDelta->lMax = maxrecords;
+	pDelta->lCount = -1L;
+	dbFile->pDelta = pDelta;
+	return TRUE;
+}
+
+int MergeDeltaLog( SDBFile *dbFile, int bForce )
+{
+	long tail;
+
+	if( !IsFileOpen( dbFile ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return FALSE;
+	}
+	if( dbFile->pDelta == NULL || dbFile->pHeader == NULL )
+		return TRUE;
+	tail = dbFile->lTotalRecords - dbFile->pHeader->lSorted;
+	if( tail == 0L || ( !bForce && tail < dbFile->pDelta->lMax ))
+		return TRUE;
+	//
+	// SortDatabase merges a few records into the sorted records in one pass
+	//
+	return SortDatabase( dbFile, dbFile->pDelta->sOffset, dbFile->pDelta->sKeySz );
+}
+
+int FlushDatabase( SDBFile *dbFile )
+{
+	if( !IsFileOpen( dbFile ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return FALSE;
+	}
+	if( !FlushCache( dbFile ) || !SaveBloom( dbFile ) || !SaveHeader( dbFile ) || !SaveSecondary( dbFile ))
+		return FALSE;
+	return SaveAggregate( dbFile );
+}
+
+//
+// The fences are made again by the next search, used after the records are reordered
+//
+static void DropFence( SDBFile *dbFile )
+{
+	if( dbFile->pFence != NULL )
+		dbFile->pFence->lCount = -1L;
+}
+
+static void FreeFence( SDBFile *dbFile )
+{
+	if( dbFile->pFence == NULL )
+		return;
+	free( dbFile->pFence->pRecNo );
+	free( dbFile->pFence );
+	dbFile->pFence = NULL;
+}
+
+//
+// The fences only cover the sorted records, the records added after the last sort are not sorted
+//
+static long FenceLimit( SDBFile *dbFile )
+{
+	return HeaderSortedRecords( dbFile, dbFile->pFence->sOffset, dbFile->pFence->sKeySz );
+}
+
+//
+// Read the key of every lStep-th record, lStep is the lowest power of 2 that leaves
+// a quarter of the fences free for appended and inserted records
+//
+static int BuildFence( SDBFile *dbFile )
+{
+	struct SDBFence *pFence;
+	char* record;
+	long recno, limit;
+
+	if( (record = (char*) malloc( dbFile->sRecSz )) == NULL )
+	{
+		lErrorCode = DB_ERROR_MEM;
+		return FALSE;
+	}
+	pFence = dbFile->pFence;
+	limit = FenceLimit( dbFile );
+	for( pFence->lStep = 1L; (limit / pFence->lStep + 1L) * 4L > pFence->lMax * 3L; pFence->lStep *= 2L )
+		;
+	pFence->lCount = 0L;
+	for( recno = 0L; recno < limit; recno += pFence->lStep )
+	{
+		if( !GotoRecord( dbFile, recno ) || !ReadCurrentRecord( dbFile, record ))
+		{
+			pFence->lCount = -1L;
+			break;
+		}
+		pFence->pRecNo[ pFence->lCount ] = recno;
+		memcpy( pFence->pKeys + pFence->lCount * pFence->sKeySz, record + pFence->sOffset, pFence->sKeySz );
+		pFence->lCount++;
+	}
+	free( record );
+	return pFence->lCount != -1L;
+}
+
+//
+// Index of the first fence with a record number not lower then recno
+//
+static long FenceAt( struct SDBFence *pFence, long recno )
+{
+	long min, max, mid;
+
+	min = 0L;
+	max = pFence->lCount;
+	while( min < max )
+	{
+		mid = (min + max) >> 1;
+		if( pFence->pRecNo[ mid ] < recno )
+			min = mid + 1L;
+		else
+			max = mid;
+	}
+	return min;
+}
+
+//
+// Narrow the search range of a key with the fences: min becomes the first record after the last
+// fence with a lower key (bUpper FALSE) or a lower or equal key (bUpper TRUE), max the record number
+// of the next fence. min and max are not changed when there is no such fence.
+// Returns FALSE when the fences can not be used for this key
+//
+static int FenceRange( SDBFile *dbFile, char* key, int checksize, int offset, int bUpper, long* min, long* max )
+{
+	struct SDBFence *pFence;
+	long lo, hi, mid;
+	int test;
+
+	if( (pFence = dbFile->pFence) == NULL || pFence->sOffset != offset || checksize > pFence->sKeySz )
+		return FALSE;
+	//
+	// Fences past the sorted records are not valid anymore
+	//
+	if( pFence->lCount > 0L && pFence->pRecNo[ pFence->lCount - 1L ] >= FenceLimit( dbFile ))
+		DropFence( dbFile );
+	if( pFence->lCount == -1L && !BuildFence( dbFile ))
+		return FALSE;
+	lo = 0L;
+	hi = pFence->lCount;
+	while( lo < hi )
+	{
+		mid = (lo + hi) >> 1;
+		test = memcmp( pFence->pKeys + mid * pFence->sKeySz, key, checksize );
+		if( test < 0 || ( bUpper && test == 0 ))
+			lo = mid + 1L;
+		else
+			hi = mid;
+	}
+	if( lo > 0L )
+		*min = pFence->pRecNo[ lo - 1L ] + 1L;
+	if( lo < pFence->lCount )
+		*max = pFence->pRecNo[ lo ];
+	return TRUE;
+}
+
+//
+// Keep the fences up to date after record recno was written
+//
+static void FenceWrite( SDBFile *dbFile, long recno, char* record, int bAppend )
+{
+	struct SDBFence *pFence;
+	long i;
+
+	if( (pFence = dbFile->pFence) == NULL || pFence->lCount == -1L )
+		return;
+	i = FenceAt( pFence, recno );
+	if( i < pFence->lCount && pFence->pRecNo[ i ] == recno )
+		memcpy( pFence->pKeys + i * pFence->sKeySz, record + pFence->sOffset, pFence->sKeySz );
+	else if( bAppend && recno < FenceLimit( dbFile ) &&
+			 ( pFence->lCount == 0L || recno - pFence->pRecNo[ pFence->lCount - 1L ] >= pFence->lStep ))
+	{
+		if( pFence->lCount == pFence->lMax )
+		{
+			DropFence( dbFile );
+			return;
+		}
+		pFence->pRecNo[ pFence->lCount ] = recno;
+		memcpy( pFence->pKeys + pFence->lCount * pFence->sKeySz, record + pFence->sOffset, pFence->sKeySz );
+		pFence->lCount++;
+	}
+}
+
+//
+// Keep the fences up to date after record is inserted at recno, the records from recno on moved one up.
+// The inserted record becomes a fence when the two fences around it get too far apart.
+//
+static void FenceInsert( SDBFile *dbFile, long recno, char* record )
+{
+	struct SDBFence *pFence;
+	long i, j, next;
+
+	if( (pFence = dbFile->pFence) == NULL || pFence->lCount == -1L )
+		return;
+	i = FenceAt( pFence, recno );
+	for( j = i; j < pFence->lCount; j++ )
+		pFence->pRecNo[ j ]++;
+	next = ( i < pFence->lCount )? pFence->pRecNo[ i ] : dbFile->lTotalRecords;
+	if( i == 0L || next - pFence->pRecNo[ i - 1L ] <= 2L * pFence->lStep )
+		return;
+	if( pFence->lCount == pFence->lMax )
+	{
+		DropFence( dbFile );
+		return;
+	}
+	memmove( pFence->pRecNo + i + 1L, pFence->pRecNo + i, (size_t)(pFence->lCount - i) * sizeof( long ));
+	memmove( pFence->pKeys + (i + 1L) * pFence->sKeySz, pFence->pKeys + i * pFence->sKeySz, (size_t)(pFence->lCount - i) * pFence->sKeySz );
+	pFence->pRecNo[ i ] = recno;
+	memcpy( pFence->pKeys + i * pFence->sKeySz, record + pFence->sOffset, pFence->sKeySz );
+	pFence->lCount++;
+}
+
+//
+// Keep the fences up to date after count records from first on are removed
+//
+static void FenceDelete( SDBFile *dbFile, long first, long count )
+{
+	struct SDBFence *pFence;
+	long i, j;
+
+	if( (pFence = dbFile->pFence) == NULL || pFence->lCount == -1L )
+		return;
+	i = FenceAt( pFence, first );
+	j = FenceAt( pFence, first + count );
+	memmove( pFence->pRecNo + i, pFence->pRecNo + j, (size_t)(pFence->lCount - j) * sizeof( long ));
+	memmove( pFence->pKeys + i * pFence->sKeySz, pFence->pKeys + j * pFence->sKeySz, (size_t)(pFence->lCount - j) * pFence->sKeySz );
+	pFence->lCount -= j - i;
+	for( ; i < pFence->lCount; i++ )
+		pFence->pRecNo[ i ] -= count;
+}
+
+int SetFenceIndex( SDBFile *dbFile, short offset, short keysize, long memory )
+{
+	struct SDBFence *pFence;
+	long max;
+
+	if( !IsFileOpen( dbFile ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return FALSE;
+	}
+	FreeFence( dbFile );
+	if( memory <= 0L )
+		return TRUE;
+	if( keysize <= 0 || dbFile->sRecSz < (keysize+offset) )
+	{
+		lErrorCode = DB_ERROR_SORTLENGTH;
+		return FALSE;
+	}
+	max = memory / (keysize + (long)sizeof( long ));
+	lErrorCode = DB_ERROR_MEM;
+	if( max < 2L || (unsigned long)memory > 0xFFFFUL )
+		return FALSE;
+	if( (pFence = (struct SDBFence*) malloc( sizeof( struct SDBFence ))) == NULL )
+		return FALSE;
+	if( (pFence->pRecNo = (long*) malloc( (unsigned int)(max * (keysize + sizeof( long ))) )) == NULL )
+	{
+		free( pFence );
+		return FALSE;
+	}
+	lErrorCode = DB_OK;
+	pFence->pKeys = (char*)(pFence->pRecNo + max);
+	pFence->sOffset = offset;
+	pFence->sKeySz = keysize;
+	pFence->lMax = max;
+	pFence->lCount = -1L;
+	dbFile->pFence = pFence;
+	return TRUE;
+}
+
+//
+// Allocate the largest buffer up to DB_MOVE_BUFSZ for moving at most count records
+//
+static char* AllocMoveBuffer( SDBFile *dbFile, long count, long *blockrecords )
+{
+	char* buffer;
+
+	*blockrecords = DB_MOVE_BUFSZ / dbFile->sRecSz;
+	if( *blockrecords > count )
+		*blockrecords = count;
+	if( *blockrecords < 1L )
+		*blockrecords = 1L;
+	while( (buffer = (char*) malloc( (unsigned int)(*blockrecords * dbFile->sRecSz) )) == NULL )
+	{
+		if( *blockrecords == 1L )
+		{
+			lErrorCode = DB_ERROR_MEM;
+			return NULL;
+		}
+		*blockrecords >>= 1;
+	}
+	return buffer;
+}
+
+//
+// Copy count records from record from to record to in blocks, the areas may overlap.
+// The cache must be flushed and invalidated by the caller
+//
+static int CopyRecords( SDBFile *dbFile, long from, long to, long count, char* buffer, long blockrecords )
+{
+	long done, src;
+	int n;
+
+	//
+	// Moving up starts at the end, moving down at the start, so nothing is overwritten before it is moved
+	//
+	for( done = 0L; done < count; done += n )
+	{
+		n = (int)(( count - done > blockrecords )? blockrecords : count - done);
+		src = ( to > from )? from + count - done - n : from + done;
+		if( !ReadAt( dbFile->fd, src * dbFile->sRecSz, buffer, n * dbFile->sRecSz ))
+			return FALSE;
+		if( !WriteAt( dbFile->fd, (src + to - from) * dbFile->sRecSz, buffer, n * dbFile->sRecSz ))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+//
+// Move count records from record from to record to in large blocks, the areas may overlap
+//
+static int MoveRecords( SDBFile *dbFile, long from, long to, long count )
+{
+	char* buffer;
+	long blockrecords;
+	int ret;
+
+	if( count <= 0L || from == to )
+		return TRUE;
+	if( !FlushCache( dbFile ))
+		return FALSE;
+	InvalidateCache( dbFile );
+	if( (buffer = AllocMoveBuffer( dbFile, count, &blockrecords )) == NULL )
+		return FALSE;
+	ret = CopyRecords( dbFile, from, to, count, buffer, blockrecords );
+	free( buffer );
+	return ret;
+}
+
+//
+// Cut the file after totalrecords records
+//
+static int TruncateRecords( SDBFile *dbFile, long totalrecords )
+{
+	if( !FlushCache( dbFile ))
+		return FALSE;
+	InvalidateCache( dbFile );
+	if( chsize( dbFile->fd, (long)(totalrecords * dbFile->sRecSz )) == -1 )
+	{
+		lErrorCode = DB_ERROR_CHANGE_SIZE;
+		return FALSE;
+	}
+	HeaderTruncate( dbFile, totalrecords );
+	dbFile->lTotalRecords = totalrecords;
+	if( dbFile->lCurrRecord >= totalrecords )
+		dbFile->lCurrRecord = totalrecords - 1L;
+	return TRUE;
+}
+
+int OpenDatabase( const char* filename, short recordsize, SDBFile *dbFile )
+{
+	long lfilesz;
+
+	if( IsFileOpen( dbFile ))
+	{
+		lErrorCode = DB_ERROR_ALREADY_OPEN;
+		return FALSE;
+	}
+
+	if( (lfilesz = fsize( (char*)filename )) == -1L )
+	{
+		lErrorCode = DB_ERROR_NOT_EXIST;
+		return FALSE;
+	}
+
+	if( (dbFile->fd = open( (char*)filename, O_RDWR | O_BINARY, 0x777 )) == -1 )
+	{
+		lErrorCode = DB_ERROR_OPEN;
+		return FALSE;
+	}
+	dbFile->bOpen = TRUE;
+	dbFile->pCache = NULL;
+	dbFile->pFence = NULL;
+	dbFile->pBloom = NULL;
+	dbFile->pHeader = NULL;
+	dbFile->pDelta = NULL;
+	dbFile->pSecondary = NULL;
+	dbFile->pAggregate = NULL;
+	dbFile->pCounter = NULL;
+	dbFile->pDictionary = NULL;
+	SetFileName( dbFile, filename );
+	dbFile->bMarkDeleted = FALSE;
+	if( lfilesz % recordsize)
+	{
+		lErrorCode = DB_ERROR_RECORD_SIZE;
+		CloseDatabase( dbFile );
+		return FALSE;
+	}
+	if( !CheckHeaderFile( filename, recordsize ))
+	{
+		CloseDatabase( dbFile );
+		lErrorCode = DB_ERROR_RECORD_SIZE;
+		return FALSE;
+	}
+	dbFile->sRecSz = recordsize;
+	dbFile->lCurrRecord = lfilesz?0:-1L;
+	dbFile->lTotalRecords = lfilesz / recordsize;
+
+	return TRUE;
+}
+
+
+int CreateDatabase( const char* filename, short recordsize, SDBFile *dbFile )
+{
+	static char headername[ DB_MAX_FNAME ];
+	char header[ HEADER_SIZE ];
+
+	if( IsFileOpen( dbFile ))
+	{
+		lErrorCode = DB_ERROR_ALREADY_OPEN;
+		return FALSE;
+	}
+
+	if( (dbFile->fd = open( (char*)filename, O_RDWR | O_BINARY | O_CREAT | O_TRUNC, 0x0 )) == -1 )
+	{
+		lErrorCode = DB_ERROR_OPEN;
+		return FALSE;
+	}
+	dbFile->bOpen = TRUE;
+	dbFile->pCache = NULL;
+	dbFile->pFence = NULL;
+	dbFile->pBloom = NULL;
+	dbFile->pHeader = NULL;
+	dbFile->pDelta = NULL;
+	dbFile->pSecondary = NULL;
+	dbFile->pAggregate = NULL;
+	dbFile->pCounter = NULL;
+	dbFile->pDictionary = NULL;
+	SetFileName( dbFile, filename );
+	dbFile->bMarkDeleted = FALSE;
+	dbFile->sRecSz = recordsize;
+	dbFile->lCurrRecord = 0L;
+	dbFile->lTotalRecords = 0L;
+	//
+	// A header file of an earlier database with this name does not fit anymore
+	//
+	if( ReadHeaderFile( filename, header ))
+	{
+		MakeFileName( filename, "hdr", headername );
+		remove( headername );
+	}
+
+	return TRUE;
+}
+
+
+//
+// Release everything attached to the database, without saving
+//
+static void FreeAttachments( SDBFile *dbFile )
+{
+	FreeCache( dbFile );
+	FreeFence( dbFile );
+	FreeBloom( dbFile );
+	FreeHeader( dbFile );
+	FreeDelta( dbFile );
+	FreeSecondary( dbFile );
+	FreeAggregate( dbFile );
+	FreeCounter( dbFile );
+	FreeDictionary( dbFile );
+}
+
+void CloseDatabase( SDBFile *dbFile )
+{
+	if( !IsFileOpen( dbFile ))
+		return;
+	//
+	// Write back the changed records, the Bloom filter, the header, the secondary indexes
+	// and the aggregates, release everything attached
+	//
+	FlushCache( dbFile );
+	SaveBloom( dbFile );
+	SaveHeader( dbFile );
+	SaveSecondary( dbFile );
+	SaveAggregate( dbFile );
+	FreeAttachments( dbFile );
+	//
+	// Close the open file handle
+	//
+	close( dbFile->fd );
+	dbFile->bOpen = FALSE;
+	dbFile->fd = -1;
+}
+
+
+long GetCurrentRecord( SDBFile *dbFile )
+{
+	if( !IsFileOpen( dbFile ) )
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return -1L;
+	}
+	if( dbFile->lTotalRecords == 0L )
+	{
+		lErrorCode = DB_ERROR_EMPTY;
+		return -1L;
+	}
+	return dbFile->lCurrRecord;
+}
+
+
+long GetTotalRecords( SDBFile *dbFile )
+{
+	if( !IsFileOpen( dbFile ) )
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return -1L;
+	}
+	return dbFile->lTotalRecords;
+}
+
+
+int GotoRecord( SDBFile *dbFile, long recordnumber )
+{
+	long totalrecords;
+	if( ( totalrecords = GetTotalRecords( dbFile )) == -1L )
+		return FALSE;
+
+	if( recordnumber < 0L || recordnumber >= totalrecords )
+	{
+		lErrorCode = DB_ERROR_INVALID_REC_NO;
+		return FALSE;
+	}
+
+	dbFile->lCurrRecord = recordnumber;
+
+	return TRUE;
+}
+
+
+int ReadCurrentRecord( SDBFile *dbFile, char* record )
+{
+	long curr;
+
+	if( (curr = GetCurrentRecord( dbFile )) == -1L )
+		return FALSE;
+
+	if( dbFile->pCache != NULL )
+		return CacheRead( dbFile, curr, record );
+
+	if( lseek( dbFile->fd, (long)(curr * dbFile->sRecSz), SEEK_SET ) == -1L)
+	{
+		lErrorCode = DB_ERROR_RECORD_JMP;
+		return FALSE;
+	}
+
+	if( read( dbFile->fd, record, dbFile->sRecSz ) != dbFile->sRecSz )
+	{
+		lErrorCode = DB_ERROR_READ_FILE;
+		record[0] = '\0';
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+//
+// Read record recno, when it is marked as deleted continue in direction step
+// until a record is found that is not deleted
+//
+static int ReadLiveRecord( SDBFile *dbFile, long recno, long step, char* record )
+{
+	long curr;
+
+	curr = dbFile->lCurrRecord;
+	for(;;)
+	{
+		if( !GotoRecord( dbFile, recno ))
+		{
+			dbFile->lCurrRecord = curr;
+			return FALSE;
+		}
+		if( !ReadCurrentRecord( dbFile, record ))
+			return FALSE;
+		if( !IsDeleted( dbFile, record ))
+			return TRUE;
+		recno += step;
+	}
+}
+
+int ReadFirstRecord( SDBFile *dbFile, char* record )
+{
+	if( !ReadLiveRecord( dbFile, 0L, 1L, record ))
+		return FALSE;
+	return TRUE;
+}
+
+
+int ReadLastRecord( SDBFile *dbFile, char* record )
+{
+	long lastrecord;
+	if( (lastrecord = GetTotalRecords( dbFile )) == -1L )
+		return FALSE;
+	if( !ReadLiveRecord( dbFile, lastrecord - 1L, -1L, record ))
+		return FALSE;
+	return TRUE;
+}
+
+
+int ReadPreviousRecord( SDBFile *dbFile, char* record )
+{
+	long curr;
+	if( (curr = GetCurrentRecord( dbFile )) == -1L )
+		return FALSE;
+	if( !ReadLiveRecord( dbFile, curr - 1L, -1L, record ))
+		return FALSE;
+	return TRUE;
+}
+
+
+int ReadNextRecord( SDBFile *dbFile, char* record )
+{
+	long curr;
+	if( (curr = GetCurrentRecord( dbFile )) == -1L )
+		return FALSE;
+	if( !ReadLiveRecord( dbFile, curr + 1L, 1L, record ))
+		return FALSE;
+	return TRUE;
+}
+
+
+//
+// Write the delete marker in one record
+//
+static int MarkDeleted( SDBFile *dbFile, long recordnumber )
+{
+	char* record;
+	int ret;
+
+	if( (record = (char*) malloc( dbFile->sRecSz )) == NULL )
+	{
+		lErrorCode = DB_ERROR_MEM;
+		return FALSE;
+	}
+	ret = FALSE;
+	if( GotoRecord( dbFile, recordnumber ) && ReadCurrentRecord( dbFile, record ))
+	{
+		ret = TRUE;
+		if( !IsDeleted( dbFile, record ))
+		{
+			record[ dbFile->sDelOffset ] = DB_DELETED_MARK;
+			ret = WriteRecord( dbFile, record, WRITE_OVER );
+			if( ret && dbFile->lDeletedRecords != -1L )
+				dbFile->lDeletedRecords++;
+		}
+	}
+	free( record );
+	return ret;
+}
+
+int DeleteRecord( SDBFile *dbFile, long recordnumber )
+{
+	return DeleteRecords( dbFile, recordnumber, 1L );
+}
+
+
+int DeleteRecords( SDBFile *dbFile, long first, long count )
+{
+	long totalrecords;
+
+	if( ( totalrecords = GetTotalRecords( dbFile )) == -1L )
+		return FALSE;
+	if( first < 0L || count < 1L || first + count > totalrecords )
+	{
+		lErrorCode = DB_ERROR_INVALID_REC_NO;
+		return FALSE;
+	}
+	if( dbFile->bMarkDeleted )
+	{
+		for( ; count > 0L; count--, first++ )
+			if( !MarkDeleted( dbFile, first ))
+				return FALSE;
+		return TRUE;
+	}
+
+	//
+	// The aggregates take off the records before they are overwritten by the move
+	//
+	HeaderDelete( dbFile, first, count );
+	AggregateDelete( dbFile, first, count, NULL );
+	if( !MoveRecords( dbFile, first + count, first, totalrecords - first - count ))
+		return FALSE;
+	FenceDelete( dbFile, first, count );
+	BloomDelete( dbFile );
+	SecondaryMoved( dbFile );
+	if( !TruncateRecords( dbFile, totalrecords - count ))
+		return FALSE;
+	dbFile->lCurrRecord = ( first < dbFile->lTotalRecords )? first : dbFile->lTotalRecords - 1L;
+	return TRUE;
+}
+
+
+int DeleteRecordSet( SDBFile *dbFile, long* recordnumbers, long count )
+{
+	char* buffer;
+	long totalrecords, i, j, next, keep, to, blockrecords;
+
+	if( ( totalrecords = GetTotalRecords( dbFile )) == -1L )
+		return FALSE;
+	if( count < 1L )
+		return TRUE;
+	for( i = 0L; i < count; i++ )
+	{
+		if( recordnumbers[ i ] < 0L || recordnumbers[ i ] >= totalrecords ||
+			( i > 0L && recordnumbers[ i ] < recordnumbers[ i - 1L ] ))
+		{
+			lErrorCode = DB_ERROR_INVALID_REC_NO;
+			return FALSE;
+		}
+	}
+	if( dbFile->bMarkDeleted )
+	{
+		for( i = 0L; i < count; i++ )
+			if( !MarkDeleted( dbFile, recordnumbers[ i ] ))
+				return FALSE;
+		return TRUE;
+	}
+
+	//
+	// The aggregates take off the records before they are overwritten, the blocks they read
+	// are dropped from the cache with the rest
+	//
+	if( !FlushCache( dbFile ))
+		return FALSE;
+	HeaderCompact( dbFile );
+	AggregateDelete( dbFile, 0L, count, recordnumbers );
+	InvalidateCache( dbFile );
+	DropFence( dbFile );
+	BloomDelete( dbFile );
+	SecondaryMoved( dbFile );
+	if( (buffer = AllocMoveBuffer( dbFile, totalrecords, &blockrecords )) == NULL )
+		return FALSE;
+
+	//
+	// Walk once through the file, every block of records between two deleted
+	// records is moved down to the end of the records kept so far
+	//
+	to = recordnumbers[ 0 ];
+	for( i = 0L; i < count; i++ )
+	{
+		if( i > 0L && recordnumbers[ i ] == recordnumbers[ i - 1L ] )
+			continue; // deleted twice
+		//
+		// The records up to the next deleted record are kept, skip the same record deleted twice
+		//
+		for( j = i + 1L; j < count && recordnumbers[ j ] == recordnumbers[ i ]; j++ )
+			;
+		next = ( j < count )? recordnumbers[ j ] : totalrecords;
+		keep = next - recordnumbers[ i ] - 1L;
+		if( keep > 0L )
+		{
+			if( !CopyRecords( dbFile, recordnumbers[ i ] + 1L, to, keep, buffer, blockrecords ))
+			{
+				free( buffer );
+				return FALSE;
+			}
+			to += keep;
+		}
+	}
+	free( buffer );
+
+	if( !TruncateRecords( dbFile, to ))
+		return FALSE;
+	dbFile->lCurrRecord = ( recordnumbers[ 0 ] < to )? recordnumbers[ 0 ] : to - 1L;
+	return TRUE;
+}
+
+
+int SetDeleteMarker( SDBFile *dbFile, short offset )
+{
+	if( !IsFileOpen( dbFile ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return FALSE;
+	}
+	if( offset >= dbFile->sRecSz )
+	{
+		lErrorCode = DB_ERROR_SORTLENGTH;
+		return FALSE;
+	}
+	dbFile->bMarkDeleted = ( offset >= 0 )? TRUE : FALSE;
+	dbFile->sDelOffset = offset;
+	dbFile->lDeletedRecords = -1L;
+	return TRUE;
+}
+
+
+int IsRecordDeleted( SDBFile *dbFile, char* record )
+{
+	return IsDeleted( dbFile, record );
+}
+
+
+//
+// Walk through the file in blocks and move all records that are not deleted to the front,
+// when bCompact is FALSE the deleted records are only counted
+//
+static long ScanDeletedRecords( SDBFile *dbFile, int bCompact )
+{
+	char* buffer;
+	char* rec;
+	long totalrecords, blockrecords, pos, to, deleted;
+	int n, i, live;
+
+	totalrecords = dbFile->lTotalRecords;
+	if( !FlushCache( dbFile ))
+		return -1L;
+	if( (buffer = AllocMoveBuffer( dbFile, totalrecords, &blockrecords )) == NULL )
+		return -1L;
+	if( bCompact )
+	{
+		InvalidateCache( dbFile );
+		DropFence( dbFile );
+		BloomDelete( dbFile );
+		HeaderCompact( dbFile );
+		SecondaryMoved( dbFile );
+		AggregateReorder( dbFile );	// only deleted records are removed
+	}
+
+	deleted = 0L;
+	to = 0L;
+	for( pos = 0L; pos < totalrecords; pos += n )
+	{
+		n = (int)(( totalrecords - pos > blockrecords )? blockrecords : totalrecords - pos);
+		if( !ReadAt( dbFile->fd, pos * dbFile->sRecSz, buffer, n * dbFile->sRecSz ))
+			break;
+		live = 0;
+		for( i = 0; i < n; i++ )
+		{
+			rec = buffer + i * dbFile->sRecSz;
+			if( IsDeleted( dbFile, rec ))
+				deleted++;
+			else
+			{
+				if( live != i )
+					memcpy( buffer + live * dbFile->sRecSz, rec, dbFile->sRecSz );
+				live++;
+			}
+		}
+		//
+		// Records are written behind the read position, so nothing is lost
+		//
+		if( bCompact && live && ( to != pos || live != n ))
+		{
+			if( !WriteAt( dbFile->fd, to * dbFile->sRecSz, buffer, live * dbFile->sRecSz ))
+				break;
+		}
+		to += live;
+	}
+	free( buffer );
+	if( pos < totalrecords )
+		return -1L;
+	if( bCompact && deleted && !TruncateRecords( dbFile, to ))
+		return -1L;
+	return deleted;
+}
+
+
+long GetDeletedRecords( SDBFile *dbFile )
+{
+	if( !IsFileOpen( dbFile ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return -1L;
+	}
+	if( !dbFile->bMarkDeleted )
+		return 0L;
+	if( dbFile->lDeletedRecords == -1L )
+		dbFile->lDeletedRecords = ScanDeletedRecords( dbFile, FALSE );
+	return dbFile->lDeletedRecords;
+}
+
+
+int CompactDatabase( SDBFile *dbFile )
+{
+	if( !IsFileOpen( dbFile ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return FALSE;
+	}
+	if( !dbFile->bMarkDeleted || dbFile->lDeletedRecords == 0L )
+		return TRUE;
+	if( ScanDeletedRecords( dbFile, TRUE ) == -1L )
+		return FALSE;
+	dbFile->lDeletedRecords = 0L;
+	if( dbFile->lCurrRecord < 0L && dbFile->lTotalRecords > 0L )
+		dbFile->lCurrRecord = 0L;
+	return TRUE;
+}
+
+
+int CompactWhenNeeded( SDBFile *dbFile, int percent )
+{
+	long deleted;
+
+	if( (deleted = GetDeletedRecords( dbFile )) == -1L )
+		return FALSE;
+	if( deleted == 0L || deleted * 100L < (long)percent * dbFile->lTotalRecords )
+		return TRUE;
+	return CompactDatabase( dbFile );
+}
+
+
+int WriteRecord( SDBFile *dbFile, char* record, int iFlag )
+{
+	long curr;
+
+	if( !IsFileOpen( dbFile ) )
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return FALSE;
+	}
+	record = CounterWrite( dbFile, record, iFlag );
+	if( iFlag == WRITE_OVER )
+	{
+		SecondaryOverwrite( dbFile );
+		AggregateOverwrite( dbFile );
+	}
+
+	if( dbFile->pCache != NULL )
+	{
+		if( iFlag == WRITE_OVER )
+		{
+			if( (curr = GetCurrentRecord( dbFile )) == -1L )
+				return FALSE;
+		}
+		else if( iFlag == WRITE_APPEND )
+			curr = dbFile->lTotalRecords;
+		else
+		{
+			lErrorCode = DB_ERROR_INVALID_WFLAG;
+			return FALSE;
+		}
+		if( !CacheWrite( dbFile, curr, record ))
+			return FALSE;
+	}
+	else if( iFlag == WRITE_OVER )
+	{
+		if( (curr = GetCurrentRecord( dbFile )) == -1L )
+			return FALSE;
+		//
+		// Jump to the position to overwrite the record
+		//
+		if( lseek( dbFile->fd, (long)(dbFile->sRecSz * curr), SEEK_SET ) == -1L)
+		{
+			lErrorCode = DB_ERROR_RECORD_JMP;
+			return FALSE;
+		}
+	}
+	else if( iFlag == WRITE_APPEND )
+	{
+		if( lseek( dbFile->fd, 0L, SEEK_END ) == -1L )
+		{
+			lErrorCode = DB_ERROR_RECORD_JMP;
+			return FALSE;
+		}
+	}
+	else
+	{
+		lErrorCode = DB_ERROR_INVALID_WFLAG;
+		return FALSE;
+	}
+
+	if( dbFile->pCache == NULL && write( dbFile->fd, record, dbFile->sRecSz ) != dbFile->sRecSz )
+	{
+		lErrorCode = DB_ERROR_WRITE_FILE;
+		return FALSE;
+	}
+
+	if( iFlag == WRITE_APPEND )
+	{
+		dbFile->lTotalRecords++;
+		curr = dbFile->lTotalRecords - 1L;
+		GotoRecord( dbFile, curr );
+	}
+	HeaderWrite( dbFile, curr, record );
+	DeltaWrite( dbFile, curr, record );
+	SecondaryWrite( dbFile, curr, record );
+	AggregateWrite( dbFile, record, iFlag == WRITE_APPEND );
+	FenceWrite( dbFile, curr, record, iFlag == WRITE_APPEND );
+	BloomWrite( dbFile, record );
+
+	return TRUE;
+}
+
+//
+// Insert record as record number recno, the records from recno on are moved one record up
+//
+static int InsertRecordAt( SDBFile *dbFile, char* record, long recno )
+{
+	long totalrecords;
+
+	totalrecords = dbFile->lTotalRecords;
+	if( recno == totalrecords )
+		return WriteRecord( dbFile, record, WRITE_APPEND );
+
+	//
+	// Make room by moving the tail one record up
+	//
+	if( !MoveRecords( dbFile, recno, recno + 1L, totalrecords - recno ))
+		return FALSE;
+	dbFile->lTotalRecords++;
+	FenceInsert( dbFile, recno, record );
+	HeaderInsert( dbFile, recno );
+	SecondaryMoved( dbFile );
+	AggregateInsert( dbFile, recno );
+	CounterInsert( dbFile, recno );
+	if( !GotoRecord( dbFile, recno ))
+		return FALSE;
+	return WriteRecord( dbFile, record, WRITE_OVER );
+}
+
+int InsertRecordSorted( SDBFile *dbFile, char* record, short offset, short keysize )
+{
+	char* temp;
+	long min, max, current, totalrecords;
+
+	if( ( totalrecords = GetTotalRecords( dbFile )) == -1L )
+		return FALSE;
+
+	if( dbFile->sRecSz < (keysize+offset) )
+	{
+		lErrorCode = DB_ERROR_SORTLENGTH;
+		return FALSE;
+	}
+
+	if( (temp = (char*) malloc( dbFile->sRecSz )) == NULL )
+	{
+		lErrorCode = DB_ERROR_MEM;
+		return FALSE;
+	}
+
+	//
+	// Find the first sorted record with a larger key
+	//
+	min = 0L;
+	max = HeaderSortedRecords( dbFile, offset, keysize );
+	FenceRange( dbFile, record + offset, keysize, offset, TRUE, &min, &max );
+	while( min < max )
+	{
+		current = ((max - min) >> 1) + min;
+		if( !GotoRecord( dbFile, current ) || !ReadCurrentRecord( dbFile, temp ))
+		{
+			free( temp );
+			return FALSE;
+		}
+		if( memcmp( record + offset, temp + offset, keysize ) < 0 )
+			max = current;
+		else
+			min = current + 1L;
+	}
+	free( temp );
+
+	return InsertRecordAt( dbFile, record, min );
+}
+
+// ++++++++++++++++++++++++++++++++++++++
+// Sorting database functions
+// ++++++++++++++++++++++++++++++++++++++
+
+//
+// Sort key used by the qsort() compare function
+//
+static short sSortOffset;
+static short sSortSize;
+
+static int CompareRecords( const void *rec1, const void *rec2 )
+{
+	return memcmp( (const char*)rec1 + sSortOffset, (const char*)rec2 + sSortOffset, sSortSize );
+}
+
+//
+// Load the complete database in one buffer, returns NULL when there is not enough memory
+// or the file could not be read
+//
+static char* LoadAllRecords( SDBFile *dbFile, long totalrecords )
+{
+	char* buffer;
+	long size;
+
+	size = totalrecords * dbFile->sRecSz;
+	if( (long)coreleft() < size + DB_MEM_RESERVE || (buffer = (char*) malloc( (unsigned int)size )) == NULL )
+	{
+		lErrorCode = DB_ERROR_MEM;
+		return NULL;
+	}
+	if( !FlushCache( dbFile ) || !ReadAt( dbFile->fd, 0L, buffer, (int)size ))
+	{
+		free( buffer );
+		return NULL;
+	}
+	return buffer;
+}
+
+//
+// Write a buffer loaded with LoadAllRecords back to the file in one sequential pass
+//
+static int StoreAllRecords( SDBFile *dbFile, char* buffer, long totalrecords )
+{
+	long size;
+
+	size = totalrecords * dbFile->sRecSz;
+	InvalidateCache( dbFile );
+	return WriteAt( dbFile->fd, 0L, buffer, (int)size );
+}
+
+//
+// Sort the complete database in memory.
+// Fails with DB_ERROR_MEM when the database does not fit, the caller then sorts on file
+//
+static int SortInMemory( SDBFile *dbFile, long totalrecords, short offset, short checksize )
+{
+	char* buffer;
+	int ret;
+
+	if( totalrecords < 2L )
+		return TRUE;
+	if( (buffer = LoadAllRecords( dbFile, totalrecords )) == NULL )
+		return FALSE;
+	sSortOffset = offset;
+	sSortSize = checksize;
+	qsort( buffer, (size_t)totalrecords, dbFile->sRecSz, CompareRecords );
+	ret = StoreAllRecords( dbFile, buffer, totalrecords );
+	free( buffer );
+	return ret;
+}
+
+//
+// Insertion sort is a very fast sorting method for almost sorted databases
+//
+int InsertionSort( SDBFile *dbFile, short offset, short checksize )
+{
+	long i, j;
+	long totalrecords;
+	char* temp1;
+	char* temp2;
+
+	if( ( totalrecords = GetTotalRecords( dbFile )) == -1L )
+		return FALSE;
+	DropFence( dbFile );	// the records are reordered
+	HeaderReorder( dbFile );
+	AggregateReorder( dbFile );
+	SecondaryMoved( dbFile );
+
+	if( dbFile->sRecSz < (checksize+offset) )
+	{
+		lErrorCode = DB_ERROR_SORTLENGTH;
+		return FALSE;
+	}
+
+	lErrorCode = DB_ERROR_MEM;
+	if( (temp1 = (char*) malloc( (unsigned int)dbFile->sRecSz)) == NULL )
+		goto Clean1;
+
+	if( (temp2 = (char*) malloc( (unsigned int)dbFile->sRecSz)) == NULL )
+		goto Clean2;
+	lErrorCode = DB_OK;
+	AggregateHold( dbFile, TRUE );
+	SecondaryHold( dbFile, TRUE );
+	CounterHold( dbFile, TRUE );
+	for( i = 1L; i < totalrecords; i++ )
+	{
+		if( !GotoRecord( dbFile, i ))
+			goto CleanAll;
+		if( !ReadCurrentRecord( dbFile, temp1 ))
+			goto CleanAll;
+		j = i;
+		while( j > 0L )
+		{
+			if( !GotoRecord( dbFile, (j-1L) ))
+				goto CleanAll;
+			if( !ReadCurrentRecord( dbFile, temp2 ))
+				goto CleanAll;
+
+			if( memcmp( temp1+offset, temp2+offset, checksize) > 0 )
+				break;
+
+			if( !GotoRecord( dbFile, j ))
+				goto CleanAll;
+			if( !WriteRecord( dbFile, temp2, WRITE_OVER ))
+				goto CleanAll;
+			j--;
+		}
+		if( !GotoRecord( dbFile, j ))
+			goto CleanAll;
+		if( !WriteRecord( dbFile, temp1, WRITE_OVER ))
+			goto CleanAll;
+	}
+
+CleanAll:
+	free( temp2 );
+Clean2:
+	free( temp1 );
+Clean1:
+	AggregateHold( dbFile, FALSE );
+	SecondaryHold( dbFile, FALSE );
+	CounterHold( dbFile, FALSE );
+	if( GetDBErrorCode() != DB_OK )
+		return FALSE;
+	return TRUE;
+}
+
+
+//
+// Heap sort helper function
+//
+static int downheap( SDBFile *dbFile, long max_records, long k, short offset, short checksize, char* tmp1, char* tmp2, char* tmp3 )
+{
+	long j, N2;
+
+	if( !GotoRecord( dbFile, (k-1L)))
+		return FALSE;
+	if( !ReadCurrentRecord( dbFile, tmp1 ))
+		return FALSE;
+
+	N2 = max_records >> 1;
+	while( k <= N2)
+	{
+		j = k + k;
+
+		if( !GotoRecord( dbFile, (j-1L)))
+			return FALSE;
+		if( !ReadCurrentRecord( dbFile, tmp2 ))
+			return FALSE;
+
+		if( j < max_records )
+		{
+			if( !GotoRecord( dbFile, j))
+				return FALSE;
+			if( !ReadCurrentRecord( dbFile, tmp3 ))
+				return FALSE;
+
+			if( memcmp( tmp2 + offset, tmp3 + offset, checksize ) < 0 )
+			{
+				memmove( tmp2, tmp3, dbFile->sRecSz );
+				j++;
+			}
+		}
+		if( !GotoRecord( dbFile, k-1L))
+			return FALSE;
+
+		if( memcmp( tmp1+offset, tmp2+offset, checksize ) >= 0 )
+			break;
+
+		if( !WriteRecord( dbFile, tmp2, WRITE_OVER ))
+			return FALSE;
+		k = j;
+	}
+	if( !GotoRecord( dbFile, k-1L))
+		return FALSE;
+
+	if( !WriteRecord( dbFile, tmp1, WRITE_OVER ))
+			return FALSE;
+
+	return TRUE;
+}
+
+//
+// Heap sort works best on databases that have not been sorted at all
+//
+int HeapSort( SDBFile *dbFile, short offset, short checksize )
+{
+	long totalrecords;
+	long k, N;
+	char* temp1;
+	char* temp2;
+	char* temp3;
+
+	if( ( totalrecords = GetTotalRecords( dbFile )) == -1L )
+		return FALSE;
+	DropFence( dbFile );	// the records are reordered
+	HeaderReorder( dbFile );
+	AggregateReorder( dbFile );
+	SecondaryMoved( dbFile );
+
+	if( dbFile->sRecSz < (checksize+offset) )
+	{
+		lErrorCode = DB_ERROR_SORTLENGTH;
+		return FALSE;
+	}
+
+	//
+	// Sort in memory when possible, otherwise fall back to sorting on file
+	//
+	if( SortInMemory( dbFile, totalrecords, offset, checksize ))
+		return TRUE;
+	if( GetDBErrorCode() != DB_ERROR_MEM )
+		return FALSE;
+
+	lErrorCode = DB_ERROR_MEM;
+	if( (temp1 = (char*) malloc( dbFile->sRecSz)) == NULL )
+		goto Clean1;
+
+	if( (temp2 = (char*) malloc( dbFile->sRecSz)) == NULL )
+		goto Clean2;
+
+	if( (temp3 = (char*) malloc( dbFile->sRecSz)) == NULL )
+		goto Clean3;
+	lErrorCode = DB_OK;
+	AggregateHold( dbFile, TRUE );
+	SecondaryHold( dbFile, TRUE );
+	CounterHold( dbFile, TRUE );
+	N = totalrecords;
+	for( k = N >> 1; k >= 1; k-- )
+		if( !downheap( dbFile, totalrecords, k, offset, checksize, temp1, temp2, temp3 ))
+			goto CleanAll;
+	while( N > 1 )
+	{
+		// swap the records in the database
+		if( !ReadFirstRecord( dbFile, temp1 ))
+			goto CleanAll;
+		if( !GotoRecord( dbFile, (N-1L) ))
+			goto CleanAll;
+		if( !ReadCurrentRecord( dbFile, temp2 ))
+			goto CleanAll;
+		if( !WriteRecord( dbFile, temp1, WRITE_OVER ))
+			goto CleanAll;
+		if( !GotoRecord( dbFile, 0L ))
+			goto CleanAll;
+		if( !WriteRecord( dbFile, temp2, WRITE_OVER ))
+			goto CleanAll;
+		N--;
+		if( !downheap( dbFile, N, 1, offset, checksize, temp1, temp2, temp3 ))
+			goto CleanAll;
+	}
+CleanAll:
+	free( temp3 );
+Clean3:
+	free( temp2 );
+Clean2:
+	free( temp1 );
+Clean1:
+	AggregateHold( dbFile, FALSE );
+	SecondaryHold( dbFile, FALSE );
+	CounterHold( dbFile, FALSE );
+	if( GetDBErrorCode() != DB_OK )
+		return FALSE;
+	return TRUE;
+}
+
+//
+// Very fast sort function faster then heapsort but uses more resources
+//
+int QuickSort( SDBFile *dbFile, short offset, short checksize )
+{
+	long totalrecords;
+	char* temp1;
+	char* temp2;
+	char* temp3;
+	long  l,r,s,i,j;
+	long* stackl;
+	long* stackr;
+	long n1;
+	int  n2;
+
+	if( ( totalrecords = GetTotalRecords( dbFile )) == -1L )
+		return FALSE;
+	DropFence( dbFile );	// the records are reordered
+	HeaderReorder( dbFile );
+	AggregateReorder( dbFile );
+	SecondaryMoved( dbFile );
+
+	if( dbFile->sRecSz < (checksize+offset) )
+	{
+		lErrorCode = DB_ERROR_SORTLENGTH;
+		return FALSE;
+	}
+	//
+	// Sort in memory when possible, otherwise fall back to sorting on file
+	//
+	if( SortInMemory( dbFile, totalrecords, offset, checksize ))
+		return TRUE;
+	if( GetDBErrorCode() != DB_ERROR_MEM )
+		return FALSE;
+
+	lErrorCode = DB_ERROR_MEM;
+	if( (temp1 = (char*) malloc( dbFile->sRecSz)) == NULL )
+		goto Clean1;
+
+	if( (temp2 = (char*) malloc( dbFile->sRecSz)) == NULL )
+		goto Clean2;
+
+	if( (temp3 = (char*) malloc( dbFile->sRecSz)) == NULL )
+		goto Clean3;
+	//
+	// Calculate size for stack
+	//
+	n2 = 1;
+	n1 = totalrecords;
+	while( (n1 /= 10) != 0 )
+		n2++;
+	n2 *= 4;
+	n2 += 10;
+
+	if( (stackl = (long*) malloc( (n2 * sizeof(long)))) == NULL )
+		goto Clean4;
+
+	if( (stackr = (long*) malloc( (n2 * sizeof(long)))) == NULL )
+		goto Clean5;
+	lErrorCode = DB_OK;
+	AggregateHold( dbFile, TRUE );
+	SecondaryHold( dbFile, TRUE );
+	CounterHold( dbFile, TRUE );
+
+	s = 1;
+	stackl[ s ] = 0L;
+	stackr[ s ] = totalrecords - 1L;
+	do
+	{
+		l = stackl[ s ];
+		r = stackr[ s ];
+		s--;
+		do
+		{
+			i = l;
+			j = r;
+			if( !GotoRecord( dbFile, ((l+r)>>1) ))
+				goto CleanAll;
+			if( !ReadCurrentRecord( dbFile, temp1 ))
+				goto CleanAll;
+
+
+			do
+			{
+				if( !GotoRecord( dbFile, i ))
+					goto CleanAll;
+				if( !ReadCurrentRecord( dbFile, temp2 ))
+					goto CleanAll;
+				while( memcmp( temp2 + offset, temp1 + offset, checksize ) < 0 )
+				{
+					i++;
+					if( !GotoRecord( dbFile, i ))
+						goto CleanAll;
+					if( !ReadCurrentRecord( dbFile, temp2 ))
+						goto CleanAll;
+				}
+
+				if( !GotoRecord( dbFile, j ))
+					goto CleanAll;
+				if( !ReadCurrentRecord( dbFile, temp3 ))
+					goto CleanAll;
+				while( memcmp( temp3 + offset, temp1 + offset, checksize ) > 0 )
+				{
+					j--;
+					if( !GotoRecord( dbFile, j ))
+						goto CleanAll;
+					if( !ReadCurrentRecord( dbFile, temp3 ))
+						goto CleanAll;
+				}
+
+				if( i <= j  )
+				{
+					if( !WriteRecord( dbFile, temp2, WRITE_OVER ))
+						goto CleanAll;
+
+					if( !GotoRecord( dbFile, i ))
+						goto CleanAll;
+					if( !WriteRecord( dbFile, temp3, WRITE_OVER ))
+						goto CleanAll;
+					i++;
+					j--;
+				}
+			} while( i <= j  );
+			if( i < r )
+			{
+				s++;
+				stackl[ s ] = i;
+				stackr[ s ] = r;
+			}
+			r = j;
+		} while( l < r );
+	} while( s > 0L );
+
+CleanAll:
+	free( stackr );
+Clean5:
+	free( stackl );
+Clean4:
+	free( temp3 );
+Clean3:
+	free( temp2 );
+Clean2:
+	free( temp1 );
+Clean1:
+	AggregateHold( dbFile, FALSE );
+	SecondaryHold( dbFile, FALSE );
+	CounterHold( dbFile, FALSE );
+	if( GetDBErrorCode() != DB_OK )
+		return FALSE;
+	return TRUE;
+}
+
+
+// ++++++++++++++++++++++++++++++++++++++
+// External sorting
+// ++++++++++++++++++++++++++++++++++++++
+
+//
+// One input run of a merge pass
+//
+typedef struct
+{
+	long	lNext;				// next record number to read from file
+	long	lEnd;				// record number after the last record of the run
+	char*	pBuffer;			// records read from the run
+	short	sPos;				// current record in the buffer
+	short	sCount;				// amount of records in the buffer
+}SMergeRun;
+
+static int FillMergeRun( SDBFile *dbFile, int fd, SMergeRun *pRun, short blockrecords )
+{
+	long count;
+
+	count = pRun->lEnd - pRun->lNext;
+	if( count > blockrecords )
+		count = blockrecords;
+	pRun->sPos = 0;
+	pRun->sCount = (short)count;
+	if( count == 0L )
+		return TRUE;
+	if( !ReadAt( fd, pRun->lNext * dbFile->sRecSz, pRun->pBuffer, (int)(count * dbFile->sRecSz) ))
+		return FALSE;
+	pRun->lNext += count;
+	return TRUE;
+}
+
+//
+// Merge every group of ways runs of runlength records from src into one run in dst
+//
+static int MergePass( SDBFile *dbFile, int src, int dst, long totalrecords, long runlength, int ways,
+					  short blockrecords, char* memory, short offset, short checksize )
+{
+	SMergeRun run[ DB_MERGE_WAYS ];
+	char* output;
+	char* best;
+	long start, outpos;
+	int i, n, ibest, outcount;
+	short recsz;
+
+	recsz = dbFile->sRecSz;
+	output = memory + ways * blockrecords * recsz;
+	outpos = 0L;
+	outcount = 0;
+	for( start = 0L; start < totalrecords; start += runlength * ways )
+	{
+		for( n = 0; n < ways && start + n * runlength < totalrecords; n++ )
+		{
+			run[ n ].pBuffer = memory + n * blockrecords * recsz;
+			run[ n ].lNext = start + n * runlength;
+			run[ n ].lEnd = run[ n ].lNext + runlength;
+			if( run[ n ].lEnd > totalrecords )
+				run[ n ].lEnd = totalrecords;
+			if( !FillMergeRun( dbFile, src, &run[ n ], blockrecords ))
+				return FALSE;
+		}
+		for(;;)
+		{
+			//
+			// Take the lowest record, on equal keys the earlier run goes first
+			//
+			ibest = -1;
+			best = NULL;
+			for( i = 0; i < n; i++ )
+			{
+				if( run[ i ].sPos >= run[ i ].sCount )
+					continue;
+				if( best == NULL || memcmp( run[ i ].pBuffer + run[ i ].sPos * recsz + offset, best + offset, checksize ) < 0 )
+				{
+					ibest = i;
+					best = run[ i ].pBuffer + run[ i ].sPos * recsz;
+				}
+			}
+			if( best == NULL )
+				break;
+			memcpy( output + outcount * recsz, best, recsz );
+			if( ++outcount == blockrecords )
+			{
+				if( !WriteAt( dst, outpos * recsz, output, outcount * recsz ))
+					return FALSE;
+				outpos += outcount;
+				outcount = 0;
+			}
+			if( ++run[ ibest ].sPos == run[ ibest ].sCount && !FillMergeRun( dbFile, src, &run[ ibest ], blockrecords ))
+				return FALSE;
+		}
+	}
+	if( outcount && !WriteAt( dst, outpos * recsz, output, outcount * recsz ))
+		return FALSE;
+	return TRUE;
+}
+
+//
+// Replace the database file by the (closed) file tempname and open it again
+//
+static int ReplaceDatabaseFile( SDBFile *dbFile, const char* tempname )
+{
+	static char backup[ DB_MAX_FNAME ];
+	char* buffer;
+	long size, pos;
+	int fd, n;
+
+	close( dbFile->fd );
+	dbFile->fd = -1;
+	MakeFileName( dbFile->szFileName, "bak", backup );
+	remove( backup );
+	if( rename( dbFile->szFileName, backup ) == 0 )
+	{
+		if( rename( tempname, dbFile->szFileName ) == 0 )
+			remove( backup );
+		else
+			rename( backup, dbFile->szFileName );
+	}
+	//
+	// Without rename support copy the new contents over the original file
+	//
+	if( fsize( (char*)tempname ) != -1L )
+	{
+		size = fsize( (char*)tempname );
+		if( (buffer = (char*) malloc( DB_MERGE_WAYS * dbFile->sRecSz )) == NULL )
+			lErrorCode = DB_ERROR_MEM;
+		else if( (fd = open( (char*)tempname, O_RDWR | O_BINARY, 0x777 )) == -1 )
+			lErrorCode = DB_ERROR_OPEN;
+		else
+		{
+			if( (dbFile->fd = open( dbFile->szFileName, O_RDWR | O_BINARY, 0x777 )) != -1 )
+			{
+				for( pos = 0L; pos < size; pos += n )
+				{
+					n = ( size - pos > DB_MERGE_WAYS * dbFile->sRecSz )? DB_MERGE_WAYS * dbFile->sRecSz : (int)(size - pos);
+					if( !ReadAt( fd, pos, buffer, n ) || !WriteAt( dbFile->fd, pos, buffer, n ))
+						break;
+				}
+				close( dbFile->fd );
+			}
+			else
+				lErrorCode = DB_ERROR_OPEN;
+			close( fd );
+			//
+			// The new contents are kept in tempname when they could not be copied
+			//
+			if( GetDBErrorCode() == DB_OK )
+				remove( tempname );
+		}
+		free( buffer );
+	}
+	if( (dbFile->fd = open( dbFile->szFileName, O_RDWR | O_BINARY, 0x777 )) == -1 )
+	{
+		lErrorCode = DB_ERROR_OPEN;
+		FreeAttachments( dbFile );
+		dbFile->bOpen = FALSE;
+		return FALSE;
+	}
+	return GetDBErrorCode() == DB_OK;
+}
+
+int ExternalSort( SDBFile *dbFile, short offset, short checksize )
+{
+	static char tempname1[ DB_MAX_FNAME ];
+	static char tempname2[ DB_MAX_FNAME ];
+	long totalrecords, budget, runlength, pos, count;
+	char* memory;
+	char* result;
+	int fd1, fd2, fd, ways;
+	short blockrecords;
+
+	if( ( totalrecords = GetTotalRecords( dbFile )) == -1L )
+		return FALSE;
+	DropFence( dbFile );	// the records are reordered
+	HeaderReorder( dbFile );
+	AggregateReorder( dbFile );
+	SecondaryMoved( dbFile );
+
+	if( dbFile->sRecSz < (checksize+offset) )
+	{
+		lErrorCode = DB_ERROR_SORTLENGTH;
+		return FALSE;
+	}
+	//
+	// Everything fits, no need for runs
+	//
+	if( SortInMemory( dbFile, totalrecords, offset, checksize ))
+		return TRUE;
+	if( GetDBErrorCode() != DB_ERROR_MEM )
+		return FALSE;
+
+	//
+	// Use all memory the OS can miss for the runs
+	//
+	lErrorCode = DB_ERROR_MEM;
+	budget = (long)coreleft() - DB_MEM_RESERVE;
+	runlength = budget / dbFile->sRecSz;
+	if( runlength > 0x7FFFL )
+		runlength = 0x7FFFL;
+	if( runlength < (DB_MERGE_WAYS + 1) || (memory = (char*) malloc( (unsigned int)(runlength * dbFile->sRecSz) )) == NULL )
+		return FALSE;
+	lErrorCode = DB_OK;
+
+	if( !FlushCache( dbFile ))
+	{
+		free( memory );
+		return FALSE;
+	}
+	InvalidateCache( dbFile );
+
+	MakeFileName( dbFile->szFileName, "tm1", tempname1 );
+	MakeFileName( dbFile->szFileName, "tm2", tempname2 );
+	result = tempname1;
+	fd1 = open( tempname1, O_RDWR | O_BINARY | O_CREAT | O_TRUNC, 0x0 );
+	fd2 = open( tempname2, O_RDWR | O_BINARY | O_CREAT | O_TRUNC, 0x0 );
+	if( fd1 == -1 || fd2 == -1 )
+	{
+		lErrorCode = DB_ERROR_CREATE;
+		goto CleanAll;
+	}
+
+	//
+	// Make the sorted runs
+	//
+	sSortOffset = offset;
+	sSortSize = checksize;
+	for( pos = 0L; pos < totalrecords; pos += count )
+	{
+		count = totalrecords - pos;
+		if( count > runlength )
+			count = runlength;
+		if( !ReadAt( dbFile->fd, pos * dbFile->sRecSz, memory, (int)(count * dbFile->sRecSz) ))
+			goto CleanAll;
+		qsort( memory, (size_t)count, dbFile->sRecSz, CompareRecords );
+		if( !WriteAt( fd1, pos * dbFile->sRecSz, memory, (int)(count * dbFile->sRecSz) ))
+			goto CleanAll;
+	}
+
+	//
+	// Merge the runs, ways input buffers and one output buffer share the memory
+	//
+	ways = (int)((totalrecords + runlength - 1L) / runlength);
+	if( ways > DB_MERGE_WAYS )
+		ways = DB_MERGE_WAYS;
+	blockrecords = (short)(runlength / (ways + 1));
+	while( runlength < totalrecords )
+	{
+		if( !MergePass( dbFile, fd1, fd2, totalrecords, runlength, ways, blockrecords, memory, offset, checksize ))
+			goto CleanAll;
+		runlength *= ways;
+		fd = fd1;
+		fd1 = fd2;
+		fd2 = fd;
+		result = (result == tempname1)? tempname2 : tempname1;
+	}
+
+CleanAll:
+	free( memory );
+	if( fd1 != -1 )
+		close( fd1 );
+	if( fd2 != -1 )
+		close( fd2 );
+	//
+	// The sorted result is in the last destination file, it is kept when the database could not be replaced
+	//
+	if( GetDBErrorCode() == DB_OK && !ReplaceDatabaseFile( dbFile, result ))
+		remove( (result == tempname1)? tempname2 : tempname1 );
+	else
+	{
+		remove( tempname1 );
+		remove( tempname2 );
+	}
+	if( GetDBErrorCode() != DB_OK )
+		return FALSE;
+	return TRUE;
+}
+
+
+// ++++++++++++++++++++++++++++++++++++++
+// Radix sorting
+// ++++++++++++++++++++++++++++++++++++++
+
+#define DB_RADIX			256		// one bucket for every character value
+#define DB_RADIX_KEYSZ		4		// SortDatabase() sorts longer keys on file with ExternalSort()
+
+//
+// Output bucket of one distribution pass on file, the DB_RADIX buckets are at the start of the
+// memory of RadixSort() so they only use memory while sorting
+//
+typedef struct
+{
+	long	lNext;				// next record number in the destination file
+	short	sFill;				// amount of records in the bucket buffer
+	char*	pBuffer;			// records of the bucket not written yet
+}SRadixBucket;
+
+//
+// Count the characters of every key position in count records,
+// counts holds DB_RADIX counters for every key position
+//
+static void CountKeyCharacters( long* counts, char* records, int count, short recsz, short offset, short checksize )
+{
+	int r, k;
+	unsigned char* key;
+
+	for( r = 0; r < count; r++ )
+	{
+		key = (unsigned char*)records + r * recsz + offset;
+		for( k = 0; k < checksize; k++ )
+			counts[ k * DB_RADIX + key[ k ] ]++;
+	}
+}
+
+//
+// Returns TRUE when all records have the same character on this key position,
+// the pass can be skipped then
+//
+static int SingleBucket( long* counts, long totalrecords )
+{
+	int c;
+
+	for( c = 0; c < DB_RADIX; c++ )
+		if( counts[ c ] != 0L )
+			return counts[ c ] == totalrecords;
+	return TRUE;
+}
+
+//
+// Radix sort with all records in memory, one pass from src to dst for every key position
+//
+static int RadixSortInMemory( SDBFile *dbFile, long totalrecords, long* counts, short offset, short checksize )
+{
+	long start[ DB_RADIX ];
+	char* src;
+	char* dst;
+	char* swap;
+	char* record;
+	long r, total;
+	int k, c, ret;
+	short recsz;
+
+	recsz = dbFile->sRecSz;
+	if( (src = LoadAllRecords( dbFile, totalrecords )) == NULL )
+		return FALSE;
+	if( (dst = (char*) malloc( (unsigned int)(totalrecords * recsz) )) == NULL )
+	{
+		free( src );
+		lErrorCode = DB_ERROR_MEM;
+		return FALSE;
+	}
+	CountKeyCharacters( counts, src, (int)totalrecords, recsz, offset, checksize );
+	//
+	// From the last key character to the first, every pass keeps the order of the previous one
+	//
+	for( k = checksize - 1; k >= 0; k-- )
+	{
+		if( SingleBucket( counts + k * DB_RADIX, totalrecords ))
+			continue;
+		for( c = 0, total = 0L; c < DB_RADIX; c++ )
+		{
+			start[ c ] = total;
+			total += counts[ k * DB_RADIX + c ];
+		}
+		for( r = 0L; r < totalrecords; r++ )
+		{
+			record = src + r * recsz;
+			memcpy( dst + start[ (unsigned char)record[ offset + k ] ]++ * recsz, record, recsz );
+		}
+		swap = src;
+		src = dst;
+		dst = swap;
+	}
+	ret = StoreAllRecords( dbFile, src, totalrecords );
+	free( dst );
+	free( src );
+	return ret;
+}
+
+//
+// Write the records in the buffer of bucket c to its place in the destination file
+//
+static int FlushBucket( int fd, SRadixBucket *pBucket, short recsz )
+{
+	if( pBucket->sFill == 0 )
+		return TRUE;
+	if( !WriteAt( fd, pBucket->lNext * recsz, pBucket->pBuffer, pBucket->sFill * recsz ))
+		return FALSE;
+	pBucket->lNext += pBucket->sFill;
+	pBucket->sFill = 0;
+	return TRUE;
+}
+
+//
+// Distribute the records of src over the buckets of key position k in dst.
+// Every bucket is a sequential stream in dst starting at the records of the lower buckets.
+//
+static int DistributePass( SDBFile *dbFile, int src, int dst, long totalrecords, long* counts, int k,
+						   SRadixBucket *buckets, char* memory, long memrecords, short offset )
+{
+	char* input;
+	char* record;
+	long pos, total;
+	int c, used, n, r;
+	short recsz, blockrecords;
+
+	recsz = dbFile->sRecSz;
+	for( c = 0, used = 0; c < DB_RADIX; c++ )
+		if( counts[ c ] != 0L )
+			used++;
+	//
+	// The memory is shared by the input buffer and the buffers of the used buckets
+	//
+	if( memrecords / (used + 1) > 0x7FFFL )
+		blockrecords = 0x7FFF;
+	else if( (blockrecords = (short)(memrecords / (used + 1))) == 0 )
+	{
+		lErrorCode = DB_ERROR_MEM;
+		return FALSE;
+	}
+	input = memory;
+	for( c = 0, total = 0L, n = 1; c < DB_RADIX; c++ )
+	{
+		buckets[ c ].lNext = total;
+		buckets[ c ].sFill = 0;
+		buckets[ c ].pBuffer = NULL;
+		if( counts[ c ] != 0L )
+			buckets[ c ].pBuffer = memory + (long)(n++) * blockrecords * recsz;
+		total += counts[ c ];
+	}
+	for( pos = 0L; pos < totalrecords; pos += n )
+	{
+		n = ( totalrecords - pos > blockrecords )? blockrecords : (int)(totalrecords - pos);
+		if( !ReadAt( src, pos * recsz, input, n * recsz ))
+			return FALSE;
+		for( r = 0; r < n; r++ )
+		{
+			record = input + r * recsz;
+			c = (unsigned char)record[ offset + k ];
+			memcpy( buckets[ c ].pBuffer + buckets[ c ].sFill * recsz, record, recsz );
+			if( ++buckets[ c ].sFill == blockrecords && !FlushBucket( dst, buckets + c, recsz ))
+				return FALSE;
+		}
+	}
+	for( c = 0; c < DB_RADIX; c++ )
+		if( !FlushBucket( dst, buckets + c, recsz ))
+			return FALSE;
+	return TRUE;
+}
+
+int RadixSort( SDBFile *dbFile, short offset, short checksize )
+{
+	static char tempname1[ DB_MAX_FNAME ];
+	static char tempname2[ DB_MAX_FNAME ];
+	long* counts;
+	long totalrecords, budget, memrecords, pos;
+	SRadixBucket *buckets;
+	char* memory;
+	char* records;
+	char* result;
+	int fd1, fd2, src, dst, k, n;
+	short blockrecords;
+
+	if( ( totalrecords = GetTotalRecords( dbFile )) == -1L )
+		return FALSE;
+	if( dbFile->sRecSz < (checksize+offset) )
+	{
+		lErrorCode = DB_ERROR_SORTLENGTH;
+		return FALSE;
+	}
+	if( totalrecords < 2L || checksize <= 0 )
+		return TRUE;
+
+	if( (counts = (long*) calloc( checksize * DB_RADIX, sizeof( long ))) == NULL )
+	{
+		lErrorCode = DB_ERROR_MEM;
+		return FALSE;
+	}
+	//
+	// Everything fits twice, sort in memory
+	//
+	if( (long)coreleft() >= 2L * totalrecords * dbFile->sRecSz + DB_MEM_RESERVE )
+	{
+		DropFence( dbFile );	// the records are reordered
+		HeaderReorder( dbFile );
+		AggregateReorder( dbFile );
+		SecondaryMoved( dbFile );
+		if( RadixSortInMemory( dbFile, totalrecords, counts, offset, checksize ))
+		{
+			free( counts );
+			return TRUE;
+		}
+		if( GetDBErrorCode() != DB_ERROR_MEM )
+		{
+			free( counts );
+			return FALSE;
+		}
+		memset( counts, 0, checksize * DB_RADIX * sizeof( long ));
+		lErrorCode = DB_OK;
+	}
+
+	//
+	// Use all memory the OS can miss for the buckets, the input and the bucket buffers
+	//
+	lErrorCode = DB_ERROR_MEM;
+	budget = (long)coreleft() - DB_MEM_RESERVE - DB_RADIX * (long)sizeof( SRadixBucket );
+	memrecords = budget / dbFile->sRecSz;
+	if( memrecords > 0x7FFFL )
+		memrecords = 0x7FFFL;
+	if( memrecords < 2L ||
+		(memory = (char*) malloc( (unsigned int)(DB_RADIX * sizeof( SRadixBucket ) + memrecords * dbFile->sRecSz) )) == NULL )
+	{
+		free( counts );
+		return FALSE;
+	}
+	buckets = (SRadixBucket*) memory;
+	records = memory + DB_RADIX * sizeof( SRadixBucket );
+	lErrorCode = DB_OK;
+
+	if( !FlushCache( dbFile ))
+	{
+		free( memory );
+		free( counts );
+		return FALSE;
+	}
+	InvalidateCache( dbFile );
+
+	MakeFileName( dbFile->szFileName, "tm1", tempname1 );
+	MakeFileName( dbFile->szFileName, "tm2", tempname2 );
+	result = NULL;
+	fd1 = open( tempname1, O_RDWR | O_BINARY | O_CREAT | O_TRUNC, 0x0 );
+	fd2 = open( tempname2, O_RDWR | O_BINARY | O_CREAT | O_TRUNC, 0x0 );
+	if( fd1 == -1 || fd2 == -1 )
+	{
+		lErrorCode = DB_ERROR_CREATE;
+		goto CleanAll;
+	}
+
+	//
+	// One sequential pass to count the characters of all key positions
+	//
+	blockrecords = (short)memrecords;
+	for( pos = 0L; pos < totalrecords; pos += n )
+	{
+		n = ( totalrecords - pos > blockrecords )? blockrecords : (int)(totalrecords - pos);
+		if( !ReadAt( dbFile->fd, pos * dbFile->sRecSz, records, n * dbFile->sRecSz ))
+			goto CleanAll;
+		CountKeyCharacters( counts, records, n, dbFile->sRecSz, offset, checksize );
+	}
+
+	//
+	// One distribution pass for every key position from the last to the first,
+	// the first pass reads the database, the others read the previous temporary file
+	//
+	src = dbFile->fd;
+	dst = fd1;
+	for( k = checksize - 1; k >= 0; k-- )
+	{
+		if( SingleBucket( counts + k * DB_RADIX, totalrecords ))
+			continue;
+		if( !DistributePass( dbFile, src, dst, totalrecords, counts + k * DB_RADIX, k, buckets, records, memrecords, offset ))
+			goto CleanAll;
+		result = (dst == fd1)? tempname1 : tempname2;
+		src = dst;
+		dst = (dst == fd1)? fd2 : fd1;
+	}
+
+CleanAll:
+	free( memory );
+	free( counts );
+	if( fd1 != -1 )
+		close( fd1 );
+	if( fd2 != -1 )
+		close( fd2 );
+	//
+	// The sorted result is in the last destination file, no result when all keys were equal.
+	// It is kept when the database could not be replaced.
+	//
+	if( GetDBErrorCode() == DB_OK && result != NULL )
+	{
+		DropFence( dbFile );	// the records are reordered
+		HeaderReorder( dbFile );
+		AggregateReorder( dbFile );
+		SecondaryMoved( dbFile );
+	}
+	if( GetDBErrorCode() == DB_OK && result != NULL && !ReplaceDatabaseFile( dbFile, result ))
+		remove( (result == tempname1)? tempname2 : tempname1 );
+	else
+	{
+		remove( tempname1 );
+		remove( tempname2 );
+	}
+	if( GetDBErrorCode() != DB_OK )
+		return FALSE;
+	return TRUE;
+}
+
+
+// ++++++++++++++++++++++++++++++++++++++
+// Tag sorting
+// ++++++++++++++++++++++++++++++++++++++
+
+#define DB_TAG_RECNO		4		// record number after the key in a tag, see PutLong()
+
+int TagSort( SDBFile *dbFile, short offset, short checksize )
+{
+	static char tempname[ DB_MAX_FNAME ];
+	char* tags;
+	char* tag;
+	char* buffer;
+	long totalrecords, blockrecords, pos, i;
+	int fd, n, r, fill;
+	short tagsize;
+
+	if( ( totalrecords = GetTotalRecords( dbFile )) == -1L )
+		return FALSE;
+	DropFence( dbFile );	// the records are reordered
+	HeaderReorder( dbFile );
+	AggregateReorder( dbFile );
+	SecondaryMoved( dbFile );
+
+	if( dbFile->sRecSz < (checksize+offset) )
+	{
+		lErrorCode = DB_ERROR_SORTLENGTH;
+		return FALSE;
+	}
+	if( totalrecords < 2L )
+		return TRUE;
+
+	//
+	// A tag is the key followed by the record number, the big endian record number
+	// makes equal keys keep their order when the tags are compared with memcmp
+	//
+	tagsize = checksize + DB_TAG_RECNO;
+	if( (long)coreleft() < totalrecords * tagsize + DB_MEM_RESERVE ||
+		(tags = (char*) malloc( (unsigned int)(totalrecords * tagsize) )) == NULL )
+	{
+		lErrorCode = DB_ERROR_MEM;
+		return FALSE;
+	}
+	if( (buffer = AllocMoveBuffer( dbFile, totalrecords, &blockrecords )) == NULL )
+	{
+		free( tags );
+		return FALSE;
+	}
+	if( !FlushCache( dbFile ))
+		goto Clean1;
+	InvalidateCache( dbFile );
+
+	//
+	// Collect the tags in one sequential pass
+	//
+	for( pos = 0L; pos < totalrecords; pos += n )
+	{
+		n = (int)(( totalrecords - pos > blockrecords )? blockrecords : totalrecords - pos);
+		if( !ReadAt( dbFile->fd, pos * dbFile->sRecSz, buffer, n * dbFile->sRecSz ))
+			goto Clean1;
+		for( r = 0; r < n; r++ )
+		{
+			tag = tags + (pos + r) * tagsize;
+			memcpy( tag, buffer + r * dbFile->sRecSz + offset, checksize );
+			PutLong( tag + checksize, pos + r );
+		}
+	}
+	sSortOffset = 0;
+	sSortSize = tagsize;
+	qsort( tags, (size_t)totalrecords, tagsize, CompareRecords );
+
+	//
+	// Nothing to do when the database was sorted already
+	//
+	for( i = 0L; i < totalrecords; i++ )
+		if( GetLong( tags + i * tagsize + checksize ) != i )
+			break;
+	if( i == totalrecords )
+		goto Clean1;
+
+	//
+	// Write the records in the order of the tags to a new file
+	//
+	MakeFileName( dbFile->szFileName, "tm1", tempname );
+	if( (fd = open( tempname, O_RDWR | O_BINARY | O_CREAT | O_TRUNC, 0x0 )) == -1 )
+	{
+		lErrorCode = DB_ERROR_CREATE;
+		goto Clean1;
+	}
+	fill = 0;
+	for( i = 0L; i < totalrecords; i++ )
+	{
+		if( !ReadAt( dbFile->fd, GetLong( tags + i * tagsize + checksize ) * dbFile->sRecSz, buffer + fill * dbFile->sRecSz, dbFile->sRecSz ))
+			break;
+		if( ++fill == blockrecords || i == totalrecords - 1L )
+		{
+			if( !WriteAt( fd, (i + 1L - fill) * dbFile->sRecSz, buffer, fill * dbFile->sRecSz ))
+				break;
+			fill = 0;
+		}
+	}
+	close( fd );
+	//
+	// tempname is kept when the database could not be replaced
+	//
+	if( GetDBErrorCode() != DB_OK || ReplaceDatabaseFile( dbFile, tempname ))
+		remove( tempname );
+
+Clean1:
+	free( buffer );
+	free( tags );
+	if( GetDBErrorCode() != DB_OK )
+		return FALSE;
+	return TRUE;
+}
+
+
+// ++++++++++++++++++++++++++++++++++++++
+// Adaptive sorting
+// ++++++++++++++++++++++++++++++++++++++
+
+//
+// Buffered sequential output file of MergeLongestRun
+//
+typedef struct
+{
+	int		fd;
+	char*	pBuffer;
+	long	lBlock;				// size of the buffer in records
+	long	lFill;				// records in the buffer
+	long	lPos;				// record number in the file of the first record in the buffer
+}SSortOutput;
+
+static int FlushSortOutput( SSortOutput *pOut, short recsz )
+{
+	if( pOut->lFill == 0L )
+		return TRUE;
+	if( !WriteAt( pOut->fd, pOut->lPos * recsz, pOut->pBuffer, (int)(pOut->lFill * recsz) ))
+		return FALSE;
+	pOut->lPos += pOut->lFill;
+	pOut->lFill = 0L;
+	return TRUE;
+}
+
+//
+// Copy count records starting at record from of file fd to the output
+//
+static int CopyToSortOutput( SSortOutput *pOut, int fd, long from, long count, short recsz )
+{
+	long n;
+
+	while( count > 0L )
+	{
+		n = pOut->lBlock - pOut->lFill;
+		if( n > count )
+			n = count;
+		if( !ReadAt( fd, from * recsz, pOut->pBuffer + pOut->lFill * recsz, (int)(n * recsz) ))
+			return FALSE;
+		pOut->lFill += n;
+		from += n;
+		count -= n;
+		if( pOut->lFill == pOut->lBlock && !FlushSortOutput( pOut, recsz ))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+//
+// Find the longest ascending run of records in one sequential pass
+//
+static int FindLongestRun( SDBFile *dbFile, long totalrecords, short offset, short checksize, long *runstart, long *runlength )
+{
+	char* buffer;
+	char* previous;
+	char* record;
+	long blockrecords, pos, start;
+	int n, r;
+
+	*runstart = 0L;
+	*runlength = 0L;
+	if( (previous = (char*) malloc( checksize )) == NULL )
+	{
+		lErrorCode = DB_ERROR_MEM;
+		return FALSE;
+	}
+	if( (buffer = AllocMoveBuffer( dbFile, totalrecords, &blockrecords )) == NULL )
+	{
+		free( previous );
+		return FALSE;
+	}
+	start = 0L;
+	for( pos = 0L; pos < totalrecords; pos += n )
+	{
+		n = (int)(( totalrecords - pos > blockrecords )? blockrecords : totalrecords - pos);
+		if( !ReadAt( dbFile->fd, pos * dbFile->sRecSz, buffer, n * dbFile->sRecSz ))
+			break;
+		for( r = 0; r < n; r++ )
+		{
+			record = buffer + r * dbFile->sRecSz + offset;
+			if( pos + r > 0L && memcmp( previous, record, checksize ) > 0 )
+			{
+				if( pos + r - start > *runlength )
+				{
+					*runstart = start;
+					*runlength = pos + r - start;
+				}
+				start = pos + r;
+			}
+			memcpy( previous, record, checksize );
+		}
+	}
+	if( totalrecords - start > *runlength )
+	{
+		*runstart = start;
+		*runlength = totalrecords - start;
+	}
+	free( buffer );
+	free( previous );
+	return GetDBErrorCode() == DB_OK;
+}
+
+//
+// Find the first record from record from on in the run ending at end with a key greater
+// then key. Probes from + 1, 3, 7, 15 .. records further and a binary search in the last step.
+// Returns the record number, -1L on error
+//
+static long GallopRun( SDBFile *dbFile, char* key, char* probe, long from, long end, short offset, short checksize )
+{
+	long low, high, bound, current;
+
+	low = from;
+	high = from;
+	bound = 1L;
+	while( high < end )
+	{
+		if( !ReadAt( dbFile->fd, high * dbFile->sRecSz + offset, probe, checksize ))
+			return -1L;
+		if( memcmp( key, probe, checksize ) < 0 )
+			break;
+		low = high + 1L;
+		high = from + bound;
+		bound = ( bound << 1 ) + 1L;
+	}
+	if( high > end )
+		high = end;
+	while( low < high )
+	{
+		current = ((high - low) >> 1) + low;
+		if( !ReadAt( dbFile->fd, current * dbFile->sRecSz + offset, probe, checksize ))
+			return -1L;
+		if( memcmp( key, probe, checksize ) < 0 )
+			high = current;
+		else
+			low = current + 1L;
+	}
+	return low;
+}
+
+//
+// Load all records outside the longest run, sort them in memory and merge them with the run
+// into a new file. The run is copied in blocks, the place of every loaded record in the run is
+// found by galloping, so the cost is one pass over the file when only a few records are loaded.
+// Fails with DB_ERROR_MEM when the records outside the run do not fit in memory.
+//
+static int MergeLongestRun( SDBFile *dbFile, long totalrecords, long runstart, long runlength, short offset, short checksize )
+{
+	static char tempname[ DB_MAX_FNAME ];
+	SSortOutput out;
+	char* rest;
+	char* probe;
+	char* record;
+	long restrecords, runpos, next, i;
+	short recsz;
+
+	recsz = dbFile->sRecSz;
+	restrecords = totalrecords - runlength;
+	lErrorCode = DB_ERROR_MEM;
+	if( (long)coreleft() < restrecords * recsz + DB_MOVE_BUFSZ + DB_MEM_RESERVE ||
+		(rest = (char*) malloc( (unsigned int)(restrecords * recsz) )) == NULL )
+		return FALSE;
+	if( (probe = (char*) malloc( checksize )) == NULL )
+	{
+		free( rest );
+		return FALSE;
+	}
+	lErrorCode = DB_OK;
+	if( (out.pBuffer = AllocMoveBuffer( dbFile, totalrecords, &out.lBlock )) == NULL )
+		goto Clean1;
+	out.lFill = 0L;
+	out.lPos = 0L;
+
+	//
+	// The records before and after the run
+	//
+	if( !ReadAt( dbFile->fd, 0L, rest, (int)(runstart * recsz) ) ||
+		!ReadAt( dbFile->fd, (runstart + runlength) * recsz, rest + runstart * recsz,
+				 (int)((totalrecords - runstart - runlength) * recsz) ))
+		goto Clean2;
+	sSortOffset = offset;
+	sSortSize = checksize;
+	qsort( rest, (size_t)restrecords, recsz, CompareRecords );
+
+	MakeFileName( dbFile->szFileName, "tm1", tempname );
+	if( (out.fd = open( tempname, O_RDWR | O_BINARY | O_CREAT | O_TRUNC, 0x0 )) == -1 )
+	{
+		lErrorCode = DB_ERROR_CREATE;
+		goto Clean2;
+	}
+	runpos = runstart;
+	for( i = 0L; i < restrecords; i++ )
+	{
+		record = rest + i * recsz;
+		//
+		// Copy the records of the run with a key up to the key of this record
+		//
+		if( (next = GallopRun( dbFile, record + offset, probe, runpos, runstart + runlength, offset, checksize )) == -1L )
+			break;
+		if( !CopyToSortOutput( &out, dbFile->fd, runpos, next - runpos, recsz ))
+			break;
+		runpos = next;
+		memcpy( out.pBuffer + out.lFill * recsz, record, recsz );
+		if( ++out.lFill == out.lBlock && !FlushSortOutput( &out, recsz ))
+			break;
+	}
+	if( GetDBErrorCode() == DB_OK )
+	{
+		CopyToSortOutput( &out, dbFile->fd, runpos, runstart + runlength - runpos, recsz );
+		FlushSortOutput( &out, recsz );
+	}
+	close( out.fd );
+	//
+	// tempname is kept when the database could not be replaced
+	//
+	if( GetDBErrorCode() != DB_OK || ReplaceDatabaseFile( dbFile, tempname ))
+		remove( tempname );
+
+Clean2:
+	free( out.pBuffer );
+Clean1:
+	free( probe );
+	free( rest );
+	return GetDBErrorCode() == DB_OK;
+}
+
+int SortDatabase( SDBFile *dbFile, short offset, short checksize )
+{
+	long totalrecords, memory, runstart, runlength;
+	int ret;
+
+	if( ( totalrecords = GetTotalRecords( dbFile )) == -1L )
+		return FALSE;
+	if( dbFile->sRecSz < (checksize+offset) )
+	{
+		lErrorCode = DB_ERROR_SORTLENGTH;
+		return FALSE;
+	}
+	//
+	// The header knows the database did not change since it was sorted
+	//
+	if( totalrecords < 2L || ( dbFile->pHeader != NULL && HeaderSortedRecords( dbFile, offset, checksize ) == totalrecords ))
+		return TRUE;
+
+	//
+	// A sorted database is one run, a sorted database with some records added has
+	// one long run. Only the records outside that run have to be sorted then.
+	//
+	if( !FlushCache( dbFile ) || !FindLongestRun( dbFile, totalrecords, offset, checksize, &runstart, &runlength ))
+		return FALSE;
+	if( runlength == totalrecords )
+	{
+		HeaderSetSorted( dbFile, offset, checksize );
+		AggregateReorder( dbFile );
+		return TRUE;
+	}
+	ret = FALSE;
+	if( runlength > totalrecords / 2L )
+	{
+		DropFence( dbFile );	// the records are reordered
+		HeaderReorder( dbFile );
+		AggregateReorder( dbFile );
+		SecondaryMoved( dbFile );
+		InvalidateCache( dbFile );
+		ret = MergeLongestRun( dbFile, totalrecords, runstart, runlength, offset, checksize );
+		if( !ret && GetDBErrorCode() != DB_ERROR_MEM )
+			return FALSE;
+		lErrorCode = DB_OK;
+	}
+
+	if( !ret )
+	{
+		memory = (long)coreleft() - DB_MEM_RESERVE;
+		//
+		// The records fit in memory
+		//
+		if( totalrecords * dbFile->sRecSz <= memory )
+			ret = QuickSort( dbFile, offset, checksize );
+		else
+		{
+			//
+			// Only the keys fit in memory
+			//
+			if( totalrecords * (checksize + DB_TAG_RECNO) + DB_MOVE_BUFSZ <= memory )
+			{
+				ret = TagSort( dbFile, offset, checksize );
+				if( !ret && GetDBErrorCode() != DB_ERROR_MEM )
+					return FALSE;
+				lErrorCode = DB_OK;
+			}
+			//
+			// A short key is sorted with a distribution pass per key position, a long key
+			// with merge passes. Without memory for the buckets the merge passes are used.
+			//
+			if( !ret && checksize <= DB_RADIX_KEYSZ )
+			{
+				ret = RadixSort( dbFile, offset, checksize );
+				if( !ret && GetDBErrorCode() != DB_ERROR_MEM )
+					return FALSE;
+				lErrorCode = DB_OK;
+			}
+			if( !ret )
+				ret = ExternalSort( dbFile, offset, checksize );
+		}
+	}
+	if( ret )
+	{
+		HeaderSetSorted( dbFile, offset, checksize );
+		AggregateReorder( dbFile );
+	}
+	return ret;
+}
+
+
+// ++++++++++++++++++++++++++++++++++++++
+// Searching database function
+// ++++++++++++++++++++++++++++++++++++++
+
+//
+// Amount of records read by the last search, see GetSearchProbes()
+//
+static long lSearchProbes;
+
+//
+// Read record recno for a search
+//
+static int ProbeRecord( SDBFile *dbFile, long recno, char* record )
+{
+	lSearchProbes++;
+	if( !GotoRecord( dbFile, recno ))
+		return FALSE;
+	return ReadCurrentRecord( dbFile, record );
+}
+
+
+//
+// The binary search found a deleted record with the search key, look at the records
+// with the same key around it for one that is not deleted
+//
+static long FindLiveDuplicate( SDBFile *dbFile, char* record, char* searchkey, int checksize, int offset, long current )
+{
+	long recno, step;
+
+	for( step = -1L; step <= 1L; step += 2L )
+	{
+		for( recno = current + step; recno >= 0L && recno < dbFile->lTotalRecords; recno += step )
+		{
+			if( !ProbeRecord( dbFile, recno, record ))
+				return -1L;
+			if( memcmp( searchkey, record + offset, checksize ) != 0 )
+				break;
+			if( !IsDeleted( dbFile, record ))
+				return recno;
+		}
+	}
+	lErrorCode = DB_ERROR_NOT_FOUND;
+	record[0] = '\0';
+	return -1L;
+}
+
+//
+// Search the keys of the delta log for searchkey, newest first.
+// Returns FALSE when there is no delta log for the key, found is -1L when the key is not in the delta.
+//
+static int DeltaSearch( SDBFile *dbFile, char* record, char* searchkey, int checksize, int offset, long* found )
+{
+	struct SDBDelta *pDelta;
+	long i;
+
+	*found = -1L;
+	if( (pDelta = dbFile->pDelta) == NULL || pDelta->sOffset != offset || checksize > pDelta->sKeySz || !DeltaUpToDate( dbFile ))
+		return FALSE;
+	for( i = pDelta->lCount - 1L; i >= 0L; i-- )
+	{
+		if( memcmp( pDelta->pKeys + i * pDelta->sKeySz, searchkey, checksize ) != 0 )
+			continue;
+		if( !ProbeRecord( dbFile, pDelta->lBase + i, record ))
+			return TRUE;
+		if( !IsDeleted( dbFile, record ))
+		{
+			*found = pDelta->lBase + i;
+			return TRUE;
+		}
+	}
+	return TRUE;
+}
+
+long BinarySearch( SDBFile *dbFile, char* record, char* searchkey, int checksize, int offset )
+{
+	int test;
+	long min, max, current, sorted;
+
+	lSearchProbes = 0L;
+	if( (max = GetTotalRecords( dbFile ) - 1L) == -2L )
+		return -1L;
+	if( !BloomMayContain( dbFile, searchkey, checksize, offset ))
+	{
+		lErrorCode = DB_ERROR_NOT_FOUND;
+		record[0] = '\0';
+		return -1L;
+	}
+	min = 0L;
+	//
+	// Records added after the last sort are looked up in the delta log first,
+	// without delta log they are searched one by one after the sorted records
+	//
+	if( (sorted = HeaderSortedRecords( dbFile, offset, checksize )) <= max )
+	{
+		max = sorted - 1L;
+		if( DeltaSearch( dbFile, record, searchkey, checksize, offset, &current ))
+		{
+			if( current != -1L || GetDBErrorCode() != DB_OK )
+				return current;
+			sorted = dbFile->lTotalRecords;
+		}
+	}
+	FenceRange( dbFile, searchkey, checksize, offset, FALSE, &min, &max );
+	while( min <= max )
+	{
+		current = ((max - min) >> 1) + min;
+		if( !ProbeRecord( dbFile, current, record ))
+			return -1L;
+
+		if( (test = memcmp( searchkey, record + offset, checksize )) == 0 )
+		{
+			if( !IsDeleted( dbFile, record ))
+				return current; // found the searchstring
+			return FindLiveDuplicate( dbFile, record, searchkey, checksize, offset, current );
+		}
+
+		if( test < 0 )
+			max = current - 1L;
+		else
+			min = current + 1L;
+	}
+	for( current = sorted; current < dbFile->lTotalRecords; current++ )
+	{
+		if( !ProbeRecord( dbFile, current, record ))
+			return -1L;
+		if( memcmp( searchkey, record + offset, checksize ) == 0 && !IsDeleted( dbFile, record ))
+			return current;
+	}
+	lErrorCode = DB_ERROR_NOT_FOUND;
+	record[0] = '\0';
+	return -1L;
+}
+
+long UpsertRecord( SDBFile *dbFile, char* searchkey, char* record, short offset, short keysize, int* existed )
+{
+	char* temp;
+	int bDelta, bMayExist;
+	long min, max, current, sorted, totalrecords, found, scan;
+
+	*existed = FALSE;
+	lSearchProbes = 0L;
+	if( (totalrecords = GetTotalRecords( dbFile )) == -1L )
+		return -1L;
+
+	if( dbFile->sRecSz < (keysize+offset) )
+	{
+		lErrorCode = DB_ERROR_SORTLENGTH;
+		return -1L;
+	}
+
+	if( (temp = (char*) malloc( dbFile->sRecSz )) == NULL )
+	{
+		lErrorCode = DB_ERROR_MEM;
+		return -1L;
+	}
+
+	//
+	// With a delta log on the key new records are appended and merged later,
+	// without one they are inserted at the lower bound of the key in the sorted records
+	//
+	bDelta = ( dbFile->pDelta != NULL && dbFile->pDelta->sOffset == offset && keysize <= dbFile->pDelta->sKeySz );
+	bMayExist = BloomMayContain( dbFile, searchkey, keysize, offset );
+	sorted = HeaderSortedRecords( dbFile, offset, keysize );
+	found = -1L;
+	scan = totalrecords;
+	min = totalrecords;
+	if( bMayExist && sorted < totalrecords )
+	{
+		if( bDelta && DeltaSearch( dbFile, temp, searchkey, keysize, offset, &found ))
+		{
+			if( found == -1L && GetDBErrorCode() != DB_OK )
+			{
+				free( temp );
+				return -1L;
+			}
+		}
+		else
+			scan = sorted;
+	}
+	if( found == -1L && ( bMayExist || !bDelta ))
+	{
+		min = 0L;
+		max = sorted;
+		FenceRange( dbFile, searchkey, keysize, offset, FALSE, &min, &max );
+		while( min < max )
+		{
+			current = ((max - min) >> 1) + min;
+			if( !ProbeRecord( dbFile, current, temp ))
+			{
+				free( temp );
+				return -1L;
+			}
+			if( memcmp( searchkey, temp + offset, keysize ) > 0 )
+				min = current + 1L;
+			else
+				max = current;
+		}
+		if( bMayExist && min < sorted )
+		{
+			if( !ProbeRecord( dbFile, min, temp ))
+			{
+				free( temp );
+				return -1L;
+			}
+			if( memcmp( searchkey, temp + offset, keysize ) == 0 )
+			{
+				if( !IsDeleted( dbFile, temp ))
+					found = min;
+				else if( (found = FindLiveDuplicate( dbFile, temp, searchkey, keysize, offset, min )) == -1L &&
+						 GetDBErrorCode() != DB_ERROR_NOT_FOUND )
+				{
+					free( temp );
+					return -1L;
+				}
+			}
+		}
+		if( bDelta )
+			min = totalrecords;
+	}
+	for( ; found == -1L && scan < totalrecords; scan++ )
+	{
+		if( !ProbeRecord( dbFile, scan, temp ))
+		{
+			free( temp );
+			return -1L;
+		}
+		if( memcmp( searchkey, temp + offset, keysize ) == 0 && !IsDeleted( dbFile, temp ))
+			found = scan;
+	}
+	free( temp );
+
+	if( found != -1L )
+	{
+		*existed = TRUE;
+		if( !GotoRecord( dbFile, found ) || !WriteRecord( dbFile, record, WRITE_OVER ))
+			return -1L;
+		return found;
+	}
+	if( !InsertRecordAt( dbFile, record, min ))
+		return -1L;
+	return min;
+}
+
+long LineairSearch( SDBFile *dbFile, char* record, char* searchkey, int checksize, int offset )
+{
+	long totalrecords, i;
+	lSearchProbes = 0L;
+	if( (totalrecords = GetTotalRecords( dbFile )) == -1L )
+		return -1L;
+	if( !BloomMayContain( dbFile, searchkey, checksize, offset ))
+	{
+		lErrorCode = DB_ERROR_NOT_FOUND;
+		record[0] = '\0';
+		return -1L;
+	}
+	for( i = 0L; i < totalrecords; i++ )
+	{
+		if( !ProbeRecord( dbFile, i, record ))
+			return -1L;
+		if( memcmp( searchkey, record + offset, checksize ) == 0 && !IsDeleted( dbFile, record ))
+			return i;
+	}
+	lErrorCode = DB_ERROR_NOT_FOUND;
+	record[0] = '\0';
+	return -1L;
+}
+
+//
+// Maximum amount of interpolation probes before KeySearch continues with a binary search
+//
+#define DB_INTERPOLATE_PROBES	6
+
+//
+// TRUE when the key only holds digits and spaces
+//
+static int IsNumericKey( char* key, int checksize )
+{
+	while( checksize-- > 0 )
+	{
+		if( *key != ' ' && ( *key < '0' || *key > '9' ))
+			return FALSE;
+		key++;
+	}
+	return TRUE;
+}
+
+//
+// Value of a key for interpolation, never in another order then memcmp() of the keys.
+// Every character is a decimal digit where a space (and anything lower) counts as 0
+// and anything higher then '9' as 9. Only the first 9 characters are used.
+//
+static double KeyValue( char* key, int checksize )
+{
+	double value;
+	int i, digit;
+
+	value = 0.0;
+	for( i = 0; i < 9; i++ )
+	{
+		digit = 0;
+		if( i < checksize )
+		{
+			if( key[ i ] > '9' )
+				digit = 9;
+			else if( key[ i ] >= '0' )
+				digit = key[ i ] - '0';
+		}
+		value = value * 10.0 + digit;
+	}
+	return value;
+}
+
+long KeySearch( SDBFile *dbFile, char* record, char* searchkey, int checksize, int offset, int mode )
+{
+	double value, lowvalue, highvalue;
+	long min, max, current;
+	int probes, test;
+
+	if( mode == DB_SEARCH_BINARY || ( mode == DB_SEARCH_AUTO && !IsNumericKey( searchkey, checksize )))
+		return BinarySearch( dbFile, record, searchkey, checksize, offset );
+	//
+	// The fences in memory already narrow the search down to a few records
+	//
+	if( dbFile->pFence != NULL && dbFile->pFence->sOffset == offset && checksize <= dbFile->pFence->sKeySz )
+		return BinarySearch( dbFile, record, searchkey, checksize, offset );
+	//
+	// BinarySearch also searches the records added after the last sort
+	//
+	if( IsFileOpen( dbFile ) && HeaderSortedRecords( dbFile, offset, checksize ) < dbFile->lTotalRecords )
+		return BinarySearch( dbFile, record, searchkey, checksize, offset );
+
+	lSearchProbes = 0L;
+	if( (max = GetTotalRecords( dbFile ) - 1L) == -2L )
+		return -1L;
+	if( dbFile->sRecSz < (checksize+offset) )
+	{
+		lErrorCode = DB_ERROR_SORTLENGTH;
+		return -1L;
+	}
+	if( !BloomMayContain( dbFile, searchkey, checksize, offset ) || max == -1L )
+		goto NotFound;
+
+	//
+	// The first and last record give the values at both ends
+	//
+	min = 0L;
+	if( !ProbeRecord( dbFile, min, record ))
+		return -1L;
+	if( (test = memcmp( searchkey, record + offset, checksize )) <= 0 )
+	{
+		current = min;
+		goto Compared;
+	}
+	lowvalue = KeyValue( record + offset, checksize );
+	if( !ProbeRecord( dbFile, max, record ))
+		return -1L;
+	if( (test = memcmp( searchkey, record + offset, checksize )) >= 0 )
+	{
+		current = max;
+		goto Compared;
+	}
+	highvalue = KeyValue( record + offset, checksize );
+	min++;
+	max--;
+
+	//
+	// The key is between min - 1 and max + 1, guess its place from the values
+	//
+	value = KeyValue( searchkey, checksize );
+	for( probes = 0; probes < DB_INTERPOLATE_PROBES && min <= max && highvalue > lowvalue; probes++ )
+	{
+		current = min + (long)((value - lowvalue) * (double)(max - min) / (highvalue - lowvalue));
+		if( current < min )
+			current = min;
+		if( current > max )
+			current = max;
+		if( !ProbeRecord( dbFile, current, record ))
+			return -1L;
+		if( (test = memcmp( searchkey, record + offset, checksize )) == 0 )
+			goto Compared;
+		if( test < 0 )
+		{
+			max = current - 1L;
+			highvalue = KeyValue( record + offset, checksize );
+		}
+		else
+		{
+			min = current + 1L;
+			lowvalue = KeyValue( record + offset, checksize );
+		}
+	}
+
+	//
+	// Not found in a few guesses, the keys are not evenly spread here
+	//
+	while( min <= max )
+	{
+		current = ((max - min) >> 1) + min;
+		if( !ProbeRecord( dbFile, current, record ))
+			return -1L;
+		if( (test = memcmp( searchkey, record + offset, checksize )) == 0 )
+			break;
+		if( test < 0 )
+			max = current - 1L;
+		else
+			min = current + 1L;
+	}
+	if( min > max )
+		goto NotFound;
+
+Compared:
+	if( test == 0 )
+	{
+		if( !IsDeleted( dbFile, record ))
+			return current;
+		return FindLiveDuplicate( dbFile, record, searchkey, checksize, offset, current );
+	}
+NotFound:
+	lErrorCode = DB_ERROR_NOT_FOUND;
+	record[0] = '\0';
+	return -1L;
+}
+
+long GetSearchProbes( void )
+{
+	return lSearchProbes;
+}
+
+//
+// qsort compare function for the pointers to the keys of BinarySearchMany
+//
+static int CompareKeyPointers( const void *key1, const void *key2 )
+{
+	return memcmp( *(char**)key1, *(char**)key2, sSortSize );
+}
+
+//
+// Walk once through all records in blocks and compare them with the sorted keys
+//
+static int MergeSearch( SDBFile *dbFile, char** sorted, long count, char* keys, short offset, short keysize, long* results )
+{
+	char* buffer;
+	char* record;
+	long totalrecords, blockrecords, pos, i;
+	int n, r, test;
+
+	totalrecords = dbFile->lTotalRecords;
+	if( !FlushCache( dbFile ))
+		return FALSE;
+	if( (buffer = AllocMoveBuffer( dbFile, totalrecords, &blockrecords )) == NULL )
+		return FALSE;
+	i = 0L;
+	for( pos = 0L; pos < totalrecords && i < count; pos += n )
+	{
+		n = (int)(( totalrecords - pos > blockrecords )? blockrecords : totalrecords - pos);
+		if( !ReadAt( dbFile->fd, pos * dbFile->sRecSz, buffer, n * dbFile->sRecSz ))
+		{
+			free( buffer );
+			return FALSE;
+		}
+		lSearchProbes += n;
+		for( r = 0; r < n && i < count; r++ )
+		{
+			record = buffer + r * dbFile->sRecSz;
+			if( IsDeleted( dbFile, record ))
+				continue;
+			//
+			// The keys lower then this record are not in the database
+			//
+			while( i < count && (test = memcmp( sorted[ i ], record + offset, keysize )) <= 0 )
+			{
+				if( test == 0 )
+					results[ (sorted[ i ] - keys) / keysize ] = pos + r;
+				i++;
+			}
+		}
+	}
+	free( buffer );
+	return TRUE;
+}
+
+//
+// Search the first record that is not lower then key from record min on, by probing
+// min + 1, 2, 4, 8 .. records further and a binary search in the last step
+// Returns the record number, totalrecords when all records are lower, -1L on error
+//
+static long GallopSearch( SDBFile *dbFile, char* record, char* key, short offset, short keysize, long min )
+{
+	long low, high, bound, current;
+
+	low = min;
+	bound = 1L;
+	high = min;
+	while( high < dbFile->lTotalRecords )
+	{
+		if( !ProbeRecord( dbFile, high, record ))
+			return -1L;
+		if( memcmp( key, record + offset, keysize ) <= 0 )
+			break;
+		low = high + 1L;
+		high = min + bound;
+		bound <<= 1;
+	}
+	if( high > dbFile->lTotalRecords )
+		high = dbFile->lTotalRecords;
+	//
+	// The first record that is not lower is between low and high
+	//
+	while( low < high )
+	{
+		current = ((high - low) >> 1) + low;
+		if( !ProbeRecord( dbFile, current, record ))
+			return -1L;
+		if( memcmp( key, record + offset, keysize ) <= 0 )
+			high = current;
+		else
+			low = current + 1L;
+	}
+	return low;
+}
+
+int BinarySearchMany( SDBFile *dbFile, char* keys, long count, short offset, short keysize, long* results )
+{
+	char** sorted;
+	char* record;
+	long totalrecords, i, pos, gap, steps;
+
+	lSearchProbes = 0L;
+	if( (totalrecords = GetTotalRecords( dbFile )) == -1L )
+		return FALSE;
+	if( dbFile->sRecSz < (keysize+offset) )
+	{
+		lErrorCode = DB_ERROR_SORTLENGTH;
+		return FALSE;
+	}
+	for( i = 0L; i < count; i++ )
+		results[ i ] = -1L;
+	if( count <= 0L || totalrecords == 0L )
+		return TRUE;
+
+	//
+	// Sort pointers to the keys, the keys themselves stay in the order of results
+	//
+	lErrorCode = DB_ERROR_MEM;
+	if( (sorted = (char**) malloc( (unsigned int)(count * sizeof( char* )))) == NULL )
+		return FALSE;
+	if( (record = (char*) malloc( dbFile->sRecSz )) == NULL )
+	{
+		free( sorted );
+		return FALSE;
+	}
+	lErrorCode = DB_OK;
+	for( i = 0L; i < count; i++ )
+		sorted[ i ] = keys + i * keysize;
+	sSortSize = keysize;
+	qsort( sorted, (size_t)count, sizeof( char* ), CompareKeyPointers );
+
+	//
+	// Few keys in many records: jump from key to key (galloping), each jump costs about
+	// 2 * log2( records between two keys ) reads. Otherwise read all records once in blocks.
+	//
+	for( gap = totalrecords / count, steps = 0L; gap > 0L; gap >>= 1 )
+		steps++;
+	if( count * 2L * steps < totalrecords / (DB_MOVE_BUFSZ / dbFile->sRecSz + 1L) )
+	{
+		pos = 0L;
+		for( i = 0L; i < count && pos < totalrecords; i++ )
+		{
+			if( !BloomMayContain( dbFile, sorted[ i ], keysize, offset ))
+				continue;
+			if( (pos = GallopSearch( dbFile, record, sorted[ i ], offset, keysize, pos )) == -1L )
+				break;
+			//
+			// Skip deleted records with the key
+			//
+			while( pos < totalrecords )
+			{
+				if( !ProbeRecord( dbFile, pos, record ))
+				{
+					pos = -1L;
+					break;
+				}
+				if( memcmp( sorted[ i ], record + offset, keysize ) != 0 )
+					break;
+				if( !IsDeleted( dbFile, record ))
+				{
+					results[ (sorted[ i ] - keys) / keysize ] = pos;
+					break;
+				}
+				pos++;
+			}
+			if( pos == -1L )
+				break;
+		}
+	}
+	else
+		MergeSearch( dbFile, sorted, count, keys, offset, keysize, results );
+
+	free( record );
+	free( sorted );
+	return GetDBErrorCode() == DB_OK;
+}
+
+
+// +++++++++++++++++++++++++++++++++++++++++
+// Special index functions
+// +++++++++++++++++++++++++++++++++++++++++
+
+//
+// The index file is a B+tree, stored in an SDBFile with pages of DB_INDEX_PAGESZ bytes as records.
+// Page 0 holds the SIndexHeader, every other page is a node that starts with an 8 byte node header:
+//
+//		short	leaf		- TRUE for a leaf page
+//		short	count		- amount of entries in the page
+//		link (4 bytes)		- leaf: page number of the next leaf, -1L for the last leaf
+//
+// followed by the entries, sorted on key + record number:
+//
+//		leaf entry:		key[ keysize ], record number (4 bytes, most significant byte first)
+//		node entry:		key[ keysize ], record number, child page (4 bytes, most significant byte first)
+//
+// The record number is stored most significant byte first so memcmp() can compare key and record number
+// together, this makes every entry unique even when the same key is in the index more than once.
+// Entry i of a node page holds the lowest entry in its child page, only entries 1..count-1 are used to
+// choose the child so the first entry does not need to be updated when a lower key is added.
+//
+#define INDEX_MAGIC			"BPT1"
+#define INDEX_NODE_HDR		8
+#define INDEX_RECNO_SZ		4
+#define INDEX_MAXDEPTH		10
+#define INDEX_CACHE_PAGES	4
+#define INDEX_MAX_ENTRY		((DB_INDEX_PAGESZ - INDEX_NODE_HDR) / 3)
+#define INDEX_PAGEBUF		(DB_INDEX_PAGESZ + INDEX_MAX_ENTRY)	// a page buffer holds one extra entry while splitting
+
+typedef struct
+{
+	char	szMagic[ 4 ];		// INDEX_MAGIC
+	short	sKeySz;				// size of the key
+	short	sHeight;			// amount of levels, 1 when the root is a leaf
+	long	lRoot;				// page number of the root page
+	long	lFirstLeaf;			// page number of the first leaf page
+	long	lKeys;				// amount of entries in the index
+	long	lGeneration;		// header generation of the database, only used for secondary indexes
+	long	lMoved;				// TRUE when records moved since the index was made, only used for secondary indexes
+}SIndexHeader;
+
+#define PAGE_LEAF( page )		(*(short*)(page))
+#define PAGE_COUNT( page )		(*(short*)((page) + 2))
+#define PAGE_ENTRY( page, i, entrysz )	((page) + INDEX_NODE_HDR + (i) * (entrysz))
+
+static long GetPageLink( char* page )
+{
+	return GetLong( page + 4 );
+}
+
+static void SetPageLink( char* page, long link )
+{
+	PutLong( page + 4, link );
+}
+
+static int ReadPage( SDBFile *dbIndex, long pageno, char* page )
+{
+	if( !GotoRecord( dbIndex, pageno ))
+		return FALSE;
+	return ReadCurrentRecord( dbIndex, page );
+}
+
+static int WritePage( SDBFile *dbIndex, long pageno, char* page )
+{
+	if( pageno == dbIndex->lTotalRecords )
+		return WriteRecord( dbIndex, page, WRITE_APPEND );
+	if( !GotoRecord( dbIndex, pageno ))
+		return FALSE;
+	return WriteRecord( dbIndex, page, WRITE_OVER );
+}
+
+static int ReadIndexHeader( SDBFile *dbIndex, SIndexHeader *pHeader, char* page )
+{
+	if( !ReadPage( dbIndex, 0L, page ))
+		return FALSE;
+	memcpy( pHeader, page, sizeof( SIndexHeader ));
+	if( memcmp( pHeader->szMagic, INDEX_MAGIC, 4 ) != 0 )
+	{
+		lErrorCode = DB_ERROR_RECORD_SIZE;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static int WriteIndexHeader( SDBFile *dbIndex, SIndexHeader *pHeader, char* page )
+{
+	memset( page, 0, DB_INDEX_PAGESZ );
+	memcpy( pHeader->szMagic, INDEX_MAGIC, 4 );
+	memcpy( page, pHeader, sizeof( SIndexHeader ));
+	return WritePage( dbIndex, 0L, page );
+}
+
+//
+// Allocate the page buffers used by the index functions
+//
+static char* AllocIndexPages( int pages )
+{
+	char* page;
+
+	if( (page = (char*) malloc( pages * INDEX_PAGEBUF )) == NULL )
+		lErrorCode = DB_ERROR_MEM;
+	return page;
+}
+
+//
+// Amount of entries in the page that are lower then target (bEqual FALSE) or lower or equal (bEqual TRUE)
+// when only the first cmpsize bytes are compared
+//
+static int IndexSlot( char* page, int entrysz, char* target, int cmpsize, int bEqual )
+{
+	int min, max, mid, test;
+
+	min = 0;
+	max = PAGE_COUNT( page );
+	while( min < max )
+	{
+		mid = (min + max) >> 1;
+		test = memcmp( PAGE_ENTRY( page, mid, entrysz ), target, cmpsize );
+		if( test < 0 || ( bEqual && test == 0 ))
+			min = mid + 1;
+		else
+			max = mid;
+	}
+	return min;
+}
+
+//
+// Find the leaf page and the position of the first entry that is not lower then the
+// first cmpsize bytes of target. The path of node pages is stored when path is not NULL
+//
+static int IndexDescend( SDBFile *dbIndex, SIndexHeader *pHeader, char* target, int cmpsize, int bEqual,
+						 char* page, long *pageno, int *pos, long* path, int* pathpos )
+{
+	int level, nodesz, slot;
+
+	nodesz = pHeader->sKeySz + 2 * INDEX_RECNO_SZ;
+	*pageno = pHeader->lRoot;
+	for( level = 0; level < pHeader->sHeight - 1; level++ )
+	{
+		if( !ReadPage( dbIndex, *pageno, page ))
+			return FALSE;
+		slot = IndexSlot( page, nodesz, target, cmpsize, bEqual );
+		if( slot > 0 )
+			slot--;
+		if( path != NULL )
+		{
+			path[ level ] = *pageno;
+			pathpos[ level ] = slot;
+		}
+		*pageno = GetLong( PAGE_ENTRY( page, slot, nodesz ) + pHeader->sKeySz + INDEX_RECNO_SZ );
+	}
+	if( !ReadPage( dbIndex, *pageno, page ))
+		return FALSE;
+	*pos = IndexSlot( page, pHeader->sKeySz + INDEX_RECNO_SZ, target, cmpsize, bEqual );
+	return TRUE;
+}
+
+//
+// Go to the next leaf while pos is behind the last entry of the leaf, a leaf can be
+// empty when its entries were removed
+//
+static int IndexSkipLeaves( SDBFile *dbIndex, char* page, long *pageno, int *pos )
+{
+	while( *pos >= PAGE_COUNT( page ) && GetPageLink( page ) != -1L )
+	{
+		*pageno = GetPageLink( page );
+		if( !ReadPage( dbIndex, *pageno, page ))
+			return FALSE;
+		*pos = 0;
+	}
+	return TRUE;
+}
+
+//
+// A leaf with one entry too many gives entries to its right or left neighbour below the same parent
+// when that one has room, so leaves are only split when their neighbours are full as well.
+// shifted is FALSE when both neighbours are full
+//
+static int IndexShift( SDBFile *dbIndex, SIndexHeader *pHeader, char* page, long pageno, long parentno, int slot, int *shifted )
+{
+	char* parent;
+	char* sibling;
+	long sibno;
+	int entrysz, nodesz, capacity, count, sibcount, move, side, ret;
+
+	*shifted = FALSE;
+	if( (parent = AllocIndexPages( 2 )) == NULL )
+		return FALSE;
+	sibling = parent + INDEX_PAGEBUF;
+	entrysz = pHeader->sKeySz + INDEX_RECNO_SZ;
+	nodesz = entrysz + INDEX_RECNO_SZ;
+	capacity = (DB_INDEX_PAGESZ - INDEX_NODE_HDR) / entrysz;
+	count = PAGE_COUNT( page );
+	ret = ReadPage( dbIndex, parentno, parent );
+	for( side = 1; ret && !*shifted && side >= -1; side -= 2 )
+	{
+		if( slot + side < 0 || slot + side >= PAGE_COUNT( parent ))
+			continue;
+		sibno = GetLong( PAGE_ENTRY( parent, slot + side, nodesz ) + entrysz );
+		if( !ReadPage( dbIndex, sibno, sibling ))
+		{
+			ret = FALSE;
+			break;
+		}
+		if( (sibcount = PAGE_COUNT( sibling )) >= capacity )
+			continue;
+		//
+		// Both pages end up about as full, the parent entry of the right page gets its new lowest entry
+		//
+		move = (count - sibcount + 1) / 2;
+		if( side > 0 )
+		{
+			memmove( PAGE_ENTRY( sibling, move, entrysz ), PAGE_ENTRY( sibling, 0, entrysz ), sibcount * entrysz );
+			memcpy( PAGE_ENTRY( sibling, 0, entrysz ), PAGE_ENTRY( page, count - move, entrysz ), move * entrysz );
+			memcpy( PAGE_ENTRY( parent, slot + 1, nodesz ), PAGE_ENTRY( sibling, 0, entrysz ), entrysz );
+		}
+		else
+		{
+			memcpy( PAGE_ENTRY( sibling, sibcount, entrysz ), PAGE_ENTRY( page, 0, entrysz ), move * entrysz );
+			memmove( PAGE_ENTRY( page, 0, entrysz ), PAGE_ENTRY( page, move, entrysz ), (count - move) * entrysz );
+			memcpy( PAGE_ENTRY( parent, slot, nodesz ), PAGE_ENTRY( page, 0, entrysz ), entrysz );
+		}
+		memset( PAGE_ENTRY( page, count - move, entrysz ), 0, move * entrysz );
+		PAGE_COUNT( page ) = (short)(count - move);
+		PAGE_COUNT( sibling ) = (short)(sibcount + move);
+		ret = WritePage( dbIndex, sibno, sibling ) && WritePage( dbIndex, pageno, page ) && WritePage( dbIndex, parentno, parent );
+		*shifted = TRUE;
+	}
+	free( parent );
+	return ret;
+}
+
+//
+// Add one entry (key + record number) to the index, splitting full pages on the way up
+//
+static int IndexInsert( SDBFile *dbIndex, SIndexHeader *pHeader, char* entry, char* page, char* newpage )
+{
+	long path[ INDEX_MAXDEPTH ];
+	int pathpos[ INDEX_MAXDEPTH ];
+	char upentry[ 2 * INDEX_MAX_ENTRY ];
+	long pageno, newpageno;
+	int depth, pos, entrysz, capacity, count, half, shifted;
+
+	if( pHeader->sHeight > INDEX_MAXDEPTH )
+	{
+		lErrorCode = DB_ERROR_RECORD_SIZE;
+		return FALSE;
+	}
+	if( !IndexDescend( dbIndex, pHeader, entry, pHeader->sKeySz + INDEX_RECNO_SZ, TRUE, page, &pageno, &pos, path, pathpos ))
+		return FALSE;
+	depth = pHeader->sHeight - 1;
+	pHeader->lKeys++;
+
+	//
+	// Insert in the leaf first, then the new page entry in the parent as long as pages split
+	//
+	entrysz = pHeader->sKeySz + INDEX_RECNO_SZ;
+	capacity = (DB_INDEX_PAGESZ - INDEX_NODE_HDR) / entrysz;
+	memcpy( upentry, entry, entrysz );
+	for(;;)
+	{
+		count = PAGE_COUNT( page );
+		memmove( PAGE_ENTRY( page, pos + 1, entrysz ), PAGE_ENTRY( page, pos, entrysz ), (count - pos) * entrysz );
+		memcpy( PAGE_ENTRY( page, pos, entrysz ), upentry, entrysz );
+		PAGE_COUNT( page ) = (short)++count;
+		if( count <= capacity )
+			return WritePage( dbIndex, pageno, page );
+		if( PAGE_LEAF( page ) && depth > 0 )
+		{
+			if( !IndexShift( dbIndex, pHeader, page, pageno, path[ depth - 1 ], pathpos[ depth - 1 ], &shifted ))
+				return FALSE;
+			if( shifted )
+				return TRUE;
+		}
+
+		//
+		// Split the page, the upper half goes to a new page at the end of the file
+		//
+		half = count >> 1;
+		newpageno = dbIndex->lTotalRecords;
+		memset( newpage, 0, DB_INDEX_PAGESZ );
+		PAGE_LEAF( newpage ) = PAGE_LEAF( page );
+		PAGE_COUNT( newpage ) = (short)(count - half);
+		memcpy( PAGE_ENTRY( newpage, 0, entrysz ), PAGE_ENTRY( page, half, entrysz ), (count - half) * entrysz );
+		if( PAGE_LEAF( page ))
+		{
+			SetPageLink( newpage, GetPageLink( page ));
+			SetPageLink( page, newpageno );
+		}
+		else
+			SetPageLink( newpage, -1L );
+		PAGE_COUNT( page ) = (short)half;
+		memset( PAGE_ENTRY( page, half, entrysz ), 0, DB_INDEX_PAGESZ - (INDEX_NODE_HDR + half * entrysz ));
+		if( !WritePage( dbIndex, newpageno, newpage ) || !WritePage( dbIndex, pageno, page ))
+			return FALSE;
+
+		//
+		// The parent gets an entry for the new page
+		//
+		memcpy( upentry, PAGE_ENTRY( newpage, 0, entrysz ), pHeader->sKeySz + INDEX_RECNO_SZ );
+		PutLong( upentry + pHeader->sKeySz + INDEX_RECNO_SZ, newpageno );
+		entrysz = pHeader->sKeySz + 2 * INDEX_RECNO_SZ;
+		capacity = (DB_INDEX_PAGESZ - INDEX_NODE_HDR) / entrysz;
+		if( depth == 0 )
+			break;
+		depth--;
+		pageno = path[ depth ];
+		if( !ReadPage( dbIndex, pageno, page ))
+			return FALSE;
+		pos = pathpos[ depth ] + 1;
+	}
+
+	//
+	// The root was split, make a new root above the old root and the new page
+	//
+	memcpy( upentry + entrysz, upentry, entrysz );
+	memcpy( upentry, PAGE_ENTRY( page, 0, PAGE_LEAF( page )? pHeader->sKeySz + INDEX_RECNO_SZ : entrysz ), pHeader->sKeySz + INDEX_RECNO_SZ );
+	PutLong( upentry + pHeader->sKeySz + INDEX_RECNO_SZ, pageno );
+	memset( newpage, 0, DB_INDEX_PAGESZ );
+	PAGE_LEAF( newpage ) = FALSE;
+	PAGE_COUNT( newpage ) = 2;
+	SetPageLink( newpage, -1L );
+	memcpy( PAGE_ENTRY( newpage, 0, entrysz ), upentry, 2 * entrysz );
+	pHeader->lRoot = dbIndex->lTotalRecords;
+	pHeader->sHeight++;
+	return WritePage( dbIndex, pHeader->lRoot, newpage );
+}
+
+//
+// Remove the first entry of which the key (without record number) is key. The pages are not
+// joined, an emptied leaf stays in the chain and gets the next entries that belong there
+//
+static int IndexRemove( SDBFile *dbIndex, char* key )
+{
+	SIndexHeader header;
+	long pageno;
+	char* page;
+	int pos, entrysz, ret;
+
+	if( (page = AllocIndexPages( 1 )) == NULL )
+		return FALSE;
+	ret = FALSE;
+	if( ReadIndexHeader( dbIndex, &header, page ) &&
+		IndexDescend( dbIndex, &header, key, header.sKeySz, FALSE, page, &pageno, &pos, NULL, NULL ) &&
+		IndexSkipLeaves( dbIndex, page, &pageno, &pos ))
+	{
+		entrysz = header.sKeySz + INDEX_RECNO_SZ;
+		if( pos < PAGE_COUNT( page ) && memcmp( PAGE_ENTRY( page, pos, entrysz ), key, header.sKeySz ) == 0 )
+		{
+			memmove( PAGE_ENTRY( page, pos, entrysz ), PAGE_ENTRY( page, pos + 1, entrysz ), (PAGE_COUNT( page ) - pos - 1) * entrysz );
+			PAGE_COUNT( page )--;
+			memset( PAGE_ENTRY( page, PAGE_COUNT( page ), entrysz ), 0, entrysz );
+			header.lKeys--;
+			ret = WritePage( dbIndex, pageno, page ) && WriteIndexHeader( dbIndex, &header, page );
+		}
+		else
+			lErrorCode = DB_ERROR_NOT_FOUND;
+	}
+	free( page );
+	return ret;
+}
+
+//
+// Append all entries of one level of pages, the pages first..last of the level below
+// are written first when first is not -1L
+//
+static int IndexBuildLevel( SDBFile *dbIndex, SIndexHeader *pHeader, long first, long last, char* page, char* newpage )
+{
+	long pageno;
+	int entrysz, capacity;
+
+	entrysz = pHeader->sKeySz + 2 * INDEX_RECNO_SZ;
+	capacity = (DB_INDEX_PAGESZ - INDEX_NODE_HDR) / entrysz;
+	memset( newpage, 0, DB_INDEX_PAGESZ );
+	SetPageLink( newpage, -1L );
+	for( pageno = first; pageno <= last; pageno++ )
+	{
+		if( !ReadPage( dbIndex, pageno, page ))
+			return FALSE;
+		memcpy( PAGE_ENTRY( newpage, PAGE_COUNT( newpage ), entrysz ), PAGE_ENTRY( page, 0, 0 ), pHeader->sKeySz + INDEX_RECNO_SZ );
+		PutLong( PAGE_ENTRY( newpage, PAGE_COUNT( newpage ), entrysz ) + pHeader->sKeySz + INDEX_RECNO_SZ, pageno );
+		if( ++PAGE_COUNT( newpage ) == capacity || pageno == last )
+		{
+			if( !WritePage( dbIndex, dbIndex->lTotalRecords, newpage ))
+				return FALSE;
+			memset( newpage, 0, DB_INDEX_PAGESZ );
+			SetPageLink( newpage, -1L );
+		}
+	}
+	return TRUE;
+}
+
+//
+// Make an index file on dbFile, the key of an entry is the field at offset followed by
+// primarysz characters from primaryofs on (a secondary index, see SetSecondaryIndex)
+// The entries are written to a temporary file, sorted, and then written to the index
+// leaf page by leaf page, after that each level of node pages is made from the level below.
+// On ok ends with an open index file, see the description of the index file above
+//
+static int BuildIndexFile( SDBFile *dbFile, short offset, short keysize, short primaryofs, short primarysz,
+						   const char* indexfilename, SDBFile *dbIndex )
+{
+	static char tempname[ DB_MAX_FNAME ];
+	static SDBFile dbTemp;
+	SIndexHeader header;
+	char* record;
+	char* entry;
+	char* page;
+	long i, totalrecords, first, last, errorcode;
+	int entrysz, capacity, ok;
+
+	if( !IsFileOpen( dbFile ))
+		return FALSE;
+	if( ( totalrecords = GetTotalRecords( dbFile )) == 0L )
+	{
+		lErrorCode = DB_ERROR_EMPTY;
+		return FALSE;
+	}
+	entrysz = keysize + primarysz + INDEX_RECNO_SZ;
+	if( dbFile->sRecSz < (keysize+offset) || dbFile->sRecSz < (primarysz+primaryofs) || entrysz + INDEX_RECNO_SZ > INDEX_MAX_ENTRY )
+	{
+		lErrorCode = DB_ERROR_SORTLENGTH;
+		return FALSE;
+	}
+
+	//
+	// Write all key + record number entries to a temporary file and sort them
+	//
+	MakeFileName( indexfilename, "tmi", tempname );
+	if( !CreateDatabase( tempname, (short)entrysz, &dbTemp ))
+		return FALSE;
+	SetDatabaseCache( &dbTemp, DB_CACHE_BLOCKS, DB_CACHE_RECORDS );
+	lErrorCode = DB_ERROR_MEM;
+	if( (record = (char*) malloc( dbFile->sRecSz + entrysz )) != NULL )
+	{
+		lErrorCode = DB_OK;
+		entry = record + dbFile->sRecSz;
+		for( i = 0; i < totalrecords; i++ )
+		{
+			if( !GotoRecord( dbFile, i ))
+				break;
+			if( !ReadCurrentRecord( dbFile, record ))
+				break;
+			memcpy( entry, record + offset, keysize );
+			memcpy( entry + keysize, record + primaryofs, primarysz );
+			PutLong( entry + keysize + primarysz, i );
+			if( !WriteRecord( &dbTemp, entry, WRITE_APPEND ))
+				break;
+		}
+		free( record );
+	}
+	if( GetDBErrorCode() == DB_OK )
+		ExternalSort( &dbTemp, 0, (short)entrysz );
+
+	//
+	// Write the leaf pages, page 0 is the header page
+	//
+	page = NULL;
+	if( GetDBErrorCode() == DB_OK && CreateDatabase( indexfilename, DB_INDEX_PAGESZ, dbIndex ))
+	{
+		SetDatabaseCache( dbIndex, INDEX_CACHE_PAGES, 1 );
+		if( (page = AllocIndexPages( 2 )) != NULL )
+		{
+			memset( &header, 0, sizeof( header ));
+			header.sKeySz = keysize + primarysz;
+			header.lKeys = totalrecords;
+			header.lFirstLeaf = 1L;
+			WriteIndexHeader( dbIndex, &header, page );
+
+			capacity = (DB_INDEX_PAGESZ - INDEX_NODE_HDR) / entrysz;
+			memset( page, 0, DB_INDEX_PAGESZ );
+			PAGE_LEAF( page ) = TRUE;
+			for( i = 0; i < totalrecords && GetDBErrorCode() == DB_OK; i++ )
+			{
+				if( !GotoRecord( &dbTemp, i ) || !ReadCurrentRecord( &dbTemp, PAGE_ENTRY( page, PAGE_COUNT( page ), entrysz )))
+					break;
+				if( ++PAGE_COUNT( page ) == capacity || i == totalrecords - 1L )
+				{
+					SetPageLink( page, ( i == totalrecords - 1L )? -1L : dbIndex->lTotalRecords + 1L );
+					if( !WritePage( dbIndex, dbIndex->lTotalRecords, page ))
+						break;
+					memset( page, 0, DB_INDEX_PAGESZ );
+					PAGE_LEAF( page ) = TRUE;
+				}
+			}
+
+			//
+			// Make the node levels until one root page is left
+			//
+			header.sHeight = 1;
+			first = 1L;
+			last = dbIndex->lTotalRecords - 1L;
+			while( first < last && GetDBErrorCode() == DB_OK )
+			{
+				if( !IndexBuildLevel( dbIndex, &header, first, last, page, page + INDEX_PAGEBUF ))
+					break;
+				first = last + 1L;
+				last = dbIndex->lTotalRecords - 1L;
+				header.sHeight++;
+			}
+			header.lRoot = last;
+			if( GetDBErrorCode() == DB_OK )
+				WriteIndexHeader( dbIndex, &header, page );
+			free( page );
+		}
+	}
+	//
+	// CloseDatabase() resets the error code, keep the reason of a failure
+	//
+	ok = page != NULL && GetDBErrorCode() == DB_OK;
+	errorcode = lErrorCode;
+	CloseDatabase( &dbTemp );
+	remove( tempname );
+	if( ok )
+	{
+		if( FlushDatabase( dbIndex ))
+			return TRUE;
+		errorcode = lErrorCode;
+	}
+	CloseDatabase( dbIndex );
+	remove( indexfilename );
+	lErrorCode = errorcode;
+	return FALSE;
+}
+
+int CreateIndexFile( SDBFile *dbFile, short offset, short keysize, const char* indexfilename, SDBFile *dbIndex )
+{
+	return BuildIndexFile( dbFile, offset, keysize, 0, 0, indexfilename, dbIndex );
+}
+
+int OpenIndexFile( const char *indexfilename, short keysize, SDBFile *dbIndex )
+{
+	SIndexHeader header;
+	long errorcode;
+	char* page;
+
+	if( !OpenDatabase( indexfilename, DB_INDEX_PAGESZ, dbIndex ))
+		return FALSE;
+	SetDatabaseCache( dbIndex, INDEX_CACHE_PAGES, 1 );
+	if( (page = AllocIndexPages( 1 )) != NULL )
+	{
+		if( ReadIndexHeader( dbIndex, &header, page ) && header.sKeySz != keysize )
+			lErrorCode = DB_ERROR_RECORD_SIZE;
+		free( page );
+	}
+	if( GetDBErrorCode() == DB_OK )
+		return TRUE;
+	errorcode = lErrorCode;
+	CloseDatabase( dbIndex );
+	lErrorCode = errorcode;
+	return FALSE;
+}
+
+
+long SearchIndexFile( SDBFile *dbIndex, char *searchkey )
+{
+	SIndexHeader header;
+	long recnr, pageno;
+	char* page;
+	int pos;
+
+	if( !IsFileOpen( dbIndex ))
+		return -1L;
+	if( (page = AllocIndexPages( 1 )) == NULL )
+		return -1L;
+
+	recnr = -1L;
+	if( ReadIndexHeader( dbIndex, &header, page ) &&
+		IndexDescend( dbIndex, &header, searchkey, header.sKeySz, FALSE, page, &pageno, &pos, NULL, NULL ))
+	{
+		//
+		// The first entry with the key can be the first entry of a next leaf
+		//
+		IndexSkipLeaves( dbIndex, page, &pageno, &pos );
+		if( pos < PAGE_COUNT( page ) && memcmp( PAGE_ENTRY( page, pos, header.sKeySz + INDEX_RECNO_SZ ), searchkey, header.sKeySz ) == 0 )
+			recnr = GetLong( PAGE_ENTRY( page, pos, header.sKeySz + INDEX_RECNO_SZ ) + header.sKeySz );
+		else if( GetDBErrorCode() == DB_OK )
+			lErrorCode = DB_ERROR_NOT_FOUND;
+	}
+	free( page );
+	return recnr;
+}
+
+//
+// Walk the entries from fromkey up to tokey, only the first cmpsize bytes of the entry
+// keys are compared with fromkey and tokey, 0 compares the whole key.
+// With bUpdate the callback may change the record number after the key, the leaf page is
+// written again then. The key does not change so the entries stay in order.
+//
+static long IndexScan( SDBFile *dbIndex, char* fromkey, char* tokey, int cmpsize, int bUpdate,
+					   int (*callback)( char* key, long recordnumber ))
+{
+	SIndexHeader header;
+	long count, pageno, recno;
+	char* page;
+	char* entry;
+	int pos, entrysz, changed, more;
+
+	if( !IsFileOpen( dbIndex ))
+		return -1L;
+	if( (page = AllocIndexPages( 1 )) == NULL )
+		return -1L;
+
+	count = -1L;
+	if( !ReadIndexHeader( dbIndex, &header, page ))
+		goto Clean;
+	entrysz = header.sKeySz + INDEX_RECNO_SZ;
+	if( cmpsize == 0 )
+		cmpsize = header.sKeySz;
+	if( fromkey != NULL )
+	{
+		if( !IndexDescend( dbIndex, &header, fromkey, cmpsize, FALSE, page, &pageno, &pos, NULL, NULL ))
+			goto Clean;
+	}
+	else
+	{
+		pos = 0;
+		pageno = header.lFirstLeaf;
+		if( !ReadPage( dbIndex, pageno, page ))
+			goto Clean;
+	}
+
+	//
+	// Walk along the leaf pages until the key is larger then tokey
+	//
+	count = 0L;
+	changed = FALSE;
+	for(;;)
+	{
+		if( pos >= PAGE_COUNT( page ))
+		{
+			if( GetPageLink( page ) == -1L )
+				break;
+			if( changed && !WritePage( dbIndex, pageno, page ))
+			{
+				count = -1L;
+				break;
+			}
+			changed = FALSE;
+			pageno = GetPageLink( page );
+			if( !ReadPage( dbIndex, pageno, page ))
+			{
+				count = -1L;
+				break;
+			}
+			pos = 0;
+			continue;
+		}
+		entry = PAGE_ENTRY( page, pos, entrysz );
+		if( tokey != NULL && memcmp( entry, tokey, cmpsize ) > 0 )
+			break;
+		count++;
+		recno = GetLong( entry + header.sKeySz );
+		more = callback( entry, recno );
+		if( bUpdate && GetLong( entry + header.sKeySz ) != recno )
+			changed = TRUE;
+		if( !more )
+			break;
+		pos++;
+	}
+	if( changed && !WritePage( dbIndex, pageno, page ))
+		count = -1L;
+Clean:
+	free( page );
+	return count;
+}
+
+long ScanIndexRange( SDBFile *dbIndex, char* fromkey, char* tokey, int (*callback)( char* key, long recordnumber ))
+{
+	return IndexScan( dbIndex, fromkey, tokey, 0, FALSE, callback );
+}
+
+int AddNewSearchkeyToIndex( SDBFile *dbIndex, char *nwsearchkey, long recordnumber )
+{
+	SIndexHeader header;
+	char* page;
+	int ret;
+
+	if( !IsFileOpen( dbIndex ))
+		return FALSE;
+
+	if( (page = AllocIndexPages( 3 )) == NULL )
+		return FALSE;
+	ret = FALSE;
+	if( ReadIndexHeader( dbIndex, &header, page ))
+	{
+		//
+		// The entry is made in the third page buffer
+		//
+		memcpy( page + 2 * INDEX_PAGEBUF, nwsearchkey, header.sKeySz );
+		PutLong( page + 2 * INDEX_PAGEBUF + header.sKeySz, recordnumber );
+		if( IndexInsert( dbIndex, &header, page + 2 * INDEX_PAGEBUF, page, page + INDEX_PAGEBUF ))
+			ret = WriteIndexHeader( dbIndex, &header, page );
+	}
+	free( page );
+	return ret;
+}
+
+// ++++++++++++++++++++++++++++++++++++++
+// Secondary index functions
+// ++++++++++++++++++++++++++++++++++++++
+
+//
+// A secondary index is an index file on a field that is not the sort key. The key of an entry is
+// the field followed by the header key (SetDatabaseHeader) of the record, the record number of the
+// entry is where the record was when the entry was made. Sorting, merging the delta log, inserting
+// and deleting records move records but do not change the field and header key of a record, so the
+// entries still fit. RangeQuery() reads the record at the record number of an entry and when that
+// record has another header key it finds the record with BinarySearch() on the header key and
+// writes the new record number into the entry. When too many records are not sorted on the header
+// key for that, the index file is made again.
+// WriteRecord() adds the entry of a written record when the index does not hold it yet, and removes
+// the entry of an overwritten record when its field or header key changed or it was marked as deleted.
+// Records removed with DeleteRecords() leave their entries in the index, RangeQuery() checks the
+// field of every record it reads so these entries are skipped.
+// The index file holds the header generation of the database it was saved for, an index file that
+// does not match the database when SetSecondaryIndex() is called is made again by RangeQuery().
+//
+
+//
+// Records that may be outside the sorted records when the moved records of a secondary index
+// are still found with BinarySearch(), without delta log
+//
+#define DB_SECONDARY_TAIL	32L
+
+//
+// Record buffer and callback of the running RangeQuery(), the index scan only passes key and record number
+//
+static SDBFile *pQueryFile;
+static struct SDBSecondary *pQuerySecondary;
+static int (*pQueryCallback)( char* record, long recordnumber );
+static char* pQueryRecord;
+static long lQueryCount;
+static int bQueryFailed;
+
+static struct SDBSecondary* FindSecondary( SDBFile *dbFile, short offset )
+{
+	struct SDBSecondary *pSecondary;
+
+	for( pSecondary = dbFile->pSecondary; pSecondary != NULL; pSecondary = pSecondary->pNext )
+		if( pSecondary->sOffset == offset )
+			break;
+	return pSecondary;
+}
+
+//
+// Read or write the generation and the moved flag in the header page of the index file
+//
+static int GetIndexGeneration( SDBFile *dbIndex, long* generation, int* moved )
+{
+	SIndexHeader header;
+	char* page;
+	int ret;
+
+	if( (page = AllocIndexPages( 1 )) == NULL )
+		return FALSE;
+	ret = ReadIndexHeader( dbIndex, &header, page );
+	*generation = header.lGeneration;
+	*moved = header.lMoved != 0L;
+	free( page );
+	return ret;
+}
+
+static int SetIndexGeneration( SDBFile *dbIndex, long generation, int moved )
+{
+	SIndexHeader header;
+	char* page;
+	int ret;
+
+	if( (page = AllocIndexPages( 1 )) == NULL )
+		return FALSE;
+	ret = ReadIndexHeader( dbIndex, &header, page );
+	if( ret && ( header.lGeneration != generation || header.lMoved != (long)moved ))
+	{
+		header.lGeneration = generation;
+		header.lMoved = moved;
+		ret = WriteIndexHeader( dbIndex, &header, page );
+	}
+	free( page );
+	return ret;
+}
+
+//
+// Any change of the database in this session leaves the entries of an index that is not
+// to be made again valid, the generation follows the header
+//
+static long SecondaryGeneration( SDBFile *dbFile, struct SDBSecondary *pSecondary )
+{
+	if( pSecondary->lGeneration != -1L && dbFile->pHeader != NULL )
+		pSecondary->lGeneration = dbFile->pHeader->lGeneration;
+	return pSecondary->lGeneration;
+}
+
+//
+// The current record is overwritten by WriteRecord(), keep the entry of the old record
+// so SecondaryWrite() can remove it when the field or the header key changes
+//
+static void SecondaryOverwrite( SDBFile *dbFile )
+{
+	struct SDBSecondary *pSecondary;
+	char* old;
+	long recno, errorcode;
+	int read;
+
+	if( dbFile->pSecondary == NULL )
+		return;
+	errorcode = lErrorCode;
+	recno = GetCurrentRecord( dbFile );
+	old = NULL;
+	read = FALSE;
+	for( pSecondary = dbFile->pSecondary; pSecondary != NULL; pSecondary = pSecondary->pNext )
+	{
+		pSecondary->bOld = FALSE;
+		if( pSecondary->lGeneration == -1L || pSecondary->bHold || recno == -1L )
+			continue;
+		//
+		// The record is read once for all secondary indexes
+		//
+		if( !read )
+		{
+			read = TRUE;
+			if( (old = (char*) malloc( dbFile->sRecSz )) != NULL && !ReadRecordAt( dbFile, recno, old ))
+			{
+				free( old );
+				old = NULL;
+			}
+		}
+		if( old == NULL )
+		{
+			pSecondary->lGeneration = -1L;
+			continue;
+		}
+		if( IsDeleted( dbFile, old ))
+			continue;
+		memcpy( pSecondary->pOld, old + pSecondary->sOffset, pSecondary->sKeySz );
+		memcpy( pSecondary->pOld + pSecondary->sKeySz, old + pSecondary->sPrimaryOfs, pSecondary->sPrimarySz );
+		pSecondary->bOld = TRUE;
+	}
+	if( old != NULL )
+		free( old );
+	lErrorCode = errorcode;
+}
+
+//
+// Keep the secondary indexes up to date after record recno was written, called after HeaderWrite.
+// The entry of an overwritten record is removed when the record gets another entry or is deleted.
+//
+static void SecondaryWrite( SDBFile *dbFile, long recno, char* record )
+{
+	struct SDBSecondary *pSecondary;
+	long errorcode;
+	int bOld;
+
+	errorcode = lErrorCode;
+	for( pSecondary = dbFile->pSecondary; pSecondary != NULL; pSecondary = pSecondary->pNext )
+	{
+		bOld = pSecondary->bOld;
+		pSecondary->bOld = FALSE;
+		if( SecondaryGeneration( dbFile, pSecondary ) == -1L || pSecondary->bHold )
+			continue;
+		memcpy( pSecondary->pKey, record + pSecondary->sOffset, pSecondary->sKeySz );
+		memcpy( pSecondary->pKey + pSecondary->sKeySz, record + pSecondary->sPrimaryOfs, pSecondary->sPrimarySz );
+		if( bOld && ( IsDeleted( dbFile, record ) || memcmp( pSecondary->pOld, pSecondary->pKey, pSecondary->sKeySz + pSecondary->sPrimarySz ) != 0 ) &&
+			!IndexRemove( &pSecondary->dbIndex, pSecondary->pOld ) && GetDBErrorCode() != DB_ERROR_NOT_FOUND )
+		{
+			pSecondary->lGeneration = -1L;
+			continue;
+		}
+		if( IsDeleted( dbFile, record ))
+			continue;
+		if( SearchIndexFile( &pSecondary->dbIndex, pSecondary->pKey ) != -1L )
+			continue;
+		if( GetDBErrorCode() != DB_ERROR_NOT_FOUND || !AddNewSearchkeyToIndex( &pSecondary->dbIndex, pSecondary->pKey, recno ))
+			pSecondary->lGeneration = -1L;
+	}
+	lErrorCode = errorcode;
+}
+
+//
+// Records are inserted, deleted, sorted or compacted, called after HeaderInsert, HeaderDelete,
+// HeaderReorder and HeaderCompact
+//
+static void SecondaryMoved( SDBFile *dbFile )
+{
+	struct SDBSecondary *pSecondary;
+
+	for( pSecondary = dbFile->pSecondary; pSecondary != NULL; pSecondary = pSecondary->pNext )
+		pSecondary->bMoved = TRUE;
+}
+
+//
+// The moved records are found with BinarySearch() on the header key. That only pays when nearly
+// all records are sorted on it (SortDatabase, MergeDeltaLog) or the other records are in the delta log,
+// else the index file is made again with the record numbers of now.
+//
+static int SecondaryCanFind( SDBFile *dbFile, struct SDBSecondary *pSecondary )
+{
+	long tail;
+
+	if( !pSecondary->bMoved )
+		return TRUE;
+	tail = dbFile->lTotalRecords - HeaderSortedRecords( dbFile, pSecondary->sPrimaryOfs, pSecondary->sPrimarySz );
+	if( dbFile->pDelta != NULL && tail <= dbFile->pDelta->lMax )
+		return TRUE;
+	return tail <= DB_SECONDARY_TAIL;
+}
+
+//
+// A sort moves records with WriteRecord() (bHold TRUE) until it is done (bHold FALSE),
+// an index is made again when the sort failed
+//
+static void SecondaryHold( SDBFile *dbFile, int bHold )
+{
+	struct SDBSecondary *pSecondary;
+
+	for( pSecondary = dbFile->pSecondary; pSecondary != NULL; pSecondary = pSecondary->pNext )
+	{
+		pSecondary->bHold = bHold;
+		if( !bHold && lErrorCode != DB_OK )
+			pSecondary->lGeneration = -1L;
+	}
+}
+
+//
+// Write the generation of every secondary index to its file, an index that is not up to
+// date gets -1L so it is made again when the database is opened the next time
+//
+static int SaveSecondary( SDBFile *dbFile )
+{
+	struct SDBSecondary *pSecondary;
+
+	for( pSecondary = dbFile->pSecondary; pSecondary != NULL; pSecondary = pSecondary->pNext )
+	{
+		if( !pSecondary->dbIndex.bOpen )
+			continue;
+		if( !SetIndexGeneration( &pSecondary->dbIndex, SecondaryGeneration( dbFile, pSecondary ), pSecondary->bMoved ) ||
+			!FlushDatabase( &pSecondary->dbIndex ))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void FreeSecondary( SDBFile *dbFile )
+{
+	struct SDBSecondary *pSecondary;
+
+	while( (pSecondary = dbFile->pSecondary) != NULL )
+	{
+		dbFile->pSecondary = pSecondary->pNext;
+		CloseDatabase( &pSecondary->dbIndex );
+		free( pSecondary->pKey );
+		free( pSecondary );
+	}
+}
+
+//
+// Make the index file again when it did not match the database or an entry could not be added,
+// or when more then half of the entries are old entries of records removed with DeleteRecords()
+//
+static int SecondaryUpToDate( SDBFile *dbFile, struct SDBSecondary *pSecondary )
+{
+	SIndexHeader header;
+	char* page;
+	long errorcode;
+
+	if( dbFile->pHeader == NULL || dbFile->pHeader->sOffset != pSecondary->sPrimaryOfs ||
+		dbFile->pHeader->sKeySz != pSecondary->sPrimarySz )
+	{
+		lErrorCode = DB_ERROR_NO_HEADER;
+		return FALSE;
+	}
+	if( SecondaryGeneration( dbFile, pSecondary ) != -1L )
+	{
+		if( (page = AllocIndexPages( 1 )) == NULL )
+			return FALSE;
+		if( !ReadIndexHeader( &pSecondary->dbIndex, &header, page ))
+			header.lKeys = -1L;
+		free( page );
+		if( header.lKeys != -1L && header.lKeys <= 2L * dbFile->lTotalRecords && SecondaryCanFind( dbFile, pSecondary ))
+			return TRUE;
+	}
+	CloseDatabase( &pSecondary->dbIndex );
+	pSecondary->lGeneration = -1L;
+	pSecondary->bMoved = FALSE;
+	if( !BuildIndexFile( dbFile, pSecondary->sOffset, pSecondary->sKeySz, pSecondary->sPrimaryOfs, pSecondary->sPrimarySz,
+						 pSecondary->szFileName, &pSecondary->dbIndex ))
+		return FALSE;
+	if( !SetIndexGeneration( &pSecondary->dbIndex, dbFile->pHeader->lGeneration, FALSE ) || !FlushDatabase( &pSecondary->dbIndex ))
+	{
+		errorcode = lErrorCode;
+		CloseDatabase( &pSecondary->dbIndex );
+		lErrorCode = errorcode;
+		return FALSE;
+	}
+	pSecondary->lGeneration = dbFile->pHeader->lGeneration;
+	return TRUE;
+}
+
+int SetSecondaryIndex( SDBFile *dbFile, short offset, short keysize, const char* indexfilename )
+{
+	struct SDBSecondary *pSecondary;
+	struct SDBSecondary **ppLink;
+	long generation;
+	short primarysz;
+
+	if( !IsFileOpen( dbFile ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return FALSE;
+	}
+	//
+	// An earlier secondary index on this field is saved and closed first
+	//
+	for( ppLink = &dbFile->pSecondary; *ppLink != NULL; ppLink = &(*ppLink)->pNext )
+	{
+		if( (*ppLink)->sOffset != offset )
+			continue;
+		pSecondary = *ppLink;
+		if( pSecondary->dbIndex.bOpen && ( !SetIndexGeneration( &pSecondary->dbIndex, SecondaryGeneration( dbFile, pSecondary ), pSecondary->bMoved ) ||
+										   !FlushDatabase( &pSecondary->dbIndex )))
+			return FALSE;
+		*ppLink = pSecondary->pNext;
+		CloseDatabase( &pSecondary->dbIndex );
+		free( pSecondary->pKey );
+		free( pSecondary );
+		break;
+	}
+	lErrorCode = DB_OK;
+	if( keysize <= 0 )
+		return TRUE;
+	if( dbFile->pHeader == NULL )
+	{
+		lErrorCode = DB_ERROR_NO_HEADER;
+		return FALSE;
+	}
+	primarysz = dbFile->pHeader->sKeySz;
+	if( dbFile->sRecSz < (keysize+offset) || keysize + primarysz + 2 * INDEX_RECNO_SZ > INDEX_MAX_ENTRY )
+	{
+		lErrorCode = DB_ERROR_SORTLENGTH;
+		return FALSE;
+	}
+	if( (pSecondary = (struct SDBSecondary*) malloc( sizeof( struct SDBSecondary ))) == NULL )
+	{
+		lErrorCode = DB_ERROR_MEM;
+		return FALSE;
+	}
+	memset( pSecondary, 0, sizeof( struct SDBSecondary ));
+	if( (pSecondary->pKey = (char*) malloc( 2 * (keysize + primarysz) )) == NULL )
+	{
+		free( pSecondary );
+		lErrorCode = DB_ERROR_MEM;
+		return FALSE;
+	}
+	pSecondary->pOld = pSecondary->pKey + keysize + primarysz;
+	pSecondary->sOffset = offset;
+	pSecondary->sKeySz = keysize;
+	pSecondary->sPrimaryOfs = dbFile->pHeader->sOffset;
+	pSecondary->sPrimarySz = primarysz;
+	pSecondary->lGeneration = -1L;
+	strncpy( pSecondary->szFileName, indexfilename, DB_MAX_FNAME - 1 );
+	//
+	// The index file of an earlier session is used when nothing changed since it was saved,
+	// else it is made again by the first RangeQuery()
+	//
+	if( OpenIndexFile( indexfilename, keysize + primarysz, &pSecondary->dbIndex ) &&
+		GetIndexGeneration( &pSecondary->dbIndex, &generation, &pSecondary->bMoved ) && generation == dbFile->pHeader->lGeneration )
+		pSecondary->lGeneration = generation;
+	pSecondary->pNext = dbFile->pSecondary;
+	dbFile->pSecondary = pSecondary;
+	lErrorCode = DB_OK;
+	return TRUE;
+}
+
+//
+// Called by IndexScan() for every entry from fromkey to tokey
+//
+static int QueryEntry( char* key, long recordnumber )
+{
+	struct SDBSecondary *pSecondary;
+	char* primary;
+
+	pSecondary = pQuerySecondary;
+	primary = key + pSecondary->sKeySz;
+	if( recordnumber < pQueryFile->lTotalRecords && !ReadRecordAt( pQueryFile, recordnumber, pQueryRecord ))
+	{
+		bQueryFailed = TRUE;
+		return FALSE;
+	}
+	//
+	// The record moved since the entry was made, find it with the header key
+	//
+	if( recordnumber >= pQueryFile->lTotalRecords ||
+		memcmp( pQueryRecord + pSecondary->sPrimaryOfs, primary, pSecondary->sPrimarySz ) != 0 ||
+		IsDeleted( pQueryFile, pQueryRecord ))
+	{
+		if( (recordnumber = BinarySearch( pQueryFile, pQueryRecord, primary, pSecondary->sPrimarySz, pSecondary->sPrimaryOfs )) == -1L )
+		{
+			if( GetDBErrorCode() != DB_ERROR_NOT_FOUND )
+			{
+				bQueryFailed = TRUE;
+				return FALSE;
+			}
+			lErrorCode = DB_OK;
+			return TRUE;
+		}
+		//
+		// The next query reads the record at once
+		//
+		PutLong( primary + pSecondary->sPrimarySz, recordnumber );
+	}
+	//
+	// Skip the old entries of overwritten records and the deleted records
+	//
+	if( memcmp( pQueryRecord + pSecondary->sOffset, key, pSecondary->sKeySz ) != 0 || IsDeleted( pQueryFile, pQueryRecord ))
+		return TRUE;
+	lQueryCount++;
+	return pQueryCallback( pQueryRecord, recordnumber );
+}
+
+long RangeQuery( SDBFile *dbFile, short offset, char* fromkey, char* tokey, int (*callback)( char* record, long recordnumber ))
+{
+	struct SDBSecondary *pSecondary;
+	long count, current;
+
+	if( !IsFileOpen( dbFile ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return -1L;
+	}
+	if( (pSecondary = FindSecondary( dbFile, offset )) == NULL )
+	{
+		lErrorCode = DB_ERROR_NOT_FOUND;
+		return -1L;
+	}
+	if( dbFile->lTotalRecords == 0L )
+		return 0L;
+	if( !SecondaryUpToDate( dbFile, pSecondary ))
+		return -1L;
+	if( (pQueryRecord = (char*) malloc( dbFile->sRecSz )) == NULL )
+	{
+		lErrorCode = DB_ERROR_MEM;
+		return -1L;
+	}
+	pQueryFile = dbFile;
+	pQuerySecondary = pSecondary;
+	pQueryCallback = callback;
+	lQueryCount = 0L;
+	bQueryFailed = FALSE;
+	//
+	// BinarySearch() moves the current record
+	//
+	current = dbFile->lCurrRecord;
+	count = IndexScan( &pSecondary->dbIndex, fromkey, tokey, pSecondary->sKeySz, TRUE, QueryEntry );
+	dbFile->lCurrRecord = current;
+	free( pQueryRecord );
+	pQueryRecord = NULL;
+	if( count == -1L || bQueryFailed )
+		return -1L;
+	return lQueryCount;
+}
+
+//
+// Record numbers found by the running SearchSecondaryIndex()
+//
+static long* pFoundRecNo;
+static long lFoundMax;
+static long lFoundCount;
+
+static int FoundRecord( char* record, long recordnumber )
+{
+	(void)record;	// only the record number is returned
+	pFoundRecNo[ lFoundCount++ ] = recordnumber;
+	return lFoundCount < lFoundMax;
+}
+
+long SearchSecondaryIndex( SDBFile *dbFile, short offset, char* searchkey, long* recordnumbers, long maxcount )
+{
+	if( maxcount <= 0L )
+		return 0L;
+	pFoundRecNo = recordnumbers;
+	lFoundMax = maxcount;
+	lFoundCount = 0L;
+	if( RangeQuery( dbFile, offset, searchkey, searchkey, FoundRecord ) == -1L )
+		return -1L;
+	if( lFoundCount == 0L )
+		lErrorCode = DB_ERROR_NOT_FOUND;
+	return lFoundCount;
+}
+
+
+// ++++++++++++++++++++++++++++++++++++++
+// Aggregate functions
+// ++++++++++++++++++++++++++++++++++++++
+
+//
+// An aggregate keeps for every key of a field the amount of records with the key, the amount of
+// writes of those records and the last (highest) value of another field, in a hash table file.
+// WriteRecord() keeps it up to date with the record it overwrites, DeleteRecords() and
+// DeleteRecordSet() take off the records they remove, sorting and compacting do not change it.
+// When the database changes in another way the aggregate is made again with one pass over the
+// database, the writes of a key are then the amount of its records. A key without records keeps
+// its writes, its last value is set again by the next record with the key.
+//
+// The table file is an SDBFile with record cache, only the cache blocks are in memory. The first
+// records hold the header:
+//
+//		"AGG2", key offset (2 bytes), key size (2 bytes), value offset (2 bytes), 0 (2 bytes),
+//		bucket size (4 bytes), generation (4 bytes), slots (4 bytes), keys (4 bytes),
+//		live keys (4 bytes), highest bucket (4 bytes), keys in the highest bucket (4 bytes)
+//
+// every next record is a slot with the key, records (4 bytes), writes (4 bytes) and last value
+// (4 bytes), a slot without writes is unused. A key is stored in slot HashKey() & (slots - 1) or,
+// when that one is used, in the next free slot (linear probing).
+// generation is the header generation the file was saved for, -1L while the slots are changed
+// and were not saved yet, so a file that was not closed is not trusted.
+//
+#define AGGREGATE_MAGIC		"AGG2"
+#define AGGREGATE_HDRSZ		40
+#define AGGREGATE_SLOTS		64		// first size of the hash table, a power of 2
+
+//
+// The counts of a slot follow the key
+//
+#define AGG_RECORDS			0
+#define AGG_WRITES			4
+#define AGG_LAST			8
+#define AGG_COUNTS			3
+
+static short AggregateRecordSize( short keysize )
+{
+	return keysize + AGG_COUNTS * 4;
+}
+
+static int WriteAggregateHeader( SDBFile *dbTable, struct SDBAggregate *pAggregate, long slots, long generation )
+{
+	char* header;
+	short i;
+
+	header = pAggregate->pHeader;
+	memset( header, 0, pAggregate->sHdrRecs * dbTable->sRecSz );
+	memcpy( header, AGGREGATE_MAGIC, 4 );
+	header[ 4 ] = (char)(pAggregate->sOffset >> 8);
+	header[ 5 ] = (char)pAggregate->sOffset;
+	header[ 6 ] = (char)(pAggregate->sKeySz >> 8);
+	header[ 7 ] = (char)pAggregate->sKeySz;
+	header[ 8 ] = (char)(pAggregate->sValueOffset >> 8);
+	header[ 9 ] = (char)pAggregate->sValueOffset;
+	PutLong( header + 12, pAggregate->lBucketSize );
+	PutLong( header + 16, generation );
+	PutLong( header + 20, slots );
+	PutLong( header + 24, pAggregate->lKeys );
+	PutLong( header + 28, pAggregate->lLiveKeys );
+	PutLong( header + 32, pAggregate->lBucket );
+	PutLong( header + 36, pAggregate->lBucketKeys );
+	for( i = 0; i < pAggregate->sHdrRecs; i++ )
+	{
+		if( i >= dbTable->lTotalRecords )
+		{
+			if( !WriteRecord( dbTable, header + i * dbTable->sRecSz, WRITE_APPEND ))
+				return FALSE;
+		}
+		else if( !GotoRecord( dbTable, (long)i ) || !WriteRecord( dbTable, header + i * dbTable->sRecSz, WRITE_OVER ))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+//
+// Make a table file of slots unused slots, its header is not up to date
+//
+static int MakeAggregateFile( const char* filename, struct SDBAggregate *pAggregate, long slots, SDBFile *dbTable )
+{
+	long i;
+
+	if( !CreateDatabase( filename, AggregateRecordSize( pAggregate->sKeySz ), dbTable ))
+		return FALSE;
+	SetDatabaseCache( dbTable, DB_CACHE_BLOCKS, DB_CACHE_RECORDS );
+	if( !WriteAggregateHeader( dbTable, pAggregate, slots, -1L ))
+		return FALSE;
+	memset( pAggregate->pEntry, 0, dbTable->sRecSz );
+	for( i = 0L; i < slots; i++ )
+	{
+		if( !WriteRecord( dbTable, pAggregate->pEntry, WRITE_APPEND ))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+//
+// Find the slot of key, or the unused slot where it is added, entry holds the slot
+//
+static int AggregateProbe( SDBFile *dbTable, struct SDBAggregate *pAggregate, long slots, char* key,
+						   char* entry, long* slot )
+{
+	long probes;
+
+	*slot = (long)( HashKey( key, pAggregate->sKeySz ) & (unsigned long)( slots - 1L ));
+	for( probes = 0L; probes < slots; probes++ )
+	{
+		if( !GotoRecord( dbTable, *slot + pAggregate->sHdrRecs ) || !ReadCurrentRecord( dbTable, entry ))
+			return FALSE;
+		if( GetLong( entry + pAggregate->sKeySz + AGG_WRITES ) == 0L ||
+			memcmp( entry, key, pAggregate->sKeySz ) == 0 )
+			return TRUE;
+		*slot = ( *slot + 1L ) & ( slots - 1L );
+	}
+	//
+	// A full table can not happen because the table is doubled before that
+	//
+	lErrorCode = DB_ERROR_RECORD_SIZE;
+	return FALSE;
+}
+
+static int AggregateStore( struct SDBAggregate *pAggregate, long slot, char* entry )
+{
+	return GotoRecord( &pAggregate->dbTable, slot + pAggregate->sHdrRecs ) &&
+		   WriteRecord( &pAggregate->dbTable, entry, WRITE_OVER );
+}
+
+//
+// The slots are going to change, the file is marked as not up to date until it is saved
+//
+static int AggregateChange( struct SDBAggregate *pAggregate )
+{
+	if( pAggregate->bDirtyOnDisk )
+		return TRUE;
+	if( !WriteAggregateHeader( &pAggregate->dbTable, pAggregate, pAggregate->lSlots, -1L ) ||
+		!FlushDatabase( &pAggregate->dbTable ))
+		return FALSE;
+	pAggregate->bDirtyOnDisk = TRUE;
+	return TRUE;
+}
+
+//
+// Double the amount of slots, all keys are stored again in a temporary file which replaces the
+// table file. The new file must leave DB_MEM_RESERVE bytes free for the OS.
+//
+static int AggregateGrow( struct SDBAggregate *pAggregate )
+{
+	static char tempname[ DB_MAX_FNAME ];
+	static SDBFile dbTemp;
+	long slots, slot, newslot;
+	char* entry;
+	char* newentry;
+
+	slots = pAggregate->lSlots * 2L;
+	if( ( pAggregate->lMaxSlots != 0L && slots > pAggregate->lMaxSlots ) ||
+		(long)coreleft() - slots * pAggregate->dbTable.sRecSz < DB_MEM_RESERVE )
+	{
+		lErrorCode = DB_ERROR_AGGREGATE_FULL;
+		return FALSE;
+	}
+	lErrorCode = DB_OK;
+	entry = pAggregate->pEntry;
+	newentry = pAggregate->pEntry + pAggregate->dbTable.sRecSz;
+	MakeFileName( pAggregate->szFileName, "tmg", tempname );
+	if( MakeAggregateFile( tempname, pAggregate, slots, &dbTemp ))
+	{
+		for( slot = 0L; slot < pAggregate->lSlots; slot++ )
+		{
+			if( !GotoRecord( &pAggregate->dbTable, slot + pAggregate->sHdrRecs ) ||
+				!ReadCurrentRecord( &pAggregate->dbTable, entry ))
+				break;
+			if( GetLong( entry + pAggregate->sKeySz + AGG_WRITES ) == 0L )
+				continue;
+			if( !AggregateProbe( &dbTemp, pAggregate, slots, entry, newentry, &newslot ) ||
+				!GotoRecord( &dbTemp, newslot + pAggregate->sHdrRecs ) || !WriteRecord( &dbTemp, entry, WRITE_OVER ))
+				break;
+		}
+	}
+	if( GetDBErrorCode() == DB_OK )
+		FlushDatabase( &dbTemp );
+	if( GetDBErrorCode() != DB_OK )
+	{
+		slot = lErrorCode;
+		CloseDatabase( &dbTemp );
+		remove( tempname );
+		lErrorCode = slot;
+		return FALSE;
+	}
+	CloseDatabase( &dbTemp );
+
+	//
+	// The cache holds blocks of the old file
+	//
+	if( !FlushCache( &pAggregate->dbTable ))
+		return FALSE;
+	InvalidateCache( &pAggregate->dbTable );
+	if( !ReplaceDatabaseFile( &pAggregate->dbTable, tempname ))
+		return FALSE;
+	pAggregate->dbTable.lTotalRecords = slots + pAggregate->sHdrRecs;
+	pAggregate->lSlots = slots;
+	return TRUE;
+}
+
+static void AggregateClear( struct SDBAggregate *pAggregate )
+{
+	pAggregate->lKeys = 0L;
+	pAggregate->lLiveKeys = 0L;
+	pAggregate->lBucket = -1L;
+	pAggregate->lBucketKeys = 0L;
+}
+
+//
+// The keys do not fit, the table file is removed and the aggregate is not made again
+// with a pass over the database for every query
+//
+static void AggregateStop( struct SDBAggregate *pAggregate )
+{
+	if( pAggregate->dbTable.bOpen )
+	{
+		CloseDatabase( &pAggregate->dbTable );
+		remove( pAggregate->szFileName );
+	}
+	pAggregate->lSlots = 0L;
+	AggregateClear( pAggregate );
+	pAggregate->lGeneration = -1L;
+	pAggregate->bFull = TRUE;
+	pAggregate->bDirty = FALSE;
+	pAggregate->bDirtyOnDisk = FALSE;
+}
+
+//
+// Adding or removing a record failed, a full table stops the aggregate, after another error
+// it is made again when it is used
+//
+static void AggregateFailed( struct SDBAggregate *pAggregate )
+{
+	if( GetDBErrorCode() == DB_ERROR_AGGREGATE_FULL )
+		AggregateStop( pAggregate );
+	else
+		pAggregate->lGeneration = -1L;
+}
+
+//
+// A key with records and last value last is counted (step 1) or not counted anymore (step -1)
+//
+static void AggregateCount( struct SDBAggregate *pAggregate, long last, int step )
+{
+	long bucket;
+
+	bucket = last / pAggregate->lBucketSize;
+	pAggregate->lLiveKeys += step;
+	if( step > 0 && bucket > pAggregate->lBucket )
+	{
+		pAggregate->lBucket = bucket;
+		pAggregate->lBucketKeys = 0L;
+	}
+	if( bucket == pAggregate->lBucket )
+		pAggregate->lBucketKeys += step;
+}
+
+//
+// Count a written record, returns FALSE when the table can not grow or on a file error
+//
+static int AggregateAdd( struct SDBAggregate *pAggregate, char* record )
+{
+	long slot, value, records, writes, last;
+	char* entry;
+
+	if( !AggregateChange( pAggregate ))
+		return FALSE;
+	if( (pAggregate->lKeys + 1L) * 4L > pAggregate->lSlots * 3L && !AggregateGrow( pAggregate ))
+		return FALSE;
+	entry = pAggregate->pEntry;
+	if( !AggregateProbe( &pAggregate->dbTable, pAggregate, pAggregate->lSlots, record + pAggregate->sOffset, entry, &slot ))
+		return FALSE;
+	value = GetLong( record + pAggregate->sValueOffset );
+	records = GetLong( entry + pAggregate->sKeySz + AGG_RECORDS );
+	writes = GetLong( entry + pAggregate->sKeySz + AGG_WRITES );
+	last = GetLong( entry + pAggregate->sKeySz + AGG_LAST );
+	if( writes == 0L )
+	{
+		memcpy( entry, record + pAggregate->sOffset, pAggregate->sKeySz );
+		pAggregate->lKeys++;
+	}
+	if( records > 0L )
+	{
+		if( value > last )
+		{
+			AggregateCount( pAggregate, last, -1 );
+			last = value;
+			AggregateCount( pAggregate, last, 1 );
+		}
+	}
+	else
+	{
+		last = value;
+		AggregateCount( pAggregate, last, 1 );
+	}
+	PutLong( entry + pAggregate->sKeySz + AGG_RECORDS, records + 1L );
+	PutLong( entry + pAggregate->sKeySz + AGG_WRITES, writes + 1L );
+	PutLong( entry + pAggregate->sKeySz + AGG_LAST, last );
+	return AggregateStore( pAggregate, slot, entry );
+}
+
+//
+// A record is removed or overwritten, its last value stays when the key has other records
+//
+static int AggregateRemove( struct SDBAggregate *pAggregate, char* record )
+{
+	long slot, records;
+	char* entry;
+
+	entry = pAggregate->pEntry;
+	if( !AggregateProbe( &pAggregate->dbTable, pAggregate, pAggregate->lSlots, record + pAggregate->sOffset, entry, &slot ))
+		return FALSE;
+	if( (records = GetLong( entry + pAggregate->sKeySz + AGG_RECORDS )) == 0L )
+		return TRUE;
+	if( !AggregateChange( pAggregate ))
+		return FALSE;
+	if( --records == 0L )
+		AggregateCount( pAggregate, GetLong( entry + pAggregate->sKeySz + AGG_LAST ), -1 );
+	PutLong( entry + pAggregate->sKeySz + AGG_RECORDS, records );
+	return AggregateStore( pAggregate, slot, entry );
+}
+
+//
+// Make the table from all records that are not deleted, in a new file of AGGREGATE_SLOTS slots
+//
+static int BuildAggregate( SDBFile *dbFile, struct SDBAggregate *pAggregate )
+{
+	long recno;
+
+	if( pAggregate->dbTable.bOpen )
+		CloseDatabase( &pAggregate->dbTable );
+	AggregateClear( pAggregate );
+	pAggregate->lGeneration = -1L;
+	pAggregate->bHold = FALSE;
+	pAggregate->bFull = FALSE;
+	pAggregate->bDirty = TRUE;
+	pAggregate->bDirtyOnDisk = TRUE;
+	pAggregate->lSlots = AGGREGATE_SLOTS;
+	if( !MakeAggregateFile( pAggregate->szFileName, pAggregate, AGGREGATE_SLOTS, &pAggregate->dbTable ))
+	{
+		AggregateFailed( pAggregate );
+		return FALSE;
+	}
+	for( recno = 0L; recno < dbFile->lTotalRecords; recno++ )
+	{
+		if( !GotoRecord( dbFile, recno ) || !ReadCurrentRecord( dbFile, pAggregate->pRecord ))
+			return FALSE;
+		if( !IsDeleted( dbFile, pAggregate->pRecord ) && !AggregateAdd( pAggregate, pAggregate->pRecord ))
+		{
+			AggregateFailed( pAggregate );
+			return FALSE;
+		}
+	}
+	pAggregate->lGeneration = dbFile->pHeader->lGeneration;
+	return TRUE;
+}
+
+static int AggregateUpToDate( SDBFile *dbFile, struct SDBAggregate *pAggregate )
+{
+	if( dbFile->pHeader == NULL )
+	{
+		lErrorCode = DB_ERROR_NO_HEADER;
+		return FALSE;
+	}
+	if( pAggregate->bFull )
+	{
+		lErrorCode = DB_ERROR_AGGREGATE_FULL;
+		return FALSE;
+	}
+	if( pAggregate->lGeneration == dbFile->pHeader->lGeneration && pAggregate->dbTable.bOpen )
+		return TRUE;
+	return BuildAggregate( dbFile, pAggregate );
+}
+
+//
+// Open the table file, returns FALSE when there is no file that fits the database
+//
+static int LoadAggregate( SDBFile *dbFile, struct SDBAggregate *pAggregate )
+{
+	char* header;
+	long slots;
+	short i;
+	int ok;
+
+	if( !OpenDatabase( pAggregate->szFileName, AggregateRecordSize( pAggregate->sKeySz ), &pAggregate->dbTable ))
+	{
+		lErrorCode = DB_OK;
+		return FALSE;
+	}
+	SetDatabaseCache( &pAggregate->dbTable, DB_CACHE_BLOCKS, DB_CACHE_RECORDS );
+	header = pAggregate->pHeader;
+	ok = TRUE;
+	for( i = 0; ok && i < pAggregate->sHdrRecs; i++ )
+		ok = GotoRecord( &pAggregate->dbTable, (long)i ) &&
+			 ReadCurrentRecord( &pAggregate->dbTable, header + i * pAggregate->dbTable.sRecSz );
+	slots = GetLong( header + 20 );
+	ok = ok && memcmp( header, AGGREGATE_MAGIC, 4 ) == 0 &&
+		 (((unsigned char)header[ 4 ] << 8) | (unsigned char)header[ 5 ]) == pAggregate->sOffset &&
+		 (((unsigned char)header[ 6 ] << 8) | (unsigned char)header[ 7 ]) == pAggregate->sKeySz &&
+		 (((unsigned char)header[ 8 ] << 8) | (unsigned char)header[ 9 ]) == pAggregate->sValueOffset &&
+		 GetLong( header + 12 ) == pAggregate->lBucketSize && GetLong( header + 16 ) == dbFile->pHeader->lGeneration &&
+		 slots >= AGGREGATE_SLOTS && ( slots & ( slots - 1L )) == 0L &&
+		 slots + pAggregate->sHdrRecs == pAggregate->dbTable.lTotalRecords;
+	lErrorCode = DB_OK;
+	if( !ok )
+	{
+		CloseDatabase( &pAggregate->dbTable );
+		lErrorCode = DB_OK;
+		return FALSE;
+	}
+	pAggregate->lSlots = slots;
+	pAggregate->lKeys = GetLong( header + 24 );
+	pAggregate->lLiveKeys = GetLong( header + 28 );
+	pAggregate->lBucket = GetLong( header + 32 );
+	pAggregate->lBucketKeys = GetLong( header + 36 );
+	pAggregate->lGeneration = dbFile->pHeader->lGeneration;
+	pAggregate->bDirty = FALSE;
+	pAggregate->bDirtyOnDisk = FALSE;
+	return TRUE;
+}
+
+//
+// Write the changed slots and then the header with the generation they are up to date with
+//
+static int SaveOneAggregate( struct SDBAggregate *pAggregate )
+{
+	if( !pAggregate->bDirty || !pAggregate->dbTable.bOpen )
+		return TRUE;
+	if( !FlushDatabase( &pAggregate->dbTable ) ||
+		!WriteAggregateHeader( &pAggregate->dbTable, pAggregate, pAggregate->lSlots, pAggregate->lGeneration ) ||
+		!FlushDatabase( &pAggregate->dbTable ))
+		return FALSE;
+	pAggregate->bDirty = FALSE;
+	pAggregate->bDirtyOnDisk = ( pAggregate->lGeneration == -1L );
+	return TRUE;
+}
+
+static int SaveAggregate( SDBFile *dbFile )
+{
+	struct SDBAggregate *pAggregate;
+
+	for( pAggregate = dbFile->pAggregate; pAggregate != NULL; pAggregate = pAggregate->pNext )
+		if( !SaveOneAggregate( pAggregate ))
+			return FALSE;
+	return TRUE;
+}
+
+static void FreeOneAggregate( struct SDBAggregate *pAggregate )
+{
+	if( pAggregate->dbTable.bOpen )
+		CloseDatabase( &pAggregate->dbTable );
+	free( pAggregate->pRecord );
+	free( pAggregate );
+}
+
+static void FreeAggregate( SDBFile *dbFile )
+{
+	struct SDBAggregate *pAggregate;
+
+	while( (pAggregate = dbFile->pAggregate) != NULL )
+	{
+		dbFile->pAggregate = pAggregate->pNext;
+		FreeOneAggregate( pAggregate );
+	}
+}
+
+//
+// The current record is overwritten by WriteRecord(), keep it for AggregateWrite()
+//
+static void AggregateOverwrite( SDBFile *dbFile )
+{
+	struct SDBAggregate *pAggregate;
+	char* old;
+	long recno, errorcode;
+
+	if( dbFile->pAggregate == NULL )
+		return;
+	errorcode = lErrorCode;
+	recno = GetCurrentRecord( dbFile );
+	old = NULL;
+	for( pAggregate = dbFile->pAggregate; pAggregate != NULL; pAggregate = pAggregate->pNext )
+	{
+		pAggregate->bOld = FALSE;
+		if( pAggregate->lGeneration == -1L || pAggregate->bHold || recno == -1L || recno == pAggregate->lInsert )
+			continue;
+		//
+		// The record is read once for all aggregates
+		//
+		if( old != NULL )
+			memcpy( pAggregate->pRecord, old, dbFile->sRecSz );
+		else if( !ReadRecordAt( dbFile, recno, pAggregate->pRecord ))
+		{
+			pAggregate->lGeneration = -1L;
+			continue;
+		}
+		old = pAggregate->pRecord;
+		pAggregate->bOld = TRUE;
+	}
+	lErrorCode = errorcode;
+}
+
+//
+// Keep the aggregates up to date after a record was written, called after HeaderWrite
+//
+static void AggregateWrite( SDBFile *dbFile, char* record, int bAppend )
+{
+	struct SDBAggregate *pAggregate;
+	long errorcode;
+
+	errorcode = lErrorCode;
+	for( pAggregate = dbFile->pAggregate; pAggregate != NULL; pAggregate = pAggregate->pNext )
+	{
+		if( pAggregate->lGeneration == -1L )
+			continue;
+		//
+		// Only the aggregate that was up to date before this write can follow it
+		//
+		if( dbFile->pHeader == NULL || pAggregate->lGeneration + 1L != dbFile->pHeader->lGeneration )
+		{
+			pAggregate->lGeneration = -1L;
+			continue;
+		}
+		pAggregate->lGeneration = dbFile->pHeader->lGeneration;
+		pAggregate->bDirty = TRUE;
+		if( !pAggregate->bHold )
+		{
+			if( !bAppend && pAggregate->bOld && !IsDeleted( dbFile, pAggregate->pRecord ) &&
+				!AggregateRemove( pAggregate, pAggregate->pRecord ))
+				AggregateFailed( pAggregate );
+			else if( !IsDeleted( dbFile, record ) && !AggregateAdd( pAggregate, record ))
+				AggregateFailed( pAggregate );
+		}
+		pAggregate->bOld = FALSE;
+		pAggregate->lInsert = -1L;
+	}
+	lErrorCode = errorcode;
+}
+
+//
+// A record is inserted at recno, the next write of recno adds a record without removing one.
+// Called after HeaderInsert
+//
+static void AggregateInsert( SDBFile *dbFile, long recno )
+{
+	struct SDBAggregate *pAggregate;
+
+	for( pAggregate = dbFile->pAggregate; pAggregate != NULL; pAggregate = pAggregate->pNext )
+	{
+		if( pAggregate->lGeneration == -1L )
+			continue;
+		if( dbFile->pHeader == NULL || pAggregate->lGeneration + 1L != dbFile->pHeader->lGeneration )
+		{
+			pAggregate->lGeneration = -1L;
+			continue;
+		}
+		pAggregate->lGeneration = dbFile->pHeader->lGeneration;
+		pAggregate->lInsert = recno;
+	}
+}
+
+//
+// count records from first on, or the count record numbers in recordnumbers, are removed without
+// delete marker. They are taken off before they are moved, called after HeaderDelete and HeaderCompact
+//
+static void AggregateDelete( SDBFile *dbFile, long first, long count, long* recordnumbers )
+{
+	struct SDBAggregate *pAggregate;
+	char* record;
+	long i, recno, errorcode;
+	int live;
+
+	errorcode = lErrorCode;
+	live = FALSE;
+	for( pAggregate = dbFile->pAggregate; pAggregate != NULL; pAggregate = pAggregate->pNext )
+	{
+		if( pAggregate->lGeneration == -1L )
+			continue;
+		if( dbFile->pHeader == NULL || pAggregate->lGeneration + 1L != dbFile->pHeader->lGeneration )
+		{
+			pAggregate->lGeneration = -1L;
+			continue;
+		}
+		pAggregate->lGeneration = dbFile->pHeader->lGeneration;
+		pAggregate->bDirty = TRUE;
+		live = TRUE;
+	}
+	if( !live )
+		return;
+	record = (char*) malloc( dbFile->sRecSz );
+	for( i = 0L; record != NULL && i < count; i++ )
+	{
+		if( recordnumbers != NULL && i > 0L && recordnumbers[ i ] == recordnumbers[ i - 1L ] )
+			continue; // deleted twice
+		recno = ( recordnumbers != NULL )? recordnumbers[ i ] : first + i;
+		if( !ReadRecordAt( dbFile, recno, record ))
+			break;
+		if( IsDeleted( dbFile, record ))
+			continue;
+		for( pAggregate = dbFile->pAggregate; pAggregate != NULL; pAggregate = pAggregate->pNext )
+			if( pAggregate->lGeneration != -1L && !AggregateRemove( pAggregate, record ))
+				AggregateFailed( pAggregate );
+	}
+	//
+	// Without the removed records an aggregate is made again when it is used
+	//
+	if( record == NULL || i < count )
+		for( pAggregate = dbFile->pAggregate; pAggregate != NULL; pAggregate = pAggregate->pNext )
+			pAggregate->lGeneration = -1L;
+	if( record != NULL )
+		free( record );
+	lErrorCode = errorcode;
+}
+
+//
+// The records are reordered or deleted records are removed, the aggregates do not change.
+// Called after HeaderReorder, HeaderSetSorted and HeaderCompact
+//
+static void AggregateReorder( SDBFile *dbFile )
+{
+	struct SDBAggregate *pAggregate;
+
+	for( pAggregate = dbFile->pAggregate; pAggregate != NULL; pAggregate = pAggregate->pNext )
+	{
+		if( pAggregate->lGeneration == -1L || dbFile->pHeader == NULL )
+			continue;
+		if( pAggregate->lGeneration + 1L == dbFile->pHeader->lGeneration )
+		{
+			pAggregate->lGeneration = dbFile->pHeader->lGeneration;
+			pAggregate->bDirty = TRUE;
+		}
+		else if( pAggregate->lGeneration != dbFile->pHeader->lGeneration )
+			pAggregate->lGeneration = -1L;
+	}
+}
+
+//
+// A sort moves records with WriteRecord() (bHold TRUE) until it is done (bHold FALSE),
+// an aggregate is made again when the sort failed
+//
+static void AggregateHold( SDBFile *dbFile, int bHold )
+{
+	struct SDBAggregate *pAggregate;
+
+	for( pAggregate = dbFile->pAggregate; pAggregate != NULL; pAggregate = pAggregate->pNext )
+	{
+		pAggregate->bHold = bHold;
+		if( !bHold && lErrorCode != DB_OK )
+			pAggregate->lGeneration = -1L;
+	}
+}
+
+static struct SDBAggregate* FindAggregate( SDBFile *dbFile, short offset )
+{
+	struct SDBAggregate *pAggregate;
+
+	for( pAggregate = dbFile->pAggregate; pAggregate != NULL; pAggregate = pAggregate->pNext )
+		if( pAggregate->sOffset == offset )
+			break;
+	return pAggregate;
+}
+
+int SetAggregate( SDBFile *dbFile, short offset, short keysize, short valueoffset, long bucketsize, long maxkeys,
+				  const char* filename )
+{
+	struct SDBAggregate *pAggregate;
+	struct SDBAggregate **ppLink;
+	short recsz;
+
+	if( !IsFileOpen( dbFile ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return FALSE;
+	}
+	//
+	// An earlier aggregate on this field is saved and released first
+	//
+	for( ppLink = &dbFile->pAggregate; *ppLink != NULL; ppLink = &(*ppLink)->pNext )
+	{
+		if( (*ppLink)->sOffset != offset )
+			continue;
+		pAggregate = *ppLink;
+		if( !SaveOneAggregate( pAggregate ))
+			return FALSE;
+		*ppLink = pAggregate->pNext;
+		FreeOneAggregate( pAggregate );
+		break;
+	}
+	lErrorCode = DB_OK;
+	if( keysize <= 0 )
+		return TRUE;
+	if( dbFile->pHeader == NULL )
+	{
+		lErrorCode = DB_ERROR_NO_HEADER;
+		return FALSE;
+	}
+	if( dbFile->sRecSz < (keysize+offset) || dbFile->sRecSz < valueoffset + 4 || bucketsize <= 0L )
+	{
+		lErrorCode = DB_ERROR_SORTLENGTH;
+		return FALSE;
+	}
+	//
+	// The record buffer is followed by two slot buffers and the header records of the table file
+	//
+	recsz = AggregateRecordSize( keysize );
+	lErrorCode = DB_ERROR_MEM;
+	if( (pAggregate = (struct SDBAggregate*) malloc( sizeof( struct SDBAggregate ))) == NULL )
+		return FALSE;
+	memset( pAggregate, 0, sizeof( struct SDBAggregate ));
+	pAggregate->sHdrRecs = (short)(( AGGREGATE_HDRSZ + recsz - 1 ) / recsz);
+	if( (pAggregate->pRecord = (char*) malloc( dbFile->sRecSz + ( 2 + pAggregate->sHdrRecs ) * recsz )) == NULL )
+	{
+		free( pAggregate );
+		return FALSE;
+	}
+	lErrorCode = DB_OK;
+	pAggregate->pEntry = pAggregate->pRecord + dbFile->sRecSz;
+	pAggregate->pHeader = pAggregate->pEntry + 2 * recsz;
+	pAggregate->sOffset = offset;
+	pAggregate->sKeySz = keysize;
+	pAggregate->sValueOffset = valueoffset;
+	pAggregate->lBucketSize = bucketsize;
+	if( maxkeys > 0L )
+		for( pAggregate->lMaxSlots = AGGREGATE_SLOTS; pAggregate->lMaxSlots * 3L < (maxkeys + 1L) * 4L; pAggregate->lMaxSlots *= 2L )
+			;
+	pAggregate->lGeneration = -1L;
+	pAggregate->lInsert = -1L;
+	pAggregate->lBucket = -1L;
+	pAggregate->dbTable.fd = -1;
+	strncpy( pAggregate->szFileName, filename, DB_MAX_FNAME - 1 );
+	pAggregate->pNext = dbFile->pAggregate;
+	dbFile->pAggregate = pAggregate;
+	//
+	// The aggregate of an earlier session is used when nothing changed since it was saved,
+	// else it is made now so the writes from now on are counted
+	//
+	if( LoadAggregate( dbFile, pAggregate ))
+		return TRUE;
+	if( BuildAggregate( dbFile, pAggregate ))
+		return SaveAggregate( dbFile );
+	return FALSE;
+}
+
+long GetAggregate( SDBFile *dbFile, short offset, char* key, long* writes, long* last )
+{
+	struct SDBAggregate *pAggregate;
+	long slot, records;
+	char* entry;
+
+	*writes = 0L;
+	*last = 0L;
+	if( !IsFileOpen( dbFile ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return -1L;
+	}
+	if( (pAggregate = FindAggregate( dbFile, offset )) == NULL )
+	{
+		lErrorCode = DB_ERROR_NOT_FOUND;
+		return -1L;
+	}
+	if( !AggregateUpToDate( dbFile, pAggregate ))
+		return -1L;
+	entry = pAggregate->pEntry;
+	if( !AggregateProbe( &pAggregate->dbTable, pAggregate, pAggregate->lSlots, key, entry, &slot ))
+		return -1L;
+	*writes = GetLong( entry + pAggregate->sKeySz + AGG_WRITES );
+	if( (records = GetLong( entry + pAggregate->sKeySz + AGG_RECORDS )) == 0L )
+	{
+		lErrorCode = DB_ERROR_NOT_FOUND;
+		return 0L;
+	}
+	*last = GetLong( entry + pAggregate->sKeySz + AGG_LAST );
+	return records;
+}
+
+long CountAggregateKeys( SDBFile *dbFile, short offset, long bucket )
+{
+	struct SDBAggregate *pAggregate;
+	long slot, count;
+	char* entry;
+
+	if( !IsFileOpen( dbFile ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return -1L;
+	}
+	if( (pAggregate = FindAggregate( dbFile, offset )) == NULL )
+	{
+		lErrorCode = DB_ERROR_NOT_FOUND;
+		return -1L;
+	}
+	if( !AggregateUpToDate( dbFile, pAggregate ))
+		return -1L;
+	if( bucket == -1L )
+		return pAggregate->lLiveKeys;
+	if( bucket == pAggregate->lBucket )
+		return pAggregate->lBucketKeys;
+	if( bucket > pAggregate->lBucket )
+		return 0L;
+	//
+	// An older bucket is counted in the table file
+	//
+	entry = pAggregate->pEntry;
+	count = 0L;
+	for( slot = 0L; slot < pAggregate->lSlots; slot++ )
+	{
+		if( !GotoRecord( &pAggregate->dbTable, slot + pAggregate->sHdrRecs ) ||
+			!ReadCurrentRecord( &pAggregate->dbTable, entry ))
+			return -1L;
+		if( GetLong( entry + pAggregate->sKeySz + AGG_RECORDS ) > 0L &&
+			GetLong( entry + pAggregate->sKeySz + AGG_LAST ) / pAggregate->lBucketSize == bucket )
+			count++;
+	}
+	return count;
+}
+
+// ++++++++++++++++++++++++++++++++++++++
+// Partition functions
+// ++++++++++++++++++++++++++++++++++++++
+
+//
+// A partitioned database splits its records over partition files on a 32 bit value in the record,
+// e.g. one file per day of a time stamp, and optionally at most a number of records per file.
+// The partition files are named after the database: the first 4 characters of the name, the number
+// of the partition as 4 hex digits and the extension, e.g. data.dat -> data0001.dat.
+// The catalog file (extension cat) holds the lowest and highest value of every partition, a query
+// or search on a range of values only opens the partitions with values in the range.
+//
+// The catalog file is saved by FlushPartitions(), ClosePartitions() and when partitions are
+// made, sorted or removed:
+//
+//		"PRT1", record size (2 bytes), value offset (2 bytes), bucket size (4 bytes), maximum records (4 bytes),
+//		sort offset (2 bytes), sort size (2 bytes), partitions (4 bytes), next partition number (4 bytes),
+//		and for every partition: number, bucket, lowest value, highest value, records, sorted (4 bytes each)
+//
+#define PARTITION_MAGIC		"PRT1"
+#define PARTITION_HDRSZ		28
+#define PARTITION_ENTRYSZ	24
+#define PARTITION_ALLOC		16		// partitions allocated at once in the catalog
+#define PARTITION_PREFIX	4		// characters of the database name in a partition name
+
+struct SDBPartition
+{
+	long	lNumber;			// number in the name of the partition file
+	long	lBucket;			// value / bucket size of its records, 0 when not partitioned on the value
+	long	lLow;				// lowest value in the partition
+	long	lHigh;				// highest value in the partition
+	long	lRecords;			// amount of records in the partition
+	int		bSorted;			// sorted on the key of SortPartitions()
+};
+
+static int IsPartitionsOpen( SDBPartitions *dbParts )
+{
+	lErrorCode = DB_OK;
+	return (dbParts->bOpen == TRUE)?TRUE:FALSE;
+}
+
+//
+// Name of a partition file, e.g. data.dat and partition 1 -> data0001.dat
+//
+static void MakePartitionName( const char* filename, long number, char* partname )
+{
+	const char* dot;
+	int prefix;
+
+	if( (dot = strrchr( filename, '.' )) == NULL )
+		dot = filename + strlen( filename );
+	prefix = (int)( dot - filename );
+	if( prefix > PARTITION_PREFIX )
+		prefix = PARTITION_PREFIX;
+	sprintf( partname, "%.*s%04lX%.4s", prefix, filename, number & 0xFFFFL, dot );
+}
+
+static long PartitionValue( SDBPartitions *dbParts, char* record )
+{
+	return GetLong( record + dbParts->sOffset );
+}
+
+static long PartitionBucket( SDBPartitions *dbParts, long value )
+{
+	return ( dbParts->lBucketSize > 0L )? value / dbParts->lBucketSize : 0L;
+}
+
+static int SaveCatalog( SDBPartitions *dbParts )
+{
+	char catalogname[ DB_MAX_FNAME ];
+	char buffer[ PARTITION_HDRSZ ];
+	struct SDBPartition *pPart;
+	long i;
+	int fd, ok;
+
+	MakeFileName( dbParts->szFileName, "cat", catalogname );
+	memset( buffer, 0, sizeof( buffer ));
+	memcpy( buffer, PARTITION_MAGIC, 4 );
+	buffer[ 4 ] = (char)(dbParts->sRecSz >> 8);
+	buffer[ 5 ] = (char)dbParts->sRecSz;
+	buffer[ 6 ] = (char)(dbParts->sOffset >> 8);
+	buffer[ 7 ] = (char)dbParts->sOffset;
+	PutLong( buffer + 8, dbParts->lBucketSize );
+	PutLong( buffer + 12, dbParts->lMaxRecords );
+	buffer[ 16 ] = (char)(dbParts->sSortOffset >> 8);
+	buffer[ 17 ] = (char)dbParts->sSortOffset;
+	buffer[ 18 ] = (char)(dbParts->sSortSz >> 8);
+	buffer[ 19 ] = (char)dbParts->sSortSz;
+	PutLong( buffer + 20, dbParts->lPartitions );
+	PutLong( buffer + 24, dbParts->lNextNumber );
+	if( (fd = open( catalogname, O_RDWR | O_BINARY | O_CREAT | O_TRUNC, 0x0 )) == -1 )
+	{
+		lErrorCode = DB_ERROR_CREATE;
+		return FALSE;
+	}
+	ok = WriteAt( fd, 0L, buffer, PARTITION_HDRSZ );
+	for( i = 0L; ok && i < dbParts->lPartitions; i++ )
+	{
+		pPart = dbParts->pParts + i;
+		PutLong( buffer, pPart->lNumber );
+		PutLong( buffer + 4, pPart->lBucket );
+		PutLong( buffer + 8, pPart->lLow );
+		PutLong( buffer + 12, pPart->lHigh );
+		PutLong( buffer + 16, pPart->lRecords );
+		PutLong( buffer + 20, (long)pPart->bSorted );
+		ok = WriteAt( fd, PARTITION_HDRSZ + i * PARTITION_ENTRYSZ, buffer, PARTITION_ENTRYSZ );
+	}
+	close( fd );
+	if( ok )
+		dbParts->bDirty = FALSE;
+	return ok;
+}
+
+//
+// Make room in the catalog for one more partition
+//
+static int GrowCatalog( SDBPartitions *dbParts )
+{
+	struct SDBPartition *pParts;
+
+	if( dbParts->lPartitions < dbParts->lAllocated )
+		return TRUE;
+	if( (pParts = (struct SDBPartition*) malloc( (unsigned int)(( dbParts->lAllocated + PARTITION_ALLOC ) * sizeof( struct SDBPartition )) )) == NULL )
+	{
+		lErrorCode = DB_ERROR_MEM;
+		return FALSE;
+	}
+	if( dbParts->pParts != NULL )
+	{
+		memcpy( pParts, dbParts->pParts, (unsigned int)(dbParts->lPartitions * sizeof( struct SDBPartition )) );
+		free( dbParts->pParts );
+	}
+	dbParts->pParts = pParts;
+	dbParts->lAllocated += PARTITION_ALLOC;
+	return TRUE;
+}
+
+//
+// Records written or removed with dbPart are counted in the catalog
+//
+static void CountPartition( SDBPartitions *dbParts )
+{
+	struct SDBPartition *pPart;
+
+	if( dbParts->lCurrent == -1L )
+		return;
+	pPart = dbParts->pParts + dbParts->lCurrent;
+	if( pPart->lRecords != dbParts->dbPart.lTotalRecords )
+	{
+		pPart->lRecords = dbParts->dbPart.lTotalRecords;
+		pPart->bSorted = FALSE;
+		dbParts->bDirty = TRUE;
+	}
+}
+
+//
+// Close the open partition
+//
+static int ReleasePartition( SDBPartitions *dbParts )
+{
+	int ok;
+
+	if( dbParts->lCurrent == -1L )
+		return TRUE;
+	CountPartition( dbParts );
+	ok = FlushDatabase( &dbParts->dbPart );
+	CloseDatabase( &dbParts->dbPart );
+	dbParts->lCurrent = -1L;
+	return ok;
+}
+
+//
+// Open partition number partition in dbPart, bCreate makes a new partition file
+//
+static int OpenPartition( SDBPartitions *dbParts, long partition, int bCreate )
+{
+	char partname[ DB_MAX_FNAME ];
+	int ok;
+
+	if( dbParts->lCurrent == partition )
+		return TRUE;
+	if( !ReleasePartition( dbParts ))
+		return FALSE;
+	MakePartitionName( dbParts->szFileName, dbParts->pParts[ partition ].lNumber, partname );
+	if( bCreate )
+		ok = CreateDatabase( partname, dbParts->sRecSz, &dbParts->dbPart );
+	else
+		ok = OpenDatabase( partname, dbParts->sRecSz, &dbParts->dbPart );
+	if( !ok )
+		return FALSE;
+	// The records of a partition are mostly read one after the other
+	SetDatabaseCache( &dbParts->dbPart, DB_CACHE_BLOCKS, DB_CACHE_RECORDS );
+	lErrorCode = DB_OK;
+	dbParts->lCurrent = partition;
+	return TRUE;
+}
+
+//
+// Count the records of a partition and find its lowest and highest value again,
+// used when the catalog was not saved after the partition changed
+//
+static int RescanPartition( SDBPartitions *dbParts, long partition )
+{
+	struct SDBPartition *pPart;
+	char* record;
+	long recno, value;
+
+	if( (record = (char*) malloc( dbParts->sRecSz )) == NULL )
+	{
+		lErrorCode = DB_ERROR_MEM;
+		return FALSE;
+	}
+	if( !OpenPartition( dbParts, partition, FALSE ))
+	{
+		free( record );
+		return FALSE;
+	}
+	pPart = dbParts->pParts + partition;
+	pPart->lRecords = dbParts->dbPart.lTotalRecords;
+	pPart->bSorted = FALSE;
+	for( recno = 0L; recno < pPart->lRecords; recno++ )
+	{
+		if( !GotoRecord( &dbParts->dbPart, recno ) || !ReadCurrentRecord( &dbParts->dbPart, record ))
+			break;
+		value = PartitionValue( dbParts, record );
+		if( recno == 0L || value < pPart->lLow )
+			pPart->lLow = value;
+		if( recno == 0L || value > pPart->lHigh )
+			pPart->lHigh = value;
+	}
+	free( record );
+	dbParts->bDirty = TRUE;
+	return recno == pPart->lRecords;
+}
+
+static int LoadCatalog( SDBPartitions *dbParts )
+{
+	char catalogname[ DB_MAX_FNAME ];
+	char partname[ DB_MAX_FNAME ];
+	char buffer[ PARTITION_HDRSZ ];
+	struct SDBPartition *pPart;
+	long partitions, i, size;
+	int fd, ok;
+
+	partitions = 0L;
+	MakeFileName( dbParts->szFileName, "cat", catalogname );
+	if( (fd = open( catalogname, O_RDWR | O_BINARY, 0x777 )) == -1 )
+	{
+		lErrorCode = DB_ERROR_NOT_EXIST;
+		return FALSE;
+	}
+	ok = ReadAt( fd, 0L, buffer, PARTITION_HDRSZ );
+	if( ok && !( memcmp( buffer, PARTITION_MAGIC, 4 ) == 0 &&
+				 (((unsigned char)buffer[ 4 ] << 8) | (unsigned char)buffer[ 5 ]) == dbParts->sRecSz &&
+				 (((unsigned char)buffer[ 6 ] << 8) | (unsigned char)buffer[ 7 ]) == dbParts->sOffset &&
+				 GetLong( buffer + 8 ) == dbParts->lBucketSize && GetLong( buffer + 12 ) == dbParts->lMaxRecords ))
+	{
+		lErrorCode = DB_ERROR_RECORD_SIZE;
+		ok = FALSE;
+	}
+	if( ok )
+	{
+		dbParts->sSortOffset = (short)(((unsigned char)buffer[ 16 ] << 8) | (unsigned char)buffer[ 17 ]);
+		dbParts->sSortSz = (short)(((unsigned char)buffer[ 18 ] << 8) | (unsigned char)buffer[ 19 ]);
+		partitions = GetLong( buffer + 20 );
+		dbParts->lNextNumber = GetLong( buffer + 24 );
+	}
+	for( i = 0L; ok && i < partitions; i++ )
+	{
+		if( !ReadAt( fd, PARTITION_HDRSZ + i * PARTITION_ENTRYSZ, buffer, PARTITION_ENTRYSZ ) || !GrowCatalog( dbParts ))
+		{
+			ok = FALSE;
+			break;
+		}
+		pPart = dbParts->pParts + dbParts->lPartitions;
+		pPart->lNumber = GetLong( buffer );
+		pPart->lBucket = GetLong( buffer + 4 );
+		pPart->lLow = GetLong( buffer + 8 );
+		pPart->lHigh = GetLong( buffer + 12 );
+		pPart->lRecords = GetLong( buffer + 16 );
+		pPart->bSorted = (int)GetLong( buffer + 20 );
+		//
+		// A partition file that was removed is dropped from the catalog
+		//
+		MakePartitionName( dbParts->szFileName, pPart->lNumber, partname );
+		if( (size = fsize( partname )) == -1L )
+		{
+			dbParts->bDirty = TRUE;
+			continue;
+		}
+		dbParts->lPartitions++;
+		//
+		// Records written after the catalog was saved are counted again
+		//
+		if( size != pPart->lRecords * dbParts->sRecSz && !RescanPartition( dbParts, dbParts->lPartitions - 1L ))
+			ok = FALSE;
+	}
+	close( fd );
+	return ok;
+}
+
+int OpenPartitions( const char *filename, short recordsize, short offset, long bucketsize, long maxrecords, SDBPartitions *dbParts )
+{
+	long error;
+
+	if( dbParts->bOpen == TRUE )
+	{
+		lErrorCode = DB_ERROR_ALREADY_OPEN;
+		return FALSE;
+	}
+	if( recordsize < offset + 4 || bucketsize < 0L || maxrecords < 0L )
+	{
+		lErrorCode = DB_ERROR_SORTLENGTH;
+		return FALSE;
+	}
+	memset( dbParts, 0, sizeof( SDBPartitions ));
+	strncpy( dbParts->szFileName, filename, DB_MAX_FNAME - 1 );
+	dbParts->sRecSz = recordsize;
+	dbParts->sOffset = offset;
+	dbParts->lBucketSize = bucketsize;
+	dbParts->lMaxRecords = maxrecords;
+	dbParts->lNextNumber = 1L;
+	dbParts->lCurrent = -1L;
+	dbParts->bOpen = TRUE;
+	//
+	// Without catalog the database has no partitions yet
+	//
+	if( LoadCatalog( dbParts ))
+	{
+		lErrorCode = DB_OK;
+		return !dbParts->bDirty || SaveCatalog( dbParts );
+	}
+	if( lErrorCode == DB_ERROR_NOT_EXIST && SaveCatalog( dbParts ))
+		return TRUE;
+	//
+	// A catalog that does not fit is left as it is
+	//
+	error = lErrorCode;
+	dbParts->bDirty = FALSE;
+	ClosePartitions( dbParts );
+	lErrorCode = error;
+	return FALSE;
+}
+
+void ClosePartitions( SDBPartitions *dbParts )
+{
+	if( !IsPartitionsOpen( dbParts ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return;
+	}
+	ReleasePartition( dbParts );
+	if( dbParts->bDirty )
+		SaveCatalog( dbParts );
+	if( dbParts->pParts != NULL )
+		free( dbParts->pParts );
+	dbParts->pParts = NULL;
+	dbParts->lPartitions = 0L;
+	dbParts->lAllocated = 0L;
+	dbParts->bOpen = FALSE;
+}
+
+int FlushPartitions( SDBPartitions *dbParts )
+{
+	if( !IsPartitionsOpen( dbParts ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return FALSE;
+	}
+	CountPartition( dbParts );
+	if( dbParts->lCurrent != -1L && !FlushDatabase( &dbParts->dbPart ))
+		return FALSE;
+	return !dbParts->bDirty || SaveCatalog( dbParts );
+}
+
+int WritePartitionRecord( SDBPartitions *dbParts, char* record )
+{
+	struct SDBPartition *pPart;
+	long value, bucket, partition;
+
+	if( !IsPartitionsOpen( dbParts ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return FALSE;
+	}
+	value = PartitionValue( dbParts, record );
+	bucket = PartitionBucket( dbParts, value );
+	//
+	// The newest partition of the bucket that is not full takes the record,
+	// mostly the last partition so it is already open
+	//
+	for( partition = dbParts->lPartitions - 1L; partition >= 0L; partition-- )
+	{
+		pPart = dbParts->pParts + partition;
+		if( pPart->lBucket == bucket && ( dbParts->lMaxRecords == 0L || pPart->lRecords < dbParts->lMaxRecords ))
+			break;
+	}
+	if( partition == -1L )
+	{
+		if( !ReleasePartition( dbParts ) || !GrowCatalog( dbParts ))
+			return FALSE;
+		partition = dbParts->lPartitions;
+		pPart = dbParts->pParts + partition;
+		memset( pPart, 0, sizeof( struct SDBPartition ));
+		pPart->lNumber = dbParts->lNextNumber;
+		pPart->lBucket = bucket;
+		pPart->lLow = value;
+		pPart->lHigh = value;
+		if( !OpenPartition( dbParts, partition, TRUE ))
+			return FALSE;
+		dbParts->lPartitions++;
+		dbParts->lNextNumber = ( dbParts->lNextNumber & 0xFFFFL ) + 1L;
+		//
+		// The new partition is in the catalog before it holds records
+		//
+		if( !SaveCatalog( dbParts ))
+			return FALSE;
+	}
+	else if( !OpenPartition( dbParts, partition, FALSE ))
+		return FALSE;
+	pPart = dbParts->pParts + partition;
+	if( !WriteRecord( &dbParts->dbPart, record, WRITE_APPEND ))
+		return FALSE;
+	if( value < pPart->lLow || pPart->lRecords == 0L )
+		pPart->lLow = value;
+	if( value > pPart->lHigh || pPart->lRecords == 0L )
+		pPart->lHigh = value;
+	pPart->lRecords = dbParts->dbPart.lTotalRecords;
+	pPart->bSorted = FALSE;
+	dbParts->bDirty = TRUE;
+	return TRUE;
+}
+
+long GetPartitionCount( SDBPartitions *dbParts )
+{
+	if( !IsPartitionsOpen( dbParts ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return -1L;
+	}
+	return dbParts->lPartitions;
+}
+
+long GetPartitionInfo( SDBPartitions *dbParts, long partition, long* low, long* high )
+{
+	struct SDBPartition *pPart;
+
+	if( !IsPartitionsOpen( dbParts ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return -1L;
+	}
+	if( partition < 0L || partition >= dbParts->lPartitions )
+	{
+		lErrorCode = DB_ERROR_INVALID_REC_NO;
+		return -1L;
+	}
+	CountPartition( dbParts );
+	pPart = dbParts->pParts + partition;
+	*low = pPart->lLow;
+	*high = pPart->lHigh;
+	return pPart->lRecords;
+}
+
+int SelectPartition( SDBPartitions *dbParts, long partition )
+{
+	if( !IsPartitionsOpen( dbParts ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return FALSE;
+	}
+	if( partition < 0L || partition >= dbParts->lPartitions )
+	{
+		lErrorCode = DB_ERROR_INVALID_REC_NO;
+		return FALSE;
+	}
+	return OpenPartition( dbParts, partition, FALSE );
+}
+
+//
+// Partitions with values from fromvalue up to and including tovalue, the others are pruned
+//
+static int PartitionInRange( struct SDBPartition *pPart, long fromvalue, long tovalue )
+{
+	return pPart->lRecords > 0L && pPart->lHigh >= fromvalue && pPart->lLow <= tovalue;
+}
+
+long QueryPartitions( SDBPartitions *dbParts, long fromvalue, long tovalue, int (*callback)( char* record, long partition, long recordnumber ))
+{
+	char* record;
+	long partition, recno, value, count;
+	int ok;
+
+	if( !IsPartitionsOpen( dbParts ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return -1L;
+	}
+	if( (record = (char*) malloc( dbParts->sRecSz )) == NULL )
+	{
+		lErrorCode = DB_ERROR_MEM;
+		return -1L;
+	}
+	CountPartition( dbParts );
+	count = 0L;
+	ok = TRUE;
+	for( partition = 0L; ok && partition < dbParts->lPartitions; partition++ )
+	{
+		if( !PartitionInRange( dbParts->pParts + partition, fromvalue, tovalue ))
+			continue;
+		if( !OpenPartition( dbParts, partition, FALSE ))
+		{
+			free( record );
+			return -1L;
+		}
+		for( recno = 0L; ok && recno < dbParts->dbPart.lTotalRecords; recno++ )
+		{
+			if( !GotoRecord( &dbParts->dbPart, recno ) || !ReadCurrentRecord( &dbParts->dbPart, record ))
+			{
+				free( record );
+				return -1L;
+			}
+			value = PartitionValue( dbParts, record );
+			if( value < fromvalue || value > tovalue || IsDeleted( &dbParts->dbPart, record ))
+				continue;
+			count++;
+			ok = callback( record, partition, recno );
+		}
+	}
+	free( record );
+	lErrorCode = DB_OK;
+	return count;
+}
+
+long SearchPartitions( SDBPartitions *dbParts, char* record, char* searchkey, short offset, short keysize,
+					   long fromvalue, long tovalue, long* partition )
+{
+	struct SDBPartition *pPart;
+	long found;
+	long i;
+
+	if( !IsPartitionsOpen( dbParts ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return -1L;
+	}
+	CountPartition( dbParts );
+	//
+	// The newest partitions first, a key is mostly searched for in the recent records
+	//
+	for( i = dbParts->lPartitions - 1L; i >= 0L; i-- )
+	{
+		pPart = dbParts->pParts + i;
+		if( !PartitionInRange( pPart, fromvalue, tovalue ))
+			continue;
+		if( !OpenPartition( dbParts, i, FALSE ))
+			return -1L;
+		if( pPart->bSorted && dbParts->sSortOffset == offset && dbParts->sSortSz >= keysize )
+			found = BinarySearch( &dbParts->dbPart, record, searchkey, keysize, offset );
+		else
+			found = LineairSearch( &dbParts->dbPart, record, searchkey, keysize, offset );
+		if( found != -1L )
+		{
+			*partition = i;
+			return found;
+		}
+		if( lErrorCode != DB_ERROR_NOT_FOUND )
+			return -1L;
+	}
+	lErrorCode = DB_ERROR_NOT_FOUND;
+	return -1L;
+}
 
-	lErrorCode = DB_ERROR_MEM;
-	if( (temp1 = (char*) malloc( dbFile->sRecSz)) == NULL )
-		goto Clean1;
+int SortPartitions( SDBPartitions *dbParts, short offset, short checksize )
+{
+	struct SDBPartition *pPart;
+	long partition;
 
-	if( (temp2 = (char*) malloc( dbFile->sRecSz)) == NULL )
-		goto Clean2;
+	if( !IsPartitionsOpen( dbParts ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return FALSE;
+	}
+	if( dbParts->sRecSz < (checksize+offset) )
+	{
+		lErrorCode = DB_ERROR_SORTLENGTH;
+		return FALSE;
+	}
+	CountPartition( dbParts );
+	//
+	// Sorted on another key the partitions must all be sorted again
+	//
+	if( dbParts->sSortOffset != offset || dbParts->sSortSz != checksize )
+	{
+		for( partition = 0L; partition < dbParts->lPartitions; partition++ )
+			dbParts->pParts[ partition ].bSorted = FALSE;
+		dbParts->sSortOffset = offset;
+		dbParts->sSortSz = checksize;
+		dbParts->bDirty = TRUE;
+	}
+	//
+	// Only the partitions that changed are sorted, every sort is as large as one partition
+	//
+	for( partition = 0L; partition < dbParts->lPartitions; partition++ )
+	{
+		pPart = dbParts->pParts + partition;
+		if( pPart->bSorted )
+			continue;
+		if( pPart->lRecords > 1L && ( !OpenPartition( dbParts, partition, FALSE ) ||
+									  !SortDatabase( &dbParts->dbPart, offset, checksize )))
+			return FALSE;
+		pPart->bSorted = TRUE;
+		dbParts->bDirty = TRUE;
+	}
+	return FlushPartitions( dbParts );
+}
 
-	if( (temp3 = (char*) malloc( dbFile->sRecSz)) == NULL )
-		goto Clean3;
-	lErrorCode = DB_OK;
-	N = totalrecords;
-	for( k = N >> 1; k >= 1; k-- )
-		if( !downheap( dbFile, totalrecords, k, offset, checksize, temp1, temp2, temp3 ))
-			goto CleanAll;
-	while( N > 1 )
+int RemovePartition( SDBPartitions *dbParts, long partition )
+{
+	char partname[ DB_MAX_FNAME ];
+
+	if( !IsPartitionsOpen( dbParts ))
 	{
-		// swap the records in the database
-		if( !ReadFirstRecord( dbFile, temp1 ))
-			goto CleanAll;
-		if( !GotoRecord( dbFile, (N-1L) ))
-			goto CleanAll;
-		if( !ReadCurrentRecord( dbFile, temp2 ))
-			goto CleanAll;
-		if( !WriteRecord( dbFile, temp1, WRITE_OVER ))
-			goto CleanAll;
-		if( !GotoRecord( dbFile, 0L ))
-			goto CleanAll;
-		if( !WriteRecord( dbFile, temp2, WRITE_OVER ))
-			goto CleanAll;
-		N--;
-		if( !downheap( dbFile, N, 1, offset, checksize, temp1, temp2, temp3 ))
-			goto CleanAll;
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return FALSE;
 	}
-CleanAll:
-	free( temp3 );
-Clean3:
-	free( temp2 );
-Clean2:
-	free( temp1 );
-Clean1:
-	if( GetDBErrorCode() != DB_OK )
+	if( partition < 0L || partition >= dbParts->lPartitions )
+	{
+		lErrorCode = DB_ERROR_INVALID_REC_NO;
 		return FALSE;
-	return TRUE;
+	}
+	if( partition == dbParts->lCurrent && !ReleasePartition( dbParts ))
+		return FALSE;
+	if( dbParts->lCurrent > partition )
+		dbParts->lCurrent--;
+	MakePartitionName( dbParts->szFileName, dbParts->pParts[ partition ].lNumber, partname );
+	remove( partname );
+	memmove( dbParts->pParts + partition, dbParts->pParts + partition + 1L,
+			 (unsigned int)(( dbParts->lPartitions - partition - 1L ) * sizeof( struct SDBPartition )) );
+	dbParts->lPartitions--;
+	return SaveCatalog( dbParts );
 }
 
 //
-// Very fast sort function faster then heapsort but uses more resources
+// Is name a partition file of the database, the prefix followed by 4 hex digits
 //
-int QuickSort( SDBFile *dbFile, short offset, short checksize )
+static int IsPartitionName( const char* name, const char* prefix, int prefixlen )
 {
-	long totalrecords;
-	char* temp1;
-	char* temp2;
-	char* temp3;
-	long  l,r,s,i,j;
-	long* stackl;
-	long* stackr;
-	long n1;
-	int  n2;
+	int i;
 
-	if( ( totalrecords = GetTotalRecords( dbFile )) == -1L )
+	if( (int)strlen( name ) != prefixlen + 4 || strncmp( name, prefix, prefixlen ) != 0 )
 		return FALSE;
-
-	if( dbFile->sRecSz < (checksize+offset) )
+	for( i = prefixlen; i < prefixlen + 4; i++ )
 	{
-		lErrorCode = DB_ERROR_SORTLENGTH;
-		return FALSE;
+		if( !(( name[ i ] >= '0' && name[ i ] <= '9' ) || ( name[ i ] >= 'A' && name[ i ] <= 'F' ) || ( name[ i ] >= 'a' && name[ i ] <= 'f' )))
+			return FALSE;
 	}
-	lErrorCode = DB_ERROR_MEM;
-	if( (temp1 = (char*) malloc( dbFile->sRecSz)) == NULL )
-		goto Clean1;
+	return TRUE;
+}
 
-	if( (temp2 = (char*) malloc( dbFile->sRecSz)) == NULL )
-		goto Clean2;
+int RemovePartitionFiles( const char *filename )
+{
+	struct ffblk ffblk;
+	char pattern[ DB_MAX_FNAME ];
+	char partname[ DB_MAX_FNAME ];
+	char prefix[ PARTITION_PREFIX + 1 ];
+	const char* dot;
+	int prefixlen;
+	int found;
 
-	if( (temp3 = (char*) malloc( dbFile->sRecSz)) == NULL )
-		goto Clean3;
+	if( (dot = strrchr( filename, '.' )) == NULL )
+		dot = filename + strlen( filename );
+	prefixlen = (int)( dot - filename );
+	if( prefixlen > PARTITION_PREFIX )
+		prefixlen = PARTITION_PREFIX;
+	memcpy( prefix, filename, prefixlen );
+	prefix[ prefixlen ] = '\0';
 	//
-	// Calculate size for stack
+	// Also the partition files that are not in the catalog anymore, the search starts
+	// again after every removed file
 	//
-	n2 = 1;
-	n1 = totalrecords;
-	while( (n1 /= 10) != 0 )
-		n2++;
-	n2 *= 4;
-	n2 += 10;
+	sprintf( pattern, "%s*%.4s", prefix, dot );
+	found = ( findfirst( pattern, &ffblk ) == 0 );
+	while( found )
+	{
+		if( IsPartitionName( ffblk.name, prefix, prefixlen ))
+		{
+			if( ffblk.ext[ 0 ] != '\0' )
+				sprintf( partname, "%s.%s", ffblk.name, ffblk.ext );
+			else
+				strcpy( partname, ffblk.name );
+			if( remove( partname ) != 0 )
+			{
+				lErrorCode = DB_ERROR_WRITE_FILE;
+				return FALSE;
+			}
+			found = ( findfirst( pattern, &ffblk ) == 0 );
+		}
+		else
+			found = ( findnext( &ffblk ) == 0 );
+	}
+	MakeFileName( filename, "cat", partname );
+	remove( partname );
+	lErrorCode = DB_OK;
+	return TRUE;
+}
 
-	if( (stackl = (long*) malloc( (n2 * sizeof(long)))) == NULL )
-		goto Clean4;
 
-	if( (stackr = (long*) malloc( (n2 * sizeof(long)))) == NULL )
-		goto Clean5;
-	lErrorCode = DB_OK;
+// ++++++++++++++++++++++++++++++++++++++
+// Write counter functions
+// ++++++++++++++++++++++++++++++++++++++
 
-	s = 1;
-	stackl[ s ] = 0L;
-	stackr[ s ] = totalrecords - 1L;
-	do
+//
+// A write counter is a 16 bit number in the record, most significant byte first. WriteRecord()
+// writes a copy of the record with the counter set, the record of the caller does not change.
+//
+#define COUNTER_MAX			0xFFFFL
+
+//
+// The counter attached to SDBFile
+//
+struct SDBCounter
+{
+	short	sOffset;			// position of the counter in the record
+	short	sKeyOffset;			// position of the key that tells an overwrite is the same record
+	short	sKeySz;				// size of the key
+	long	lInsert;			// record number of an inserted record, it has no old record
+	int		bHold;				// a sort moves the records with WriteRecord(), nothing is counted
+	char*	pRecord;			// the record that is written
+	char*	pOld;				// the record that is overwritten
+};
+
+static long GetCounter( struct SDBCounter *pCounter, char* record )
+{
+	return ((long)(unsigned char)record[ pCounter->sOffset ] << 8) | (unsigned char)record[ pCounter->sOffset + 1 ];
+}
+
+static void FreeCounter( SDBFile *dbFile )
+{
+	if( dbFile->pCounter == NULL )
+		return;
+	free( dbFile->pCounter->pRecord );
+	free( dbFile->pCounter );
+	dbFile->pCounter = NULL;
+}
+
+//
+// Returns the record WriteRecord() writes, a copy with the counter of the old record plus one when
+// the current record with the same key is overwritten, else with counter 1. Records marked as deleted
+// and records moved by a sort are written as they are.
+//
+static char* CounterWrite( SDBFile *dbFile, char* record, int iFlag )
+{
+	struct SDBCounter *pCounter;
+	long count, recno, errorcode;
+
+	if( (pCounter = dbFile->pCounter) == NULL || pCounter->bHold || IsDeleted( dbFile, record ))
+		return record;
+	errorcode = lErrorCode;
+	count = 1L;
+	recno = GetCurrentRecord( dbFile );
+	if( iFlag == WRITE_OVER && recno != -1L && recno != pCounter->lInsert &&
+		ReadRecordAt( dbFile, recno, pCounter->pOld ) && !IsDeleted( dbFile, pCounter->pOld ) &&
+		memcmp( pCounter->pOld + pCounter->sKeyOffset, record + pCounter->sKeyOffset, pCounter->sKeySz ) == 0 )
 	{
-		l = stackl[ s ];
-		r = stackr[ s ];
-		s--;
-		do
-		{
-			i = l;
-			j = r;
-			if( !GotoRecord( dbFile, ((l+r)>>1) ))
-				goto CleanAll;
-			if( !ReadCurrentRecord( dbFile, temp1 ))
-				goto CleanAll;
+		count = GetCounter( pCounter, pCounter->pOld );
+		if( count < COUNTER_MAX )
+			count++;
+	}
+	lErrorCode = errorcode;
+	pCounter->lInsert = -1L;
+	memcpy( pCounter->pRecord, record, dbFile->sRecSz );
+	pCounter->pRecord[ pCounter->sOffset ] = (char)(count >> 8);
+	pCounter->pRecord[ pCounter->sOffset + 1 ] = (char)count;
+	return pCounter->pRecord;
+}
 
+//
+// A record is inserted at recno, the next write of recno counts 1. Called after HeaderInsert
+//
+static void CounterInsert( SDBFile *dbFile, long recno )
+{
+	if( dbFile->pCounter != NULL )
+		dbFile->pCounter->lInsert = recno;
+}
 
-			do
-			{
-				if( !GotoRecord( dbFile, i ))
-					goto CleanAll;
-				if( !ReadCurrentRecord( dbFile, temp2 ))
-					goto CleanAll;
-				while( memcmp( temp2 + offset, temp1 + offset, checksize ) < 0 )
-				{
-					i++;
-					if( !GotoRecord( dbFile, i ))
-						goto CleanAll;
-					if( !ReadCurrentRecord( dbFile, temp2 ))
-						goto CleanAll;
-				}
+static void CounterHold( SDBFile *dbFile, int bHold )
+{
+	if( dbFile->pCounter != NULL )
+		dbFile->pCounter->bHold = bHold;
+}
 
-				if( !GotoRecord( dbFile, j ))
-					goto CleanAll;
-				if( !ReadCurrentRecord( dbFile, temp3 ))
-					goto CleanAll;
-				while( memcmp( temp3 + offset, temp1 + offset, checksize ) > 0 )
-				{
-					j--;
-					if( !GotoRecord( dbFile, j ))
-						goto CleanAll;
-					if( !ReadCurrentRecord( dbFile, temp3 ))
-						goto CleanAll;
-				}
+int SetWriteCounter( SDBFile *dbFile, short offset, short keyoffset, short keysize )
+{
+	struct SDBCounter *pCounter;
 
-				if( i <= j  )
-				{
-					if( !WriteRecord( dbFile, temp2, WRITE_OVER ))
-						goto CleanAll;
+	if( !IsFileOpen( dbFile ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return FALSE;
+	}
+	FreeCounter( dbFile );
+	if( offset < 0 )
+		return TRUE;
+	if( dbFile->sRecSz < offset + 2 || dbFile->sRecSz < (keysize+keyoffset) || keysize <= 0 )
+	{
+		lErrorCode = DB_ERROR_SORTLENGTH;
+		return FALSE;
+	}
+	if( (pCounter = (struct SDBCounter*) malloc( sizeof( struct SDBCounter ))) == NULL )
+	{
+		lErrorCode = DB_ERROR_MEM;
+		return FALSE;
+	}
+	if( (pCounter->pRecord = (char*) malloc( 2 * dbFile->sRecSz )) == NULL )
+	{
+		free( pCounter );
+		lErrorCode = DB_ERROR_MEM;
+		return FALSE;
+	}
+	pCounter->pOld = pCounter->pRecord + dbFile->sRecSz;
+	pCounter->sOffset = offset;
+	pCounter->sKeyOffset = keyoffset;
+	pCounter->sKeySz = keysize;
+	pCounter->lInsert = -1L;
+	pCounter->bHold = FALSE;
+	dbFile->pCounter = pCounter;
+	return TRUE;
+}
 
-					if( !GotoRecord( dbFile, i ))
-						goto CleanAll;
-					if( !WriteRecord( dbFile, temp3, WRITE_OVER ))
-						goto CleanAll;
-					i++;
-					j--;
-				}
-			} while( i <= j  );
-			if( i < r )
-			{
-				s++;
-				stackl[ s ] = i;
-				stackr[ s ] = r;
-			}
-			r = j;
-		} while( l < r );
-	} while( s > 0L );
+// ++++++++++++++++++++++++++++++++++++++
+// Hash index functions
+// ++++++++++++++++++++++++++++++++++++++
 
-CleanAll:
-	free( stackr );
-Clean5:
-	free( stackl );
-Clean4:
-	free( temp3 );
-Clean3:
-	free( temp2 );
-Clean2:
-	free( temp1 );
-Clean1:
-	if( GetDBErrorCode() != DB_OK )
+//
+// The hash index file is an SDBFile with one bucket per record, record 0 holds the header:
+//
+//		"HSH1", keysize (2 bytes), amount of buckets (4 bytes), amount of keys (4 bytes)
+//
+// every next record is a bucket with the key followed by the record number (4 bytes, most significant
+// byte first), -1L when the bucket is empty. A key is stored in the bucket HashKey() % buckets
+// or, when that one is used, in the next free bucket (linear probing).
+// The table is doubled when it gets more then 3/4 full, so probing stays short.
+//
+#define HASH_MAGIC			"HSH1"
+#define HASH_HDRSZ			14
+#define HASH_MIN_BUCKETS	64L
+
+typedef struct
+{
+	short	sKeySz;				// size of the key
+	long	lBuckets;			// amount of buckets
+	long	lKeys;				// amount of used buckets
+}SHashHeader;
+
+static short HashRecordSize( short keysize )
+{
+	return (keysize + INDEX_RECNO_SZ < HASH_HDRSZ)? HASH_HDRSZ : keysize + INDEX_RECNO_SZ;
+}
+
+static int ReadHashHeader( SDBFile *dbHash, SHashHeader *pHeader, char* entry )
+{
+	if( !GotoRecord( dbHash, 0L ) || !ReadCurrentRecord( dbHash, entry ))
+		return FALSE;
+	if( memcmp( entry, HASH_MAGIC, 4 ) != 0 )
+	{
+		lErrorCode = DB_ERROR_RECORD_SIZE;
 		return FALSE;
+	}
+	pHeader->sKeySz = (short)(((unsigned char)entry[ 4 ] << 8) | (unsigned char)entry[ 5 ]);
+	pHeader->lBuckets = GetLong( entry + 6 );
+	pHeader->lKeys = GetLong( entry + 10 );
+	if( HashRecordSize( pHeader->sKeySz ) != dbHash->sRecSz || pHeader->lBuckets + 1L != dbHash->lTotalRecords )
+	{
+		lErrorCode = DB_ERROR_RECORD_SIZE;
+		return FALSE;
+	}
 	return TRUE;
 }
 
+static int WriteHashHeader( SDBFile *dbHash, SHashHeader *pHeader, char* entry )
+{
+	memset( entry, 0, dbHash->sRecSz );
+	memcpy( entry, HASH_MAGIC, 4 );
+	entry[ 4 ] = (char)(pHeader->sKeySz >> 8);
+	entry[ 5 ] = (char)pHeader->sKeySz;
+	PutLong( entry + 6, pHeader->lBuckets );
+	PutLong( entry + 10, pHeader->lKeys );
+	if( dbHash->lTotalRecords == 0L )
+		return WriteRecord( dbHash, entry, WRITE_APPEND );
+	if( !GotoRecord( dbHash, 0L ))
+		return FALSE;
+	return WriteRecord( dbHash, entry, WRITE_OVER );
+}
 
-// ++++++++++++++++++++++++++++++++++++++
-// Searching database function
-// ++++++++++++++++++++++++++++++++++++++
-
-
-long BinarySearch( SDBFile *dbFile, char* record, char* searchkey, int checksize, int offset )
+//
+// Make a new hash file with buckets empty buckets
+//
+static int MakeHashFile( const char* hashfilename, short keysize, long buckets, SDBFile *dbHash, char* entry )
 {
-	int test;
-	long min, max, current;
+	SHashHeader header;
+	long i;
 
-	if( (max = GetTotalRecords( dbFile )) == -1L )
-		return -1L;
-	min = 0L;
-	for (;;)
+	if( !CreateDatabase( hashfilename, HashRecordSize( keysize ), dbHash ))
+		return FALSE;
+	SetDatabaseCache( dbHash, DB_CACHE_BLOCKS, DB_CACHE_RECORDS );
+	header.sKeySz = keysize;
+	header.lBuckets = buckets;
+	header.lKeys = 0L;
+	if( !WriteHashHeader( dbHash, &header, entry ))
+		return FALSE;
+	memset( entry, 0, dbHash->sRecSz );
+	PutLong( entry + keysize, -1L );
+	for( i = 0L; i < buckets; i++ )
 	{
-		current = ((max - min) >> 1) + min;
-		if( !GotoRecord( dbFile, current ))
-			return -1L;
-		if( !ReadCurrentRecord( dbFile, record ))
-			return -1L;
+		if( !WriteRecord( dbHash, entry, WRITE_APPEND ))
+			return FALSE;
+	}
+	return TRUE;
+}
 
-		if( (test = memcmp( searchkey, record + offset, checksize )) == 0 )
-			return current; // found the searchstring
+//
+// Find the bucket with key, or the empty bucket where the key can be stored
+// Returns TRUE when the key is found, FALSE when not found or on error (lErrorCode set)
+//
+static int HashProbe( SDBFile *dbHash, SHashHeader *pHeader, char* key, char* entry, long* bucket )
+{
+	long probes;
 
-		if( test < 0 )
-			max = current - 1L;
-		else
-			min = current + 1L;
-		if( min > max)
-		{
-			lErrorCode = DB_ERROR_NOT_FOUND;
-			record[0] = '\0';
-			return (-1L);
-		}
+	*bucket = (long)(HashKey( key, pHeader->sKeySz ) % (unsigned long)pHeader->lBuckets);
+	for( probes = 0L; probes < pHeader->lBuckets; probes++ )
+	{
+		if( !GotoRecord( dbHash, *bucket + 1L ) || !ReadCurrentRecord( dbHash, entry ))
+			return FALSE;
+		if( GetLong( entry + pHeader->sKeySz ) == -1L )
+			return FALSE;
+		if( memcmp( entry, key, pHeader->sKeySz ) == 0 )
+			return TRUE;
+		if( ++*bucket == pHeader->lBuckets )
+			*bucket = 0L;
 	}
+	//
+	// A full table can not happen because the table is doubled before that
+	//
+	lErrorCode = DB_ERROR_RECORD_SIZE;
+	return FALSE;
 }
 
-long LineairSearch( SDBFile *dbFile, char* record, char* searchkey, int checksize, int offset )
+//
+// Store key and recordnumber in the table, the key replaces an equal key
+//
+static int HashStore( SDBFile *dbHash, SHashHeader *pHeader, char* key, long recordnumber, char* entry )
 {
-	long totalrecords, i;
-	if( (totalrecords = GetTotalRecords( dbFile )) == -1L )
-		return -1L;
-	for( i = 0L; i < totalrecords; i++ )
+	long bucket;
+
+	if( !HashProbe( dbHash, pHeader, key, entry, &bucket ))
 	{
-		if( !GotoRecord( dbFile, i ) )
-			return -1L;
-		if( !ReadCurrentRecord( dbFile, record ))
-			return -1L;
-		if( memcmp( searchkey, record + offset, checksize ) == 0 )
-			return i;
+		if( GetDBErrorCode() != DB_OK )
+			return FALSE;
+		pHeader->lKeys++;
 	}
-	lErrorCode = DB_ERROR_NOT_FOUND;
-	record[0] = '\0';
-	return -1L;
+	memcpy( entry, key, pHeader->sKeySz );
+	PutLong( entry + pHeader->sKeySz, recordnumber );
+	if( !GotoRecord( dbHash, bucket + 1L ))
+		return FALSE;
+	return WriteRecord( dbHash, entry, WRITE_OVER );
 }
 
+//
+// Double the amount of buckets, all keys are stored again in a temporary file which replaces the hash file
+//
+static int HashGrow( SDBFile *dbHash, SHashHeader *pHeader, char* entry )
+{
+	static char tempname[ DB_MAX_FNAME ];
+	static SDBFile dbTemp;
+	SHashHeader header;
+	long bucket;
+	char* key;
 
-// +++++++++++++++++++++++++++++++++++++++++
-// Special index functions
-// +++++++++++++++++++++++++++++++++++++++++
+	if( (key = (char*) malloc( dbHash->sRecSz )) == NULL )
+	{
+		lErrorCode = DB_ERROR_MEM;
+		return FALSE;
+	}
+	MakeFileName( dbHash->szFileName, "tmh", tempname );
+	if( MakeHashFile( tempname, pHeader->sKeySz, pHeader->lBuckets * 2L, &dbTemp, entry ))
+	{
+		header.sKeySz = pHeader->sKeySz;
+		header.lBuckets = pHeader->lBuckets * 2L;
+		header.lKeys = 0L;
+		for( bucket = 0L; bucket < pHeader->lBuckets; bucket++ )
+		{
+			if( !GotoRecord( dbHash, bucket + 1L ) || !ReadCurrentRecord( dbHash, key ))
+				break;
+			if( GetLong( key + pHeader->sKeySz ) != -1L &&
+				!HashStore( &dbTemp, &header, key, GetLong( key + pHeader->sKeySz ), entry ))
+				break;
+		}
+		if( bucket == pHeader->lBuckets )
+			WriteHashHeader( &dbTemp, &header, entry );
+	}
+	free( key );
+	if( GetDBErrorCode() == DB_OK )
+		FlushDatabase( &dbTemp );
+	if( GetDBErrorCode() != DB_OK )
+	{
+		bucket = lErrorCode;
+		CloseDatabase( &dbTemp );
+		remove( tempname );
+		lErrorCode = bucket;
+		return FALSE;
+	}
+	CloseDatabase( &dbTemp );
 
-//
-// Make an index file on dbFile
-// On ok ends with an open indexed file with recordsize of keysize + 4 bytes
-// the 4 bytes holds the index record number
-int CreateIndexFile( SDBFile *dbFile, short offset, short keysize, const char* indexfilename, SDBFile *dbIndex )
+	//
+	// The cache holds blocks of the old file
+	//
+	if( !FlushCache( dbHash ))
+		return FALSE;
+	InvalidateCache( dbHash );
+	if( !ReplaceDatabaseFile( dbHash, tempname ))
+		return FALSE;
+	dbHash->lTotalRecords = header.lBuckets + 1L;
+	*pHeader = header;
+	return TRUE;
+}
+
+int CreateHashIndex( SDBFile *dbFile, short offset, short keysize, const char* hashfilename, SDBFile *dbHash )
 {
+	SHashHeader header;
+	long i, totalrecords, buckets, errorcode;
 	char* record;
-	long i, totalrecords;
+	char* entry;
 
 	if( !IsFileOpen( dbFile ))
 		return FALSE;
-	if( ( totalrecords = GetTotalRecords( dbFile )) == 0L )
+	totalrecords = dbFile->lTotalRecords;
+	if( dbFile->sRecSz < (keysize+offset) || keysize <= 0 )
 	{
-		lErrorCode = DB_ERROR_EMPTY;
+		lErrorCode = DB_ERROR_SORTLENGTH;
 		return FALSE;
 	}
-
-	if( !CreateDatabase( indexfilename, (short)(keysize + sizeof( long )), dbIndex)	)
+	//
+	// Start at most half full
+	//
+	for( buckets = HASH_MIN_BUCKETS; buckets < totalrecords * 2L; buckets *= 2L )
+		;
+	if( (record = (char*) malloc( dbFile->sRecSz + HashRecordSize( keysize ))) == NULL )
+	{
+		lErrorCode = DB_ERROR_MEM;
 		return FALSE;
-
-	lErrorCode = DB_ERROR_MEM;
-	record = (char*)malloc( dbFile->sRecSz + sizeof( long ) );
-	if( record != NULL )
+	}
+	entry = record + dbFile->sRecSz;
+	if( MakeHashFile( hashfilename, keysize, buckets, dbHash, entry ))
 	{
-		lErrorCode = DB_OK;
-
-		for( i = 0; i < totalrecords; i++ )
+		header.sKeySz = keysize;
+		header.lBuckets = buckets;
+		header.lKeys = 0L;
+		for( i = 0L; i < totalrecords; i++ )
 		{
-			if( !GotoRecord( dbFile, i ))
-				break;
-			if( !ReadCurrentRecord( dbFile, record ))
+			if( !GotoRecord( dbFile, i ) || !ReadCurrentRecord( dbFile, record ))
 				break;
-			memcpy( record + (offset + keysize), &i, sizeof( long ));
-			if( !WriteRecord( dbIndex, record + offset, WRITE_APPEND ))
+			if( IsDeleted( dbFile, record ))
+				continue;
+			if( !HashStore( dbHash, &header, record + offset, i, entry ))
 				break;
 		}
-		free( record );
-		//
-		// Sort the index database
-		//
-		if( GetDBErrorCode() == DB_OK )
-		{
-			if( QuickSort( dbIndex, 0, keysize ))
-				return TRUE;
-		}
+		if( i == totalrecords && WriteHashHeader( dbHash, &header, entry ))
+			FlushDatabase( dbHash );
 	}
-	CloseDatabase( dbIndex );
-	remove( indexfilename );
+	free( record );
+	if( GetDBErrorCode() == DB_OK )
+		return TRUE;
+	errorcode = lErrorCode;
+	CloseDatabase( dbHash );
+	remove( hashfilename );
+	lErrorCode = errorcode;
 	return FALSE;
 }
 
-int OpenIndexFile( const char *indexfilename, short keysize, SDBFile *dbIndex )
+int OpenHashIndex( const char* hashfilename, short keysize, SDBFile *dbHash )
 {
-	return OpenDatabase( indexfilename, (short)(keysize + sizeof( long )), dbIndex );
-}
+	SHashHeader header;
+	long errorcode;
+	char* entry;
 
+	if( !OpenDatabase( hashfilename, HashRecordSize( keysize ), dbHash ))
+		return FALSE;
+	SetDatabaseCache( dbHash, DB_CACHE_BLOCKS, DB_CACHE_RECORDS );
+	if( (entry = (char*) malloc( dbHash->sRecSz )) == NULL )
+		lErrorCode = DB_ERROR_MEM;
+	else
+	{
+		if( ReadHashHeader( dbHash, &header, entry ) && header.sKeySz != keysize )
+			lErrorCode = DB_ERROR_RECORD_SIZE;
+		free( entry );
+	}
+	if( GetDBErrorCode() == DB_OK )
+		return TRUE;
+	errorcode = lErrorCode;
+	CloseDatabase( dbHash );
+	lErrorCode = errorcode;
+	return FALSE;
+}
 
-long SearchIndexFile( SDBFile *dbIndex, char *searchkey )
+long SearchHashIndex( SDBFile *dbHash, char* searchkey )
 {
-	static long recnr;
-	char* record;
+	SHashHeader header;
+	long bucket, recnr;
+	char* entry;
 
-	if( !IsFileOpen( dbIndex ))
+	if( !IsFileOpen( dbHash ))
 		return -1L;
-	if( ( recnr = GetTotalRecords( dbIndex )) == 0L )
+	if( (entry = (char*) malloc( dbHash->sRecSz )) == NULL )
 	{
-		lErrorCode = DB_ERROR_EMPTY;
+		lErrorCode = DB_ERROR_MEM;
 		return -1L;
 	}
+	recnr = -1L;
+	if( ReadHashHeader( dbHash, &header, entry ))
+	{
+		if( HashProbe( dbHash, &header, searchkey, entry, &bucket ))
+			recnr = GetLong( entry + header.sKeySz );
+		else if( GetDBErrorCode() == DB_OK )
+			lErrorCode = DB_ERROR_NOT_FOUND;
+	}
+	free( entry );
+	return recnr;
+}
 
-	if( ( record = (char*) malloc( dbIndex->sRecSz )) == NULL )
+int AddKeyToHashIndex( SDBFile *dbHash, char* key, long recordnumber )
+{
+	SHashHeader header;
+	char* entry;
+	int ret;
+
+	if( !IsFileOpen( dbHash ))
+		return FALSE;
+	if( (entry = (char*) malloc( dbHash->sRecSz )) == NULL )
 	{
 		lErrorCode = DB_ERROR_MEM;
-		return -1L;
+		return FALSE;
 	}
-	recnr = -1L;
-	if( BinarySearch( dbIndex, record, searchkey, (dbIndex->sRecSz - sizeof( long ) ), 0 ) != -1L )
+	ret = FALSE;
+	if( ReadHashHeader( dbHash, &header, entry ))
 	{
-		memcpy( &recnr, record + (dbIndex->sRecSz - sizeof( long )), sizeof( long ) );
+		if( (header.lKeys + 1L) * 4L <= header.lBuckets * 3L || HashGrow( dbHash, &header, entry ))
+		{
+			if( HashStore( dbHash, &header, key, recordnumber, entry ))
+				ret = WriteHashHeader( dbHash, &header, entry );
+		}
 	}
-	free( record );
-	return recnr;
+	free( entry );
+	return ret;
 }
 
-int AddNewSearchkeyToIndex( SDBFile *dbIndex, char *nwsearchkey, long recordnumber )
+int VerifyHashIndex( SDBFile *dbFile, short offset, SDBFile *dbHash )
 {
+	SHashHeader header;
+	long i, bucket, keys, recno;
 	char* record;
-	if( !IsFileOpen( dbIndex ))
-		return FALSE;
+	char* entry;
+	int ret;
 
-	if( ( record = (char*) malloc( dbIndex->sRecSz )) == NULL )
+	if( !IsFileOpen( dbFile ) || !IsFileOpen( dbHash ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return FALSE;
+	}
+	if( (record = (char*) malloc( dbFile->sRecSz + dbHash->sRecSz )) == NULL )
 	{
 		lErrorCode = DB_ERROR_MEM;
-		return -1L;
+		return FALSE;
 	}
-	memcpy( record, nwsearchkey, dbIndex->sRecSz - sizeof( long ) );
-	memcpy( record + dbIndex->sRecSz - sizeof( long ), &recordnumber, sizeof( long ) );
-	if( WriteRecord( dbIndex, record, WRITE_APPEND ) )
+	entry = record + dbFile->sRecSz;
+	ret = FALSE;
+	if( !ReadHashHeader( dbHash, &header, entry ))
+		goto Clean;
+	if( dbFile->sRecSz < (header.sKeySz+offset) )
 	{
-		free( record );
-		return (  InsertionSort( dbIndex, 0, (short)(dbIndex->sRecSz - sizeof( long )) ));
+		lErrorCode = DB_ERROR_SORTLENGTH;
+		goto Clean;
+	}
+	//
+	// Every stored entry must hold the record number of a live record with its key, and be the
+	// only entry with that key. With duplicate keys it is one of the records with the key.
+	//
+	keys = 0L;
+	for( i = 0L; i < header.lBuckets; i++ )
+	{
+		if( !GotoRecord( dbHash, i + 1L ) || !ReadCurrentRecord( dbHash, entry ))
+			goto Clean;
+		if( (recno = GetLong( entry + header.sKeySz )) == -1L )
+			continue;
+		keys++;
+		if( recno < 0L || recno >= dbFile->lTotalRecords )
+			goto NotValid;
+		if( !GotoRecord( dbFile, recno ) || !ReadCurrentRecord( dbFile, record ))
+			goto Clean;
+		if( IsDeleted( dbFile, record ) || memcmp( record + offset, entry, header.sKeySz ) != 0 )
+			goto NotValid;
+		if( !HashProbe( dbHash, &header, record + offset, entry, &bucket ) || bucket != i )
+			goto NotValid;
+	}
+	if( keys != header.lKeys )
+		goto NotValid;
+	//
+	// The key of every live record must be in the table, the entries are then the distinct keys
+	//
+	for( i = 0L; i < dbFile->lTotalRecords; i++ )
+	{
+		if( !GotoRecord( dbFile, i ) || !ReadCurrentRecord( dbFile, record ))
+			goto Clean;
+		if( IsDeleted( dbFile, record ))
+			continue;
+		if( !HashProbe( dbHash, &header, record + offset, entry, &bucket ))
+			goto NotValid;
 	}
+	ret = TRUE;
+	goto Clean;
+NotValid:
+	if( GetDBErrorCode() == DB_OK )
+		lErrorCode = DB_ERROR_NOT_FOUND;
+Clean:
 	free( record );
+	return ret;
+}
+
+int RebuildHashIndex( SDBFile *dbFile, short offset, SDBFile *dbHash )
+{
+	static char hashfilename[ DB_MAX_FNAME ];
+	SHashHeader header;
+	char* entry;
+
+	if( !IsFileOpen( dbHash ))
+		return FALSE;
+	if( (entry = (char*) malloc( dbHash->sRecSz )) == NULL )
+	{
+		lErrorCode = DB_ERROR_MEM;
+		return FALSE;
+	}
+	ReadHashHeader( dbHash, &header, entry );
+	free( entry );
+	if( GetDBErrorCode() != DB_OK )
+		return FALSE;
+	strcpy( hashfilename, dbHash->szFileName );
+	CloseDatabase( dbHash );
+	remove( hashfilename );
+	return CreateHashIndex( dbFile, offset, header.sKeySz, hashfilename, dbHash );
+}
+
+// ++++++++++++++++++++++++++++++++++++++
+// Dictionary functions
+// ++++++++++++++++++++++++++++++++++++++
+
+//
+// A dictionary file is an SDBFile with one key per record, the record number is the code of the key.
+// Keys are only appended, so a code never changes. The code of a key is found with a hash index
+// on the dictionary with the extension hsh, a code is decoded by reading its record. Only the cache
+// blocks of both files are in memory. A code is stored in DB_DICT_CODESZ bytes, most significant byte first.
+//
+#define DICT_EXT			"hsh"
+
+struct SDBDictionary
+{
+	SDBFile	dbHash;				// hash index of the keys, the record number is the code
+};
+
+static void FreeDictionary( SDBFile *dbFile )
+{
+	if( dbFile->pDictionary == NULL )
+		return;
+	CloseDatabase( &dbFile->pDictionary->dbHash );
+	free( dbFile->pDictionary );
+	dbFile->pDictionary = NULL;
+}
+
+//
+// Open the hash index of the dictionary, it is made again when it is missing or when it does not hold
+// every key once, e.g. when the terminal was switched off after a key was added to the dictionary file
+//
+static int OpenDictionaryHash( SDBFile *dbDict )
+{
+	static char hashname[ DB_MAX_FNAME ];
+	SDBFile *dbHash;
+	SHashHeader header;
+	char* entry;
+	int ok;
+
+	dbHash = &dbDict->pDictionary->dbHash;
+	MakeFileName( dbDict->szFileName, DICT_EXT, hashname );
+	if( !OpenHashIndex( hashname, dbDict->sRecSz, dbHash ))
+	{
+		remove( hashname );
+		return CreateHashIndex( dbDict, 0, dbDict->sRecSz, hashname, dbHash );
+	}
+	if( (entry = (char*) malloc( dbHash->sRecSz )) == NULL )
+	{
+		lErrorCode = DB_ERROR_MEM;
+		return FALSE;
+	}
+	ok = ReadHashHeader( dbHash, &header, entry );
+	free( entry );
+	if( !ok )
+		return FALSE;
+	if( header.lKeys == dbDict->lTotalRecords )
+		return TRUE;
+	return RebuildHashIndex( dbDict, 0, dbHash );
+}
+
+int OpenDictionary( const char *filename, short keysize, SDBFile *dbDict )
+{
+	long errorcode;
+	int ok;
+
+	if( fsize( (char*)filename ) == -1L )
+		ok = CreateDatabase( filename, keysize, dbDict );
+	else
+		ok = OpenDatabase( filename, keysize, dbDict );
+	if( !ok )
+		return FALSE;
+	if( dbDict->lTotalRecords > DB_DICT_MAX_CODES )
+		lErrorCode = DB_ERROR_RECORD_SIZE;
+	else if( (dbDict->pDictionary = (struct SDBDictionary*) malloc( sizeof( struct SDBDictionary ))) == NULL )
+		lErrorCode = DB_ERROR_MEM;
+	else
+	{
+		memset( dbDict->pDictionary, 0, sizeof( struct SDBDictionary ));
+		SetDatabaseCache( dbDict, DB_CACHE_BLOCKS, DB_CACHE_RECORDS );
+		if( OpenDictionaryHash( dbDict ))
+			return TRUE;
+	}
+	errorcode = lErrorCode;
+	CloseDatabase( dbDict );
+	lErrorCode = errorcode;
 	return FALSE;
 }
+
+int EncodeKey( SDBFile *dbDict, char* key, char* code, int bAdd )
+{
+	long value;
+
+	if( !IsFileOpen( dbDict ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return FALSE;
+	}
+	if( dbDict->pDictionary == NULL )
+	{
+		lErrorCode = DB_ERROR_NOT_FOUND;
+		return FALSE;
+	}
+	if( (value = SearchHashIndex( &dbDict->pDictionary->dbHash, key )) == -1L )
+	{
+		if( GetDBErrorCode() != DB_ERROR_NOT_FOUND || !bAdd )
+			return FALSE;
+		value = dbDict->lTotalRecords;
+		if( value >= DB_DICT_MAX_CODES )
+		{
+			lErrorCode = DB_ERROR_DICT_FULL;
+			return FALSE;
+		}
+		//
+		// The key is on file before its code is used, the hash index is made again
+		// by OpenDictionary() when it was not saved
+		//
+		if( !WriteRecord( dbDict, key, WRITE_APPEND ) || !FlushDatabase( dbDict ) ||
+			!AddKeyToHashIndex( &dbDict->pDictionary->dbHash, key, value ))
+			return FALSE;
+	}
+	code[ 0 ] = (char)(value >> 8);
+	code[ 1 ] = (char)value;
+	return TRUE;
+}
+
+int DecodeKey( SDBFile *dbDict, char* code, char* key )
+{
+	long value;
+
+	if( !IsFileOpen( dbDict ))
+	{
+		lErrorCode = DB_ERROR_NOT_OPEN;
+		return FALSE;
+	}
+	value = ((long)(unsigned char)code[ 0 ] << 8) | (long)(unsigned char)code[ 1 ];
+	if( dbDict->pDictionary == NULL || value >= dbDict->lTotalRecords )
+	{
+		lErrorCode = DB_ERROR_NOT_FOUND;
+		return FALSE;
+	}
+	return GotoRecord( dbDict, value ) && ReadCurrentRecord( dbDict, key );
+}
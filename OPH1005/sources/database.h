@@ -14,10 +14,121 @@
 //
 // 23/12/2005:	Added a reset of the database error code in the function IsFileOpen
 //
+// 17/10/2026:	Added an optional record block cache with LRU eviction and write-back (SetDatabaseCache)
+//
+// 17/10/2026:	HeapSort() and QuickSort() sort the whole file in memory when it fits in coreleft()
+//
+// 17/10/2026:	Added ExternalSort() for databases that do not fit in memory
+//
+// 17/10/2026:	Added InsertRecordSorted() to keep a sorted database sorted without sorting it again
+//
+// 17/10/2026:	Added DeleteRecords() and DeleteRecordSet(), DeleteRecord() moves the following records in blocks
+//
+// 17/10/2026:	Added delete markers (SetDeleteMarker) with CompactDatabase() and CompactWhenNeeded()
+//
+// 17/10/2026:	The index file is now a B+tree with pages of DB_INDEX_PAGESZ bytes, added ScanIndexRange()
+//
+// 17/10/2026:	Added a hash index file with linear probing for exact key lookups (CreateHashIndex)
+//
+// 17/10/2026:	Added an in memory fence index for BinarySearch and InsertRecordSorted (SetFenceIndex)
+//
+// 17/10/2026:	Added a Bloom filter saved next to the database to skip searches for unknown keys (SetBloomFilter)
+//
+// 17/10/2026:	Added KeySearch() with interpolation search for numeric keys and GetSearchProbes()
+//
+// 17/10/2026:	Added BinarySearchMany() to find many keys in one pass through the database
+//
+// 17/10/2026:	Added RadixSort() for fixed width keys, in memory or with distribution passes on file
+//
+// 17/10/2026:	Added TagSort() and SortDatabase() which picks the sort method that fits in memory
+//
+// 17/10/2026:	SortDatabase() finds the longest sorted run and merges the other records into it
+//
+// 17/10/2026:	Added a header file with the sort state and a change counter (SetDatabaseHeader)
+//
+// 17/10/2026:	Added a delta log, records are appended and merged into the sorted records later (SetDeltaLog)
+//
+// 17/10/2026:	Added secondary indexes kept up to date by WriteRecord() and RangeQuery() (SetSecondaryIndex)
+//
+// 17/10/2026:	Added SearchSecondaryIndex() to find all records with a key in a secondary index
+//
+// 17/10/2026:	Added UpsertRecord() to overwrite or insert a record with one search
+//
+// 17/10/2026:	Added aggregates kept up to date by WriteRecord(), counts and last values per key (SetAggregate)
+//
+// 17/10/2026:	SortDatabase() uses RadixSort() for short keys on file, the radix buckets only use memory while sorting
+//
+// 17/10/2026:	Secondary index entries hold the header key, sorts and merges no longer make the index file again
+//
+// 17/10/2026:	SetAggregate() limits the keys of an aggregate, the table only grows when memory is left for the OS
+//
+// 17/10/2026:	The aggregate table is kept in a file with a record cache, DeleteRecords() takes off the removed records
+//
+// 17/10/2026:	Added a write counter in the record kept by WriteRecord(), e.g. the scans of a device (SetWriteCounter)
+//
+// 17/10/2026:	Added partitioned databases, records split over files per value bucket with a catalog (OpenPartitions)
+//
+// 17/10/2026:	Added dictionary files that give keys a 16 bit code, found with a hash index file (OpenDictionary)
+//
 
 #ifndef __DATABASE_H__
 #define __DATABASE_H__
 
+//
+// Record cache, the layout is private to database.c
+//
+struct SDBCache;
+
+//
+// Fence index, the layout is private to database.c
+//
+struct SDBFence;
+
+//
+// Bloom filter, the layout is private to database.c
+//
+struct SDBBloom;
+
+//
+// Sort state header, the layout is private to database.c
+//
+struct SDBHeader;
+
+//
+// Delta log, the layout is private to database.c
+//
+struct SDBDelta;
+
+//
+// Secondary index, the layout is private to database.c
+//
+struct SDBSecondary;
+
+//
+// Aggregate, the layout is private to database.c
+//
+struct SDBAggregate;
+
+//
+// Write counter, the layout is private to database.c
+//
+struct SDBCounter;
+
+//
+// Partition of a partitioned database, the layout is private to database.c
+//
+struct SDBPartition;
+
+//
+// Hash index of a dictionary file, the layout is private to database.c
+//
+struct SDBDictionary;
+
+//
+// Maximum length of a database file name including the terminating 0, same as MAX_FNAME of the OS
+//
+#define DB_MAX_FNAME		(12 + 3 + 1)
+
 //
 // This is really the handle that is returned by open/create database
 //
@@ -28,14 +139,94 @@ typedef struct
 	long	lCurrRecord;		// current record number
 	long	lTotalRecords;		// total amount of records
 	int		bOpen;				// check to see if db is open or closed
+	struct SDBCache *pCache;	// record block cache, NULL when not used
+	char	szFileName[ DB_MAX_FNAME ];	// name of the open file
+	int		bMarkDeleted;		// deleted records are only marked, see SetDeleteMarker()
+	short	sDelOffset;			// position of the delete marker in a record
+	long	lDeletedRecords;	// amount of marked records, -1L when not counted yet
+	struct SDBFence *pFence;	// fence index, NULL when not used
+	struct SDBBloom *pBloom;	// Bloom filter, NULL when not used
+	struct SDBHeader *pHeader;	// sort state header, NULL when not used
+	struct SDBDelta *pDelta;	// delta log, NULL when not used
+	struct SDBSecondary *pSecondary;	// secondary indexes, NULL when not used
+	struct SDBAggregate *pAggregate;	// aggregates, NULL when not used
+	struct SDBCounter *pCounter;	// write counter, NULL when not used
+	struct SDBDictionary *pDictionary;	// hash index of a dictionary file, NULL when not a dictionary
 }SDBFile;
 
+//
+// Handle of a partitioned database, see OpenPartitions()
+//
+typedef struct
+{
+	short	sRecSz;				// record size of the partitions
+	short	sOffset;			// position of the partition value in a record
+	long	lBucketSize;		// values in one partition, 0 when not partitioned on the value
+	long	lMaxRecords;		// records in one partition, 0 when not limited
+	short	sSortOffset;		// key the partitions are sorted on, see SortPartitions()
+	short	sSortSz;			// size of that key, 0 when not sorted
+	long	lPartitions;		// amount of partitions
+	long	lAllocated;			// amount of partitions that fit in pParts
+	long	lNextNumber;		// number of the next partition file
+	int		bOpen;				// check to see if the catalog is open or closed
+	int		bDirty;				// catalog changed since it was saved
+	char	szFileName[ DB_MAX_FNAME ];	// database name, the catalog and partition files are named after it
+	struct SDBPartition *pParts;	// the partitions in the order they were made
+	long	lCurrent;			// partition open in dbPart, -1L when none
+	SDBFile	dbPart;				// the open partition, see SelectPartition()
+}SDBPartitions;
+
+//
+// Default record cache dimensions, see SetDatabaseCache()
+//
+#define DB_CACHE_BLOCKS			4	// Amount of blocks kept in memory
+#define DB_CACHE_RECORDS		16	// Amount of records in one block
+
+//
+// Default memory for the fence index in bytes, see SetFenceIndex()
+//
+#define DB_FENCE_MEMORY			2048
+
+//
+// Default size of the Bloom filter in bytes, see SetBloomFilter()
+// about 1% false hits up to 800 keys
+//
+#define DB_BLOOM_SIZE			1024
+
 //
 // Write flasg defines
 //
 #define WRITE_OVER		1	// Overwrite the current record
 #define WRITE_APPEND	2	// Append record to the end of database
 
+//
+// Search modes of KeySearch()
+//
+#define DB_SEARCH_BINARY		0	// Binary search, same as BinarySearch()
+#define DB_SEARCH_INTERPOLATE	1	// Interpolation search
+#define DB_SEARCH_AUTO			2	// Interpolation search when the search key only holds digits and spaces
+
+//
+// Highest value of a partitioned database, see QueryPartitions()
+//
+#define DB_VALUE_MAX		0x7FFFFFFFL
+
+//
+// Size of a code of a dictionary and the maximum amount of codes, see OpenDictionary()
+//
+#define DB_DICT_CODESZ		2
+#define DB_DICT_MAX_CODES	0xFFFFL
+
+//
+// Value of the delete marker byte of a deleted record, see SetDeleteMarker()
+//
+#define DB_DELETED_MARK		'*'
+
+//
+// Size of one page of an index file, see CreateIndexFile()
+//
+#define DB_INDEX_PAGESZ		512
+
 //
 // database error codes
 //
@@ -59,8 +250,12 @@ typedef struct
 #define DB_ERROR_INVALID_WFLAG	0x00000031	// Invalid write flag
 
 #define DB_ERROR_MEM			0x00000050	// Error allocating memory for HDBFILE, or for buffers
+#define DB_ERROR_AGGREGATE_FULL	0x00000051	// The keys of an aggregate do not fit, see SetAggregate()
+
+#define DB_ERROR_DICT_FULL		0x00000060	// All codes of a dictionary are used, see EncodeKey()
 
 #define DB_ERROR_SORTLENGTH		0x00000100	// Offset and sort length are larger then record size
+#define DB_ERROR_NO_HEADER		0x00000101	// There is no header for this key, see SetDatabaseHeader()
 
 #define DB_ERROR_NOT_FOUND		0x00001000	// Error string not found in any record of the database
 
@@ -114,6 +309,169 @@ int CreateDatabase( const char *filename, short recordsize, SDBFile *dbFile );
 //
 void CloseDatabase( SDBFile *dbFile );
 
+//-----------------------------------------------------------------------------
+// Purpose:     Attach a record block cache to an open database.
+//				Records are read from file a complete block at a time and kept in memory,
+//				changed blocks are only written back on eviction, FlushDatabase or CloseDatabase.
+//				The least recently used block is evicted first.
+//
+// Parameters:  dbFile		- pointer to an open database handle
+//
+//				blocks		- amount of blocks in the cache, 0 removes the cache
+//
+//				recordsperblock - amount of records in one block
+//
+// Remark:		Memory used is about blocks * recordsperblock * recordsize bytes
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int SetDatabaseCache( SDBFile *dbFile, short blocks, short recordsperblock );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Write all changed records in the cache back to the database file
+//
+// Parameters:  dbFile		- pointer to an open database handle
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int FlushDatabase( SDBFile *dbFile );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Keep the keys of every Nth record of a sorted database in memory (the fences).
+//				BinarySearch and InsertRecordSorted first search the fences in memory and then
+//				only the records between two fences in the file. With the record cache attached
+//				(SetDatabaseCache) and N not larger then the records in a cache block that is
+//				mostly one block read per search.
+//				The fences are read on the first search and kept up to date by WriteRecord,
+//				InsertRecordSorted and DeleteRecords. Sorting or compacting the database
+//				drops them until the next search.
+//
+// Parameters:  dbFile		- pointer to an open database handle, sorted on the key
+//
+//				offset		- how many positions to the right the key starts in the record
+//
+//				keysize		- the size of the key, searches with a longer key do not use the fences
+//
+//				memory		- the amount of memory in bytes used for the fences, at most 64 KB,
+//							  0 removes the fences. N is the lowest power of 2 that fits.
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int SetFenceIndex( SDBFile *dbFile, short offset, short keysize, long memory );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Attach a Bloom filter on a key to the database.
+//				BinarySearch and LineairSearch first look in the filter, a key that is not in the
+//				database is then mostly found to be missing without reading the database file.
+//				The filter is saved in a file with the database name and extension blm by
+//				FlushDatabase and CloseDatabase, and read again by the next SetBloomFilter.
+//				A filter file that does not match the database is made again from the records.
+//				Written records are added to the filter, after records are deleted the
+//				filter is made again on the next search.
+//
+// Parameters:  dbFile		- pointer to an open database handle
+//
+//				offset		- how many positions to the right the key starts in the record
+//
+//				keysize		- the size of the key, only searches with this offset and size use the filter
+//
+//				size		- the size of the filter in bytes, at most 32 KB, 0 removes the filter
+//
+// Remark:		All changes of the database must be made with the filter attached,
+//				remove the blm file together with the database file.
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int SetBloomFilter( SDBFile *dbFile, short offset, short keysize, long size );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Check the Bloom filter for a key, e.g. before searching another index of the database
+//
+// Parameters:  dbFile		- pointer to an open database handle
+//
+//				searchkey	- the key to look for, the size given to SetBloomFilter
+//
+// Returns:     FALSE when the key is certainly not in the database,
+//				TRUE when it may be in the database or there is no Bloom filter
+//
+int MayContainKey( SDBFile *dbFile, char* searchkey );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Attach a header that keeps the sort state of the database
+//				The header holds the record size, the sort key, the amount of records, how
+//				many records from the start are sorted on the key and a generation counter
+//				that increases on every change. It is saved in a file with the database name
+//				and extension hdr by FlushDatabase and CloseDatabase, the database file itself
+//				stays a plain file of records.
+//				With the header SortDatabase does nothing when the database did not change
+//				since it was sorted, and BinarySearch searches the records added after the
+//				last sort one by one. OpenDatabase refuses a header of another record size.
+//				A header that does not match the database or was not saved after the last
+//				change is not trusted, the database is then taken as not sorted.
+//
+// Parameters:  dbFile		- pointer to an open database handle
+//
+//				offset		- how many positions to the right the sort key starts in the record
+//
+//				keysize		- the size of the sort key, 0 removes the header from dbFile
+//
+// Remark:		All changes of the database must be made with the header attached,
+//				remove the hdr file together with the database file.
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int SetDatabaseHeader( SDBFile *dbFile, short offset, short keysize );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Get the amount of records from the start of the database that are sorted on
+//				the key of the header
+//
+// Returns:     the amount of sorted records, 0 without a header, -1L on FAILURE
+//
+long GetSortedRecords( SDBFile *dbFile );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Get the generation counter of the header, it increases on every change
+//				of the database
+//
+// Returns:     the generation, 0 without a header, -1L on FAILURE
+//
+long GetDatabaseGeneration( SDBFile *dbFile );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Attach a delta log to a database with a header (SetDatabaseHeader)
+//				New records are appended to the database instead of inserted at their sorted
+//				place. The keys of the records after the sorted records are kept in memory,
+//				BinarySearch looks there first and searches the sorted records after that.
+//				MergeDeltaLog merges the appended records into the sorted records.
+//
+// Parameters:  dbFile		- pointer to an open database handle
+//
+//				offset		- the offset of the key of the header
+//
+//				keysize		- the size of the key of the header
+//
+//				maxrecords	- the amount of appended records before MergeDeltaLog merges them,
+//							  0 removes the delta log
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int SetDeltaLog( SDBFile *dbFile, short offset, short keysize, long maxrecords );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Merge the appended records of the delta log into the sorted records
+//				Call it after appending records, and with bForce when the terminal is idle.
+//				The merge is done with SortDatabase and reads the database about once.
+//
+// Parameters:  dbFile		- pointer to an open database handle
+//
+//				bForce		- FALSE merges only when maxrecords records were appended,
+//							  TRUE merges every appended record
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int MergeDeltaLog( SDBFile *dbFile, int bForce );
+
 
 // ++++++++++++++++++++++++++++++++++++++++
 // Record reading scrolling functionality
@@ -215,141 +573,415 @@ int ReadNextRecord( SDBFile *dbFile, char* record );
 int DeleteRecord( SDBFile *dbFile, long recordnumber );
 
 //-----------------------------------------------------------------------------
-// Purpose:     overwrite or append a record in the database
+// Purpose:     Delete a range of records from the database
+//				The following records are moved down in large blocks in one pass
 //
 // Parameters:  dbFile		- pointer to an open database handle
 //
-//				record		- pointer to record buffer
+//				first		- The first record number to delete
+//
+//				count		- The amount of records to delete
 //
 // Returns:     TRUE on success, FALSE on FAILURE
 //
-int WriteRecord( SDBFile *dbFile, char* record, int iFlag );
-
-
-// ++++++++++++++++++++++++++++++++++++++++++
-// Sorting functions
-// ++++++++++++++++++++++++++++++++++++++++++
+int DeleteRecords( SDBFile *dbFile, long first, long count );
 
 //-----------------------------------------------------------------------------
-// Purpose:     Sort the file with insertion sort method
-//				Insertion sort is a very good sort algorithm for small changes to a database
+// Purpose:     Delete a set of records from the database
+//				The file is compacted in one pass, the records in between are moved in large blocks
 //
 // Parameters:  dbFile		- pointer to an open database handle
 //
-//				offset		- start from what position in record sorting
+//				recordnumbers - The record numbers to delete, sorted from low to high
 //
-//				checksize	- length of sorting part of database e.g. EAN8 is only 8 characters
+//				count		- The amount of record numbers in recordnumbers
 //
 // Returns:     TRUE on success, FALSE on FAILURE
 //
-int InsertionSort( SDBFile *dbFile, short offset, short checksize );
+int DeleteRecordSet( SDBFile *dbFile, long* recordnumbers, long count );
 
 //-----------------------------------------------------------------------------
-// Purpose:     Sort the file with heap sort method
-//				Heap sort works good on not sorted databases
+// Purpose:     Only mark deleted records instead of removing them from the file
+//				A delete writes DB_DELETED_MARK at offset in the record, which makes it a cheap
+//				single record write. ReadFirstRecord, ReadNextRecord, ReadPreviousRecord,
+//				ReadLastRecord, BinarySearch and LineairSearch skip marked records.
+//				The space is given back by CompactDatabase() or CompactWhenNeeded().
 //
 // Parameters:  dbFile		- pointer to an open database handle
 //
-//				offset		- start from what position in record sorting
+//				offset		- position of the marker byte in a record, -1 really deletes records again
 //
-//				checksize	- length of sorting part of database e.g. EAN8 is only 8 characters
+// Remark:		The setting is lost when the database is closed
 //
 // Returns:     TRUE on success, FALSE on FAILURE
 //
-int HeapSort( SDBFile *dbFile, short offset, short checksize );
+int SetDeleteMarker( SDBFile *dbFile, short offset );
 
 //-----------------------------------------------------------------------------
-// Purpose:     Sort the file with heap sort method
-//				Quick sort works very good on not sorted databases
-//				Faster then HeapSort but uses more resources
+// Purpose:     Check if a record read from the database is marked as deleted
 //
 // Parameters:  dbFile		- pointer to an open database handle
 //
-//				offset		- start from what position in record sorting
-//
-//				checksize	- length of sorting part of database e.g. EAN8 is only 8 characters
+//				record		- pointer to record buffer
 //
-// Returns:     TRUE on success, FALSE on FAILURE
+// Returns:     TRUE when deleted, FALSE when not
 //
-int QuickSort( SDBFile *dbFile, short offset, short checksize );
-
-// +++++++++++++++++++++++++++++++++++++++++
-// Searching  functions
-// +++++++++++++++++++++++++++++++++++++++++
+int IsRecordDeleted( SDBFile *dbFile, char* record );
 
 //-----------------------------------------------------------------------------
-// Purpose:     Find the search key in the sorted database
+// Purpose:     Get the amount of records marked as deleted
 //
 // Parameters:  dbFile		- pointer to an open database handle
 //
-//				record		- pointer to record buffer
-//
-//				searchkey	- the string to search for in the database
+// Returns:     long		- The amount of deleted records, -1L error
 //
-//				checksize	- the length of the searchkey
+long GetDeletedRecords( SDBFile *dbFile );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Remove all records marked as deleted from the file in one pass
 //
-//				offset		- how many positions to the right must the searchstring be compared
+// Parameters:  dbFile		- pointer to an open database handle
 //
-// Returns:     record number on success, -1L on FAILURE
+// Returns:     TRUE on success, FALSE on FAILURE
 //
-long BinarySearch( SDBFile *dbFile, char* record, char* searchkey, int checksize, int offset );
+int CompactDatabase( SDBFile *dbFile );
 
 //-----------------------------------------------------------------------------
-// Purpose:     Find the search key in a database (slow but does not need to be sorted )
+// Purpose:     Compact the database when enough records are marked as deleted
+//				Meant to be called when there is time, e.g. when the terminal is in the cradle
 //
 // Parameters:  dbFile		- pointer to an open database handle
 //
-//				record		- pointer to record buffer
+//				percent		- compact when at least this percentage of the records is deleted
 //
-//				searchkey	- the string to search for in the database
+// Returns:     TRUE on success, FALSE on FAILURE
 //
-//				checksize	- the length of the searchkey
+int CompactWhenNeeded( SDBFile *dbFile, int percent );
+
+//-----------------------------------------------------------------------------
+// Purpose:     overwrite or append a record in the database
 //
-//				offset		- how many positions to the right must the searchstring be compared
+// Parameters:  dbFile		- pointer to an open database handle
 //
-// Returns:     record number on success, -1L on FAILURE
+//				record		- pointer to record buffer
 //
-long LineairSearch( SDBFile *dbFile, char* record, char* searchkey, int checksize, int offset );
-
-// +++++++++++++++++++++++++++++++++++++++++
-// Special index functions
-// +++++++++++++++++++++++++++++++++++++++++
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int WriteRecord( SDBFile *dbFile, char* record, int iFlag );
 
 //-----------------------------------------------------------------------------
-// Purpose:     Make a sorted indexed file from a not sorted database for fast searching in non sorted databases
+// Purpose:     Insert a record at its sorted position in a sorted database
+//				The position is found with a binary search and only the records behind it
+//				are moved, in large blocks. Equal keys keep their order, the new record goes last.
 //
-// Parameters:  dbFile		- pointer to an open database handle to make index from
-//
-//				offset		- how many positions to the right to start making index
+// Parameters:  dbFile		- pointer to an open database handle
 //
-//				keysize		- the size of the search key to make the index on
+//				record		- pointer to record buffer
 //
-//				indexfilename - name of the to create index file
+//				offset		- start from what position in record the key is
 //
-//				dbIndex		- On success holds a pointer to open index file
+//				keysize		- length of the key the database is sorted on
 //
-// Remark:		dbIndex needs to be closed with CloseDatabase( SDBFile *dbFile );
+// Remark:		On success the inserted record is the current record
 //
 // Returns:     TRUE on success, FALSE on FAILURE
 //
-int CreateIndexFile( SDBFile *dbFile, short offset, short keysize, const char* indexfilename, SDBFile *dbIndex );
+int InsertRecordSorted( SDBFile *dbFile, char* record, short offset, short keysize );
 
 //-----------------------------------------------------------------------------
-// Purpose:     Opens an existing index database file
+// Purpose:     Overwrite the record with a key, or insert it when the key is not in the database
+//				The key is searched once like BinarySearch. A new record is inserted at its
+//				sorted position, or appended when a delta log on the key is set (SetDeltaLog).
 //
-// Parameters:  indexfilename - index database file name
+// Parameters:  dbFile		- pointer to an open database handle
 //
-//              keysize		- length of keysize to search for in index
+//				searchkey	- the key to search for, the same key as in record
 //
-//				dbIndex		- returns the pointer to the index database handle
+//				record		- pointer to record buffer with the new record
 //
-// Remark:		dbIndex needs to be closed with CloseDatabase( SDBFile *dbFile );
+//				offset		- start from what position in record the key is
 //
-// Returns:     TRUE on success, FALSE on FAILURE
+//				keysize		- length of the key the database is sorted on
 //
-int OpenIndexFile( const char *indexfilename, short keysize, SDBFile *dbIndex );
-
-//-----------------------------------------------------------------------------
+//				existed		- set to TRUE when a record was overwritten, FALSE when it was inserted
+//
+// Remark:		On success the written record is the current record, GetSearchProbes()
+//				returns the records read by the search
+//
+// Returns:     The record number of the written record, -1L on FAILURE
+//
+long UpsertRecord( SDBFile *dbFile, char* searchkey, char* record, short offset, short keysize, int* existed );
+
+
+// ++++++++++++++++++++++++++++++++++++++++++
+// Sorting functions
+// ++++++++++++++++++++++++++++++++++++++++++
+
+//-----------------------------------------------------------------------------
+// Purpose:     Sort the file with insertion sort method
+//				Insertion sort is a very good sort algorithm for small changes to a database
+//
+// Parameters:  dbFile		- pointer to an open database handle
+//
+//				offset		- start from what position in record sorting
+//
+//				checksize	- length of sorting part of database e.g. EAN8 is only 8 characters
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int InsertionSort( SDBFile *dbFile, short offset, short checksize );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Sort the file with heap sort method
+//				Heap sort works good on not sorted databases
+//				When the database fits in memory it is loaded, sorted and written back in one pass
+//
+// Parameters:  dbFile		- pointer to an open database handle
+//
+//				offset		- start from what position in record sorting
+//
+//				checksize	- length of sorting part of database e.g. EAN8 is only 8 characters
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int HeapSort( SDBFile *dbFile, short offset, short checksize );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Sort the file with heap sort method
+//				Quick sort works very good on not sorted databases
+//				Faster then HeapSort but uses more resources
+//				When the database fits in memory it is loaded, sorted and written back in one pass
+//
+// Parameters:  dbFile		- pointer to an open database handle
+//
+//				offset		- start from what position in record sorting
+//
+//				checksize	- length of sorting part of database e.g. EAN8 is only 8 characters
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int QuickSort( SDBFile *dbFile, short offset, short checksize );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Sort the file with an external merge sort
+//				For databases that are larger then the available memory. Sorted runs as large as
+//				coreleft() allows are written to a temporary file and merged in passes of up to
+//				8 runs at a time. The sorted result replaces the original file.
+//				All file access is sequential.
+//
+// Parameters:  dbFile		- pointer to an open database handle
+//
+//				offset		- start from what position in record sorting
+//
+//				checksize	- length of sorting part of database e.g. EAN8 is only 8 characters
+//
+// Remark:		Needs free disk space for two temporary copies of the database (.tm1 and .tm2)
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int ExternalSort( SDBFile *dbFile, short offset, short checksize );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Sort the file with a LSD radix sort on the characters of the key
+//				Sorts on the last key character first and on the first one last, every pass
+//				keeps the order of the previous pass. The time grows linear with the amount
+//				of records. When the file fits twice in coreleft() it is sorted in memory,
+//				otherwise every pass distributes the records over temporary files with
+//				sequential reads and writes. Key positions where all records have the same
+//				character (e.g. leading zeros) are skipped.
+//
+// Parameters:  dbFile		- pointer to an open database handle
+//
+//				offset		- start from what position in record sorting
+//
+//				checksize	- length of sorting part of database e.g. EAN8 is only 8 characters
+//
+// Remark:		Needs free disk space for two temporary copies of the database (.tm1 and .tm2)
+//				when the database does not fit in memory. The buckets of a pass on file are
+//				allocated with the record buffers and freed when the sort is done.
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int RadixSort( SDBFile *dbFile, short offset, short checksize );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Sort the file on tags of key and record number
+//				For databases where the keys fit in memory but the records do not. The tags
+//				are collected in one sequential pass and sorted in memory, then the records are
+//				written in the sorted order to a temporary file that replaces the database.
+//
+// Parameters:  dbFile		- pointer to an open database handle
+//
+//				offset		- start from what position in record sorting
+//
+//				checksize	- length of sorting part of database e.g. EAN8 is only 8 characters
+//
+// Remark:		Needs (checksize + 4) bytes of memory for every record and free disk space
+//				for one temporary copy of the database (.tm1)
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int TagSort( SDBFile *dbFile, short offset, short checksize );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Sort the file with the best method for the database and the available memory
+//				This is the sort function to use, no need to choose a sort method per call.
+//				One sequential pass finds the longest sorted run of records. A sorted database
+//				is not written at all. When the run is more then half of the database (e.g. a
+//				sorted database with some records added) the other records are sorted in memory
+//				and merged into the run, the run is copied in blocks.
+//				Otherwise the database is sorted in memory (QuickSort) when all records fit in
+//				coreleft(), with TagSort when only the keys fit, else with RadixSort for keys up to
+//				4 characters and ExternalSort for longer keys.
+//				With a header (SetDatabaseHeader) on the key a database that did not change
+//				since it was sorted is not read at all.
+//
+// Parameters:  dbFile		- pointer to an open database handle
+//
+//				offset		- start from what position in record sorting
+//
+//				checksize	- length of sorting part of database e.g. EAN8 is only 8 characters
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int SortDatabase( SDBFile *dbFile, short offset, short checksize );
+
+// +++++++++++++++++++++++++++++++++++++++++
+// Searching  functions
+// +++++++++++++++++++++++++++++++++++++++++
+
+//-----------------------------------------------------------------------------
+// Purpose:     Find the search key in the sorted database
+//				With a header (SetDatabaseHeader) on the key only the sorted records are
+//				searched binary, the records added after the last sort are looked up in the
+//				delta log (SetDeltaLog) or else searched one by one
+//
+// Parameters:  dbFile		- pointer to an open database handle
+//
+//				record		- pointer to record buffer
+//
+//				searchkey	- the string to search for in the database
+//
+//				checksize	- the length of the searchkey
+//
+//				offset		- how many positions to the right must the searchstring be compared
+//
+// Returns:     record number on success, -1L on FAILURE
+//
+long BinarySearch( SDBFile *dbFile, char* record, char* searchkey, int checksize, int offset );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Find the search key in a database (slow but does not need to be sorted )
+//
+// Parameters:  dbFile		- pointer to an open database handle
+//
+//				record		- pointer to record buffer
+//
+//				searchkey	- the string to search for in the database
+//
+//				checksize	- the length of the searchkey
+//
+//				offset		- how many positions to the right must the searchstring be compared
+//
+// Returns:     record number on success, -1L on FAILURE
+//
+long LineairSearch( SDBFile *dbFile, char* record, char* searchkey, int checksize, int offset );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Find the search key in the sorted database, for evenly spread numeric keys
+//				(e.g. device numbers) interpolation search guesses the place of the key from
+//				the keys around it and needs less reads then a binary search. When the key is
+//				not found after a few guesses the search continues as a binary search.
+//				With a fence index (SetFenceIndex) on the key a binary search is always used.
+//
+// Parameters:  dbFile		- pointer to an open database handle
+//
+//				record		- pointer to record buffer
+//
+//				searchkey	- the string to search for in the database
+//
+//				checksize	- the length of the searchkey
+//
+//				offset		- how many positions to the right must the searchstring be compared
+//
+//				mode		- DB_SEARCH_BINARY, DB_SEARCH_INTERPOLATE or DB_SEARCH_AUTO
+//
+// Returns:     record number on success, -1L on FAILURE
+//
+long KeySearch( SDBFile *dbFile, char* record, char* searchkey, int checksize, int offset, int mode );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Get the amount of records read by the last BinarySearch, LineairSearch or KeySearch
+//
+// Returns:     the amount of records read
+//
+long GetSearchProbes( void );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Search many keys at once in a database sorted on the key
+//				The keys are sorted first, then the database is walked through once from
+//				the start to the end. For a few keys in a large database the search jumps
+//				from key to key with growing steps (galloping), otherwise all records are
+//				read once in blocks and compared with the sorted keys (merge).
+//
+// Parameters:  dbFile		- pointer to an open database handle
+//
+//				keys		- the keys to search for, count keys of keysize characters each
+//
+//				count		- the amount of keys
+//
+//				offset		- how many positions to the right must the keys be compared
+//
+//				keysize		- the length of one key
+//
+//				results		- array of count record numbers, filled with the record number
+//							  of each key in the same order as keys, -1L when not found
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int BinarySearchMany( SDBFile *dbFile, char* keys, long count, short offset, short keysize, long* results );
+
+// +++++++++++++++++++++++++++++++++++++++++
+// Special index functions
+// +++++++++++++++++++++++++++++++++++++++++
+
+//-----------------------------------------------------------------------------
+// Purpose:     Make a sorted indexed file from a not sorted database for fast searching in non sorted databases
+//				The index file is a B+tree, a search or an added key only reads the pages from the root
+//				down to one leaf page, so it stays fast when the index grows.
+//
+// Parameters:  dbFile		- pointer to an open database handle to make index from
+//
+//				offset		- how many positions to the right to start making index
+//
+//				keysize		- the size of the search key to make the index on
+//
+//				indexfilename - name of the to create index file
+//
+//				dbIndex		- On success holds a pointer to open index file
+//
+// Remark:		dbIndex needs to be closed with CloseDatabase( SDBFile *dbFile );
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int CreateIndexFile( SDBFile *dbFile, short offset, short keysize, const char* indexfilename, SDBFile *dbIndex );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Opens an existing index database file
+//
+// Parameters:  indexfilename - index database file name
+//
+//              keysize		- length of keysize to search for in index
+//
+//				dbIndex		- returns the pointer to the index database handle
+//
+// Remark:		dbIndex needs to be closed with CloseDatabase( SDBFile *dbFile );
+//
+// Returns:     TRUE on success, FALSE on FAILURE (DB_ERROR_RECORD_SIZE when it is no index file or keysize differs)
+//
+int OpenIndexFile( const char *indexfilename, short keysize, SDBFile *dbIndex );
+
+//-----------------------------------------------------------------------------
 // Purpose:     Find the search string in the index database
 //
 // Parameters:  dbIndex		- pointer to an open index database handle
@@ -357,9 +989,26 @@ int OpenIndexFile( const char *indexfilename, short keysize, SDBFile *dbIndex );
 //				searchkey	- the string to search for in the database
 //
 // Returns:     record number on success, -1L on FAILURE
+//				When the key is in the index more then once, the lowest record number is returned
 //
 long SearchIndexFile( SDBFile *dbIndex, char* searchkey );
 
+//-----------------------------------------------------------------------------
+// Purpose:     Walk through all keys in the index from fromkey up to and including tokey in sorted order
+//
+// Parameters:  dbIndex		- pointer to an open index database handle
+//
+//				fromkey		- first key to return, NULL to start at the lowest key
+//
+//				tokey		- last key to return, NULL to walk up to the highest key
+//
+//				callback	- called with the key and record number of each found key,
+//							  returns TRUE to continue and FALSE to stop the scan
+//
+// Returns:     amount of keys passed to callback, -1L on failure
+//
+long ScanIndexRange( SDBFile *dbIndex, char* fromkey, char* tokey, int (*callback)( char* key, long recordnumber ));
+
 //-----------------------------------------------------------------------------
 // Purpose:     Add a new item to the index database
 //
@@ -373,6 +1022,522 @@ long SearchIndexFile( SDBFile *dbIndex, char* searchkey );
 //
 int AddNewSearchkeyToIndex( SDBFile *dbIndex, char *nwsearchkey, long recordnumber );
 
+// +++++++++++++++++++++++++++++++++++++++++
+// Secondary index functions
+// +++++++++++++++++++++++++++++++++++++++++
+
+//-----------------------------------------------------------------------------
+// Purpose:     Attach a secondary index on a field that is not the sort key, e.g. a time stamp.
+//				The index is an index file (see CreateIndexFile) with the field and the header key of
+//				every record, WriteRecord() adds the entries of appended and overwritten records and
+//				removes the old entry of an overwritten record that changed the field or was marked as deleted.
+//				Records that were moved by inserting, deleting, sorting, compacting or merging the
+//				delta log are found again with their header key, so the index file is not made again.
+//
+// Parameters:  dbFile		- pointer to an open database handle
+//
+//				offset		- position of the field in the record, one secondary index per offset
+//
+//				keysize		- size of the field, 0 removes the secondary index on offset
+//
+//				indexfilename - name of the index file, it is used again when the database is opened
+//							  the next time and did not change since the index file was saved
+//
+// Remark:		Needs a header (see SetDatabaseHeader) on a key that is unique per record, e.g. the
+//				device. Its change counter tells if the index file of an earlier session still fits
+//				the database. Remove the index file together with the database.
+//				The index file is saved by FlushDatabase() and closed by CloseDatabase().
+//
+// Returns:     TRUE on success, FALSE on FAILURE (DB_ERROR_NO_HEADER without header)
+//
+int SetSecondaryIndex( SDBFile *dbFile, short offset, short keysize, const char* indexfilename );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Find all records with a field from fromkey up to and including tokey with the secondary
+//				index on the field, without reading the other records. Records marked as deleted are skipped.
+//
+// Parameters:  dbFile		- pointer to an open database handle with a secondary index on offset
+//
+//				offset		- position of the field in the record, see SetSecondaryIndex()
+//
+//				fromkey		- lowest field value, NULL to start at the lowest value
+//
+//				tokey		- highest field value, NULL to end at the highest value
+//
+//				callback	- called with the record and record number of each found record in the order
+//							  of the field and the header key, returns TRUE to continue and FALSE to stop
+//							  the query. The callback must not change the database or start another RangeQuery()
+//
+// Remark:		A secondary index on a time stamp gives e.g. the records of today or since the last
+//				transmit with one query. That is API only, CowAlert keeps no time index: it only queries
+//				its wearer index (see SearchSecondaryIndex) and counts the scans of today in its scan log
+//				with QueryPartitions().
+//
+// Returns:     amount of records passed to callback, -1L on failure
+//				(DB_ERROR_NOT_FOUND when there is no secondary index on offset)
+//
+long RangeQuery( SDBFile *dbFile, short offset, char* fromkey, char* tokey, int (*callback)( char* record, long recordnumber ));
+
+//-----------------------------------------------------------------------------
+// Purpose:     Find the record numbers of all records with a key in the secondary index on offset
+//
+// Parameters:  dbFile		- pointer to an open database handle with a secondary index on offset
+//
+//				offset		- position of the field in the record, see SetSecondaryIndex()
+//
+//				searchkey	- the key to search for, as long as the field
+//
+//				recordnumbers - holds the found record numbers, in the order of the header key
+//
+//				maxcount	- amount of record numbers that fit in recordnumbers
+//
+// Returns:     amount of found record numbers, at most maxcount, -1L on failure
+//				(DB_ERROR_NOT_FOUND with 0 when no record has the key)
+//
+long SearchSecondaryIndex( SDBFile *dbFile, short offset, char* searchkey, long* recordnumbers, long maxcount );
+
+// +++++++++++++++++++++++++++++++++++++++++
+// Aggregate functions
+// +++++++++++++++++++++++++++++++++++++++++
+
+//-----------------------------------------------------------------------------
+// Purpose:     Attach an aggregate on a field, e.g. a device. For every key of the field it keeps the
+//				amount of records with the key, the amount of writes of those records and the last (highest)
+//				value of another field, e.g. a time stamp. WriteRecord() keeps it up to date in a hash table
+//				file, DeleteRecords() and DeleteRecordSet() take off the records they remove, sorting and
+//				compacting do not change it, so the counts are known without reading the database.
+//				Records marked as deleted are not counted.
+//
+// Parameters:  dbFile		- pointer to an open database handle
+//
+//				offset		- position of the key in the record, one aggregate per offset
+//
+//				keysize		- size of the key, 0 removes the aggregate on offset
+//
+//				valueoffset	- position of the value in the record, a 32 bit number of 0 or higher
+//							  with the most significant byte first
+//
+//				bucketsize	- the last values are counted per bucket of this size, see CountAggregateKeys()
+//
+//				maxkeys		- the table holds at least this amount of keys and does not grow beyond,
+//							  0L lets it grow as long as the RAM disk has room
+//
+//				filename	- name of the aggregate file, it is used again when the database is opened
+//							  the next time and did not change since the file was saved
+//
+// Remark:		Needs a header (see SetDatabaseHeader), its change counter tells if the aggregate still fits
+//				the database. When the database changes in another way then WriteRecord(), DeleteRecords(),
+//				DeleteRecordSet(), sorting or compacting the aggregate is made again with one pass over the
+//				database, the writes of a key are its records then.
+//				The aggregate file is saved by FlushDatabase() and CloseDatabase(), remove it together
+//				with the database. It is marked as not up to date on its first change after it was saved,
+//				so it is made again when the terminal was switched off before the database was flushed.
+//				A key takes 16 bytes (4 byte key) in a hash table file that doubles when it is three
+//				quarters full, only DB_CACHE_BLOCKS blocks of DB_CACHE_RECORDS keys are in memory. The file
+//				only grows when the RAM disk keeps 5000 bytes free for the OS. When the keys do not fit the
+//				file is removed and GetAggregate() and CountAggregateKeys() fail with DB_ERROR_AGGREGATE_FULL
+//				until SetAggregate() is called again.
+//
+// Returns:     TRUE on success, FALSE on FAILURE (DB_ERROR_NO_HEADER without header, DB_ERROR_AGGREGATE_FULL)
+//
+int SetAggregate( SDBFile *dbFile, short offset, short keysize, short valueoffset, long bucketsize, long maxkeys,
+				  const char* filename );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Get the counts of one key of the aggregate on offset
+//
+// Parameters:  dbFile		- pointer to an open database handle with an aggregate on offset
+//
+//				offset		- position of the key in the record, see SetAggregate()
+//
+//				key			- the key, as long as the field
+//
+//				writes		- holds the amount of writes of records with the key
+//
+//				last		- holds the highest value of the records with the key
+//
+// Returns:     amount of records with the key, -1L on failure
+//				(DB_ERROR_NOT_FOUND with -1L when there is no aggregate on offset, with 0L when no record has the key)
+//
+long GetAggregate( SDBFile *dbFile, short offset, char* key, long* writes, long* last );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Count the keys of the aggregate on offset that have records
+//
+// Parameters:  dbFile		- pointer to an open database handle with an aggregate on offset
+//
+//				offset		- position of the key in the record, see SetAggregate()
+//
+//				bucket		- only count the keys with their last value in this bucket (value / bucketsize),
+//							  -1L counts all keys. The highest bucket is counted without looking at the keys.
+//
+// Returns:     amount of keys, -1L on failure (DB_ERROR_NOT_FOUND when there is no aggregate on offset)
+//
+long CountAggregateKeys( SDBFile *dbFile, short offset, long bucket );
+
+// +++++++++++++++++++++++++++++++++++++++++
+// Partition functions
+// +++++++++++++++++++++++++++++++++++++++++
+
+//-----------------------------------------------------------------------------
+// Purpose:     Open a partitioned database, or start a new one when it has no catalog yet.
+//				The records are split over partition files on a value in the record, e.g. one file per
+//				day of a time stamp. Queries and searches on a range of values only open the partitions
+//				that hold values in the range, sorts and searches stay as large as one partition and
+//				old partitions are sent and removed one at a time.
+//				The partitions are named after the database, the first 4 characters of the name, the
+//				number of the partition as 4 hex digits and the extension, e.g. data0001.dat. The catalog
+//				with the lowest and highest value of every partition has the extension cat, e.g. data.cat.
+//
+// Parameters:  filename	- database file name, only used to name the catalog and partition files
+//
+//              recordsize	- length of one record
+//
+//				offset		- position of the value in the record, a 32 bit number of 0 or higher
+//							  with the most significant byte first
+//
+//				bucketsize	- records with another value / bucketsize go in another partition,
+//							  0 to only split on maxrecords
+//
+//				maxrecords	- a partition with this many records is full, the next record of its bucket
+//							  starts a new partition, 0 when not limited
+//
+//				dbParts		- returns the handle of the partitioned database
+//
+// Remark:		A partition whose file size does not fit the catalog, e.g. after the terminal was switched
+//				off before FlushPartitions(), is read once to count its records and values again.
+//
+// Returns:     TRUE on success, FALSE on FAILURE (DB_ERROR_RECORD_SIZE when the catalog
+//				was made with another record size, offset, bucketsize or maxrecords)
+//
+int OpenPartitions( const char *filename, short recordsize, short offset, long bucketsize, long maxrecords, SDBPartitions *dbParts );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Close the open partition and save the catalog
+//
+// Parameters:  dbParts		- pointer to an open partitioned database
+//
+// Returns:     None
+//
+void ClosePartitions( SDBPartitions *dbParts );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Write the changed records of the open partition and the catalog to their files
+//
+// Parameters:  dbParts		- pointer to an open partitioned database
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int FlushPartitions( SDBPartitions *dbParts );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Append a record to the newest partition of its bucket that is not full,
+//				a new partition is made when there is none
+//
+// Parameters:  dbParts		- pointer to an open partitioned database
+//
+//				record		- the record to append
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int WritePartitionRecord( SDBPartitions *dbParts, char* record );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Get the amount of partitions, partition 0 is the oldest
+//
+// Parameters:  dbParts		- pointer to an open partitioned database
+//
+// Returns:     amount of partitions, -1L on failure
+//
+long GetPartitionCount( SDBPartitions *dbParts );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Get the records and the range of values of a partition
+//
+// Parameters:  dbParts		- pointer to an open partitioned database
+//
+//				partition	- the partition, from 0 up to GetPartitionCount() - 1
+//
+//				low			- holds the lowest value in the partition
+//
+//				high		- holds the highest value in the partition
+//
+// Returns:     amount of records in the partition, -1L on failure
+//
+long GetPartitionInfo( SDBPartitions *dbParts, long partition, long* low, long* high );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Open a partition as dbParts->dbPart, e.g. to send it with its own CSV file or to scroll through it.
+//				All database functions can be used on dbParts->dbPart until another partition is opened.
+//
+// Parameters:  dbParts		- pointer to an open partitioned database
+//
+//				partition	- the partition, from 0 up to GetPartitionCount() - 1
+//
+// Remark:		Records written to dbParts->dbPart must keep their value within the bucket of the partition,
+//				else QueryPartitions() and SearchPartitions() may skip them.
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int SelectPartition( SDBPartitions *dbParts, long partition );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Find all records with a value from fromvalue up to and including tovalue, only the
+//				partitions with values in that range are read. Records marked as deleted are skipped.
+//
+// Parameters:  dbParts		- pointer to an open partitioned database
+//
+//				fromvalue	- lowest value, 0L to start at the lowest value
+//
+//				tovalue		- highest value, DB_VALUE_MAX to end at the highest value
+//
+//				callback	- called with the record, partition and record number of each found record,
+//							  partitions from old to new. Returns TRUE to continue and FALSE to stop the query.
+//							  The callback must not change the partitions or open another partition
+//
+// Returns:     amount of records passed to callback, -1L on failure
+//
+long QueryPartitions( SDBPartitions *dbParts, long fromvalue, long tovalue, int (*callback)( char* record, long partition, long recordnumber ));
+
+//-----------------------------------------------------------------------------
+// Purpose:     Search a key in the partitions with values from fromvalue up to and including tovalue,
+//				the newest partition first. Partitions sorted on the key by SortPartitions() are searched
+//				with BinarySearch(), the others with LineairSearch().
+//
+// Parameters:  dbParts		- pointer to an open partitioned database
+//
+//				record		- holds the found record
+//
+//				searchkey	- the key to search for
+//
+//				offset		- how many positions to the right the key starts in the record
+//
+//				keysize		- the size of the key
+//
+//				fromvalue	- lowest value, 0L to start at the lowest value
+//
+//				tovalue		- highest value, DB_VALUE_MAX to end at the highest value
+//
+//				partition	- holds the partition of the found record, it is open as dbParts->dbPart
+//
+// Returns:     the record number in the partition, -1L on failure (DB_ERROR_NOT_FOUND when no partition has the key)
+//
+long SearchPartitions( SDBPartitions *dbParts, char* record, char* searchkey, short offset, short keysize,
+					   long fromvalue, long tovalue, long* partition );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Sort every partition on a key with SortDatabase(), the partitions that did not change
+//				since they were sorted on the same key are skipped
+//
+// Parameters:  dbParts		- pointer to an open partitioned database
+//
+//				offset		- how many positions to the right the key starts in the record
+//
+//				checksize	- the size of the key
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int SortPartitions( SDBPartitions *dbParts, short offset, short checksize );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Remove a partition file and its entry in the catalog, e.g. after it was sent.
+//				The partitions after it move one number down.
+//
+// Parameters:  dbParts		- pointer to an open partitioned database
+//
+//				partition	- the partition, from 0 up to GetPartitionCount() - 1
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int RemovePartition( SDBPartitions *dbParts, long partition );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Remove the catalog and all partition files of a database, also the partition files
+//				that are not in the catalog anymore. The files are found with findfirst() and findnext().
+//
+// Parameters:  filename	- database file name as passed to OpenPartitions(), the database must be closed
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int RemovePartitionFiles( const char *filename );
+
+// +++++++++++++++++++++++++++++++++++++++++
+// Write counter functions
+// +++++++++++++++++++++++++++++++++++++++++
+
+//-----------------------------------------------------------------------------
+// Purpose:     Count the writes of every record in a field of the record, e.g. the scans of a device
+//				that is overwritten on every scan. WriteRecord() sets the counter of an appended record
+//				to 1, and of an overwritten record with the same key to the counter of the old record
+//				plus 1. An overwritten record with another key starts at 1 again.
+//
+// Parameters:  dbFile		- pointer to an open database handle
+//
+//				offset		- position of the counter in the record, 2 bytes with the most significant
+//							  byte first, -1 removes the counter
+//
+//				keyoffset	- position of the key that tells the overwritten record is the same
+//
+//				keysize		- size of the key
+//
+// Remark:		WriteRecord() writes a copy of the record with the counter, the record passed to it does
+//				not change. Sorts, merges and inserts move records without counting, records marked as
+//				deleted keep their counter and the counter stops at 65535.
+//				The counter is not saved with the database, set it again after every open.
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int SetWriteCounter( SDBFile *dbFile, short offset, short keyoffset, short keysize );
+
+// +++++++++++++++++++++++++++++++++++++++++
+// Hash index functions
+// +++++++++++++++++++++++++++++++++++++++++
+
+//-----------------------------------------------------------------------------
+// Purpose:     Make a hash index file on a database for exact key lookups in a database that is not sorted
+//				A search reads one or a few buckets, independent of the size of the database.
+//				Each key is stored once, with the record number of the last record that has the key.
+//				Deleted records (see SetDeleteMarker) are not added.
+//
+// Parameters:  dbFile		- pointer to an open database handle to make the hash index from
+//
+//				offset		- how many positions to the right the key starts in the record
+//
+//				keysize		- the size of the key
+//
+//				hashfilename - name of the to create hash index file
+//
+//				dbHash		- On success holds a pointer to the open hash index file
+//
+// Remark:		dbHash needs to be closed with CloseDatabase( SDBFile *dbFile );
+//				The record numbers in the hash index are only valid as long as no records are inserted,
+//				deleted or sorted in the database, use RebuildHashIndex after that.
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int CreateHashIndex( SDBFile *dbFile, short offset, short keysize, const char* hashfilename, SDBFile *dbHash );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Opens an existing hash index file
+//
+// Parameters:  hashfilename - hash index file name
+//
+//              keysize		- the size of the key the hash index was made on
+//
+//				dbHash		- returns the pointer to the hash index handle
+//
+// Returns:     TRUE on success, FALSE on FAILURE (DB_ERROR_RECORD_SIZE when it is no hash index file or keysize differs)
+//
+int OpenHashIndex( const char* hashfilename, short keysize, SDBFile *dbHash );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Find the record number of a key in the hash index
+//
+// Parameters:  dbHash		- pointer to an open hash index handle
+//
+//				searchkey	- the key to search for
+//
+// Returns:     record number on success, -1L on FAILURE (DB_ERROR_NOT_FOUND when the key is not in the index)
+//
+long SearchHashIndex( SDBFile *dbHash, char* searchkey );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Add a key to the hash index or change the record number of a key that is already in it
+//				The hash index file is doubled in size when it gets more then 3/4 full.
+//
+// Parameters:  dbHash		- pointer to an open hash index handle
+//
+//				key			- the key of the record
+//
+//				recordnumber- the record number of the record in the database
+//
+// Returns:     TRUE on success, FALSE on failure
+//
+int AddKeyToHashIndex( SDBFile *dbHash, char* key, long recordnumber );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Check that the hash index holds the key of every record of the database once, and that
+//				every entry holds the record number of a record with its key. With duplicate keys the
+//				entry may be any of the records with the key.
+//
+// Parameters:  dbFile		- pointer to the open database handle the hash index was made on
+//
+//				offset		- how many positions to the right the key starts in the record
+//
+//				dbHash		- pointer to an open hash index handle
+//
+// Returns:     TRUE when the hash index is valid, FALSE when not (DB_ERROR_NOT_FOUND) or on failure
+//
+int VerifyHashIndex( SDBFile *dbFile, short offset, SDBFile *dbHash );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Make the hash index again from the database, e.g. after VerifyHashIndex failed
+//
+// Parameters:  dbFile		- pointer to the open database handle the hash index was made on
+//
+//				offset		- how many positions to the right the key starts in the record
+//
+//				dbHash		- pointer to an open hash index handle, stays open on success
+//
+// Returns:     TRUE on success, FALSE on failure
+//
+int RebuildHashIndex( SDBFile *dbFile, short offset, SDBFile *dbHash );
+
+// +++++++++++++++++++++++++++++++++++++++++
+// Dictionary functions
+// +++++++++++++++++++++++++++++++++++++++++
+
+//-----------------------------------------------------------------------------
+// Purpose:     Open a dictionary file, or make it when it does not exist. A dictionary gives every key
+//				a code of DB_DICT_CODESZ bytes, e.g. a device that is stored many times in a log is stored
+//				as its code, and a sort or search on the field compares the code instead of the key.
+//				The codes are given in the order the keys are added and never change, the code order is
+//				not the key order. The codes are found with a hash index file with the extension hsh,
+//				only the cache blocks of the dictionary and the hash index are kept in memory.
+//
+// Parameters:  filename	- dictionary file name, one record per key, the record number is the code
+//
+//				keysize		- the size of a key
+//
+//				dbDict		- returns the handle of the dictionary, closed with CloseDatabase()
+//
+// Remark:		Only add keys with EncodeKey(), the other database functions must not change the file.
+//				The hash index is made again when it is missing or does not match the dictionary.
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int OpenDictionary( const char *filename, short keysize, SDBFile *dbDict );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Get the code of a key, the hash index is searched for the key
+//
+// Parameters:  dbDict		- pointer to an open dictionary, see OpenDictionary()
+//
+//				key			- the key, as long as the keysize of the dictionary
+//
+//				code		- holds the DB_DICT_CODESZ bytes of the code, most significant byte first
+//
+//				bAdd		- TRUE appends a new key to the dictionary file and gives it the next code,
+//							  the dictionary file is written before the function returns
+//
+// Returns:     TRUE on success, FALSE on FAILURE (DB_ERROR_NOT_FOUND for a new key without bAdd,
+//				DB_ERROR_DICT_FULL when DB_DICT_MAX_CODES keys are used)
+//
+int EncodeKey( SDBFile *dbDict, char* key, char* code, int bAdd );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Get the key of a code, the reverse of EncodeKey(), the record of the code is read
+//
+// Parameters:  dbDict		- pointer to an open dictionary, see OpenDictionary()
+//
+//				code		- the DB_DICT_CODESZ bytes of the code
+//
+//				key			- holds the key
+//
+// Returns:     TRUE on success, FALSE on FAILURE (DB_ERROR_NOT_FOUND for an unused code)
+//
+int DecodeKey( SDBFile *dbDict, char* code, char* key );
+
 #endif // __DATABASE_H__
 
 
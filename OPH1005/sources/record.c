@@ -0,0 +1,373 @@
+//
+// record.c
+//
+// implementation of the packed record of the CowAlert database and
+// the CSV line it is rendered to when the data is transmitted
+//
+// 17/10/2026:	First version, the database holds packed binary records of REC_SIZE bytes
+//				instead of CSV lines, the CSV line is only made when the data leaves the terminal
+//
+// 17/10/2026:	Added IsDeviceNumber(), only device numbers of digits are packed without collisions
+//
+// 17/10/2026:	Added the scans of the device to the record, the CSV line does not change
+//
+// 17/10/2026:	Added coded records with the device as its code in a dictionary, for logs with many scans per device
+//
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#ifdef OPH1004
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+#include "lib.h"
+#ifdef OPH1004
+#undef O_BINARY
+#define O_BINARY 0x00
+#endif
+
+#include "record.h"
+
+//
+// Amount of CSV lines read or written with one file access
+//
+#define REC_CSV_LINES		16
+
+//
+// Days from 01/03/0000 to 01/01/1970 and the days in 400 years
+//
+#define REC_DAYS_EPOCH		719468L
+#define REC_DAYS_ERA		146097L
+
+static char szCsvBuffer[ REC_CSV_SIZE * REC_CSV_LINES ];
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// Packed fields
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+static void PutBig32( char* dest, unsigned long value )
+{
+	dest[0] = (char)( value >> 24 );
+	dest[1] = (char)( value >> 16 );
+	dest[2] = (char)( value >> 8 );
+	dest[3] = (char)value;
+}
+
+static unsigned long GetBig32( const char* src )
+{
+	return ((unsigned long)(unsigned char)src[0] << 24) |
+		   ((unsigned long)(unsigned char)src[1] << 16) |
+		   ((unsigned long)(unsigned char)src[2] << 8) |
+			(unsigned long)(unsigned char)src[3];
+}
+
+void PackDevice( const char* device, char* key )
+{
+	int i;
+	int nibble;
+	int end;
+
+	end = FALSE;
+	memset( key, 0, REC_SZ_DEVICE );
+	for( i = 0; i < REC_DEVICE_DIGITS; i++ )
+	{
+		if( device[i] == '\0' )
+			end = TRUE;
+		//
+		// Only digits are packed, the padding spaces and anything else become 0xF
+		//
+		if( !end && device[i] >= '0' && device[i] <= '9' )
+			nibble = device[i] - '0';
+		else
+			nibble = 0x0F;
+		if( i & 1 )
+			key[ i / 2 ] |= (char)nibble;
+		else
+			key[ i / 2 ] = (char)( nibble << 4 );
+	}
+}
+
+int IsDeviceNumber( const char* device )
+{
+	int i;
+
+	for( i = 0; i < REC_DEVICE_DIGITS && device[i] >= '0' && device[i] <= '9'; i++ )
+		;
+	if( i == 0 )
+		return FALSE;
+	for( ; i < REC_DEVICE_DIGITS && device[i] != '\0'; i++ )
+		if( device[i] != ' ' )
+			return FALSE;
+	return TRUE;
+}
+
+void UnpackDevice( const char* key, char* device )
+{
+	int i;
+	int nibble;
+
+	for( i = 0; i < REC_DEVICE_DIGITS; i++ )
+	{
+		nibble = (unsigned char)key[ i / 2 ];
+		nibble = ( i & 1 ) ? ( nibble & 0x0F ) : ( nibble >> 4 );
+		device[i] = ( nibble <= 9 ) ? (char)( '0' + nibble ) : ' ';
+	}
+	device[ REC_DEVICE_DIGITS ] = '\0';
+}
+
+void PackRecord( char* record, const char* device, long wearer, unsigned long stamp )
+{
+	PackDevice( device, record + REC_OFS_DEVICE );
+	PackWearer( wearer, record + REC_OFS_WEARER );
+	PackStamp( stamp, record + REC_OFS_STAMP );
+	record[ REC_OFS_SCANS ] = 0;
+	record[ REC_OFS_SCANS + 1 ] = 1;
+	record[ REC_OFS_FLAG ] = REC_FLAG_VALID;
+}
+
+void PackWearer( long wearer, char* key )
+{
+	//
+	// Inverting the sign bit keeps negative wearers before positive ones with memcmp()
+	//
+	PutBig32( key, (unsigned long)wearer ^ 0x80000000UL );
+}
+
+void PackStamp( unsigned long stamp, char* key )
+{
+	PutBig32( key, stamp );
+}
+
+long GetRecordWearer( const char* record )
+{
+	unsigned long value;
+
+	value = GetBig32( record + REC_OFS_WEARER ) ^ 0x80000000UL;
+	if( value & 0x80000000UL )
+		return -(long)( ~value & 0x7FFFFFFFUL ) - 1L;
+	return (long)value;
+}
+
+unsigned long GetRecordStamp( const char* record )
+{
+	return GetBig32( record + REC_OFS_STAMP );
+}
+
+long GetRecordScans( const char* record )
+{
+	return ((long)(unsigned char)record[ REC_OFS_SCANS ] << 8) | (unsigned char)record[ REC_OFS_SCANS + 1 ];
+}
+
+int EncodeRecord( SDBFile *dbDict, const char* record, char* coded )
+{
+	if( !EncodeKey( dbDict, (char*)record + REC_OFS_DEVICE, coded + REC_CODED_OFS_CODE, TRUE ))
+		return FALSE;
+	memcpy( coded + REC_CODED_OFS_WEARER, record + REC_OFS_WEARER, REC_SZ_WEARER );
+	memcpy( coded + REC_CODED_OFS_STAMP, record + REC_OFS_STAMP, REC_SZ_STAMP );
+	return TRUE;
+}
+
+int DecodeRecord( SDBFile *dbDict, const char* coded, char* record )
+{
+	if( !DecodeKey( dbDict, (char*)coded + REC_CODED_OFS_CODE, record + REC_OFS_DEVICE ))
+		return FALSE;
+	memcpy( record + REC_OFS_WEARER, coded + REC_CODED_OFS_WEARER, REC_SZ_WEARER );
+	memcpy( record + REC_OFS_STAMP, coded + REC_CODED_OFS_STAMP, REC_SZ_STAMP );
+	record[ REC_OFS_SCANS ] = 0;
+	record[ REC_OFS_SCANS + 1 ] = 1;
+	record[ REC_OFS_FLAG ] = REC_FLAG_VALID;
+	return TRUE;
+}
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// Time stamps
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+//
+// Value of the digits in a field, anything that is not a digit is skipped
+//
+static long FieldValue( const char* field, int size )
+{
+	long value;
+
+	value = 0L;
+	while( size-- > 0 )
+	{
+		if( *field >= '0' && *field <= '9' )
+			value = value * 10L + ( *field - '0' );
+		field++;
+	}
+	return value;
+}
+
+//
+// Days since 01/01/1970, the year is counted from March so the leap day is the last day of a year
+//
+static long DaysFromDate( long year, long month, long day )
+{
+	long era;
+	long yoe;
+	long doy;
+
+	if( month <= 2 )
+		year--;
+	era = year / 400L;
+	yoe = year - era * 400L;
+	doy = ( 153L * ( month > 2 ? month - 3 : month + 9 ) + 2L ) / 5L + day - 1L;
+	return era * REC_DAYS_ERA + yoe * 365L + yoe / 4L - yoe / 100L + doy - REC_DAYS_EPOCH;
+}
+
+static void DateFromDays( long days, long* year, long* month, long* day )
+{
+	long era;
+	long doe;
+	long yoe;
+	long doy;
+	long mp;
+
+	days += REC_DAYS_EPOCH;
+	era = days / REC_DAYS_ERA;
+	doe = days - era * REC_DAYS_ERA;
+	yoe = ( doe - doe / 1460L + doe / 36524L - doe / 146096L ) / 365L;
+	doy = doe - ( 365L * yoe + yoe / 4L - yoe / 100L );
+	mp = ( 5L * doy + 2L ) / 153L;
+	*day = doy - ( 153L * mp + 2L ) / 5L + 1L;
+	*month = mp < 10L ? mp + 3L : mp - 9L;
+	*year = yoe + era * 400L + ( *month <= 2L ? 1L : 0L );
+}
+
+unsigned long MakeTimeStamp( const char* time, const char* date )
+{
+	unsigned long stamp;
+
+	stamp = (unsigned long)DaysFromDate( FieldValue( date + 6, 4 ), FieldValue( date + 3, 2 ), FieldValue( date, 2 ));
+	stamp = stamp * 24UL + (unsigned long)FieldValue( time, 2 );
+	stamp = stamp * 60UL + (unsigned long)FieldValue( time + 3, 2 );
+	stamp = stamp * 60UL + (unsigned long)FieldValue( time + 6, 2 );
+	return stamp;
+}
+
+void FormatTimeStamp( unsigned long stamp, char* time, char* date )
+{
+	long year;
+	long month;
+	long day;
+
+	sprintf( time, "%02ld:%02ld:%02ld", (long)( stamp / 3600UL % 24UL ), (long)( stamp / 60UL % 60UL ), (long)( stamp % 60UL ));
+	DateFromDays( (long)( stamp / 86400UL ), &year, &month, &day );
+	sprintf( date, "%02ld/%02ld/%04ld", day, month, year );
+}
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// CSV lines
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+void RecordToCsv( const char* record, char* line )
+{
+	static char device[ REC_DEVICE_DIGITS + 1 ];
+	static char time[ REC_CSV_TIME + 1 ];
+	static char date[ REC_CSV_DATE + 1 ];
+
+	UnpackDevice( record + REC_OFS_DEVICE, device );
+	FormatTimeStamp( GetRecordStamp( record ), time, date );
+	sprintf( line, "%-*.*s,%*ld,%-*.*s,%-*.*s\r\n",
+				REC_CSV_DEVICE, REC_CSV_DEVICE, device,
+				REC_CSV_WEARER, GetRecordWearer( record ),
+				REC_CSV_TIME, REC_CSV_TIME, time,
+				REC_CSV_DATE, REC_CSV_DATE, date );
+}
+
+int CsvToRecord( const char* line, char* record )
+{
+	static char wearer[ REC_CSV_WEARER + 1 ];
+	const char* time;
+	const char* date;
+
+	if( line[ REC_CSV_SIZE - 2 ] == DB_DELETED_MARK )
+		return FALSE;
+	memcpy( wearer, line + REC_CSV_DEVICE + 1, REC_CSV_WEARER );
+	wearer[ REC_CSV_WEARER ] = '\0';
+	time = line + REC_CSV_DEVICE + 1 + REC_CSV_WEARER + 1;
+	date = time + REC_CSV_TIME + 1;
+	PackRecord( record, line, atol( wearer ), MakeTimeStamp( time, date ));
+	return TRUE;
+}
+
+int ExportCsvFile( SDBFile *dbFile, const char* csvname, SDBFile *dbDict )
+{
+	static char record[ REC_SIZE ];
+	static char coded[ REC_CODED_SIZE ];
+	static char line[ REC_CSV_SIZE + 1 ];
+	long total;
+	long recno;
+	int lines;
+	int fd;
+
+	if( (total = GetTotalRecords( dbFile )) == -1L )
+		return FALSE;
+	if( (fd = open( (char*)csvname, O_RDWR | O_BINARY | O_CREAT | O_TRUNC, 0x0 )) == -1 )
+		return FALSE;
+	lines = 0;
+	for( recno = 0L; recno < total; recno++ )
+	{
+		if( !GotoRecord( dbFile, recno ) || !ReadCurrentRecord( dbFile, ( dbDict == NULL )? record : coded ))
+			break;
+		if( IsRecordDeleted( dbFile, ( dbDict == NULL )? record : coded ))
+			continue;
+		//
+		// A coded record gets its device from the dictionary
+		//
+		if( dbDict != NULL && !DecodeRecord( dbDict, coded, record ))
+			break;
+		RecordToCsv( record, line );
+		memcpy( szCsvBuffer + lines * REC_CSV_SIZE, line, REC_CSV_SIZE );
+		//
+		// The lines are written in blocks, a write per line is slow on the flash drive
+		//
+		if( ++lines == REC_CSV_LINES )
+		{
+			if( write( fd, szCsvBuffer, lines * REC_CSV_SIZE ) != lines * REC_CSV_SIZE )
+				break;
+			lines = 0;
+		}
+	}
+	if( recno == total && lines > 0 && write( fd, szCsvBuffer, lines * REC_CSV_SIZE ) != lines * REC_CSV_SIZE )
+		recno = -1L;
+	close( fd );
+	if( recno != total )
+	{
+		remove( csvname );
+		return FALSE;
+	}
+	return TRUE;
+}
+
+int ImportCsvFile( const char* csvname, SDBFile *dbFile )
+{
+	static char record[ REC_SIZE ];
+	int bytes;
+	int i;
+	int fd;
+	int ret;
+
+	if( (fd = open( (char*)csvname, O_RDWR | O_BINARY, 0x777 )) == -1 )
+		return FALSE;
+	ret = TRUE;
+	while( ret && (bytes = read( fd, szCsvBuffer, sizeof( szCsvBuffer ))) > 0 )
+	{
+		//
+		// A partial line at the end of the file is dropped
+		//
+		for( i = 0; ret && i + REC_CSV_SIZE <= bytes; i += REC_CSV_SIZE )
+		{
+			if( CsvToRecord( szCsvBuffer + i, record ))
+				ret = WriteRecord( dbFile, record, WRITE_APPEND );
+		}
+	}
+	close( fd );
+	return ret && bytes == 0;
+}
@@ -15,6 +15,7 @@
 #include        <string.h>
 #include        "lib.h"
 #include 		"database.h"
+#include 		"record.h"
 #include 		"input.h"
 #include 		"menu.h"
 #include 		"images.h"
@@ -39,7 +40,51 @@
 #define WEARER          "Cow"
 
 // Database name
-#define DBASE_NAME	   	"data.csv"  //"DATA.TXT"
+// OLD #define DBASE_NAME	   	"data.csv"  //"DATA.TXT"
+#define DBASE_NAME	   	"data.dat"
+
+// The database is transmitted as CSV file, made from the packed records just before sending
+#define CSV_NAME		"data.csv"
+
+// Bloom filter of the devices in the database, made by the database functions
+#define BLOOM_NAME		"data.blm"
+
+// Sort state of the database, made by the database functions
+#define HEADER_NAME		"data.hdr"
+
+// New devices are appended and merged into the sorted database after this amount of records
+#define DELTA_RECORDS	32
+
+// Index on the wearer of the records, made by the database functions
+#define WEARER_INDEX_NAME	"data.wix"
+
+// Maximum amount of devices shown for one wearer
+#define FIND_DEVICES	8
+
+// Cows with their last scans, kept up to date by the database functions
+#define WEARER_AGGREGATE_NAME	"data.agw"
+
+// Cows counted by the aggregate, the table file takes 16 bytes per slot and 24000 cows fit in
+// 32768 slots (512 Kbytes), only its cache blocks are in memory
+#define AGGREGATE_WEARERS	24000L
+
+// The aggregates count the last scans per day
+#define SECONDS_PER_DAY	86400L
+
+// Every scan is kept in a log with a partition per day, catalog scan.cat and partitions scan0001.dat, ...
+#define SCAN_LOG_NAME	"scan.dat"
+
+// Scans in one partition of the scan log, a day with more scans gets more partitions
+#define SCAN_LOG_RECORDS	500L
+
+// Days kept in the scan log, the partitions of older days are removed
+#define SCAN_LOG_DAYS	7L
+
+// Devices of the scan log, a scan is logged with the 2 byte code of its device in this dictionary
+#define DICT_NAME		"scan.dct"
+
+// Hash index of the dictionary, made by the database functions
+#define DICT_HASH_NAME	"scan.hsh"
 
 // Database record
 // DEPRECATED #define SZ_BARCODE		100 // Now SZ_DEVICE
@@ -50,7 +95,16 @@
 #define SZ_TIME			(2+1+2+1+2)
 #define SZ_DATE			(4+1+2+1+2)
 // OLD #define SZ_RECORD		(SZ_BARCODE+1+SZ_SIGN+SZ_QUANTITY+1+SZ_TIME+1+SZ_DATE+1+1)
-#define SZ_RECORD		(SZ_DEVICE+1+SZ_WEARER+1+SZ_TIME+1+SZ_DATE+1+1)
+// OLD #define SZ_RECORD		(SZ_DEVICE+1+SZ_WEARER+1+SZ_TIME+1+SZ_DATE+1+1)
+// The database holds packed records, see record.h
+#define SZ_RECORD		REC_SIZE
+// The records are sorted and searched on the packed device
+#define POS_KEY			REC_OFS_DEVICE
+#define SZ_KEY			REC_SZ_DEVICE
+// OLD Deleted records are marked by replacing the <CR> with DB_DELETED_MARK
+// OLD #define POS_DEL_MARKER	(SZ_RECORD-2)
+// Deleted records are marked by replacing the flag with DB_DELETED_MARK
+#define POS_DEL_MARKER	REC_OFS_FLAG
 
 // barcode menu defines
 #define ID_CD39         0x0000001	// bit 0
@@ -385,15 +439,140 @@ void display_input_data( db_record *db_rec )
 #endif
 }
 
+// The database session keeps the database open while scanning and scrolling,
+// it is opened once instead of for every search, store and scrolled record.
+// It stays open between the menus and is closed before anything else uses the
+// database file (transmit, delete, compact or a drive change).
+static SDBFile dbSession; // static initializes all items to 0
+
+// The scan log is opened and closed with the session, it holds a coded record of every scan
+static SDBPartitions dbScans; // static initializes all items to 0
+static SDBFile dbDevices; // static initializes all items to 0
+
+// Open the database session, bCreate makes the database when it does not exist
+int open_session( int bCreate )
+{
+	if( dbSession.bOpen )
+		return TRUE;
+	if( !OpenDatabase( (char*)DBASE_NAME, SZ_RECORD, &dbSession ))
+	{
+		// A CSV database of an earlier version, or a CSV file that was not sent yet, is packed into a new database
+		if( fsize((char*)DBASE_NAME) == -1L && fsize((char*)CSV_NAME) != -1L )
+		{
+			if( !CreateDatabase( (char*)DBASE_NAME, SZ_RECORD, &dbSession ))
+				return FALSE;
+			if( !ImportCsvFile( CSV_NAME, &dbSession ))
+			{
+				CloseDatabase( &dbSession );
+				remove( DBASE_NAME );
+				return FALSE;
+			}
+			remove( CSV_NAME );
+			// The Bloom filter holds the devices as text
+			remove( BLOOM_NAME );
+		}
+		else if( !bCreate || !CreateDatabase( (char*)DBASE_NAME, SZ_RECORD, &dbSession ))
+			return FALSE;
+	}
+	// Keep blocks of records in memory while searching
+	SetDatabaseCache( &dbSession, DB_CACHE_BLOCKS, DB_CACHE_RECORDS );
+	// Most scanned devices of a new deployment are not in the database yet,
+	// the filter finds that without searching the database
+	SetBloomFilter( &dbSession, POS_KEY, SZ_KEY, DB_BLOOM_SIZE );
+	// Remember which part of the database is sorted on device
+	SetDatabaseHeader( &dbSession, POS_KEY, SZ_KEY );
+	// Find the devices on a wearer without reading the whole database
+	SetSecondaryIndex( &dbSession, REC_OFS_WEARER, REC_SZ_WEARER, WEARER_INDEX_NAME );
+	// Count the scans of a device in its record, the record of a device is overwritten on every scan
+	SetWriteCounter( &dbSession, REC_OFS_SCANS, POS_KEY, SZ_KEY );
+	// Count the cows of a day for the summary, a device has one record and needs no aggregate
+	SetAggregate( &dbSession, REC_OFS_WEARER, REC_SZ_WEARER, REC_OFS_STAMP, SECONDS_PER_DAY, AGGREGATE_WEARERS, WEARER_AGGREGATE_NAME );
+	// The database is sorted on device, search the fences in memory first
+	SetFenceIndex( &dbSession, POS_KEY, SZ_KEY, DB_FENCE_MEMORY );
+	// New devices are appended, their keys are kept in memory until they are merged
+	SetDeltaLog( &dbSession, POS_KEY, SZ_KEY, DELTA_RECORDS );
+	// The scans are logged per day on their time stamp, the devices are stored without a log when it can not be opened
+	if( OpenDictionary( DICT_NAME, REC_SZ_DEVICE, &dbDevices ) &&
+		!OpenPartitions( SCAN_LOG_NAME, REC_CODED_SIZE, REC_CODED_OFS_STAMP, SECONDS_PER_DAY, SCAN_LOG_RECORDS, &dbScans ))
+		CloseDatabase( &dbDevices );
+	return TRUE;
+}
+
+// Write the changed records of the session to the file
+int flush_session( void )
+{
+	if( !dbSession.bOpen )
+		return TRUE;
+	if( dbScans.bOpen && !FlushPartitions( &dbScans ))
+		return FALSE;
+	return FlushDatabase( &dbSession );
+}
+
+// Close the session, the next open_session() opens the database again
+void close_session( void )
+{
+	if( dbScans.bOpen )
+		ClosePartitions( &dbScans );
+	CloseDatabase( &dbDevices );
+	CloseDatabase( &dbSession );
+}
+
+// Log a scan as coded record, the partitions of the days before SCAN_LOG_DAYS are removed first
+int log_scan( char* record )
+{
+	static char coded[ REC_CODED_SIZE ];
+	long lLow;
+	long lHigh;
+
+	if( !dbScans.bOpen )
+		return TRUE;
+	while( GetPartitionCount( &dbScans ) > 0L && GetPartitionInfo( &dbScans, 0L, &lLow, &lHigh ) != -1L &&
+		   lHigh / SECONDS_PER_DAY + SCAN_LOG_DAYS <= (long)( GetRecordStamp( record ) / (unsigned long)SECONDS_PER_DAY ))
+	{
+		if( !RemovePartition( &dbScans, 0L ))
+			return FALSE;
+	}
+	return EncodeRecord( &dbDevices, record, coded ) && WritePartitionRecord( &dbScans, coded );
+}
+
 // Save the data into the database
+void show_device_error( void )
+{
+#if OPH | OPH1004 | OPH1005
+	printf("\fError device\nDigits only\n\n\n\n\n\nPress any key");
+#else
+	printf("\fError device\nDigits only\n\nPress any key");
+#endif
+	WaitForKey();
+}
+
+// Space needed on the drive to make the CSV file of the database with one more record,
+// the plain protocol makes the CSV lines while sending and needs no space
+long export_space( void )
+{
+	long lRecords;
+
+	if( lProtocol != ID_NETO_PROTOCOL
+#if PX25 | OPH1004 | OPH1005
+		&& lProtocol != ID_OSECOMM_PROTOCOL
+#endif
+		)
+		return 0L;
+	if( (lRecords = fsize((char*)DBASE_NAME)) == -1L )
+		lRecords = 0L;
+	return ( lRecords / SZ_RECORD + 1L ) * REC_CSV_SIZE;
+}
+
 void store_input_data( db_record *db_rec, long lRecordNo )
 {
-	static SDBFile dbFile; // static initializes all items to 0
 	static char record[ SZ_RECORD + 1 ];
+	int bWritten;
+	int bExisted;
 
 	// Check if there is enough space available for storing the barcode data
 	// We use 5000 because the OS (NetO) also need some memory
-	if( coreleft() < 5000L )
+	// NetO and OseComm send data.csv, it is made next to the database and must fit as well
+	if( coreleft() < 5000L + export_space() )
 	{
 		#if OPH | OPH1004
 			printf("\fRam disk full\ndata not stored!\n\n\n\n\nPress any key");
@@ -404,33 +583,45 @@ void store_input_data( db_record *db_rec, long lRecordNo )
 		return;
 	}
 	// Make the record to store
-	sprintf(record, "%-*.*s,%-*.*s,%-*.*s,%-*.*s\r\n",
-				//OLD SZ_BARCODE, SZ_BARCODE, db_rec->barcode,
-				SZ_DEVICE, SZ_DEVICE, db_rec->device,
-				//OLD SZ_SIGN+SZ_QUANTITY, SZ_SIGN+SZ_QUANTITY, db_rec->quantity,
-				SZ_WEARER, SZ_WEARER, db_rec->wearer,
-				SZ_TIME, SZ_TIME, db_rec->time,
-				SZ_DATE, SZ_DATE, db_rec->date );
-
-	if( !OpenDatabase( (char*)DBASE_NAME, SZ_RECORD, &dbFile ))
+	//OLD sprintf(record, "%-*.*s,%-*.*s,%-*.*s,%-*.*s\r\n",
+	//OLD			SZ_BARCODE, SZ_BARCODE, db_rec->barcode,
+	//OLD			SZ_SIGN+SZ_QUANTITY, SZ_SIGN+SZ_QUANTITY, db_rec->quantity,
+	//OLD			SZ_TIME, SZ_TIME, db_rec->time,
+	//OLD			SZ_DATE, SZ_DATE, db_rec->date );
+	PackRecord( record, db_rec->device, atol( db_rec->wearer ), MakeTimeStamp( db_rec->time, db_rec->date ));
+
+	if( !open_session( TRUE ))
 	{
-		if( !CreateDatabase( (char*)DBASE_NAME, SZ_RECORD, &dbFile ))
-		{
 #if OPH | OPH1004
-				printf("\fError create\nDatabase\nCode=%ld\n\n\n\n\nPress any key", GetDBErrorCode() );
+			printf("\fError create\nDatabase\nCode=%ld\n\n\n\n\nPress any key", GetDBErrorCode() );
 #else
-				printf("\fError create\nDatabase\nCode=%ld\nPress any key", GetDBErrorCode() );
+			printf("\fError create\nDatabase\nCode=%ld\nPress any key", GetDBErrorCode() );
 #endif
-			WaitForKey();
-			return;
-		}
+		WaitForKey();
+		return;
 	}
 	if( lRecordNo != -1L )
-		GotoRecord( &dbFile, lRecordNo );
-
-	if( !WriteRecord( &dbFile, record, ((lRecordNo==-1L)?WRITE_APPEND:WRITE_OVER)))
 	{
-		CloseDatabase( &dbFile );
+		GotoRecord( &dbSession, lRecordNo );
+		bWritten = WriteRecord( &dbSession, record, WRITE_OVER );
+	}
+	else
+	{
+		// New device, UpsertRecord appends it to the delta log, BinarySearch finds it there
+		// until the delta log is full and merged into the sorted database.
+		// The Bloom filter and delta log keep its search in memory for a really new device.
+		bWritten = UpsertRecord( &dbSession, record + POS_KEY, record, POS_KEY, SZ_KEY, &bExisted ) != -1L &&
+				   MergeDeltaLog( &dbSession, FALSE );
+	}
+	// The device record only holds the last scan, the log keeps them all
+	if( bWritten )
+		bWritten = log_scan( record );
+	// Every stored animal is a flush point, nothing is lost when the terminal is switched off
+	if( bWritten )
+		bWritten = flush_session();
+	if( !bWritten )
+	{
+		close_session();
 #if OPH | OPH1004 | OPH1005
 			printf("\fError write\nrecord\nCode=%ld\n\n\n\n\nPress any key", GetDBErrorCode() );
 #else
@@ -439,22 +630,6 @@ void store_input_data( db_record *db_rec, long lRecordNo )
 		WaitForKey();
 		return;
 	}
-	if( lRecordNo == -1L )
-	{
-		// Record was appended, now sort the database
-		// to be able to use BinarySearch next time to search the database
-		//OLD if( !QuickSort( &dbFile, 0, SZ_BARCODE ))
-		if( !QuickSort( &dbFile, 0, SZ_DEVICE ))
-		{
-#if OPH | OPH1004 | OPH1005
-				printf("\fError sort\nrecord\nCode=%ld\n\n\n\n\nPress any key", GetDBErrorCode() );
-#else
-				printf("\fError sort\nrecord\nCode=%ld\nPress any key", GetDBErrorCode() );
-#endif
-			WaitForKey();
-		}
-	}
-	CloseDatabase( &dbFile );
 }
 
 //OLD long string_quantity_to_long( char* quantity, int* illegal )
@@ -488,42 +663,44 @@ long string_wearer_to_long( char* wearer, int* illegal )
 	return( atol( tmp ));
 }
 
-void fill_record_struct( db_record *db_rec, char* record )
+// Fill the record struct, record is a coded record of the scan log when dbDict is not NULL
+void fill_record_struct( db_record *db_rec, char* record, SDBFile *dbDict )
 {
-	int offset;
+	static char packed[ SZ_RECORD ];
+
 	memset( db_rec, '\0', sizeof( db_record ));
-	offset = 0;
+	if( dbDict != NULL )
+	{
+		if( !DecodeRecord( dbDict, record, packed ))
+			return;
+		record = packed;
+	}
 	//OLD memcpy( db_rec->barcode, record+offset, SZ_BARCODE );
-	//OLD offset+=SZ_BARCODE+1;
-	memcpy( db_rec->device, record+offset, SZ_DEVICE );
-	offset+=SZ_DEVICE+1;
 	//OLD memcpy( db_rec->quantity, record+offset, SZ_SIGN+SZ_QUANTITY );
-	//OLD offset+= SZ_SIGN+SZ_QUANTITY+1;
-	memcpy( db_rec->wearer, record+offset, SZ_WEARER );
-	offset+= SZ_WEARER+1;
-	memcpy( db_rec->time, record+offset, SZ_TIME );
-	offset+= SZ_TIME+1;
-	memcpy( db_rec->date, record+offset, SZ_DATE );
+	UnpackDevice( record, db_rec->device );
+	sprintf( db_rec->wearer, "%*ld", SZ_WEARER, GetRecordWearer( record ));
+	FormatTimeStamp( GetRecordStamp( record ), db_rec->time, db_rec->date );
 }
 
 //long FindBarcodeInDatabase( char *device, char *quantity )
 long FindBarcodeInDatabase( char *device, char *wearer )
 {
-	static SDBFile dbFile;
 	static char record[ SZ_RECORD + 1 ];
+	static char key[ SZ_KEY ];
 	static db_record db_rec;
 	long lFound = -1L;
-	if( !OpenDatabase( (char*)DBASE_NAME, SZ_RECORD, &dbFile ))
+	if( !open_session( FALSE ))
 		return lFound;
+	// The database holds the packed device
+	PackDevice( device, key );
 	//OLD if( (lFound = BinarySearch( &dbFile, record, barcode, SZ_BARCODE, 0 )) != -1L )
-	if( (lFound = BinarySearch( &dbFile, record, device, SZ_DEVICE, 0 )) != -1L )
+	if( (lFound = BinarySearch( &dbSession, record, key, SZ_KEY, POS_KEY )) != -1L )
 	{
 		// Barcode was found fill the quantity string
-		fill_record_struct( &db_rec, record );
+		fill_record_struct( &db_rec, record, NULL );
 		//OLD strncpy( quantity, db_rec.quantity, SZ_SIGN+SZ_QUANTITY );
 		strncpy( wearer, db_rec.wearer, SZ_WEARER );
 	}
-	CloseDatabase( &dbFile );
 	return lFound;
 }
 
@@ -577,7 +754,19 @@ void ScanLabels( void )
 		// param8 = int display_height; 1
 		key = ScanOrKeyboardInput( device, 1, SZ_DEVICE, INPUT_NUM, 1, 1, GetMaxCharsXPos(), GetMaxCharsYPos()-3);
 		if( key == CLR_KEY || key == ESC_KEY )
+		{
+			// Scanning stopped, merge the new devices into the sorted database now
+			if( dbSession.bOpen && MergeDeltaLog( &dbSession, TRUE ))
+				flush_session();
 			return;
+		}
+		// A scanned label can hold other characters then digits, those are not stored
+		if( !IsDeviceNumber( device ))
+		{
+			show_device_error();
+			memset( device, '\0', sizeof( device ));
+			continue;
+		}
 
 		//
 		// A new for loop, so that quantity is cancelled
@@ -673,10 +862,9 @@ void display_scroll_data( db_record *db_rec, long curr, long max )
 
 int get_record( db_record *db_rec, long *rec_nr, long *max_rec )
 {
-	static SDBFile dbFile; // static initializes all items to 0
 	static char record[ SZ_RECORD + 1];
 
-	if( !OpenDatabase( (char*)DBASE_NAME, SZ_RECORD, &dbFile ))
+	if( !open_session( FALSE ))
 	{
 #if OPH | OPH1004 | OPH1005
 			printf("\fError open\ndatabase.\nCode=%ld\n\n\n\n\nPress any key", GetDBErrorCode());
@@ -687,9 +875,9 @@ int get_record( db_record *db_rec, long *rec_nr, long *max_rec )
 		return FALSE;
 	}
 
-	*max_rec = GetTotalRecords( &dbFile );
+	*max_rec = GetTotalRecords( &dbSession );
 
-	if( !GotoRecord( &dbFile, *rec_nr ))
+	if( !GotoRecord( &dbSession, *rec_nr ))
 	{
 #if OPH | OPH1004 | OPH1005
 			printf("\fError goto\nrecord.\nCode=%ld\n\n\n\n\nPress any key", GetDBErrorCode());
@@ -700,7 +888,7 @@ int get_record( db_record *db_rec, long *rec_nr, long *max_rec )
 		return FALSE;
 	}
 
-	if( !ReadCurrentRecord( &dbFile,  record ))
+	if( !ReadCurrentRecord( &dbSession,  record ))
 	{
 #if OPH | OPH1004 | OPH1005
 			printf("\fError read\nrecord.\nCode=%ld\n\n\n\n\nPress any key", GetDBErrorCode());
@@ -710,31 +898,70 @@ int get_record( db_record *db_rec, long *rec_nr, long *max_rec )
 		WaitForKey();
 		return FALSE;
 	}
-	CloseDatabase( &dbFile );
 
-	fill_record_struct( db_rec, record );
+	fill_record_struct( db_rec, record, NULL );
 	return TRUE;
 }
 
-void ScrollDatabase( void )
+// Amount of scans in the scan log, counted in the catalog without reading the partitions
+static long total_scans( void )
 {
-	long current;
-	long max = 0L;
-	static db_record db_rec;
+	long lPartition;
+	long lTotal;
+	long lLow;
+	long lHigh;
+
+	lTotal = 0L;
+	for( lPartition = GetPartitionCount( &dbScans ) - 1L; lPartition >= 0L; lPartition-- )
+		lTotal += GetPartitionInfo( &dbScans, lPartition, &lLow, &lHigh );
+	return lTotal;
+}
 
-	if( fsize((char*)DBASE_NAME) == -1L )
+// Read scan rec_nr of the scan log, scan 0 is the newest, only the partition of the scan is opened
+int get_scan( db_record *db_rec, long *rec_nr, long *max_rec )
+{
+	static char coded[ REC_CODED_SIZE ];
+	long lPartition;
+	long lRecords;
+	long lScan;
+	long lLow;
+	long lHigh;
+
+	*max_rec = total_scans();
+	lScan = *rec_nr;
+	for( lPartition = GetPartitionCount( &dbScans ) - 1L; lPartition >= 0L; lPartition-- )
+	{
+		lRecords = GetPartitionInfo( &dbScans, lPartition, &lLow, &lHigh );
+		if( lScan < lRecords )
+			break;
+		lScan -= lRecords;
+	}
+	// The scans of a partition are appended, the newest is the last record
+	if( lPartition < 0L || !SelectPartition( &dbScans, lPartition ) ||
+		!GotoRecord( &dbScans.dbPart, lRecords - 1L - lScan ) || !ReadCurrentRecord( &dbScans.dbPart, coded ))
 	{
 #if OPH | OPH1004 | OPH1005
-			printf("\fDatabase\nnot available\n\n\n\n\n\nPress any key");
+			printf("\fError read\nscan.\nCode=%ld\n\n\n\n\nPress any key", GetDBErrorCode());
 #else
-			printf("\fDatabase\nnot available\n\nPress any key");
+			printf("\fError read\nscan.\nCode=%ld\nPress any key", GetDBErrorCode());
 #endif
 		WaitForKey();
-		return;
+		return FALSE;
 	}
+	// The device of the scan is decoded with the dictionary
+	fill_record_struct( db_rec, coded, &dbDevices );
+	return TRUE;
+}
+
+// Scroll through the records get reads, from record 0 on
+static void scroll_records( int (*get)( db_record *db_rec, long *rec_nr, long *max_rec ))
+{
+	long current;
+	long max = 0L;
+	static db_record db_rec;
 
 	current = 0L;
-	if( !get_record( &db_rec, &current, &max )  )
+	if( !get( &db_rec, &current, &max )  )
 		return;
 
 	putchar('\f');
@@ -776,11 +1003,93 @@ void ScrollDatabase( void )
 			case ESC_KEY:
 				return;
 		}
-		if( !get_record( &db_rec, &current, &max ))
+		if( !get( &db_rec, &current, &max ))
 			return;
 	}
 }
 
+void ScrollDatabase( void )
+{
+	if( fsize((char*)DBASE_NAME) == -1L )
+	{
+#if OPH | OPH1004 | OPH1005
+			printf("\fDatabase\nnot available\n\n\n\n\n\nPress any key");
+#else
+			printf("\fDatabase\nnot available\n\nPress any key");
+#endif
+		WaitForKey();
+		return;
+	}
+	scroll_records( get_record );
+}
+
+// Scroll through the scan log, the newest scan first
+void ScrollScans( void )
+{
+	if( !open_session( FALSE ) || !dbScans.bOpen || total_scans() <= 0L )
+	{
+#if OPH | OPH1004 | OPH1005
+			printf("\fNo scans\nlogged\n\n\n\n\n\nPress any key");
+#else
+			printf("\fNo scans\nlogged\n\nPress any key");
+#endif
+		WaitForKey();
+		return;
+	}
+	scroll_records( get_scan );
+}
+
+// Show the devices on a wearer, found with the wearer index
+void FindWearer( void )
+{
+	static char 		wearer[ SZ_WEARER + 1 ];
+	static char 		key[ REC_SZ_WEARER ];
+	static char 		record[ SZ_RECORD + 1 ];
+	static long 		lRecords[ FIND_DEVICES ];
+	static db_record	db_rec;
+	long				lWearer;
+	long				lFound;
+	int					nIllegal;
+	int					i;
+
+	memset( wearer, '\0', sizeof( wearer ));
+	printf("\fCow ID:\n");
+	if( KeyboardInput( wearer, 1, SZ_WEARER, INPUT_NUM | INPUT_NEGATIVE, 0, 1, GetMaxCharsXPos(), 3, CLR_KEY, ESC_KEY, ENT_KEY ) != ENT_KEY )
+		return;
+	lWearer = string_wearer_to_long( wearer, &nIllegal );
+	if( nIllegal )
+		return;
+
+	if( !open_session( FALSE ))
+	{
+#if OPH | OPH1004 | OPH1005
+			printf("\fDatabase\nnot available\n\n\n\n\n\nPress any key");
+#else
+			printf("\fDatabase\nnot available\n\nPress any key");
+#endif
+		WaitForKey();
+		return;
+	}
+	PackWearer( lWearer, key );
+	lFound = SearchSecondaryIndex( &dbSession, REC_OFS_WEARER, key, lRecords, FIND_DEVICES );
+	// Keep the index when it was made again for this search
+	flush_session();
+
+	printf("\f%s %ld\n", WEARER, lWearer );
+	if( lFound <= 0L )
+		printf("No %s\n", DEVICE );
+	for( i = 0; i < lFound && i < GetMaxCharsYPos() - 2; i++ )
+	{
+		if( !GotoRecord( &dbSession, lRecords[ i ] ) || !ReadCurrentRecord( &dbSession, record ))
+			break;
+		fill_record_struct( &db_rec, record, NULL );
+		printf("%s %s\n", DEVICE, db_rec.device );
+	}
+	gotoxy( 0, GetMaxCharsYPos() - 1 );
+	printf("Press any key");
+	WaitForKey();
+}
+
 void SelectPort( void )
 {
 	int  nMaxItems;
@@ -1063,6 +1372,111 @@ void AvailableMemory( void )
 	WaitForKey();
 }
 
+// Text of a count of the aggregate, it has no count when its table did not fit
+static void format_count( long lCount, char* text )
+{
+	if( lCount == -1L )
+		strcpy( text, "n/a" );
+	else
+		sprintf( text, "%ld", lCount );
+}
+
+// Count the scans found in the scan log
+static int count_scan( char* record, long partition, long recordnumber )
+{
+	(void)record;	// QueryPartitions() counts the records
+	(void)partition;
+	(void)recordnumber;
+	return TRUE;
+}
+
+// Scans in the log from a time stamp on, only the partitions of those days are read
+static long count_scans( long lFrom )
+{
+	if( !dbScans.bOpen )
+		return -1L;
+	return QueryPartitions( &dbScans, lFrom, DB_VALUE_MAX, count_scan );
+}
+
+// Show the devices, the cows of today counted by the aggregate, the scans of today
+// in the scan log and the scans and last scan of a device
+void ShowSummary( void )
+{
+	static char device[ SZ_DEVICE + 1 ];
+	static char wearer[ SZ_WEARER + 1 ];
+	static char record[ SZ_RECORD + 1 ];
+	static char date[ SZ_DATE + 1 ];
+	static char time[ SZ_TIME + 1 ];
+	static char cows[ 12 ];
+	static char cowstoday[ 12 ];
+	static char scans[ 12 ];
+	static char scanstoday[ 12 ];
+	struct date dates;
+	long lToday;
+	long lDevices;
+	long lCows;
+	long lCowsToday;
+	long lFound;
+	int key_pressed;
+
+	if( !open_session( FALSE ))
+	{
+#if OPH | OPH1004 | OPH1005
+			printf("\fDatabase\nnot available\n\n\n\n\n\nPress any key");
+#else
+			printf("\fDatabase\nnot available\n\nPress any key");
+#endif
+		WaitForKey();
+		return;
+	}
+	getdate( &dates );
+	sprintf( date, "%02d/%02d/%04d", dates.da_day, dates.da_mon, dates.da_year );
+	lToday = (long)( MakeTimeStamp( "00:00:00", date ) / (unsigned long)SECONDS_PER_DAY );
+	for(;;)
+	{
+		// Every device has one record
+		lDevices = GetTotalRecords( &dbSession ) - GetDeletedRecords( &dbSession );
+		lCows = CountAggregateKeys( &dbSession, REC_OFS_WEARER, -1L );
+		lCowsToday = CountAggregateKeys( &dbSession, REC_OFS_WEARER, lToday );
+		// Making an aggregate again takes a pass over the database, keep it
+		flush_session();
+		format_count( lCows, cows );
+		format_count( lCowsToday, cowstoday );
+		format_count( count_scans( lToday * SECONDS_PER_DAY ), scanstoday );
+		format_count( count_scans( 0L ), scans );
+
+#if OPH | OPH1004 | OPH1005
+		printf("\fSUMMARY\n%ss: %ld\n%ss: %s\n%ss today: %s\nScans today: %s\nScans %ld days: %s\nScan %s:", DEVICE, lDevices, WEARER, cows, WEARER, cowstoday, scanstoday, SCAN_LOG_DAYS, scans, DEVICE );
+#else
+		printf("\f%ss: %ld\n%ss: %s/%s\nScans: %s/%s\nScan %s:", DEVICE, lDevices, WEARER, cowstoday, cows, scanstoday, scans, DEVICE );
+#endif
+		memset( device, '\0', sizeof( device ));
+		key_pressed = ScanOrKeyboardInput( device, 1, SZ_DEVICE, INPUT_NUM, 0, GetMaxCharsYPos()-1, GetMaxCharsXPos(), 1 );
+		if( key_pressed == CLR_KEY || key_pressed == ESC_KEY )
+			return;
+
+		if( !IsDeviceNumber( device ))
+		{
+			show_device_error();
+			continue;
+		}
+
+		// The cow and the last scan of one device
+		printf("\f%s %s\n", DEVICE, device );
+		if( (lFound = FindBarcodeInDatabase( device, wearer )) != -1L &&
+			GotoRecord( &dbSession, lFound ) && ReadCurrentRecord( &dbSession, record ))
+		{
+			FormatTimeStamp( GetRecordStamp( record ), time, date );
+			printf("%s: %ld\nScans: %ld\nLast scan:\n%s\n%s\n", WEARER, GetRecordWearer( record ), GetRecordScans( record ), date, time );
+		}
+		else
+			printf("Not found\n");
+		gotoxy( 0, GetMaxCharsYPos() - 1 );
+		printf("Press any key");
+		WaitForKey();
+	}
+}
+
 #if OPH								// drive selection only available for the OPH-1000
 void SetDrive ( void )
 {
@@ -1076,6 +1490,7 @@ void SetDrive ( void )
 	};
 	nIndex = 0;
 	ShowGraphSelectionMenu( mnuSelDrive, sizeof( mnuSelDrive ) / sizeof( sSelMenu ), MENU_SINGLE, &lDrive);
+	close_session();	// the database of the other drive is opened next time
 	set_drive();
 }
 
@@ -1089,6 +1504,8 @@ void _SystemMenu( void )
 		{"Display",		_display,	ChangeContrast},
 		{"Barcodes",	_barcode, 	SetBarcodes},
 		{"Memory",		_memory, 	AvailableMemory},
+		{"Summary",		_scroll,	ShowSummary},
+		{"Scans",		_scroll,	ScrollScans},
 		{"Drive",		_drive,		SetDrive}
 	};
 
@@ -1105,7 +1522,9 @@ void _SystemMenu( void )
 		{"Com Port",	_com_port_pic,	ComPortSettings},
 		{"Protocol",	_protocol_pic, 		SelectProtocol},
 		{"Barcodes",	_barcode_pic,	SetBarcodes},
-		{"Memory",		_memory_pic, 	AvailableMemory}
+		{"Memory",		_memory_pic, 	AvailableMemory},
+		{"Summary",		_open_file_pic,	ShowSummary},
+		{"Scans",		_open_file_pic,	ScrollScans}
 	};
 
 	ShowGraphMenu( mnuSystem, sizeof( mnuSystem ) / sizeof( sgraphMenu ));
@@ -1121,7 +1540,9 @@ void _SystemMenu( void )
 		{"Protocol",	_protocol, 	SelectProtocol},
 		{"Display",		_display,	ChangeContrast},
 		{"Barcodes",	_barcode, 	SetBarcodes},
-		{"Memory",		_memory, 	AvailableMemory}
+		{"Memory",		_memory, 	AvailableMemory},
+		{"Summary",		_scroll,	ShowSummary},
+		{"Scans",		_scroll,	ScrollScans}
 	};
 
 	ShowGraphMenu( mnuSystem, sizeof( mnuSystem ) / sizeof( sgraphMenu ));
@@ -1138,7 +1559,18 @@ void DeleteDatabase( void )
 	#endif
 	key = WaitForKeys( 4, ENT_KEY, TRIGGER_KEY, CLR_KEY, ESC_KEY );
 	if( key == ENT_KEY || key == TRIGGER_KEY )
+	{
+		close_session();
 		remove(DBASE_NAME );
+		remove(CSV_NAME );
+		remove(BLOOM_NAME );
+		remove(HEADER_NAME );
+		remove(WEARER_INDEX_NAME );
+		remove(WEARER_AGGREGATE_NAME );
+		RemovePartitionFiles( SCAN_LOG_NAME );
+		remove(DICT_NAME );
+		remove(DICT_HASH_NAME );
+	}
 }
 
 #if PX25 | OPH1004 | OPH1005
@@ -1157,7 +1589,18 @@ void OnOseComInfo(int status, int errorsuccess, int progress, const char *info)
     case STAT_XMIT_FILE_TO_PC:
         // if successful then delete the file
         if (errorsuccess == SUCC_COMPLETE)
+        {
             remove(info);    // Delete the transfered file
+            // The CSV file was made of the database, the sent records are deleted as well
+            if( strcmp( info, CSV_NAME ) == 0 )
+            {
+                remove(DBASE_NAME);
+                remove(BLOOM_NAME);
+                remove(HEADER_NAME);
+                remove(WEARER_INDEX_NAME);
+                remove(WEARER_AGGREGATE_NAME);
+            }
+        }
         break;
     case STAT_RECV_FILE_FROM_PC:
         break;
@@ -1167,12 +1610,47 @@ void OnOseComInfo(int status, int errorsuccess, int progress, const char *info)
 }
 #endif
 
+// Remove the records marked as deleted, done before transmitting so
+// the time consuming rewrite happens while the terminal is in the cradle
+void compact_database( void )
+{
+	static SDBFile dbFile; // static initializes all items to 0
+
+	close_session();
+	if( !OpenDatabase( (char*)DBASE_NAME, SZ_RECORD, &dbFile ))
+		return;
+	SetDeleteMarker( &dbFile, POS_DEL_MARKER );
+	SetDatabaseHeader( &dbFile, POS_KEY, SZ_KEY );
+	CompactDatabase( &dbFile );
+	// Send the devices sorted, the header knows when the database is still sorted
+	SortDatabase( &dbFile, POS_KEY, SZ_KEY );
+	CloseDatabase( &dbFile );
+}
+
+// Make the CSV file of the database for the protocols that send a file
+int export_database( void )
+{
+	static SDBFile dbFile; // static initializes all items to 0
+	int bExported;
+
+	if( !OpenDatabase( (char*)DBASE_NAME, SZ_RECORD, &dbFile ))
+		return FALSE;
+	SetDatabaseCache( &dbFile, DB_CACHE_BLOCKS, DB_CACHE_RECORDS );
+	SetDeleteMarker( &dbFile, POS_DEL_MARKER );
+	bExported = ExportCsvFile( &dbFile, CSV_NAME, NULL );
+	CloseDatabase( &dbFile );
+	return bExported;
+}
+
 void TransmitData( void )
 {
 	int nRet;
 	static SDBFile dbFile; // static initializes all items to 0
 	static char record[ SZ_RECORD + 1];
+	static char line[ REC_CSV_SIZE + 1 ];
 
+	// The file is sent as a whole, it can not stay open in the session
+	close_session();
 	if( fsize((char*)DBASE_NAME) == -1L )
 	{
 #if OPH | OPH1004 | OPH1005
@@ -1183,6 +1661,25 @@ void TransmitData( void )
 		WaitForKey();
 		return;
 	}
+	compact_database();
+	// NetO and OseComm send a file, the CSV lines are made of the packed records first
+	if( lProtocol == ID_NETO_PROTOCOL
+#if PX25 | OPH1004 | OPH1005
+		|| lProtocol == ID_OSECOMM_PROTOCOL
+#endif
+		)
+	{
+		if( !export_database() )
+		{
+#if OPH | OPH1004 | OPH1005
+				printf("\fError export\ndatabase.\nCode=%ld\n\n\n\n\nPress any key", GetDBErrorCode());
+#else
+				printf("\fError export\ndatabase.\nCode=%ld\nPress any key", GetDBErrorCode());
+#endif
+			WaitForKey();
+			return;
+		}
+	}
 	if( comopen( (unsigned int)lPort ) != OK )
 	{
 #if OPH | OPH1004 | OPH1005
@@ -1191,13 +1688,15 @@ void TransmitData( void )
 			printf("\fError open\nCOM port\n\nPress any key");
 #endif
 		WaitForKey();
+		remove( CSV_NAME );
 		return;
 	}
 	printf("\fTransmit data\n");
 	if( lProtocol == ID_NETO_PROTOCOL )
 	{
 		printf("NetO protocol\n\n\n\n\n\nScan to cancel");
-		nRet = neto_transmit( (char(*)[12+1+3])DBASE_NAME, 1, "123456", TRIGGER_KEY, 3 );
+		//OLD nRet = neto_transmit( (char(*)[12+1+3])DBASE_NAME, 1, "123456", TRIGGER_KEY, 3 );
+		nRet = neto_transmit( (char(*)[12+1+3])CSV_NAME, 1, "123456", TRIGGER_KEY, 3 );
 		cursor( NOWRAP );
 		if( nRet != OK )
 		{
@@ -1233,6 +1732,9 @@ void TransmitData( void )
 		}
 		else
 		{
+			// Read the database in blocks instead of one record at a time
+			SetDatabaseCache( &dbFile, DB_CACHE_BLOCKS, DB_CACHE_RECORDS );
+			SetDeleteMarker( &dbFile, POS_DEL_MARKER );
 			if( ReadFirstRecord( &dbFile, record ))
 			{
 				putchar('\f');
@@ -1240,8 +1742,12 @@ void TransmitData( void )
 				{
 					gotoxy(0,0);
 					printf("Send %04ld/%04ld", dbFile.lCurrRecord+1, dbFile.lTotalRecords);
-					for( nRet = 0; nRet < SZ_RECORD; nRet++ )
-			            putcom( record[ nRet ]);
+					// The CSV line is made while sending, there is no CSV file
+					RecordToCsv( record, line );
+					//OLD for( nRet = 0; nRet < SZ_RECORD; nRet++ )
+					//OLD     putcom( record[ nRet ]);
+					for( nRet = 0; nRet < REC_CSV_SIZE; nRet++ )
+			            putcom( line[ nRet ]);
         			delay(10);
 
 				}while( ReadNextRecord( &dbFile, record ) );
@@ -1259,6 +1765,8 @@ void TransmitData( void )
 		}
 	}
 	comclose( (unsigned int) lPort );
+	// The CSV file is made again for the next transmit, the database keeps the records
+	remove( CSV_NAME );
 }
 
 void ShowVersion( void )
@@ -1372,6 +1880,7 @@ void main( void )
 	{
 	    {"Scan Labels",			_barcode_pic,		ScanLabels},
 		{"Scroll DBase",		_open_file_pic,		ScrollDatabase},
+		{"Find Cow",			_barcode_pic,		FindWearer},
 		{"Transmit Data",  		_wireless_pic,		TransmitData},
 		{"Delete DBase",		_recycle_pic,		DeleteDatabase},
 		{"System Menu", 		_setting_pic,		_SystemMenu},
@@ -1383,6 +1892,7 @@ void main( void )
 	{
 	    {"Scan Labels",			_scan,		ScanLabels},
 		{"Scroll DBase",		_scroll,	ScrollDatabase},
+		{"Find Cow",			_scan,		FindWearer},
 		{"Transmit Data",  		_transmit,	TransmitData},
 		{"Delete DBase",		_trash,		DeleteDatabase},
 		{"System Menu", 		_tools,		_SystemMenu},
@@ -1394,6 +1904,7 @@ void main( void )
 	{
 	   	{"Scan Labels",			_scan,		ScanLabels},
 		{"Scroll Database",		_scroll,	ScrollDatabase},
+		{"Find Cow",			_scan,		FindWearer},
 		{"Transmit Data",  		_transmit,	TransmitData},
 		{"Delete Database",		_trash,		DeleteDatabase},
 		{"System Menu", 		_tools,		_SystemMenu},
@@ -1449,6 +1960,9 @@ void main( void )
 #endif
 	systemsetting("7G");	// Charging indication LED enabled
 
+	// Pack the CSV database of an earlier version before the menus look for the database
+	open_session( FALSE );
+
 	InitGraphMenu();
 
 	for(;;)
@@ -0,0 +1,240 @@
+//
+// record.h
+//
+// header file of the packed record of the CowAlert database and
+// the CSV line it is rendered to when the data is transmitted
+//
+// 17/10/2026:	First version, the database holds packed binary records of REC_SIZE bytes
+//				instead of CSV lines, the CSV line is only made when the data leaves the terminal
+//
+// 17/10/2026:	Added IsDeviceNumber(), only device numbers of digits are packed without collisions
+//
+// 17/10/2026:	Added the scans of the device to the record, the CSV line does not change
+//
+// 17/10/2026:	Added coded records with the device as its code in a dictionary, for logs with many scans per device
+//
+
+#ifndef __RECORD_H__
+#define __RECORD_H__
+
+#include "database.h"
+
+//
+// Packed record layout, all numbers are stored big endian so the fields sort with memcmp()
+//
+#define REC_DEVICE_DIGITS	8		// characters of a device number
+#define REC_OFS_DEVICE		0		// device as packed BCD, two digits a byte, a space or other character is 0xF
+#define REC_SZ_DEVICE		4
+#define REC_OFS_WEARER		4		// wearer as 32 bit number with the sign bit inverted
+#define REC_SZ_WEARER		4
+#define REC_OFS_STAMP		8		// seconds since 01/01/1970 00:00:00 as 32 bit unsigned number
+#define REC_SZ_STAMP		4
+#define REC_OFS_SCANS		12		// scans of the device as 16 bit number, counted by the database (SetWriteCounter)
+#define REC_SZ_SCANS		2
+#define REC_OFS_FLAG		14		// REC_FLAG_VALID, or DB_DELETED_MARK when used as delete marker
+#define REC_SIZE			15
+
+#define REC_FLAG_VALID		' '
+
+//
+// Coded record layout for a log with many records per device, the packed device is stored as its
+// code in a dictionary (OpenDictionary) and the scans and flag are left out
+//
+#define REC_CODED_OFS_CODE		0		// code of the packed device, DB_DICT_CODESZ bytes
+#define REC_CODED_OFS_WEARER	(REC_CODED_OFS_CODE+DB_DICT_CODESZ)
+#define REC_CODED_OFS_STAMP		(REC_CODED_OFS_WEARER+REC_SZ_WEARER)
+#define REC_CODED_SIZE			(REC_CODED_OFS_STAMP+REC_SZ_STAMP)
+
+//
+// CSV line "DEVICE  ,  WEARER,HH:MM:SS,DD/MM/YYYY<CR><LF>", the line the database held before
+//
+#define REC_CSV_DEVICE		8
+#define REC_CSV_WEARER		8
+#define REC_CSV_TIME		(2+1+2+1+2)
+#define REC_CSV_DATE		(2+1+2+1+4)
+#define REC_CSV_SIZE		(REC_CSV_DEVICE+1+REC_CSV_WEARER+1+REC_CSV_TIME+1+REC_CSV_DATE+1+1)
+
+//-----------------------------------------------------------------------------
+// Purpose:     Pack a device number into the REC_SZ_DEVICE bytes of a search key
+//
+// Parameters:  device		- device number of REC_DEVICE_DIGITS characters, shorter when terminated by '\0'
+//
+//				key			- holds the packed device number
+//
+// Returns:     Nothing
+//
+void PackDevice( const char* device, char* key );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Check a device number before it is packed
+//				PackDevice() makes 0xF of every character that is not a digit, so two devices
+//				that only differ in other characters would get the same key
+//
+// Parameters:  device		- device number of REC_DEVICE_DIGITS characters, shorter when terminated by '\0'
+//
+// Returns:     TRUE when the device has one or more digits followed by nothing but padding spaces,
+//				FALSE otherwise
+//
+int IsDeviceNumber( const char* device );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Unpack a device number, the reverse of PackDevice()
+//
+// Parameters:  key			- the packed device number
+//
+//				device		- holds REC_DEVICE_DIGITS characters and a terminating '\0'
+//
+// Returns:     Nothing
+//
+void UnpackDevice( const char* key, char* device );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Make a packed record
+//
+// Parameters:  record		- holds the REC_SIZE bytes of the record
+//
+//				device		- device number, see PackDevice()
+//
+//				wearer		- wearer number
+//
+//				stamp		- time stamp, see MakeTimeStamp()
+//
+// Remarks:		The scans are set to 1, WriteRecord() counts them when a write counter is set
+//
+// Returns:     Nothing
+//
+void PackRecord( char* record, const char* device, long wearer, unsigned long stamp );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Get the wearer, the time stamp or the scans of a packed record
+//
+// Parameters:  record		- the packed record
+//
+// Returns:     The wearer number, the time stamp or the amount of scans
+//
+long GetRecordWearer( const char* record );
+unsigned long GetRecordStamp( const char* record );
+long GetRecordScans( const char* record );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Make a coded record of a packed record, a new device is added to the dictionary
+//
+// Parameters:  dbDict		- open dictionary of packed devices, see OpenDictionary()
+//
+//				record		- the packed record
+//
+//				coded		- holds the REC_CODED_SIZE bytes of the coded record
+//
+// Returns:     TRUE on success, FALSE on FAILURE (see EncodeKey())
+//
+int EncodeRecord( SDBFile *dbDict, const char* record, char* coded );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Make a packed record of a coded record, the reverse of EncodeRecord()
+//
+// Parameters:  dbDict		- open dictionary of packed devices, see OpenDictionary()
+//
+//				coded		- the coded record
+//
+//				record		- holds the REC_SIZE bytes of the packed record, with 1 scan
+//
+// Returns:     TRUE on success, FALSE on FAILURE (see DecodeKey())
+//
+int DecodeRecord( SDBFile *dbDict, const char* coded, char* record );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Store a wearer number as search key of the REC_SZ_WEARER bytes at REC_OFS_WEARER
+//
+// Parameters:  wearer		- wearer number
+//
+//				key			- holds the wearer number, most significant byte first with the sign bit inverted
+//
+// Returns:     Nothing
+//
+void PackWearer( long wearer, char* key );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Store a time stamp as search key of the REC_SZ_STAMP bytes at REC_OFS_STAMP
+//
+// Parameters:  stamp		- seconds since 01/01/1970 00:00:00
+//
+//				key			- holds the time stamp, most significant byte first
+//
+// Returns:     Nothing
+//
+void PackStamp( unsigned long stamp, char* key );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Make a time stamp of the time and date strings shown on the terminal
+//
+// Parameters:  time		- "HH:MM:SS"
+//
+//				date		- "DD/MM/YYYY"
+//
+// Returns:     Seconds since 01/01/1970 00:00:00
+//
+unsigned long MakeTimeStamp( const char* time, const char* date );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Make the time and date strings of a time stamp, the reverse of MakeTimeStamp()
+//
+// Parameters:  stamp		- seconds since 01/01/1970 00:00:00
+//
+//				time		- holds "HH:MM:SS" and a terminating '\0'
+//
+//				date		- holds "DD/MM/YYYY" and a terminating '\0'
+//
+// Returns:     Nothing
+//
+void FormatTimeStamp( unsigned long stamp, char* time, char* date );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Render a packed record as CSV line
+//
+// Parameters:  record		- the packed record
+//
+//				line		- holds the REC_CSV_SIZE characters of the line and a terminating '\0'
+//
+// Returns:     Nothing
+//
+void RecordToCsv( const char* record, char* line );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Pack a CSV line, the reverse of RecordToCsv()
+//
+// Parameters:  line		- REC_CSV_SIZE characters of the line
+//
+//				record		- holds the packed record
+//
+// Returns:     TRUE on success, FALSE when the line was marked as deleted (DB_DELETED_MARK on the <CR>)
+//
+int CsvToRecord( const char* line, char* record );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Write the records of a database as CSV file
+//
+// Parameters:  dbFile		- open database with packed records, the records marked as deleted
+//							  are skipped when a delete marker is set (SetDeleteMarker)
+//
+//				csvname		- the CSV file to make, an existing file is overwritten
+//
+//				dbDict		- dictionary of the devices when dbFile holds coded records, else NULL
+//
+// Returns:     TRUE on success, FALSE on FAILURE (the CSV file is removed)
+//
+// Remarks:		The CSV file is written in blocks of lines with plain file functions
+//
+int ExportCsvFile( SDBFile *dbFile, const char* csvname, SDBFile *dbDict );
+
+//-----------------------------------------------------------------------------
+// Purpose:     Append the lines of a CSV file to a database with packed records
+//
+// Parameters:  csvname		- the CSV file, lines marked as deleted are skipped
+//
+//				dbFile		- open database with packed records
+//
+// Returns:     TRUE on success, FALSE on FAILURE
+//
+int ImportCsvFile( const char* csvname, SDBFile *dbFile );
+
+#endif // __RECORD_H__
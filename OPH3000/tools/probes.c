@@ -0,0 +1,150 @@
+//
+// probes.c
+//
+// Host benchmark of KeySearch(), counts the records read per lookup by binary search and by
+// interpolation search on databases with numeric keys, see GetSearchProbes().
+// Made with the PC compiler, not for the terminal:
+//
+//		make -f makefile.host
+//
+// The database files are made in the current directory and removed afterwards.
+//
+// History:
+// 17/10/2026:	First version
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "lib.h"
+#include "database.h"
+
+#define BENCH_NAME		"probes.dat"
+#define BENCH_RECSZ		12		// 8 digit key, ",x\r\n"
+#define BENCH_KEYSZ		8
+#define BENCH_LOOKUPS	2000L	// half of them hit, the other half are random keys
+#define BENCH_MAX		20000L
+
+#define DIST_UNIFORM	0		// random 8 digit keys
+#define DIST_SEQUENTIAL	1		// increasing keys with small gaps
+#define DIST_CLUSTERS	2		// half of the keys close together, the other half spread out
+
+// ++++++++++++++++++++++++++++++++++++++
+// Functions of the terminal library used by database.c
+// ++++++++++++++++++++++++++++++++++++++
+
+unsigned long coreleft( void )
+{
+	return 60000UL;
+}
+
+long fsize( const char *filename )
+{
+	struct stat st;
+
+	if( stat( filename, &st ) != 0 )
+		return -1L;
+	return (long)st.st_size;
+}
+
+int chsize( int handle, long size )
+{
+	return ftruncate( handle, size );
+}
+
+// ++++++++++++++++++++++++++++++++++++++
+// Benchmark
+// ++++++++++++++++++++++++++++++++++++++
+
+static long keys[ BENCH_MAX ];
+
+static int CompareKeys( const void* a, const void* b )
+{
+	long x = *(const long*)a;
+	long y = *(const long*)b;
+
+	return (x < y)? -1 : (x > y);
+}
+
+static long RandomKey( void )
+{
+	return ((long)rand() * 7919L + rand()) % 100000000L;
+}
+
+static void MakeKeys( long count, int distribution )
+{
+	long i;
+
+	for( i = 0L; i < count; i++ )
+	{
+		switch( distribution )
+		{
+		case DIST_SEQUENTIAL:
+			keys[ i ] = 12000000L + i * 3L + rand() % 3;
+			break;
+		case DIST_CLUSTERS:
+			keys[ i ] = ( i < count / 2L )? 10000000L + i : 90000000L + ((long)rand() * 13L) % 9000000L;
+			break;
+		default:
+			keys[ i ] = RandomKey();
+			break;
+		}
+	}
+	qsort( keys, count, sizeof( long ), CompareKeys );
+}
+
+static int RunBenchmark( const char* name, long count, int distribution )
+{
+	static SDBFile dbFile;	// static initializes all items to 0
+	char record[ BENCH_RECSZ + 1 ];
+	char key[ 16 ];
+	double binary, interpolate;
+	long i, found1, found2;
+
+	MakeKeys( count, distribution );
+	remove( BENCH_NAME );
+	if( !CreateDatabase( BENCH_NAME, BENCH_RECSZ, &dbFile ))
+		return FALSE;
+	for( i = 0L; i < count; i++ )
+	{
+		sprintf( record, "%08ld,x\r\n", keys[ i ] );
+		if( !WriteRecord( &dbFile, record, WRITE_APPEND ))
+			return FALSE;
+	}
+
+	binary = interpolate = 0.0;
+	for( i = 0L; i < BENCH_LOOKUPS; i++ )
+	{
+		sprintf( key, "%08ld", ( i & 1 )? keys[ rand() % count ] : RandomKey());
+		found1 = BinarySearch( &dbFile, record, key, BENCH_KEYSZ, 0 );
+		binary += GetSearchProbes();
+		found2 = KeySearch( &dbFile, record, key, BENCH_KEYSZ, 0, DB_SEARCH_AUTO );
+		interpolate += GetSearchProbes();
+		if( ( found1 == -1L ) != ( found2 == -1L ) || ( found2 != -1L && memcmp( record, key, BENCH_KEYSZ ) != 0 ))
+		{
+			printf( "%s: KeySearch() and BinarySearch() differ for %s\n", name, key );
+			CloseDatabase( &dbFile );
+			return FALSE;
+		}
+	}
+	printf( "%-22s %6ld records, probes per lookup: binary %5.2f interpolation %5.2f\n",
+			name, count, binary / BENCH_LOOKUPS, interpolate / BENCH_LOOKUPS );
+	CloseDatabase( &dbFile );
+	return TRUE;
+}
+
+int main( void )
+{
+	int ok;
+
+	srand( 1 );
+	ok = RunBenchmark( "uniform 8 digit keys", 1000L, DIST_UNIFORM ) &&
+		 RunBenchmark( "uniform 8 digit keys", 20000L, DIST_UNIFORM ) &&
+		 RunBenchmark( "sequential with gaps", 20000L, DIST_SEQUENTIAL ) &&
+		 RunBenchmark( "two clusters", 20000L, DIST_CLUSTERS );
+	remove( BENCH_NAME );
+	return ok? 0 : 1;
+}